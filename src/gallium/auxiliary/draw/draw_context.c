@@ -858,3 +858,17 @@ draw_get_shader_param(unsigned shader, enum pipe_shader_cap param)
    return draw_get_shader_param_no_llvm(shader, param);
 }
 
+
+
+/**
+ * Copy the number of vertices fetched (ia_vertices) and vertex shader
+ * invocations (vs_invocations) since the context was created into
+ * \p stats.  The other counters are left to the driver.
+ */
+void
+draw_get_pipeline_statistics(const struct draw_context *draw,
+                             struct pipe_query_data_pipeline_statistics *stats)
+{
+   stats->ia_vertices = draw->statistics.ia_vertices;
+   stats->vs_invocations = draw->statistics.vs_invocations;
+}
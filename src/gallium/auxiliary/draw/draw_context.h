@@ -270,6 +270,10 @@ void draw_set_driver_clipping( struct draw_context *draw,
 void draw_set_force_passthrough( struct draw_context *draw, 
                                  boolean enable );
 
+void
+draw_get_pipeline_statistics(const struct draw_context *draw,
+                             struct pipe_query_data_pipeline_statistics *stats);
+
 /*******************************************************************************
  * Draw pipeline 
  */
@@ -35,10 +35,15 @@
 
 #include "pipe/p_shader_tokens.h"
 
+#include "util/u_debug.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/u_prim.h"
 
+#ifdef HAVE_LLVM
+#include "draw_llvm.h"
+#endif
+
 /* fixme: move it from here */
 #define MAX_PRIMITIVES 64
 
@@ -69,6 +74,23 @@ void draw_gs_destroy( struct draw_context *draw )
    tgsi_exec_machine_destroy(draw->gs.tgsi.machine);
 }
 
+static void
+draw_fetch_gs_input(struct draw_geometry_shader *shader,
+                    unsigned *indices,
+                    unsigned num_vertices,
+                    unsigned prim_idx);
+
+static void
+gs_flush(struct draw_geometry_shader *shader,
+         unsigned input_primitives);
+
+#ifdef HAVE_LLVM
+static void
+llvm_gs_init(struct draw_context *draw,
+             struct draw_geometry_shader *gs);
+#endif
+
+
 struct draw_geometry_shader *
 draw_create_geometry_shader(struct draw_context *draw,
                             const struct pipe_shader_state *state)
@@ -110,6 +132,16 @@ draw_create_geometry_shader(struct draw_context *draw,
 
    gs->machine = draw->gs.tgsi.machine;
 
+   /* the interpreter runs one input primitive at a time */
+   gs->vector_length = 1;
+   gs->fetch_inputs = draw_fetch_gs_input;
+   gs->run = gs_flush;
+
+#ifdef HAVE_LLVM
+   if (draw->llvm)
+      llvm_gs_init(draw, gs);
+#endif
+
    if (gs)
    {
       uint i;
@@ -143,6 +175,15 @@ void draw_bind_geometry_shader(struct draw_context *draw,
 void draw_delete_geometry_shader(struct draw_context *draw,
                                  struct draw_geometry_shader *dgs)
 {
+#ifdef HAVE_LLVM
+   if (dgs->llvm_variant) {
+      draw_gs_llvm_destroy_variant(dgs->llvm_variant);
+      align_free(dgs->llvm_inputs);
+      FREE(dgs->llvm_emitted_vertices);
+      FREE(dgs->llvm_emitted_prims);
+      FREE(dgs->llvm_prim_lengths);
+   }
+#endif
    FREE(dgs->primitive_lengths);
    FREE((void*) dgs->state.tokens);
    FREE(dgs);
@@ -196,7 +237,8 @@ draw_geometry_fetch_outputs(struct draw_geometry_shader *shader,
 }
 
 /*#define DEBUG_INPUTS 1*/
-static void draw_fetch_gs_input(struct draw_geometry_shader *shader,
+static void
+draw_fetch_gs_input(struct draw_geometry_shader *shader,
                                 unsigned *indices,
                                 unsigned num_vertices,
                                 unsigned prim_idx)
@@ -255,8 +297,9 @@ static void draw_fetch_gs_input(struct draw_geometry_shader *shader,
    }
 }
 
-static void gs_flush(struct draw_geometry_shader *shader,
-                     unsigned input_primitives)
+static void
+gs_flush(struct draw_geometry_shader *shader,
+         unsigned input_primitives)
 {
    unsigned out_prim_count;
    struct tgsi_exec_machine *machine = shader->machine;
@@ -285,6 +328,201 @@ static void gs_flush(struct draw_geometry_shader *shader,
                                &shader->tmp_output);
 }
 
+#ifdef HAVE_LLVM
+
+/**
+ * Store the input vertices of primitive prim_idx of the next run in the
+ * layout described at draw_gs_jit_func.
+ */
+static void
+llvm_fetch_gs_input(struct draw_geometry_shader *shader,
+                    unsigned *indices,
+                    unsigned num_vertices,
+                    unsigned prim_idx)
+{
+   const unsigned vector_length = shader->vector_length;
+   const unsigned num_inputs = shader->info.num_inputs;
+   unsigned slot, vs_slot, chan, i;
+
+   for (i = 0; i < num_vertices; ++i) {
+      const float (*input)[4] = (const float (*)[4])(
+         (const char *)shader->input +
+         (indices[i] * shader->input_vertex_stride));
+      float *dst = shader->llvm_inputs +
+                   i * num_inputs * TGSI_NUM_CHANNELS * vector_length +
+                   prim_idx;
+
+      for (slot = 0, vs_slot = 0; slot < num_inputs; ++slot) {
+         if (shader->info.input_semantic_name[slot] == TGSI_SEMANTIC_PRIMID) {
+            for (chan = 0; chan < TGSI_NUM_CHANNELS; ++chan)
+               dst[chan * vector_length] = (float)shader->in_prim_idx;
+         } else {
+            for (chan = 0; chan < TGSI_NUM_CHANNELS; ++chan)
+               dst[chan * vector_length] = input[vs_slot][chan];
+            ++vs_slot;
+         }
+         dst += TGSI_NUM_CHANNELS * vector_length;
+      }
+   }
+}
+
+
+/**
+ * Fill the unused lanes of a partial vector of input primitives with the
+ * last fetched one, so that the shader doesn't run on stale or garbage
+ * inputs there, which could make input-dependent loops run away.
+ */
+static void
+llvm_fill_unused_lanes(struct draw_geometry_shader *shader,
+                       unsigned input_primitives)
+{
+   const unsigned vector_length = shader->vector_length;
+   const unsigned num_rows = u_vertices_per_prim(shader->input_primitive) *
+                             shader->info.num_inputs * TGSI_NUM_CHANNELS;
+   float *row = shader->llvm_inputs;
+   unsigned i, j;
+
+   for (i = 0; i < num_rows; ++i) {
+      const float last = row[input_primitives - 1];
+      for (j = input_primitives; j < vector_length; ++j)
+         row[j] = last;
+      row += vector_length;
+   }
+}
+
+
+/**
+ * Run the generated code on the fetched primitives and pack the vertices
+ * and primitive lengths it output.  The code writes the output of each
+ * input primitive to a fixed range of max_output_vertices + 1 vertices,
+ * which are moved down to follow the previous primitive's.
+ */
+static void
+llvm_gs_run(struct draw_geometry_shader *shader,
+            unsigned input_primitives)
+{
+   const unsigned vertex_size = shader->vertex_size;
+   const unsigned num_slots = shader->max_output_vertices + 1;
+   char *output = shader->llvm_output;
+   unsigned i, j;
+
+   if (input_primitives < shader->vector_length)
+      llvm_fill_unused_lanes(shader, input_primitives);
+
+   shader->llvm_variant->jit_func(&shader->draw->llvm->jit_context,
+                                  shader->llvm_inputs,
+                                  (struct vertex_header *)output,
+                                  vertex_size,
+                                  shader->llvm_emitted_vertices,
+                                  shader->llvm_emitted_prims,
+                                  shader->llvm_prim_lengths);
+
+   for (i = 0; i < input_primitives; ++i) {
+      const unsigned num_verts = shader->llvm_emitted_vertices[i];
+      const unsigned num_prims = shader->llvm_emitted_prims[i];
+      const char *src = shader->llvm_output + i * num_slots * vertex_size;
+
+      if (output != src)
+         memmove(output, src, num_verts * vertex_size);
+      output += num_verts * vertex_size;
+
+      for (j = 0; j < num_prims; ++j) {
+         shader->primitive_lengths[shader->emitted_primitives++] =
+            shader->llvm_prim_lengths[i * num_slots + j];
+      }
+      shader->emitted_vertices += num_verts;
+   }
+
+   shader->llvm_output = output;
+}
+
+
+/**
+ * Use the LLVM geometry shader unless it's disabled with DRAW_LLVM_GS
+ * or the shader uses something the generated code doesn't support.
+ */
+static void
+llvm_gs_init(struct draw_context *draw,
+             struct draw_geometry_shader *gs)
+{
+   const unsigned max_input_vertices = 6;
+   unsigned vector_length;
+
+   if (!debug_get_bool_option("DRAW_LLVM_GS", TRUE))
+      return;
+
+   if (gs->info.file_max[TGSI_FILE_SAMPLER] >= 0 ||
+       (gs->info.indirect_files & (1 << TGSI_FILE_INPUT)))
+      return;
+
+   gs->llvm_variant = draw_gs_llvm_create_variant(draw->llvm, gs);
+   if (!gs->llvm_variant)
+      return;
+
+   vector_length = gs->llvm_variant->vector_length;
+
+   gs->llvm_inputs = align_malloc(max_input_vertices * gs->info.num_inputs *
+                                  TGSI_NUM_CHANNELS * vector_length *
+                                  sizeof(float), 16);
+   gs->llvm_emitted_vertices = CALLOC(vector_length, sizeof(int));
+   gs->llvm_emitted_prims = CALLOC(vector_length, sizeof(int));
+   gs->llvm_prim_lengths = CALLOC(vector_length *
+                                  (gs->max_output_vertices + 1),
+                                  sizeof(int));
+
+   if ((gs->info.num_inputs && !gs->llvm_inputs) ||
+       !gs->llvm_emitted_vertices ||
+       !gs->llvm_emitted_prims ||
+       !gs->llvm_prim_lengths) {
+      draw_gs_llvm_destroy_variant(gs->llvm_variant);
+      align_free(gs->llvm_inputs);
+      FREE(gs->llvm_emitted_vertices);
+      FREE(gs->llvm_emitted_prims);
+      FREE(gs->llvm_prim_lengths);
+      gs->llvm_variant = NULL;
+      return;
+   }
+
+   gs->vector_length = vector_length;
+   gs->fetch_inputs = llvm_fetch_gs_input;
+   gs->run = llvm_gs_run;
+}
+
+#endif /* HAVE_LLVM */
+
+
+/**
+ * Fetch the vertices of the next input primitive and run the shader once
+ * a vector of input primitives has been fetched.
+ */
+static void
+gs_fetch_and_run(struct draw_geometry_shader *shader,
+                 unsigned *indices,
+                 unsigned num_vertices)
+{
+   shader->fetch_inputs(shader, indices, num_vertices,
+                        shader->fetched_prim_count);
+   ++shader->in_prim_idx;
+
+   if (++shader->fetched_prim_count == shader->vector_length) {
+      shader->run(shader, shader->fetched_prim_count);
+      shader->fetched_prim_count = 0;
+   }
+}
+
+
+/**
+ * Run the shader on the input primitives fetched so far.
+ */
+static void
+gs_run_fetched(struct draw_geometry_shader *shader)
+{
+   if (shader->fetched_prim_count) {
+      shader->run(shader, shader->fetched_prim_count);
+      shader->fetched_prim_count = 0;
+   }
+}
+
 static void gs_point(struct draw_geometry_shader *shader,
                      int idx)
 {
@@ -292,10 +530,7 @@ static void gs_point(struct draw_geometry_shader *shader,
 
    indices[0] = idx;
 
-   draw_fetch_gs_input(shader, indices, 1, 0);
-   ++shader->in_prim_idx;
-
-   gs_flush(shader, 1);
+   gs_fetch_and_run(shader, indices, 1);
 }
 
 static void gs_line(struct draw_geometry_shader *shader,
@@ -306,10 +541,7 @@ static void gs_line(struct draw_geometry_shader *shader,
    indices[0] = i0;
    indices[1] = i1;
 
-   draw_fetch_gs_input(shader, indices, 2, 0);
-   ++shader->in_prim_idx;
-
-   gs_flush(shader, 1);
+   gs_fetch_and_run(shader, indices, 2);
 }
 
 static void gs_line_adj(struct draw_geometry_shader *shader,
@@ -322,10 +554,7 @@ static void gs_line_adj(struct draw_geometry_shader *shader,
    indices[2] = i2;
    indices[3] = i3;
 
-   draw_fetch_gs_input(shader, indices, 4, 0);
-   ++shader->in_prim_idx;
-
-   gs_flush(shader, 1);
+   gs_fetch_and_run(shader, indices, 4);
 }
 
 static void gs_tri(struct draw_geometry_shader *shader,
@@ -337,10 +566,7 @@ static void gs_tri(struct draw_geometry_shader *shader,
    indices[1] = i1;
    indices[2] = i2;
 
-   draw_fetch_gs_input(shader, indices, 3, 0);
-   ++shader->in_prim_idx;
-
-   gs_flush(shader, 1);
+   gs_fetch_and_run(shader, indices, 3);
 }
 
 static void gs_tri_adj(struct draw_geometry_shader *shader,
@@ -356,10 +582,7 @@ static void gs_tri_adj(struct draw_geometry_shader *shader,
    indices[4] = i4;
    indices[5] = i5;
 
-   draw_fetch_gs_input(shader, indices, 6, 0);
-   ++shader->in_prim_idx;
-
-   gs_flush(shader, 1);
+   gs_fetch_and_run(shader, indices, 6);
 }
 
 #define FUNC         gs_run
@@ -374,7 +597,8 @@ static void gs_tri_adj(struct draw_geometry_shader *shader,
 
 
 /**
- * Execute geometry shader using TGSI interpreter.
+ * Execute geometry shader using the generated code if there is some,
+ * otherwise the TGSI interpreter.
  */
 int draw_geometry_shader_run(struct draw_geometry_shader *shader,
                              const void *constants[PIPE_MAX_CONSTANT_BUFFERS], 
@@ -397,13 +621,25 @@ int draw_geometry_shader_run(struct draw_geometry_shader *shader,
    unsigned max_out_prims = u_gs_prims_for_vertices(shader->output_primitive,
                                                     shader->max_output_vertices)
                             * num_in_primitives;
+   unsigned max_out_verts = num_in_primitives * shader->max_output_vertices;
+
+#ifdef HAVE_LLVM
+   if (shader->llvm_variant) {
+      /* Each run writes max_output_vertices + 1 vertices per input
+       * primitive of the vector, see llvm_gs_run().  Every output
+       * primitive has at least one vertex.
+       */
+      max_out_verts = align(num_in_primitives, shader->vector_length) *
+                      (shader->max_output_vertices + 1);
+      max_out_prims = num_in_primitives * shader->max_output_vertices;
+   }
+#endif
 
    output_verts->vertex_size = input_verts->vertex_size;
    output_verts->stride = input_verts->vertex_size;
    output_verts->verts =
       (struct vertex_header *)MALLOC(input_verts->vertex_size *
-                                     num_in_primitives *
-                                     shader->max_output_vertices);
+                                     max_out_verts);
 
 
 #if 0
@@ -425,12 +661,24 @@ int draw_geometry_shader_run(struct draw_geometry_shader *shader,
    shader->in_prim_idx = 0;
    shader->input_vertex_stride = input_stride;
    shader->input = input;
+   shader->fetched_prim_count = 0;
    FREE(shader->primitive_lengths);
    shader->primitive_lengths = MALLOC(max_out_prims * sizeof(unsigned));
 
    tgsi_exec_set_constant_buffers(machine, PIPE_MAX_CONSTANT_BUFFERS,
                                   constants, constants_size);
 
+#ifdef HAVE_LLVM
+   if (shader->llvm_variant) {
+      struct draw_jit_context *jit_context = &shader->draw->llvm->jit_context;
+      unsigned i;
+
+      for (i = 0; i < Elements(jit_context->gs_constants); ++i)
+         jit_context->gs_constants[i] = constants[i];
+      shader->llvm_output = (char *)output_verts->verts;
+   }
+#endif
+
    if (input_prim->linear)
       gs_run(shader, input_prim, input_verts,
              output_prims, output_verts);
@@ -438,6 +686,8 @@ int draw_geometry_shader_run(struct draw_geometry_shader *shader,
       gs_run_elts(shader, input_prim, input_verts,
                   output_prims, output_verts);
 
+   gs_run_fetched(shader);
+
    /* Update prim_info:
     */
    output_prims->linear = TRUE;
@@ -35,6 +35,7 @@
 #define MAX_TGSI_PRIMITIVES 4
 
 struct draw_context;
+struct draw_gs_llvm_variant;
 
 /**
  * Private version of the compiled geometry shader
@@ -64,6 +65,27 @@ struct draw_geometry_shader {
    unsigned in_prim_idx;
    unsigned input_vertex_stride;
    const float (*input)[4];
+
+   /** Number of input primitives the shader is run on at once */
+   unsigned vector_length;
+   /** Number of input primitives fetched for the next run */
+   unsigned fetched_prim_count;
+
+   void (*fetch_inputs)(struct draw_geometry_shader *shader,
+                        unsigned *indices,
+                        unsigned num_vertices,
+                        unsigned prim_idx);
+   void (*run)(struct draw_geometry_shader *shader,
+               unsigned input_primitives);
+
+#ifdef HAVE_LLVM
+   struct draw_gs_llvm_variant *llvm_variant;
+   float *llvm_inputs;
+   char *llvm_output;       /**< where the next run writes its vertices */
+   int *llvm_emitted_vertices;
+   int *llvm_emitted_prims;
+   int *llvm_prim_lengths;
+#endif
 };
 
 /*
@@ -28,6 +28,7 @@
 #include "draw_llvm.h"
 
 #include "draw_context.h"
+#include "draw_gs.h"
 #include "draw_vs.h"
 
 #include "gallivm/lp_bld_arit.h"
@@ -48,7 +49,9 @@
 
 #include "tgsi/tgsi_exec.h"
 #include "tgsi/tgsi_dump.h"
+#include "tgsi/tgsi_parse.h"
 
+#include "util/u_hash.h"
 #include "util/u_math.h"
 #include "util/u_pointer.h"
 #include "util/u_string.h"
@@ -371,6 +374,9 @@ void
 draw_llvm_destroy(struct draw_llvm *llvm)
 {
    /* XXX free other draw_llvm data? */
+   if (llvm->gallivm_batch)
+      gallivm_destroy(llvm->gallivm_batch);
+
    FREE(llvm);
 }
 
@@ -396,7 +402,16 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
 
    variant->llvm = llvm;
 
-   variant->gallivm = gallivm_create();
+   variant->gallivm = gallivm_batch_get(&llvm->gallivm_batch);
+   if (!variant->gallivm) {
+      FREE(variant);
+      return NULL;
+   }
+
+   gallivm_stats_begin(variant->gallivm, GALLIVM_STATS_VS,
+                       util_hash_crc32(shader->base.state.tokens,
+                                       tgsi_num_tokens(shader->base.state.tokens) *
+                                       sizeof(struct tgsi_token)));
 
    create_jit_types(variant);
 
@@ -461,7 +476,8 @@ generate_vs(struct draw_llvm_variant *variant,
                      inputs,
                      outputs,
                      sampler,
-                     &llvm->draw->vs.vertex_shader->info);
+                     &llvm->draw->vs.vertex_shader->info,
+                     NULL);
 
    {
       LLVMValueRef out;
@@ -665,6 +681,33 @@ store_aos_array(struct gallivm_state *gallivm,
 }
 
 
+/**
+ * Transpose the four channels of an attribute of soa_type.length vertices
+ * into one xyzw vector per vertex.  The soa values are clobbered.
+ */
+static void
+transpose_to_aos(struct gallivm_state *gallivm,
+                 struct lp_type soa_type,
+                 LLVMValueRef soa[TGSI_NUM_CHANNELS],
+                 LLVMValueRef aos[LP_MAX_VECTOR_WIDTH / 32])
+{
+   unsigned i;
+
+   if (soa_type.length == TGSI_NUM_CHANNELS) {
+      lp_build_transpose_aos(gallivm, soa_type, soa, aos);
+   } else {
+      lp_build_transpose_aos(gallivm, soa_type, soa, soa);
+
+      for (i = 0; i < soa_type.length; ++i) {
+         aos[i] = lp_build_extract_range(gallivm,
+                                         soa[i % TGSI_NUM_CHANNELS],
+                                         (i / TGSI_NUM_CHANNELS) * TGSI_NUM_CHANNELS,
+                                         TGSI_NUM_CHANNELS);
+      }
+   }
+}
+
+
 static void
 convert_to_aos(struct gallivm_state *gallivm,
                LLVMValueRef io,
@@ -675,7 +718,7 @@ convert_to_aos(struct gallivm_state *gallivm,
                boolean have_clipdist)
 {
    LLVMBuilderRef builder = gallivm->builder;
-   unsigned chan, attrib, i;
+   unsigned chan, attrib;
 
 #if DEBUG_STORE
    lp_build_printf(gallivm, "   # storing begin\n");
@@ -703,18 +746,7 @@ convert_to_aos(struct gallivm_state *gallivm,
       }
 
 
-      if (soa_type.length == TGSI_NUM_CHANNELS) {
-         lp_build_transpose_aos(gallivm, soa_type, soa, aos);
-      } else {
-         lp_build_transpose_aos(gallivm, soa_type, soa, soa);
-
-         for (i = 0; i < soa_type.length; ++i) {
-            aos[i] = lp_build_extract_range(gallivm,
-                                            soa[i % TGSI_NUM_CHANNELS],
-                                            (i / TGSI_NUM_CHANNELS) * TGSI_NUM_CHANNELS,
-                                            TGSI_NUM_CHANNELS);
-         }
-      }
+      transpose_to_aos(gallivm, soa_type, soa, aos);
 
       store_aos_array(gallivm,
                       soa_type,
@@ -1314,6 +1346,368 @@ draw_llvm_generate(struct draw_llvm *llvm, struct draw_llvm_variant *variant,
 }
 
 
+/**
+ * State of the geometry shader being generated, see draw_gs_jit_func.
+ */
+struct draw_gs_llvm_iface
+{
+   struct lp_build_tgsi_gs_iface base;
+
+   const struct draw_geometry_shader *shader;
+   LLVMValueRef input_ptr;
+   LLVMValueRef io_ptr;
+   LLVMValueRef vertex_size;
+   LLVMValueRef emitted_vertices_ptr;
+   LLVMValueRef emitted_prims_ptr;
+   LLVMValueRef prim_lengths_ptr;
+};
+
+
+static INLINE const struct draw_gs_llvm_iface *
+draw_gs_llvm_iface(const struct lp_build_tgsi_gs_iface *iface)
+{
+   return (const struct draw_gs_llvm_iface *)iface;
+}
+
+
+static LLVMValueRef
+draw_gs_llvm_fetch_input(const struct lp_build_tgsi_gs_iface *gs_iface,
+                         struct lp_build_tgsi_context *bld_base,
+                         unsigned vertex,
+                         unsigned attrib,
+                         unsigned swizzle)
+{
+   const struct draw_gs_llvm_iface *gs = draw_gs_llvm_iface(gs_iface);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   unsigned num_inputs = gs->shader->info.num_inputs;
+   LLVMValueRef index, ptr, res;
+
+   index = lp_build_const_int32(gallivm,
+                                (vertex * num_inputs + attrib) *
+                                TGSI_NUM_CHANNELS + swizzle);
+   ptr = LLVMBuildPointerCast(builder, gs->input_ptr,
+                              LLVMPointerType(bld_base->base.vec_type, 0), "");
+   ptr = LLVMBuildGEP(builder, ptr, &index, 1, "");
+   res = LLVMBuildLoad(builder, ptr, "");
+   lp_set_load_alignment(res, sizeof(float));
+
+   return res;
+}
+
+
+/**
+ * Pointers to the output vertex or primitive length 'index' of each vector
+ * element, or to the element's scratch slot where mask is off.
+ */
+static void
+draw_gs_llvm_slot_ptrs(const struct draw_gs_llvm_iface *gs,
+                       struct lp_build_tgsi_context *bld_base,
+                       LLVMValueRef base_ptr,
+                       LLVMValueRef element_size,
+                       LLVMValueRef index,
+                       LLVMValueRef mask,
+                       LLVMValueRef *ptrs)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *int_bld = &bld_base->int_bld;
+   const unsigned num_slots = gs->shader->max_output_vertices + 1;
+   LLVMValueRef scratch, offset;
+   unsigned i;
+
+   scratch = lp_build_const_int_vec(gallivm, int_bld->type, num_slots - 1);
+   index = lp_build_select(int_bld, mask, index, scratch);
+
+   for (i = 0; i < int_bld->type.length; ++i) {
+      LLVMValueRef ii = lp_build_const_int32(gallivm, i);
+      offset = LLVMBuildExtractElement(builder, index, ii, "");
+      offset = LLVMBuildAdd(builder, offset,
+                            lp_build_const_int32(gallivm, i * num_slots), "");
+      offset = LLVMBuildMul(builder, offset, element_size, "");
+      ptrs[i] = LLVMBuildGEP(builder, base_ptr, &offset, 1, "");
+   }
+}
+
+
+static void
+draw_gs_llvm_emit_vertex(const struct lp_build_tgsi_gs_iface *gs_iface,
+                         struct lp_build_tgsi_context *bld_base,
+                         LLVMValueRef (*outputs)[4],
+                         LLVMValueRef vertex_index,
+                         LLVMValueRef mask)
+{
+   const struct draw_gs_llvm_iface *gs = draw_gs_llvm_iface(gs_iface);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   const struct lp_type gs_type = bld_base->base.type;
+   LLVMTypeRef int32_ptr_type =
+      LLVMPointerType(LLVMInt32TypeInContext(gallivm->context), 0);
+   LLVMTypeRef data_ptr_type =
+      LLVMPointerType(lp_build_vec_type(gallivm, lp_float32_vec4_type()), 0);
+   LLVMValueRef io_ptrs[LP_MAX_VECTOR_WIDTH / 32];
+   LLVMValueRef header;
+   unsigned attrib, chan, i;
+
+   draw_gs_llvm_slot_ptrs(gs, bld_base, gs->io_ptr, gs->vertex_size,
+                          vertex_index, mask, io_ptrs);
+
+   /* vertex id:16 = 0xffff, edgeflag:1 = 1, the clipmask is computed
+    * after the geometry shader has run
+    */
+   header = lp_build_const_int32(gallivm,
+                                 (0xffff << 16) | (1 << DRAW_TOTAL_CLIP_PLANES));
+   for (i = 0; i < gs_type.length; ++i) {
+      LLVMValueRef id_ptr = LLVMBuildPointerCast(builder, io_ptrs[i],
+                                                 int32_ptr_type, "");
+      LLVMBuildStore(builder, header, id_ptr);
+   }
+
+   for (attrib = 0; attrib < gs->shader->info.num_outputs; ++attrib) {
+      LLVMValueRef soa[TGSI_NUM_CHANNELS];
+      LLVMValueRef aos[LP_MAX_VECTOR_WIDTH / 32];
+      LLVMValueRef offset =
+         lp_build_const_int32(gallivm,
+                              offsetof(struct vertex_header, data) +
+                              attrib * TGSI_NUM_CHANNELS * sizeof(float));
+
+      for (chan = 0; chan < TGSI_NUM_CHANNELS; ++chan) {
+         if (outputs[attrib][chan])
+            soa[chan] = LLVMBuildLoad(builder, outputs[attrib][chan], "");
+         else
+            soa[chan] = bld_base->base.zero;
+      }
+
+      transpose_to_aos(gallivm, gs_type, soa, aos);
+
+      for (i = 0; i < gs_type.length; ++i) {
+         LLVMValueRef data_ptr = LLVMBuildGEP(builder, io_ptrs[i],
+                                              &offset, 1, "");
+         data_ptr = LLVMBuildPointerCast(builder, data_ptr,
+                                         data_ptr_type, "");
+         /* Unaligned store due to the vertex header */
+         lp_set_store_alignment(LLVMBuildStore(builder, aos[i], data_ptr),
+                                sizeof(float));
+      }
+   }
+}
+
+
+static void
+draw_gs_llvm_end_primitive(const struct lp_build_tgsi_gs_iface *gs_iface,
+                           struct lp_build_tgsi_context *bld_base,
+                           LLVMValueRef num_vertices,
+                           LLVMValueRef prim_index,
+                           LLVMValueRef mask)
+{
+   const struct draw_gs_llvm_iface *gs = draw_gs_llvm_iface(gs_iface);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef ptrs[LP_MAX_VECTOR_WIDTH / 32];
+   unsigned i;
+
+   draw_gs_llvm_slot_ptrs(gs, bld_base, gs->prim_lengths_ptr,
+                          lp_build_const_int32(gallivm, 1),
+                          prim_index, mask, ptrs);
+
+   for (i = 0; i < bld_base->int_bld.type.length; ++i) {
+      LLVMValueRef ii = lp_build_const_int32(gallivm, i);
+      LLVMBuildStore(builder,
+                     LLVMBuildExtractElement(builder, num_vertices, ii, ""),
+                     ptrs[i]);
+   }
+}
+
+
+static void
+draw_gs_llvm_epilogue(const struct lp_build_tgsi_gs_iface *gs_iface,
+                      struct lp_build_tgsi_context *bld_base,
+                      LLVMValueRef total_vertices,
+                      LLVMValueRef total_prims)
+{
+   const struct draw_gs_llvm_iface *gs = draw_gs_llvm_iface(gs_iface);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef vec_ptr_type = LLVMPointerType(bld_base->int_bld.vec_type, 0);
+   LLVMValueRef ptr;
+
+   ptr = LLVMBuildPointerCast(builder, gs->emitted_vertices_ptr,
+                              vec_ptr_type, "");
+   lp_set_store_alignment(LLVMBuildStore(builder, total_vertices, ptr),
+                          sizeof(int));
+
+   ptr = LLVMBuildPointerCast(builder, gs->emitted_prims_ptr,
+                              vec_ptr_type, "");
+   lp_set_store_alignment(LLVMBuildStore(builder, total_prims, ptr),
+                          sizeof(int));
+}
+
+
+static void
+draw_gs_llvm_generate(struct draw_llvm *llvm,
+                      struct draw_gs_llvm_variant *variant,
+                      const struct draw_geometry_shader *shader)
+{
+   struct gallivm_state *gallivm = variant->gallivm;
+   LLVMContextRef context = gallivm->context;
+   LLVMTypeRef int32_type = LLVMInt32TypeInContext(context);
+   LLVMTypeRef int32_ptr_type = LLVMPointerType(int32_type, 0);
+   LLVMTypeRef arg_types[7];
+   LLVMTypeRef func_type, texture_type, context_type;
+   LLVMValueRef variant_func, context_ptr, consts_ptr;
+   LLVMBasicBlockRef block;
+   LLVMBuilderRef builder;
+   struct lp_type gs_type;
+   struct lp_bld_tgsi_system_values system_values;
+   struct draw_gs_llvm_iface gs_iface;
+   LLVMValueRef outputs[PIPE_MAX_SHADER_OUTPUTS][TGSI_NUM_CHANNELS];
+   unsigned i;
+
+   memset(&system_values, 0, sizeof(system_values));
+
+   texture_type = create_jit_texture_type(gallivm, "texture");
+   context_type = create_jit_context_type(gallivm, texture_type,
+                                          "draw_jit_context");
+
+   arg_types[0] = LLVMPointerType(context_type, 0);           /* context */
+   arg_types[1] = LLVMPointerType(LLVMFloatTypeInContext(context), 0);
+                                                              /* input */
+   arg_types[2] = LLVMPointerType(LLVMInt8TypeInContext(context), 0);
+                                                              /* io */
+   arg_types[3] = int32_type;                                 /* vertex_size */
+   arg_types[4] = int32_ptr_type;                       /* emitted_vertices */
+   arg_types[5] = int32_ptr_type;                       /* emitted_prims */
+   arg_types[6] = int32_ptr_type;                       /* prim_lengths */
+
+   func_type = LLVMFunctionType(LLVMVoidTypeInContext(context),
+                                arg_types, Elements(arg_types), 0);
+
+   variant_func = LLVMAddFunction(gallivm->module, "draw_llvm_gs_variant",
+                                  func_type);
+   variant->function = variant_func;
+
+   LLVMSetFunctionCallConv(variant_func, LLVMCCallConv);
+   for (i = 0; i < Elements(arg_types); ++i)
+      if (LLVMGetTypeKind(arg_types[i]) == LLVMPointerTypeKind)
+         LLVMAddAttribute(LLVMGetParam(variant_func, i),
+                          LLVMNoAliasAttribute);
+
+   memset(&gs_iface, 0, sizeof gs_iface);
+   gs_iface.base.fetch_input = draw_gs_llvm_fetch_input;
+   gs_iface.base.emit_vertex = draw_gs_llvm_emit_vertex;
+   gs_iface.base.end_primitive = draw_gs_llvm_end_primitive;
+   gs_iface.base.epilogue = draw_gs_llvm_epilogue;
+   gs_iface.base.max_output_vertices = shader->max_output_vertices;
+   gs_iface.shader = shader;
+
+   context_ptr                  = LLVMGetParam(variant_func, 0);
+   gs_iface.input_ptr           = LLVMGetParam(variant_func, 1);
+   gs_iface.io_ptr              = LLVMGetParam(variant_func, 2);
+   gs_iface.vertex_size         = LLVMGetParam(variant_func, 3);
+   gs_iface.emitted_vertices_ptr = LLVMGetParam(variant_func, 4);
+   gs_iface.emitted_prims_ptr   = LLVMGetParam(variant_func, 5);
+   gs_iface.prim_lengths_ptr    = LLVMGetParam(variant_func, 6);
+
+   lp_build_name(context_ptr, "context");
+   lp_build_name(gs_iface.input_ptr, "input");
+   lp_build_name(gs_iface.io_ptr, "io");
+   lp_build_name(gs_iface.vertex_size, "vertex_size");
+   lp_build_name(gs_iface.emitted_vertices_ptr, "emitted_vertices");
+   lp_build_name(gs_iface.emitted_prims_ptr, "emitted_prims");
+   lp_build_name(gs_iface.prim_lengths_ptr, "prim_lengths");
+
+   /*
+    * Function body
+    */
+
+   block = LLVMAppendBasicBlockInContext(gallivm->context, variant_func, "entry");
+   builder = gallivm->builder;
+   LLVMPositionBuilderAtEnd(builder, block);
+
+   memset(&gs_type, 0, sizeof gs_type);
+   gs_type.floating = TRUE; /* floating point values */
+   gs_type.sign = TRUE;     /* values are signed */
+   gs_type.norm = FALSE;    /* values are not limited to [0,1] or [-1,1] */
+   gs_type.width = 32;      /* 32-bit float */
+   gs_type.length = variant->vector_length;
+
+   consts_ptr = draw_jit_context_gs_constants(gallivm, context_ptr);
+
+   if (gallivm_debug & (GALLIVM_DEBUG_TGSI | GALLIVM_DEBUG_IR)) {
+      tgsi_dump(shader->state.tokens, 0);
+   }
+
+   lp_build_tgsi_soa(gallivm,
+                     shader->state.tokens,
+                     gs_type,
+                     NULL /*struct lp_build_mask_context *mask*/,
+                     consts_ptr,
+                     &system_values,
+                     NULL /*pos*/,
+                     NULL /*inputs*/,
+                     outputs,
+                     NULL /*sampler*/,
+                     &shader->info,
+                     &gs_iface.base);
+
+   LLVMBuildRetVoid(builder);
+
+   gallivm_verify_function(gallivm, variant_func);
+}
+
+
+/**
+ * Create LLVM-generated code for a geometry shader.
+ * The shader must not sample textures nor index its inputs indirectly.
+ */
+struct draw_gs_llvm_variant *
+draw_gs_llvm_create_variant(struct draw_llvm *llvm,
+                            const struct draw_geometry_shader *shader)
+{
+   struct draw_gs_llvm_variant *variant;
+
+   variant = CALLOC_STRUCT(draw_gs_llvm_variant);
+   if (variant == NULL)
+      return NULL;
+
+   variant->vector_length = lp_native_vector_width / 32;
+
+   variant->gallivm = gallivm_batch_get(&llvm->gallivm_batch);
+   if (!variant->gallivm) {
+      FREE(variant);
+      return NULL;
+   }
+
+   gallivm_stats_begin(variant->gallivm, GALLIVM_STATS_GS,
+                       util_hash_crc32(shader->state.tokens,
+                                       tgsi_num_tokens(shader->state.tokens) *
+                                       sizeof(struct tgsi_token)));
+
+   draw_gs_llvm_generate(llvm, variant, shader);
+
+   gallivm_compile_module(variant->gallivm);
+
+   variant->jit_func = (draw_gs_jit_func)
+         gallivm_jit_function(variant->gallivm, variant->function);
+
+   return variant;
+}
+
+
+void
+draw_gs_llvm_destroy_variant(struct draw_gs_llvm_variant *variant)
+{
+   if (variant->function) {
+      gallivm_free_function(variant->gallivm,
+                            variant->function, variant->jit_func);
+   }
+
+   gallivm_destroy(variant->gallivm);
+
+   FREE(variant);
+}
+
+
 struct draw_llvm_variant_key *
 draw_llvm_make_variant_key(struct draw_llvm *llvm, char *store)
 {
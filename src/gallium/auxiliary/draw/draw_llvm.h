@@ -40,6 +40,7 @@
 
 struct draw_llvm;
 struct llvm_vertex_shader;
+struct draw_geometry_shader;
 
 struct draw_jit_texture
 {
@@ -162,6 +163,25 @@ typedef int
                            struct pipe_vertex_buffer *vertex_buffers,
                            unsigned instance_id);
 
+/**
+ * Runs a geometry shader on one vector of input primitives, one primitive
+ * per vector element.  Vertex v of input primitive i is at
+ * input[((v * num_inputs + attrib) * 4 + chan) * vector_length + i].
+ * Output vertex v of primitive i is written to vertex
+ * i * (max_output_vertices + 1) + v of io, and the length of its output
+ * primitive p to prim_lengths[i * (max_output_vertices + 1) + p].  The
+ * last vertex and length of each primitive are scratch space.
+ */
+typedef void
+(*draw_gs_jit_func)(struct draw_jit_context *context,
+                    const float *input,
+                    struct vertex_header *io,
+                    unsigned vertex_size,
+                    int *emitted_vertices,
+                    int *emitted_prims,
+                    int *prim_lengths);
+
+
 struct draw_llvm_variant_key
 {
    unsigned nr_vertex_elements:8;
@@ -241,6 +261,17 @@ struct draw_llvm_variant
    struct draw_llvm_variant_key key;
 };
 
+struct draw_gs_llvm_variant
+{
+   struct gallivm_state *gallivm;
+
+   LLVMValueRef function;
+   draw_gs_jit_func jit_func;
+
+   /** Number of input primitives run by each call of jit_func */
+   unsigned vector_length;
+};
+
 struct llvm_vertex_shader {
    struct draw_vertex_shader base;
 
@@ -257,6 +288,9 @@ struct draw_llvm {
 
    struct draw_llvm_variant_list_item vs_variants_list;
    int nr_variants;
+
+   /** State shared by the variants, see gallivm_batch_get() */
+   struct gallivm_state *gallivm_batch;
 };
 
 
@@ -281,6 +315,13 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
 void
 draw_llvm_destroy_variant(struct draw_llvm_variant *variant);
 
+struct draw_gs_llvm_variant *
+draw_gs_llvm_create_variant(struct draw_llvm *llvm,
+                            const struct draw_geometry_shader *shader);
+
+void
+draw_gs_llvm_destroy_variant(struct draw_gs_llvm_variant *variant);
+
 struct draw_llvm_variant_key *
 draw_llvm_make_variant_key(struct draw_llvm *llvm, char *store);
 
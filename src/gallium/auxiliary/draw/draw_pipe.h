@@ -91,6 +91,11 @@ extern struct draw_stage *draw_wide_line_stage( struct draw_context *context );
 extern struct draw_stage *draw_wide_point_stage( struct draw_context *context );
 extern struct draw_stage *draw_validate_stage( struct draw_context *context );
 
+extern void draw_clip_interp_modes( const struct draw_context *draw,
+                                    uint *num_flat_attribs,
+                                    uint flat_attribs[PIPE_MAX_SHADER_OUTPUTS],
+                                    boolean noperspective_attribs[PIPE_MAX_SHADER_OUTPUTS] );
+
 
 extern void draw_free_temp_verts( struct draw_stage *stage );
 extern boolean draw_alloc_temp_verts( struct draw_stage *stage, unsigned nr );
@@ -564,15 +564,19 @@ clip_tri( struct draw_stage *stage,
 }
 
 
-/* Update state.  Could further delay this until we hit the first
- * primitive that really requires clipping.
+/**
+ * Find the attributes which are flat shaded and those interpolated
+ * without perspective correction.  Also used by the batched clipper in
+ * draw_pt_clip.c.
  */
-static void 
-clip_init_state( struct draw_stage *stage )
+void
+draw_clip_interp_modes( const struct draw_context *draw,
+                        uint *num_flat_attribs,
+                        uint flat_attribs[PIPE_MAX_SHADER_OUTPUTS],
+                        boolean noperspective_attribs[PIPE_MAX_SHADER_OUTPUTS] )
 {
-   struct clip_stage *clipper = clip_stage( stage );
-   const struct draw_vertex_shader *vs = stage->draw->vs.vertex_shader;
-   const struct draw_fragment_shader *fs = stage->draw->fs.fragment_shader;
+   const struct draw_vertex_shader *vs = draw->vs.vertex_shader;
+   const struct draw_fragment_shader *fs = draw->fs.fragment_shader;
    uint i;
 
    /* We need to know for each attribute what kind of interpolation is
@@ -595,7 +599,7 @@ clip_init_state( struct draw_stage *stage )
     * gl_Color/gl_SecondaryColor, with the correct default.
     */
    int indexed_interp[2];
-   indexed_interp[0] = indexed_interp[1] = stage->draw->rasterizer->flatshade ?
+   indexed_interp[0] = indexed_interp[1] = draw->rasterizer->flatshade ?
       TGSI_INTERPOLATE_CONSTANT : TGSI_INTERPOLATE_PERSPECTIVE;
 
    if (fs) {
@@ -614,8 +618,9 @@ clip_init_state( struct draw_stage *stage )
     * noperspective attributes.
     */
 
-   clipper->num_flat_attribs = 0;
-   memset(clipper->noperspective_attribs, 0, sizeof(clipper->noperspective_attribs));
+   *num_flat_attribs = 0;
+   memset(noperspective_attribs, 0,
+          PIPE_MAX_SHADER_OUTPUTS * sizeof(noperspective_attribs[0]));
    for (i = 0; i < vs->info.num_outputs; i++) {
       /* Find the interpolation mode for a specific attribute
        */
@@ -647,12 +652,27 @@ clip_init_state( struct draw_stage *stage )
        * the noperspective mask.
        */
       if (interp == TGSI_INTERPOLATE_CONSTANT) {
-         clipper->flat_attribs[clipper->num_flat_attribs] = i;
-         clipper->num_flat_attribs++;
+         flat_attribs[*num_flat_attribs] = i;
+         (*num_flat_attribs)++;
       } else
-         clipper->noperspective_attribs[i] = interp == TGSI_INTERPOLATE_LINEAR;
+         noperspective_attribs[i] = interp == TGSI_INTERPOLATE_LINEAR;
    }
-   
+}
+
+
+/* Update state.  Could further delay this until we hit the first
+ * primitive that really requires clipping.
+ */
+static void 
+clip_init_state( struct draw_stage *stage )
+{
+   struct clip_stage *clipper = clip_stage( stage );
+
+   draw_clip_interp_modes(stage->draw,
+                          &clipper->num_flat_attribs,
+                          clipper->flat_attribs,
+                          clipper->noperspective_attribs);
+
    stage->tri = clip_tri;
    stage->line = clip_line;
 }
@@ -301,6 +301,11 @@ struct draw_context
 
    unsigned instance_id;
 
+   /** Counts for PIPE_QUERY_PIPELINE_STATISTICS, only ia_vertices and
+    * vs_invocations are used.  See draw_get_pipeline_statistics().
+    */
+   struct pipe_query_data_pipeline_statistics statistics;
+
 #ifdef HAVE_LLVM
    struct draw_llvm *llvm;
 #endif
@@ -71,6 +71,8 @@ draw_pt_arrays(struct draw_context *draw,
          return TRUE;
    }
 
+   draw->statistics.ia_vertices += count;
+
    if (!draw->force_passthrough) {
       unsigned gs_out_prim = (draw->gs.geometry_shader ? 
                               draw->gs.geometry_shader->output_primitive :
@@ -147,6 +149,9 @@ draw_pt_arrays(struct draw_context *draw,
 
    frontend->run( frontend, start, count );
 
+   if (middle->flush)
+      middle->flush(middle);
+
    return TRUE;
 }
 
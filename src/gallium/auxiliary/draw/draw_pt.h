@@ -124,6 +124,11 @@ struct draw_pt_middle_end {
 
    int (*get_max_vertex_count)( struct draw_pt_middle_end * );
 
+   /* Complete the runs whose vertex processing was deferred, at the end
+    * of each draw.  Optional, may be NULL.
+    */
+   void (*flush)( struct draw_pt_middle_end * );
+
    void (*finish)( struct draw_pt_middle_end * );
    void (*destroy)( struct draw_pt_middle_end * );
 };
@@ -241,6 +246,25 @@ struct pt_post_vs *draw_pt_post_vs_create( struct draw_context *draw );
 void draw_pt_post_vs_destroy( struct pt_post_vs *pvs );
 
 
+/*******************************************************************************
+ * Triangle clipping for the HW vertex emit path:
+ */
+struct pt_clip;
+
+void draw_pt_clip_prepare( struct pt_clip *clip,
+                           unsigned prim,
+                           unsigned opt );
+
+boolean draw_pt_clip_run( struct pt_clip *clip,
+                          struct draw_vertex_info *vert_info,
+                          const struct draw_prim_info *prim_info,
+                          struct draw_prim_info *out_prim_info );
+
+struct pt_clip *draw_pt_clip_create( struct draw_context *draw );
+
+void draw_pt_clip_destroy( struct pt_clip *clip );
+
+
 /*******************************************************************************
  * Utils: 
  */
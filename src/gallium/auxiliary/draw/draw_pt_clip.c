@@ -0,0 +1,713 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/**
+ * Batched triangle clipping for the middle ends' emit path.
+ *
+ * When the only reason a draw would go through the draw_stage pipeline
+ * is that some of its triangles cross clip planes, the middle ends hand
+ * the shaded vertices here instead.  The primitives are decomposed into
+ * triangles and classified by their vertices' clipmasks.  Trivially
+ * accepted triangles just have their indices copied, rejected ones are
+ * dropped, and only the straddling ones are clipped.  The distances of a
+ * vertex to all the clip planes are computed at once, four planes at a
+ * time, so clipping against several planes doesn't revisit the vertex.
+ *
+ * The vertices created by clipping are appended to the vertex buffer and
+ * the result is emitted as one indexed triangle list, so the whole draw
+ * still reaches the driver in a single vertex buffer.
+ *
+ * The clipping itself follows do_clip_tri() in draw_pipe_clip.c, which
+ * still handles lines, points and everything else that needs the
+ * pipeline (unfilled triangles, edge flags, wide lines, ...).
+ */
+
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/u_prim.h"
+#include "util/u_sse.h"
+#include "draw/draw_context.h"
+#include "draw/draw_private.h"
+#include "draw/draw_pipe.h"
+#include "draw/draw_pt.h"
+
+
+#ifndef IS_NEGATIVE
+#define IS_NEGATIVE(X) ((X) < 0.0)
+#endif
+
+#ifndef DIFFERENT_SIGNS
+#define DIFFERENT_SIGNS(x, y) ((x) * (y) <= 0.0F && (x) - (y) != 0.0F)
+#endif
+
+#define MAX_CLIPPED_VERTICES ((2 * (6 + PIPE_MAX_CLIP_PLANES))+1)
+
+/** The clip planes, in groups of four */
+#define NUM_PLANE_GROUPS ((DRAW_TOTAL_CLIP_PLANES + 3) / 4)
+#define NUM_PLANES (NUM_PLANE_GROUPS * 4)
+
+#define LINTERP(T, OUT, IN) ((OUT) + (T) * ((IN) - (OUT)))
+
+
+DEBUG_GET_ONCE_BOOL_OPTION(draw_pipeline_clip, "DRAW_PIPELINE_CLIP", FALSE)
+
+
+struct pt_clip {
+   struct draw_context *draw;
+
+   boolean enabled;
+
+   /* List of the attributes to be flatshaded. */
+   uint num_flat_attribs;
+   uint flat_attribs[PIPE_MAX_SHADER_OUTPUTS];
+
+   /* Mask of attributes in noperspective mode */
+   boolean noperspective_attribs[PIPE_MAX_SHADER_OUTPUTS];
+
+   /* The vertices being clipped and the current state.
+    */
+   char *verts;
+   unsigned count;
+   unsigned stride;
+   unsigned nr_attrs;
+   unsigned pos_attr;
+   unsigned clip_attr;
+   unsigned cd[2];
+   boolean flatshade_first;
+
+   /** The clip planes transposed, plane_t[g][c][i] = plane[4 * g + i][c] */
+   float plane_t[NUM_PLANE_GROUPS][4][4];
+
+   /** The output triangle list */
+   ushort *elts;
+   unsigned nr_elts;
+   unsigned max_elts;
+
+   /** Vertices created by clipping, numbered from 'count' on */
+   char *new_verts;
+   unsigned nr_new_verts;
+   unsigned max_new_verts;
+
+   boolean failed;
+};
+
+
+/** A vertex of the polygon being clipped */
+struct poly_vertex {
+   struct vertex_header *v;
+   const float *dist;            /**< distances to all the clip planes */
+   unsigned index;
+};
+
+
+static INLINE struct vertex_header *
+get_vertex(const struct pt_clip *clip, unsigned index)
+{
+   if (index < clip->count)
+      return (struct vertex_header *)(clip->verts + index * clip->stride);
+   else
+      return (struct vertex_header *)(clip->new_verts +
+                                      (index - clip->count) * clip->stride);
+}
+
+
+/**
+ * Make sure there is room for clipping one more triangle: the elements
+ * of the polygon's triangles, and the new vertices of do_clip_tri().
+ * Growing the buffers here keeps the vertex pointers valid while a
+ * triangle is clipped.
+ */
+static boolean
+reserve(struct pt_clip *clip)
+{
+   const unsigned need_elts = clip->nr_elts + 3 * MAX_CLIPPED_VERTICES;
+   const unsigned need_verts = clip->nr_new_verts + MAX_CLIPPED_VERTICES + 1;
+
+   /* draw_pt_emit() allocates at most 0xffff vertices */
+   if (clip->count + need_verts > 0xffff)
+      return FALSE;
+
+   if (need_elts > clip->max_elts) {
+      unsigned max_elts = MAX2(2 * clip->max_elts, need_elts);
+      ushort *elts = REALLOC(clip->elts,
+                             clip->max_elts * sizeof(ushort),
+                             max_elts * sizeof(ushort));
+      if (!elts)
+         return FALSE;
+      clip->elts = elts;
+      clip->max_elts = max_elts;
+   }
+
+   if (need_verts > clip->max_new_verts) {
+      unsigned max_new_verts = MAX2(2 * clip->max_new_verts, need_verts);
+      char *new_verts = REALLOC(clip->new_verts,
+                                clip->max_new_verts * clip->stride,
+                                max_new_verts * clip->stride);
+      if (!new_verts)
+         return FALSE;
+      clip->new_verts = new_verts;
+      clip->max_new_verts = max_new_verts;
+   }
+
+   return TRUE;
+}
+
+
+static INLINE struct vertex_header *
+new_vertex(struct pt_clip *clip, unsigned *index)
+{
+   *index = clip->count + clip->nr_new_verts;
+   return (struct vertex_header *)(clip->new_verts +
+                                   clip->nr_new_verts++ * clip->stride);
+}
+
+
+/**
+ * Compute the distances of a vertex to all the clip planes, like
+ * getclipdist() in draw_pipe_clip.c.
+ */
+static void
+compute_dists(const struct pt_clip *clip,
+              const struct vertex_header *v,
+              float dist[NUM_PLANES])
+{
+   unsigned i;
+
+#if defined(PIPE_ARCH_SSE)
+   const __m128 x = _mm_set1_ps(v->clip[0]);
+   const __m128 y = _mm_set1_ps(v->clip[1]);
+   const __m128 z = _mm_set1_ps(v->clip[2]);
+   const __m128 w = _mm_set1_ps(v->clip[3]);
+
+   for (i = 0; i < NUM_PLANE_GROUPS; i++) {
+      __m128 d;
+      d = _mm_mul_ps(x, _mm_loadu_ps(clip->plane_t[i][0]));
+      d = _mm_add_ps(d, _mm_mul_ps(y, _mm_loadu_ps(clip->plane_t[i][1])));
+      d = _mm_add_ps(d, _mm_mul_ps(z, _mm_loadu_ps(clip->plane_t[i][2])));
+      d = _mm_add_ps(d, _mm_mul_ps(w, _mm_loadu_ps(clip->plane_t[i][3])));
+      _mm_store_ps(&dist[4 * i], d);
+   }
+#else
+   for (i = 0; i < NUM_PLANES; i++) {
+      const unsigned g = i / 4, j = i % 4;
+      dist[i] = (v->clip[0] * clip->plane_t[g][0][j] +
+                 v->clip[1] * clip->plane_t[g][1][j] +
+                 v->clip[2] * clip->plane_t[g][2][j] +
+                 v->clip[3] * clip->plane_t[g][3][j]);
+   }
+#endif
+
+   if (v->have_clipdist) {
+      for (i = 6; i < DRAW_TOTAL_CLIP_PLANES; i++) {
+         const unsigned idx = i - 6;
+         dist[i] = v->data[clip->cd[idx >= 4]][idx % 4];
+      }
+   }
+}
+
+
+/**
+ * The distances of an interpolated vertex.  The distances are linear in
+ * the clip coordinates and clip distances, so this gives the same result
+ * as compute_dists() on the new vertex, up to rounding.
+ */
+static void
+interp_dists(float dst[NUM_PLANES],
+             float t,
+             const float in[NUM_PLANES],
+             const float out[NUM_PLANES])
+{
+   unsigned i;
+
+#if defined(PIPE_ARCH_SSE)
+   const __m128 tt = _mm_set1_ps(t);
+
+   for (i = 0; i < NUM_PLANES; i += 4) {
+      const __m128 o = _mm_load_ps(&out[i]);
+      const __m128 d = _mm_sub_ps(_mm_load_ps(&in[i]), o);
+      _mm_store_ps(&dst[i], _mm_add_ps(o, _mm_mul_ps(tt, d)));
+   }
+#else
+   for (i = 0; i < NUM_PLANES; i++)
+      dst[i] = LINTERP(t, out[i], in[i]);
+#endif
+}
+
+
+/* All attributes are float[4], so this is easy:
+ */
+static INLINE void
+interp_attr(float dst[4],
+            float t,
+            const float in[4],
+            const float out[4])
+{
+#if defined(PIPE_ARCH_SSE)
+   const __m128 o = _mm_loadu_ps(out);
+   const __m128 d = _mm_sub_ps(_mm_loadu_ps(in), o);
+   _mm_storeu_ps(dst, _mm_add_ps(o, _mm_mul_ps(_mm_set1_ps(t), d)));
+#else
+   dst[0] = LINTERP( t, out[0], in[0] );
+   dst[1] = LINTERP( t, out[1], in[1] );
+   dst[2] = LINTERP( t, out[2], in[2] );
+   dst[3] = LINTERP( t, out[3], in[3] );
+#endif
+}
+
+
+/* Interpolate between two vertices to produce a third, like interp() in
+ * draw_pipe_clip.c.
+ */
+static void
+interp(const struct pt_clip *clip,
+       struct vertex_header *dst,
+       float t,
+       const struct vertex_header *out,
+       const struct vertex_header *in)
+{
+   const unsigned pos_attr = clip->pos_attr;
+   const unsigned clip_attr = clip->clip_attr;
+   unsigned j;
+   float t_nopersp;
+
+   dst->clipmask = 0;
+   dst->edgeflag = 0;
+   dst->have_clipdist = in->have_clipdist;
+   dst->vertex_id = UNDEFINED_VERTEX_ID;
+
+   interp_attr(dst->clip, t, in->clip, out->clip);
+   interp_attr(dst->pre_clip_pos, t, in->pre_clip_pos, out->pre_clip_pos);
+
+   /* Do the projective divide and viewport transformation to get
+    * new window coordinates:
+    */
+   {
+      const float *pos = dst->pre_clip_pos;
+      const float *scale = clip->draw->viewport.scale;
+      const float *trans = clip->draw->viewport.translate;
+      const float oow = 1.0f / pos[3];
+
+      dst->data[pos_attr][0] = pos[0] * oow * scale[0] + trans[0];
+      dst->data[pos_attr][1] = pos[1] * oow * scale[1] + trans[1];
+      dst->data[pos_attr][2] = pos[2] * oow * scale[2] + trans[2];
+      dst->data[pos_attr][3] = oow;
+   }
+
+   /* The screen-space t for noperspective attributes.
+    */
+   {
+      int k;
+      t_nopersp = t;
+      for (k = 0; k < 2; k++)
+         if (in->data[pos_attr][k] != out->data[pos_attr][k]) {
+            t_nopersp = (dst->data[pos_attr][k] - out->data[pos_attr][k]) /
+               (in->data[pos_attr][k] - out->data[pos_attr][k]);
+            break;
+         }
+   }
+
+   for (j = 0; j < clip->nr_attrs; j++) {
+      if (j != pos_attr && j != clip_attr) {
+         if (clip->noperspective_attribs[j])
+            interp_attr(dst->data[j], t_nopersp, in->data[j], out->data[j]);
+         else
+            interp_attr(dst->data[j], t, in->data[j], out->data[j]);
+      }
+   }
+}
+
+
+/**
+ * Emit a post-clip polygon as triangles, in the same order as
+ * emit_poly() in draw_pipe_clip.c.  The provoking vertex is p[0].
+ */
+static void
+emit_poly(struct pt_clip *clip,
+          const struct poly_vertex *p,
+          unsigned n)
+{
+   ushort *elts = clip->elts + clip->nr_elts;
+   unsigned i;
+
+   for (i = 2; i < n; i++, elts += 3) {
+      if (clip->flatshade_first) {
+         elts[0] = p[0].index;
+         elts[1] = p[i-1].index;
+         elts[2] = p[i].index;
+      }
+      else {
+         elts[0] = p[i-1].index;
+         elts[1] = p[i].index;
+         elts[2] = p[0].index;
+      }
+   }
+
+   clip->nr_elts += 3 * (n - 2);
+}
+
+
+/* Clip a triangle against the planes in clipmask.
+ */
+static void
+do_clip_tri(struct pt_clip *clip,
+            unsigned i0, unsigned i1, unsigned i2,
+            unsigned clipmask)
+{
+   PIPE_ALIGN_VAR(16) float dist[3 + MAX_CLIPPED_VERTICES + 1][NUM_PLANES];
+   struct poly_vertex a[MAX_CLIPPED_VERTICES];
+   struct poly_vertex b[MAX_CLIPPED_VERTICES];
+   struct poly_vertex *inlist = a;
+   struct poly_vertex *outlist = b;
+   unsigned tmpnr = 0;
+   unsigned n = 3;
+   unsigned i;
+
+   inlist[0].index = i0;
+   inlist[1].index = i1;
+   inlist[2].index = i2;
+
+   for (i = 0; i < 3; i++) {
+      inlist[i].v = get_vertex(clip, inlist[i].index);
+      inlist[i].dist = dist[i];
+      compute_dists(clip, inlist[i].v, dist[i]);
+   }
+
+   while (clipmask && n >= 3) {
+      const unsigned plane_idx = ffs(clipmask)-1;
+      const struct poly_vertex *prev = &inlist[0];
+      float dp_prev = prev->dist[plane_idx];
+      unsigned outcount = 0;
+
+      clipmask &= ~(1<<plane_idx);
+
+      assert(n < MAX_CLIPPED_VERTICES);
+      if (n >= MAX_CLIPPED_VERTICES)
+         return;
+      inlist[n] = inlist[0]; /* prevent rotation of vertices */
+
+      for (i = 1; i <= n; i++) {
+         const struct poly_vertex *cur = &inlist[i];
+         const float dp = cur->dist[plane_idx];
+
+         if (!IS_NEGATIVE(dp_prev)) {
+            assert(outcount < MAX_CLIPPED_VERTICES);
+            if (outcount >= MAX_CLIPPED_VERTICES)
+               return;
+            outlist[outcount++] = *prev;
+         }
+
+         if (DIFFERENT_SIGNS(dp, dp_prev)) {
+            struct poly_vertex *new_vert;
+            float *new_dist;
+
+            assert(tmpnr < MAX_CLIPPED_VERTICES + 1);
+            if (tmpnr >= MAX_CLIPPED_VERTICES + 1)
+               return;
+            new_dist = dist[3 + tmpnr++];
+
+            assert(outcount < MAX_CLIPPED_VERTICES);
+            if (outcount >= MAX_CLIPPED_VERTICES)
+               return;
+            new_vert = &outlist[outcount++];
+            new_vert->v = new_vertex(clip, &new_vert->index);
+            new_vert->dist = new_dist;
+
+            if (IS_NEGATIVE(dp)) {
+               /* Going out of bounds.  Avoid division by zero as we
+                * know dp != dp_prev from DIFFERENT_SIGNS, above.
+                */
+               float t = dp / (dp - dp_prev);
+               interp(clip, new_vert->v, t, cur->v, prev->v);
+               interp_dists(new_dist, t, prev->dist, cur->dist);
+            }
+            else {
+               /* Coming back in.
+                */
+               float t = dp_prev / (dp_prev - dp);
+               interp(clip, new_vert->v, t, prev->v, cur->v);
+               interp_dists(new_dist, t, cur->dist, prev->dist);
+            }
+         }
+
+         prev = cur;
+         dp_prev = dp;
+      }
+
+      /* swap in/out lists */
+      {
+         struct poly_vertex *tmp = inlist;
+         inlist = outlist;
+         outlist = tmp;
+         n = outcount;
+      }
+   }
+
+   if (n >= 3) {
+      /* If flat-shading, copy provoking vertex attributes to polygon
+       * vertex[0].
+       */
+      if (clip->num_flat_attribs) {
+         const unsigned provoking = clip->flatshade_first ? i0 : i2;
+
+         if (inlist[0].index != provoking) {
+            const struct vertex_header *src = get_vertex(clip, provoking);
+            struct vertex_header *dup;
+            unsigned j;
+
+            assert(tmpnr < MAX_CLIPPED_VERTICES + 1);
+            if (tmpnr >= MAX_CLIPPED_VERTICES + 1)
+               return;
+            tmpnr++;
+
+            dup = new_vertex(clip, &inlist[0].index);
+            memcpy(dup, inlist[0].v, clip->stride);
+            dup->vertex_id = UNDEFINED_VERTEX_ID;
+            inlist[0].v = dup;
+
+            for (j = 0; j < clip->num_flat_attribs; j++) {
+               const uint attr = clip->flat_attribs[j];
+               COPY_4FV(dup->data[attr], src->data[attr]);
+            }
+         }
+      }
+
+      emit_poly(clip, inlist, n);
+   }
+}
+
+
+static INLINE void
+clip_tri(struct pt_clip *clip, unsigned i0, unsigned i1, unsigned i2)
+{
+   const unsigned m0 = get_vertex(clip, i0)->clipmask;
+   const unsigned m1 = get_vertex(clip, i1)->clipmask;
+   const unsigned m2 = get_vertex(clip, i2)->clipmask;
+   const unsigned clipmask = m0 | m1 | m2;
+
+   if (clip->failed)
+      return;
+
+   if (!reserve(clip)) {
+      clip->failed = TRUE;
+      return;
+   }
+
+   if (clipmask == 0) {
+      ushort *elts = clip->elts + clip->nr_elts;
+      elts[0] = (ushort)i0;
+      elts[1] = (ushort)i1;
+      elts[2] = (ushort)i2;
+      clip->nr_elts += 3;
+   }
+   else if ((m0 & m1 & m2) == 0) {
+      do_clip_tri(clip, i0, i1, i2, clipmask);
+   }
+}
+
+
+/*
+ * Set up macros for draw_decompose_tmp.h.  Only triangles get here.
+ */
+
+#define LOCAL_VARS                                   \
+   const boolean quads_flatshade_last =              \
+      clip->draw->quads_always_flatshade_last;       \
+   const boolean last_vertex_last =                  \
+      !(clip->draw->rasterizer->flatshade &&         \
+        clip->draw->rasterizer->flatshade_first);
+
+#define TRIANGLE(flags,i0,i1,i2) clip_tri(clip, i0, i1, i2)
+#define LINE(flags,i0,i1)        assert(0)
+#define POINT(i0)                assert(0)
+
+#define GET_ELT(idx) (MIN2(elts[idx], clip->count - 1))
+
+#define FUNC clip_run_elts
+#define FUNC_VARS                               \
+   struct pt_clip *clip,                        \
+   unsigned prim,                               \
+   unsigned prim_flags,                         \
+   const ushort *elts,                          \
+   unsigned count
+
+#include "draw_decompose_tmp.h"
+
+
+#define LOCAL_VARS                                   \
+   const boolean quads_flatshade_last =              \
+      clip->draw->quads_always_flatshade_last;       \
+   const boolean last_vertex_last =                  \
+      !(clip->draw->rasterizer->flatshade &&         \
+        clip->draw->rasterizer->flatshade_first);
+
+#define TRIANGLE(flags,i0,i1,i2) clip_tri(clip, i0, i1, i2)
+#define LINE(flags,i0,i1)        assert(0)
+#define POINT(i0)                assert(0)
+
+#define GET_ELT(idx) (start + (idx))
+
+#define FUNC clip_run_linear
+#define FUNC_VARS                               \
+   struct pt_clip *clip,                        \
+   unsigned prim,                               \
+   unsigned prim_flags,                         \
+   unsigned start,                              \
+   unsigned count
+
+#include "draw_decompose_tmp.h"
+
+
+/**
+ * Clip the triangles of a draw, if the clipper is enabled for it.
+ * On success the new vertices are appended to vert_info and
+ * out_prim_info describes the clipped triangles, which refer to storage
+ * owned by the clipper.
+ *
+ * \return FALSE if the draw must be clipped by the pipeline instead; the
+ *         vertices are untouched then.
+ */
+boolean
+draw_pt_clip_run(struct pt_clip *clip,
+                 struct draw_vertex_info *vert_info,
+                 const struct draw_prim_info *prim_info,
+                 struct draw_prim_info *out_prim_info)
+{
+   struct draw_context *draw = clip->draw;
+   unsigned start, i, j;
+
+   if (!clip->enabled)
+      return FALSE;
+
+   if (clip->stride != vert_info->stride) {
+      /* the new vertices are stored with this stride */
+      FREE(clip->new_verts);
+      clip->new_verts = NULL;
+      clip->max_new_verts = 0;
+   }
+
+   clip->verts = (char *)vert_info->verts;
+   clip->count = vert_info->count;
+   clip->stride = vert_info->stride;
+   clip->nr_attrs = draw_current_shader_outputs(draw);
+   clip->pos_attr = draw_current_shader_position_output(draw);
+   clip->clip_attr = draw_current_shader_clipvertex_output(draw);
+   clip->cd[0] = draw_current_shader_clipdistance_output(draw, 0);
+   clip->cd[1] = draw_current_shader_clipdistance_output(draw, 1);
+   clip->flatshade_first = draw->rasterizer->flatshade_first;
+   clip->nr_elts = 0;
+   clip->nr_new_verts = 0;
+   clip->failed = FALSE;
+
+   for (i = 0; i < DRAW_TOTAL_CLIP_PLANES; i++) {
+      for (j = 0; j < 4; j++)
+         clip->plane_t[i / 4][j][i % 4] = draw->plane[i][j];
+   }
+
+   for (start = i = 0;
+        i < prim_info->primitive_count;
+        start += prim_info->primitive_lengths[i], i++)
+   {
+      const unsigned count = prim_info->primitive_lengths[i];
+
+      if (prim_info->linear)
+         clip_run_linear(clip, prim_info->prim, prim_info->flags,
+                         prim_info->start + start, count);
+      else
+         clip_run_elts(clip, prim_info->prim, prim_info->flags,
+                       prim_info->elts + start, count);
+   }
+
+   if (clip->failed)
+      return FALSE;
+
+   if (clip->nr_new_verts) {
+      const unsigned size = clip->count * clip->stride;
+      const unsigned new_size = clip->nr_new_verts * clip->stride;
+      char *verts = REALLOC(vert_info->verts, size, size + new_size);
+      if (!verts)
+         return FALSE;
+
+      memcpy(verts + size, clip->new_verts, new_size);
+      vert_info->verts = (struct vertex_header *)verts;
+      vert_info->count += clip->nr_new_verts;
+   }
+
+   out_prim_info->linear = FALSE;
+   out_prim_info->start = 0;
+   out_prim_info->elts = clip->elts;
+   out_prim_info->count = clip->nr_elts;
+   out_prim_info->prim = PIPE_PRIM_TRIANGLES;
+   out_prim_info->flags = 0;
+   out_prim_info->primitive_lengths = &clip->nr_elts;
+   out_prim_info->primitive_count = clip->nr_elts ? 1 : 0;
+
+   return TRUE;
+}
+
+
+/**
+ * Enable the clipper for draws of 'prim' (the primitive after the
+ * geometry shader) if they don't otherwise need the pipeline.
+ */
+void
+draw_pt_clip_prepare(struct pt_clip *clip,
+                     unsigned prim,
+                     unsigned opt)
+{
+   clip->enabled = (!(opt & PT_PIPELINE) &&
+                    u_reduced_prim(prim) == PIPE_PRIM_TRIANGLES &&
+                    !debug_get_option_draw_pipeline_clip());
+
+   if (clip->enabled) {
+      draw_clip_interp_modes(clip->draw,
+                             &clip->num_flat_attribs,
+                             clip->flat_attribs,
+                             clip->noperspective_attribs);
+   }
+}
+
+
+struct pt_clip *
+draw_pt_clip_create(struct draw_context *draw)
+{
+   struct pt_clip *clip = CALLOC_STRUCT(pt_clip);
+   if (!clip)
+      return NULL;
+
+   clip->draw = draw;
+
+   return clip;
+}
+
+
+void
+draw_pt_clip_destroy(struct pt_clip *clip)
+{
+   FREE(clip->elts);
+   FREE(clip->new_verts);
+   FREE(clip);
+}
@@ -142,7 +142,7 @@ draw_pt_emit(struct pt_emit *emit,
    /* XXX: and work out some way to coordinate the render primitive
     * between vbuf.c and here...
     */
-   draw->render->set_primitive(draw->render, emit->prim);
+   draw->render->set_primitive(draw->render, prim_info->prim);
 
    render->allocate_vertices(render,
                              (ushort)translate->key.output_stride,
@@ -206,6 +206,8 @@ fse_run_linear(struct draw_pt_middle_end *middle,
     * Clipping is done elsewhere -- either by the API or on hardware,
     * or for some other reason not required...
     */
+   draw->statistics.vs_invocations += count;
+
    fse->active->run_linear( fse->active,
                             start, count,
                             hw_verts );
@@ -268,6 +270,8 @@ fse_run(struct draw_pt_middle_end *middle,
 
    /* Single routine to fetch vertices, run shader and emit HW verts.
     */
+   draw->statistics.vs_invocations += fetch_count;
+
    fse->active->run_elts( fse->active,
                           fetch_elts,
                           fetch_count,
@@ -328,6 +332,8 @@ fse_run_linear_elts(struct draw_pt_middle_end *middle,
     * Clipping is done elsewhere -- either by the API or on hardware,
     * or for some other reason not required...
     */
+   draw->statistics.vs_invocations += count;
+
    fse->active->run_linear( fse->active,
                             start, count,
                             hw_verts );
@@ -44,6 +44,7 @@ struct fetch_pipeline_middle_end {
    struct pt_so_emit *so_emit;
    struct pt_fetch *fetch;
    struct pt_post_vs *post_vs;
+   struct pt_clip *clip;
 
    unsigned vertex_data_offset;
    unsigned vertex_size;
@@ -117,6 +118,8 @@ static void fetch_pipeline_prepare( struct draw_pt_middle_end *middle,
 			    (boolean)draw->rasterizer->gl_rasterization_rules,
 			    (draw->vs.edgeflag_output ? TRUE : FALSE) );
 
+   draw_pt_clip_prepare( fpme->clip, gs_out_prim, opt );
+
    draw_pt_so_emit_prepare( fpme->so_emit, FALSE );
 
    if (!(opt & PT_PIPELINE)) {
@@ -224,6 +227,7 @@ static void fetch_pipeline_generic( struct draw_pt_middle_end *middle,
    struct draw_vertex_shader *vshader = draw->vs.vertex_shader;
    struct draw_geometry_shader *gshader = draw->gs.geometry_shader;
    struct draw_prim_info gs_prim_info;
+   struct draw_prim_info clip_prim_info;
    struct draw_vertex_info fetched_vert_info;
    struct draw_vertex_info vs_vert_info;
    struct draw_vertex_info gs_vert_info;
@@ -254,6 +258,8 @@ static void fetch_pipeline_generic( struct draw_pt_middle_end *middle,
     * the pipeline verts.
     */
    if (fpme->opt & PT_SHADE) {
+      draw->statistics.vs_invocations += vert_info->count;
+
       draw_vertex_shader_run(vshader,
                              draw->pt.user.vs_constants,
                              draw->pt.user.vs_constants_size,
@@ -291,7 +297,13 @@ static void fetch_pipeline_generic( struct draw_pt_middle_end *middle,
    if (draw_pt_post_vs_run( fpme->post_vs,
                             vert_info ))
    {
-      opt |= PT_PIPELINE;
+      if (draw_pt_clip_run( fpme->clip,
+                            vert_info,
+                            prim_info,
+                            &clip_prim_info ))
+         prim_info = &clip_prim_info;
+      else
+         opt |= PT_PIPELINE;
    }
 
    /* Do we need to run the pipeline?
@@ -419,6 +431,9 @@ static void fetch_pipeline_destroy( struct draw_pt_middle_end *middle )
    if (fpme->post_vs)
       draw_pt_post_vs_destroy( fpme->post_vs );
 
+   if (fpme->clip)
+      draw_pt_clip_destroy( fpme->clip );
+
    FREE(middle);
 }
 
@@ -447,6 +462,10 @@ struct draw_pt_middle_end *draw_pt_fetch_pipeline_or_emit( struct draw_context *
    if (!fpme->post_vs)
       goto fail;
 
+   fpme->clip = draw_pt_clip_create( draw );
+   if (!fpme->clip)
+      goto fail;
+
    fpme->emit = draw_pt_emit_create( draw );
    if (!fpme->emit)
       goto fail;
@@ -25,6 +25,9 @@
  *
  **************************************************************************/
 
+#include "os/os_thread.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_debug.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "draw/draw_context.h"
@@ -37,6 +40,44 @@
 #include "gallivm/lp_bld_init.h"
 
 
+/** Max number of vertex processing threads */
+#define DRAW_MAX_THREADS 8
+
+/** Runs with fewer vertices than this are only deferred behind others */
+#define MIN_JOB_VERTICES 256
+
+
+struct llvm_middle_end;
+
+
+/**
+ * A run whose fetch and vertex shading is done by one of the threads.
+ * The primitives are emitted by the calling thread, in the order of the
+ * runs, so the elements are copied to the job.
+ */
+struct llvm_shade_job {
+   struct llvm_middle_end *fpme;
+
+   struct draw_fetch_info fetch_info;
+   struct draw_prim_info prim_info;
+   unsigned prim_length;
+
+   unsigned *fetch_elts;
+   unsigned max_fetch_elts;
+   ushort *draw_elts;
+   unsigned max_draw_elts;
+
+   /* results */
+   struct draw_vertex_info vert_info;
+   unsigned clipped;
+
+   pipe_thread thread;
+   pipe_semaphore work_ready;
+   pipe_semaphore work_done;
+   boolean exit_flag;
+};
+
+
 struct llvm_middle_end {
    struct draw_pt_middle_end base;
    struct draw_context *draw;
@@ -45,6 +86,7 @@ struct llvm_middle_end {
    struct pt_so_emit *so_emit;
    struct pt_fetch *fetch;
    struct pt_post_vs *post_vs;
+   struct pt_clip *clip;
 
 
    unsigned vertex_data_offset;
@@ -54,6 +96,14 @@ struct llvm_middle_end {
 
    struct draw_llvm *llvm;
    struct draw_llvm_variant *current_variant;
+
+   /**
+    * Vertex processing threads, one job each.  Jobs first_job to
+    * next_job - 1 (modulo num_threads) are queued, oldest first.
+    */
+   unsigned num_threads;
+   struct llvm_shade_job *jobs;
+   unsigned first_job, next_job;
 };
 
 
@@ -102,6 +152,8 @@ llvm_middle_end_prepare( struct draw_pt_middle_end *middle,
 			    (boolean)draw->rasterizer->gl_rasterization_rules,
 			    (draw->vs.edgeflag_output ? TRUE : FALSE) );
 
+   draw_pt_clip_prepare( fpme->clip, out_prim, opt );
+
    draw_pt_so_emit_prepare( fpme->so_emit, TRUE );
 
    if (!(opt & PT_PIPELINE)) {
@@ -237,35 +289,35 @@ static void emit(struct pt_emit *emit,
    }
 }
 
-static void
-llvm_pipeline_generic( struct draw_pt_middle_end *middle,
-                       const struct draw_fetch_info *fetch_info,
-                       const struct draw_prim_info *prim_info )
+
+/**
+ * Fetch the vertices and run the vertex shader and the cliptest on them.
+ * Called by the vertex processing threads too, so this only reads the
+ * middle end's state.
+ *
+ * \return the cliptest result, i.e. whether some vertices need clipping.
+ */
+static unsigned
+llvm_shade( const struct llvm_middle_end *fpme,
+            const struct draw_fetch_info *fetch_info,
+            struct draw_vertex_info *vert_info )
 {
-   struct llvm_middle_end *fpme = (struct llvm_middle_end *)middle;
    struct draw_context *draw = fpme->draw;
-   struct draw_geometry_shader *gshader = draw->gs.geometry_shader;
-   struct draw_prim_info gs_prim_info;
-   struct draw_vertex_info llvm_vert_info;
-   struct draw_vertex_info gs_vert_info;
-   struct draw_vertex_info *vert_info;
-   unsigned opt = fpme->opt;
-   unsigned clipped = 0;
 
-   llvm_vert_info.count = fetch_info->count;
-   llvm_vert_info.vertex_size = fpme->vertex_size;
-   llvm_vert_info.stride = fpme->vertex_size;
-   llvm_vert_info.verts =
+   vert_info->count = fetch_info->count;
+   vert_info->vertex_size = fpme->vertex_size;
+   vert_info->stride = fpme->vertex_size;
+   vert_info->verts =
       (struct vertex_header *)MALLOC(fpme->vertex_size *
                                      align(fetch_info->count,  lp_native_vector_width / 32));
-   if (!llvm_vert_info.verts) {
+   if (!vert_info->verts) {
       assert(0);
-      return;
+      return 0;
    }
 
    if (fetch_info->linear)
-      clipped = fpme->current_variant->jit_func( &fpme->llvm->jit_context,
-                                       llvm_vert_info.verts,
+      return fpme->current_variant->jit_func( &fpme->llvm->jit_context,
+                                       vert_info->verts,
                                        (const char **)draw->pt.user.vbuffer,
                                        fetch_info->start,
                                        fetch_info->count,
@@ -273,20 +325,36 @@ llvm_pipeline_generic( struct draw_pt_middle_end *middle,
                                        draw->pt.vertex_buffer,
                                        draw->instance_id);
    else
-      clipped = fpme->current_variant->jit_func_elts( &fpme->llvm->jit_context,
-                                            llvm_vert_info.verts,
+      return fpme->current_variant->jit_func_elts( &fpme->llvm->jit_context,
+                                            vert_info->verts,
                                             (const char **)draw->pt.user.vbuffer,
                                             fetch_info->elts,
                                             fetch_info->count,
                                             fpme->vertex_size,
                                             draw->pt.vertex_buffer,
                                             draw->instance_id);
+}
 
-   /* Finished with fetch and vs:
-    */
-   fetch_info = NULL;
-   vert_info = &llvm_vert_info;
 
+/**
+ * Run the geometry shader, stream output and clipping on the shaded
+ * vertices and emit the primitives.  Frees the vertices.
+ */
+static void
+llvm_pipeline_emit( struct llvm_middle_end *fpme,
+                    struct draw_vertex_info *vert_info,
+                    const struct draw_prim_info *prim_info,
+                    unsigned clipped )
+{
+   struct draw_context *draw = fpme->draw;
+   struct draw_geometry_shader *gshader = draw->gs.geometry_shader;
+   struct draw_prim_info gs_prim_info;
+   struct draw_prim_info clip_prim_info;
+   struct draw_vertex_info gs_vert_info;
+   unsigned opt = fpme->opt;
+
+   if (!vert_info->verts)
+      return;
 
    if ((opt & PT_SHADE) && gshader) {
       draw_geometry_shader_run(gshader,
@@ -311,7 +379,13 @@ llvm_pipeline_generic( struct draw_pt_middle_end *middle,
                     prim_info );
 
    if (clipped) {
-      opt |= PT_PIPELINE;
+      if (draw_pt_clip_run( fpme->clip,
+                            vert_info,
+                            prim_info,
+                            &clip_prim_info ))
+         prim_info = &clip_prim_info;
+      else
+         opt |= PT_PIPELINE;
    }
 
    /* Do we need to run the pipeline? Now will come here if clipped
@@ -330,6 +404,168 @@ llvm_pipeline_generic( struct draw_pt_middle_end *middle,
 }
 
 
+static PIPE_THREAD_ROUTINE( llvm_shade_thread, init_data )
+{
+   struct llvm_shade_job *job = (struct llvm_shade_job *) init_data;
+
+   while (1) {
+      pipe_semaphore_wait(&job->work_ready);
+
+      if (job->exit_flag)
+         break;
+
+      job->clipped = llvm_shade(job->fpme, &job->fetch_info, &job->vert_info);
+
+      pipe_semaphore_signal(&job->work_done);
+   }
+
+   return NULL;
+}
+
+
+static boolean
+llvm_create_jobs( struct llvm_middle_end *fpme )
+{
+   unsigned i;
+
+   fpme->jobs = CALLOC(fpme->num_threads, sizeof *fpme->jobs);
+   if (!fpme->jobs)
+      return FALSE;
+
+   for (i = 0; i < fpme->num_threads; i++) {
+      struct llvm_shade_job *job = &fpme->jobs[i];
+      job->fpme = fpme;
+      pipe_semaphore_init(&job->work_ready, 0);
+      pipe_semaphore_init(&job->work_done, 0);
+      job->thread = pipe_thread_create(llvm_shade_thread, job);
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Wait for the oldest queued job and emit its primitives.
+ */
+static void
+llvm_retire_job( struct llvm_middle_end *fpme )
+{
+   struct llvm_shade_job *job =
+      &fpme->jobs[fpme->first_job % fpme->num_threads];
+
+   pipe_semaphore_wait(&job->work_done);
+
+   llvm_pipeline_emit( fpme, &job->vert_info, &job->prim_info,
+                       job->clipped );
+
+   fpme->first_job++;
+}
+
+
+/**
+ * Emit the primitives of all the queued jobs.
+ */
+static void
+llvm_middle_end_flush( struct draw_pt_middle_end *middle )
+{
+   struct llvm_middle_end *fpme = (struct llvm_middle_end *)middle;
+
+   while (fpme->first_job != fpme->next_job)
+      llvm_retire_job( fpme );
+}
+
+
+/**
+ * Queue a run on the next thread, copying its elements.
+ *
+ * \return FALSE if the job couldn't be queued (out of memory).
+ */
+static boolean
+llvm_queue_job( struct llvm_middle_end *fpme,
+                const struct draw_fetch_info *fetch_info,
+                const struct draw_prim_info *prim_info )
+{
+   struct llvm_shade_job *job;
+
+   if (fpme->next_job - fpme->first_job == fpme->num_threads)
+      llvm_retire_job( fpme );
+
+   job = &fpme->jobs[fpme->next_job % fpme->num_threads];
+
+   job->fetch_info = *fetch_info;
+   if (!fetch_info->linear) {
+      if (fetch_info->count > job->max_fetch_elts) {
+         unsigned *elts = REALLOC(job->fetch_elts,
+                                  job->max_fetch_elts * sizeof(unsigned),
+                                  fetch_info->count * sizeof(unsigned));
+         if (!elts)
+            return FALSE;
+         job->fetch_elts = elts;
+         job->max_fetch_elts = fetch_info->count;
+      }
+      memcpy(job->fetch_elts, fetch_info->elts,
+             fetch_info->count * sizeof(unsigned));
+      job->fetch_info.elts = job->fetch_elts;
+   }
+
+   assert(prim_info->primitive_count == 1);
+   job->prim_info = *prim_info;
+   job->prim_length = prim_info->primitive_lengths[0];
+   job->prim_info.primitive_lengths = &job->prim_length;
+   if (!prim_info->linear) {
+      if (prim_info->count > job->max_draw_elts) {
+         ushort *elts = REALLOC(job->draw_elts,
+                                job->max_draw_elts * sizeof(ushort),
+                                prim_info->count * sizeof(ushort));
+         if (!elts)
+            return FALSE;
+         job->draw_elts = elts;
+         job->max_draw_elts = prim_info->count;
+      }
+      memcpy(job->draw_elts, prim_info->elts,
+             prim_info->count * sizeof(ushort));
+      job->prim_info.elts = job->draw_elts;
+   }
+
+   fpme->next_job++;
+   pipe_semaphore_signal(&job->work_ready);
+
+   return TRUE;
+}
+
+
+static void
+llvm_pipeline_generic( struct draw_pt_middle_end *middle,
+                       const struct draw_fetch_info *fetch_info,
+                       const struct draw_prim_info *prim_info )
+{
+   struct llvm_middle_end *fpme = (struct llvm_middle_end *)middle;
+   struct draw_vertex_info vert_info;
+   unsigned clipped;
+
+   fpme->draw->statistics.vs_invocations += fetch_info->count;
+
+   /* Large runs are shaded by the vertex processing threads while the
+    * primitives of the previous runs are emitted, but a small run is
+    * only worth queueing to keep the primitives in order.
+    */
+   if (fpme->num_threads &&
+       (fetch_info->count >= MIN_JOB_VERTICES ||
+        fpme->first_job != fpme->next_job)) {
+      if (!fpme->jobs && !llvm_create_jobs( fpme ))
+         fpme->num_threads = 0;
+      else if (llvm_queue_job( fpme, fetch_info, prim_info ))
+         return;
+
+      llvm_middle_end_flush( middle );
+   }
+
+   clipped = llvm_shade( fpme, fetch_info, &vert_info );
+
+   llvm_pipeline_emit( fpme, &vert_info, prim_info, clipped );
+}
+
+
 static void llvm_middle_end_run( struct draw_pt_middle_end *middle,
                                  const unsigned *fetch_elts,
                                  unsigned fetch_count,
@@ -422,12 +658,33 @@ llvm_middle_end_linear_run_elts( struct draw_pt_middle_end *middle,
 
 static void llvm_middle_end_finish( struct draw_pt_middle_end *middle )
 {
-   /* nothing to do */
+   llvm_middle_end_flush( middle );
 }
 
 static void llvm_middle_end_destroy( struct draw_pt_middle_end *middle )
 {
    struct llvm_middle_end *fpme = (struct llvm_middle_end *)middle;
+   unsigned i;
+
+   if (fpme->jobs) {
+      llvm_middle_end_flush( middle );
+
+      for (i = 0; i < fpme->num_threads; i++) {
+         fpme->jobs[i].exit_flag = TRUE;
+         pipe_semaphore_signal(&fpme->jobs[i].work_ready);
+      }
+
+      for (i = 0; i < fpme->num_threads; i++) {
+         struct llvm_shade_job *job = &fpme->jobs[i];
+         pipe_thread_wait(job->thread);
+         pipe_semaphore_destroy(&job->work_ready);
+         pipe_semaphore_destroy(&job->work_done);
+         FREE(job->fetch_elts);
+         FREE(job->draw_elts);
+      }
+
+      FREE(fpme->jobs);
+   }
 
    if (fpme->fetch)
       draw_pt_fetch_destroy( fpme->fetch );
@@ -441,6 +698,9 @@ static void llvm_middle_end_destroy( struct draw_pt_middle_end *middle )
    if (fpme->post_vs)
       draw_pt_post_vs_destroy( fpme->post_vs );
 
+   if (fpme->clip)
+      draw_pt_clip_destroy( fpme->clip );
+
    FREE(middle);
 }
 
@@ -462,6 +722,7 @@ draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
    fpme->base.run             = llvm_middle_end_run;
    fpme->base.run_linear      = llvm_middle_end_linear_run;
    fpme->base.run_linear_elts = llvm_middle_end_linear_run_elts;
+   fpme->base.flush           = llvm_middle_end_flush;
    fpme->base.finish          = llvm_middle_end_finish;
    fpme->base.destroy         = llvm_middle_end_destroy;
 
@@ -475,6 +736,10 @@ draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
    if (!fpme->post_vs)
       goto fail;
 
+   fpme->clip = draw_pt_clip_create( draw );
+   if (!fpme->clip)
+      goto fail;
+
    fpme->emit = draw_pt_emit_create( draw );
    if (!fpme->emit)
       goto fail;
@@ -489,6 +754,15 @@ draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
 
    fpme->current_variant = NULL;
 
+   /* The calling thread emits the primitives, so by default leave it a
+    * CPU of its own.
+    */
+   util_cpu_detect();
+   fpme->num_threads = debug_get_num_option("DRAW_NUM_THREADS",
+                                            MIN2(util_cpu_caps.nr_cpus - 1,
+                                                 DRAW_MAX_THREADS));
+   fpme->num_threads = MIN2(fpme->num_threads, DRAW_MAX_THREADS);
+
    return &fpme->base;
 
  fail:
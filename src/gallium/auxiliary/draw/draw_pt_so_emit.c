@@ -34,9 +34,15 @@
 
 #include "pipe/p_state.h"
 
+#include "translate/translate.h"
+#include "translate/translate_cache.h"
+
 #include "util/u_math.h"
 #include "util/u_memory.h"
 
+/* Number of vertex indices gathered before they are written out */
+#define SO_MAX_ELTS 1024
+
 struct pt_so_emit {
    struct draw_context *draw;
 
@@ -49,9 +55,103 @@ struct pt_so_emit {
    unsigned emitted_primitives;
    unsigned emitted_vertices;
    unsigned generated_primitives;
+
+   /* One translate per buffer written, copying the outputs of a vertex
+    * from the vertex data (buffer 0) and pre-clip position (buffer 1).
+    * NULL for a buffer with outputs means they are copied one by one,
+    * see so_write_outputs().
+    */
+   struct translate_cache *cache;
+   struct translate *translate[PIPE_MAX_SO_BUFFERS];
+   unsigned vertex_bytes[PIPE_MAX_SO_BUFFERS];
+
+   /* Vertices of the primitives which fit in the buffers, not yet written */
+   unsigned elts[SO_MAX_ELTS];
+   unsigned num_elts;
 };
 
 
+static void so_prepare_translate(struct pt_so_emit *emit)
+{
+   struct draw_context *draw = emit->draw;
+   const struct pipe_stream_output_info *state =
+      &draw->vs.vertex_shader->state.stream_output;
+   struct translate_key key;
+   unsigned ob, slot;
+
+   for (ob = 0; ob < PIPE_MAX_SO_BUFFERS; ob++) {
+      boolean too_many_outputs = FALSE;
+
+      memset(&key, 0, sizeof key);
+
+      emit->vertex_bytes[ob] = 0;
+
+      for (slot = 0; slot < state->num_outputs; slot++) {
+         unsigned idx = state->output[slot].register_index;
+         unsigned start_comp = state->output[slot].start_component;
+         unsigned num_comps = state->output[slot].num_components;
+         struct translate_element *elem;
+         enum pipe_format format;
+
+         if (state->output[slot].output_buffer != ob)
+            continue;
+
+         emit->vertex_bytes[ob] += num_comps * sizeof(float);
+
+         if (key.nr_elements == Elements(key.element)) {
+            too_many_outputs = TRUE;
+            continue;
+         }
+         elem = &key.element[key.nr_elements];
+
+         switch (num_comps) {
+         case 1:
+            format = PIPE_FORMAT_R32_FLOAT;
+            break;
+         case 2:
+            format = PIPE_FORMAT_R32G32_FLOAT;
+            break;
+         case 3:
+            format = PIPE_FORMAT_R32G32B32_FLOAT;
+            break;
+         default:
+            format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+            break;
+         }
+
+         elem->type = TRANSLATE_ELEMENT_NORMAL;
+         elem->input_format = format;
+         if (idx == emit->pos_idx && emit->use_pre_clip_pos) {
+            elem->input_buffer = 1;
+            elem->input_offset = start_comp * sizeof(float);
+         }
+         else {
+            elem->input_buffer = 0;
+            elem->input_offset = (idx * 4 + start_comp) * sizeof(float);
+         }
+         elem->instance_divisor = 0;
+         elem->output_format = format;
+         elem->output_offset = state->output[slot].dst_offset * sizeof(float);
+
+         key.nr_elements++;
+      }
+
+      if (!key.nr_elements || too_many_outputs) {
+         emit->translate[ob] = NULL;
+         continue;
+      }
+
+      key.output_stride = state->stride[ob] * sizeof(float);
+
+      if (!emit->translate[ob] ||
+          translate_key_compare(&emit->translate[ob]->key, &key) != 0) {
+         translate_key_sanitize(&key);
+         emit->translate[ob] = translate_cache_find(emit->cache, &key);
+      }
+   }
+}
+
+
 void draw_pt_so_emit_prepare(struct pt_so_emit *emit, boolean use_pre_clip_pos)
 {
    struct draw_context *draw = emit->draw;
@@ -78,82 +178,131 @@ void draw_pt_so_emit_prepare(struct pt_so_emit *emit, boolean use_pre_clip_pos)
    if (!emit->has_so)
       return;
 
+   so_prepare_translate(emit);
+
    /* XXX: need to flush to get prim_vbuf.c to release its allocation??
     */
    draw_do_flush( draw, DRAW_FLUSH_BACKEND );
 }
 
-static void so_emit_prim(struct pt_so_emit *so,
-                         unsigned *indices,
-                         unsigned num_vertices)
+
+/**
+ * Copy the outputs of the gathered vertices to buffer \p ob one by one,
+ * for layouts a translate can't handle.
+ */
+static void so_write_outputs(struct pt_so_emit *so, unsigned ob, char *buffer)
 {
-   unsigned slot, i;
-   unsigned input_vertex_stride = so->input_vertex_stride;
    struct draw_context *draw = so->draw;
-   const float (*input_ptr)[4];
-   const float (*pcp_ptr)[4] = NULL;
    const struct pipe_stream_output_info *state =
       &draw->vs.vertex_shader->state.stream_output;
-   float *buffer;
-   int buffer_total_bytes[PIPE_MAX_SO_BUFFERS];
+   unsigned i, slot;
 
-   input_ptr = so->inputs;
-   if (so->use_pre_clip_pos)
-      pcp_ptr = so->pre_clip_pos;
+   for (i = 0; i < so->num_elts; i++) {
+      const float (*input)[4] = (const float (*)[4])(
+         (const char *)so->inputs + so->elts[i] * so->input_vertex_stride);
+      const float *pre_clip_pos = NULL;
+      float *vertex = (float *)buffer + i * state->stride[ob];
 
-   ++so->generated_primitives;
+      if (so->use_pre_clip_pos)
+         pre_clip_pos = (const float *)(
+            (const char *)so->pre_clip_pos +
+            so->elts[i] * so->input_vertex_stride);
 
-   for (i = 0; i < draw->so.num_targets; i++) {
-      struct draw_so_target *target = draw->so.targets[i];
-      buffer_total_bytes[i] = target->internal_offset;
+      for (slot = 0; slot < state->num_outputs; slot++) {
+         unsigned idx = state->output[slot].register_index;
+         unsigned start_comp = state->output[slot].start_component;
+         unsigned num_comps = state->output[slot].num_components;
+         float *dst = vertex + state->output[slot].dst_offset;
+
+         if (state->output[slot].output_buffer != ob)
+            continue;
+
+         if (idx == so->pos_idx && pre_clip_pos)
+            memcpy(dst, &pre_clip_pos[start_comp], num_comps * sizeof(float));
+         else
+            memcpy(dst, &input[idx][start_comp], num_comps * sizeof(float));
+      }
    }
+}
 
-   /* check have we space to emit prim first - if not don't do anything */
-   for (i = 0; i < num_vertices; ++i) {
-      for (slot = 0; slot < state->num_outputs; ++slot) {
-         unsigned num_comps = state->output[slot].num_components;
-         int ob = state->output[slot].output_buffer;
 
-         if ((buffer_total_bytes[ob] + num_comps * sizeof(float)) >
-             draw->so.targets[ob]->target.buffer_size) {
-            return;
-         }
-         buffer_total_bytes[ob] += num_comps * sizeof(float);
+/**
+ * Write the gathered vertices to the buffers.  Their space was already
+ * accounted for in the targets' internal_offset, so they end there.
+ */
+static void so_flush(struct pt_so_emit *so)
+{
+   struct draw_context *draw = so->draw;
+   const struct pipe_stream_output_info *state =
+      &draw->vs.vertex_shader->state.stream_output;
+   unsigned ob;
+
+   if (!so->num_elts)
+      return;
+
+   for (ob = 0; ob < draw->so.num_targets; ob++) {
+      struct translate *translate = so->translate[ob];
+      struct draw_so_target *target = draw->so.targets[ob];
+      char *buffer;
+
+      if (!so->vertex_bytes[ob])
+         continue;
+
+      buffer = (char *)target->mapping +
+               target->target.buffer_offset +
+               target->internal_offset -
+               so->num_elts * state->stride[ob] * sizeof(float);
+
+      if (!translate) {
+         so_write_outputs(so, ob, buffer);
+         continue;
       }
+
+      translate->set_buffer(translate, 0, so->inputs,
+                            so->input_vertex_stride, ~0);
+      if (so->use_pre_clip_pos)
+         translate->set_buffer(translate, 1, so->pre_clip_pos,
+                               so->input_vertex_stride, ~0);
+
+      translate->run_elts(translate, so->elts, so->num_elts, 0, buffer);
    }
 
-   for (i = 0; i < num_vertices; ++i) {
-      const float (*input)[4];
-      const float (*pre_clip_pos)[4];
-      unsigned total_written_compos = 0;
-      int ob;
-      /*debug_printf("%d) vertex index = %d (prim idx = %d)\n", i, indices[i], prim_idx);*/
-      input = (const float (*)[4])(
-         (const char *)input_ptr + (indices[i] * input_vertex_stride));
+   so->num_elts = 0;
+}
 
-      if (pcp_ptr)
-         pre_clip_pos = (const float (*)[4])(
-         (const char *)pcp_ptr + (indices[i] * input_vertex_stride));
 
-      for (slot = 0; slot < state->num_outputs; ++slot) {
-         unsigned idx = state->output[slot].register_index;
-         unsigned start_comp = state->output[slot].start_component;
-         unsigned num_comps = state->output[slot].num_components;
+static void so_emit_prim(struct pt_so_emit *so,
+                         unsigned *indices,
+                         unsigned num_vertices)
+{
+   struct draw_context *draw = so->draw;
+   const struct pipe_stream_output_info *state =
+      &draw->vs.vertex_shader->state.stream_output;
+   unsigned i, ob;
 
-         ob = state->output[slot].output_buffer;
+   ++so->generated_primitives;
 
-         buffer = (float *)((char *)draw->so.targets[ob]->mapping +
-                            draw->so.targets[ob]->target.buffer_offset +
-                            draw->so.targets[ob]->internal_offset) + state->output[slot].dst_offset;
-         if (idx == so->pos_idx && pcp_ptr)
-            memcpy(buffer, &pre_clip_pos[start_comp], num_comps * sizeof(float));
-         else
-            memcpy(buffer, &input[idx][start_comp], num_comps * sizeof(float));
-         total_written_compos += num_comps;
+   /* check have we space to emit prim first - if not don't do anything */
+   for (ob = 0; ob < draw->so.num_targets; ob++) {
+      struct draw_so_target *target = draw->so.targets[ob];
+
+      if (so->vertex_bytes[ob] &&
+          target->internal_offset + num_vertices * so->vertex_bytes[ob] >
+          target->target.buffer_size) {
+         return;
       }
-      for (ob = 0; ob < draw->so.num_targets; ++ob)
-         draw->so.targets[ob]->internal_offset += state->stride[ob] * sizeof(float);
    }
+
+   if (so->num_elts + num_vertices > SO_MAX_ELTS)
+      so_flush(so);
+
+   for (i = 0; i < num_vertices; ++i)
+      so->elts[so->num_elts++] = indices[i];
+
+   for (ob = 0; ob < draw->so.num_targets; ++ob)
+      draw->so.targets[ob]->internal_offset +=
+         num_vertices * state->stride[ob] * sizeof(float);
+
    so->emitted_vertices += num_vertices;
    ++so->emitted_primitives;
 }
@@ -240,6 +389,8 @@ void draw_pt_so_emit( struct pt_so_emit *emit,
       }
    }
 
+   so_flush(emit);
+
    render->set_stream_output_info(render,
                                   emit->emitted_primitives,
                                   emit->emitted_vertices,
@@ -255,10 +406,17 @@ struct pt_so_emit *draw_pt_so_emit_create( struct draw_context *draw )
 
    emit->draw = draw;
 
+   emit->cache = translate_cache_create();
+   if (!emit->cache) {
+      FREE(emit);
+      return NULL;
+   }
+
    return emit;
 }
 
 void draw_pt_so_emit_destroy( struct pt_so_emit *emit )
 {
+   translate_cache_destroy(emit->cache);
    FREE(emit);
 }
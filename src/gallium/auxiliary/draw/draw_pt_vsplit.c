@@ -30,9 +30,11 @@
 #include "draw/draw_context.h"
 #include "draw/draw_private.h"
 #include "draw/draw_pt.h"
+#include "draw/draw_vbuf.h"
 
-#define SEGMENT_SIZE 1024
-#define MAP_SIZE     256
+#define SEGMENT_SIZE 4096
+#define MAP_SETS     256
+#define MAP_WAYS     4
 
 struct vsplit_frontend {
    struct draw_pt_front_end base;
@@ -51,10 +53,13 @@ struct vsplit_frontend {
    ushort identity_draw_elts[SEGMENT_SIZE];
 
    struct {
-      /* map a fetch element to a draw element */
-      unsigned fetches[MAP_SIZE];
-      ushort draws[MAP_SIZE];
-      boolean has_max_fetch;
+      /*
+       * Map a fetch element to a draw element, 4-way set associative,
+       * most recently added first.  An entry is valid only if it refers
+       * to one of the segment's fetch elements, with the right value, so
+       * the map needn't be cleared for each segment.
+       */
+      ushort draws[MAP_SETS][MAP_WAYS];
 
       ushort num_fetch_elts;
       ushort num_draw_elts;
@@ -65,8 +70,6 @@ struct vsplit_frontend {
 static void
 vsplit_clear_cache(struct vsplit_frontend *vsplit)
 {
-   memset(vsplit->cache.fetches, 0xff, sizeof(vsplit->cache.fetches));
-   vsplit->cache.has_max_fetch = FALSE;
    vsplit->cache.num_fetch_elts = 0;
    vsplit->cache.num_draw_elts = 0;
 }
@@ -86,41 +89,33 @@ static INLINE void
 vsplit_add_cache(struct vsplit_frontend *vsplit, unsigned fetch)
 {
    struct draw_context *draw = vsplit->draw;
-   unsigned hash;
+   ushort *set;
+   ushort elt;
+   unsigned i;
 
    fetch = MIN2(fetch, draw->pt.max_index);
 
-   hash = fetch % MAP_SIZE;
+   set = vsplit->cache.draws[fetch % MAP_SETS];
 
-   if (vsplit->cache.fetches[hash] != fetch) {
-      /* update cache */
-      vsplit->cache.fetches[hash] = fetch;
-      vsplit->cache.draws[hash] = vsplit->cache.num_fetch_elts;
-
-      /* add fetch */
-      assert(vsplit->cache.num_fetch_elts < vsplit->segment_size);
-      vsplit->fetch_elts[vsplit->cache.num_fetch_elts++] = fetch;
+   for (i = 0; i < MAP_WAYS; i++) {
+      elt = set[i];
+      if (elt < vsplit->cache.num_fetch_elts &&
+          vsplit->fetch_elts[elt] == fetch) {
+         vsplit->draw_elts[vsplit->cache.num_draw_elts++] = elt;
+         return;
+      }
    }
 
-   vsplit->draw_elts[vsplit->cache.num_draw_elts++] = vsplit->cache.draws[hash];
-}
+   /* add fetch, evicting the oldest entry of the set */
+   assert(vsplit->cache.num_fetch_elts < vsplit->segment_size);
+   elt = vsplit->cache.num_fetch_elts++;
+   vsplit->fetch_elts[elt] = fetch;
 
+   for (i = MAP_WAYS - 1; i > 0; i--)
+      set[i] = set[i - 1];
+   set[0] = elt;
 
-/**
- * Add a fetch element and add it to the draw elements.  The fetch element is
- * in full range (uint).
- */
-static INLINE void
-vsplit_add_cache_uint(struct vsplit_frontend *vsplit, unsigned fetch)
-{
-   /* special care for 0xffffffff */
-   if (fetch == 0xffffffff && !vsplit->cache.has_max_fetch) {
-      unsigned hash = fetch % MAP_SIZE;
-      vsplit->cache.fetches[hash] = fetch - 1; /* force update */
-      vsplit->cache.has_max_fetch = TRUE;
-   }
-
-   vsplit_add_cache(vsplit, fetch);
+   vsplit->draw_elts[vsplit->cache.num_draw_elts++] = elt;
 }
 
 
@@ -139,7 +134,7 @@ vsplit_add_cache_uint(struct vsplit_frontend *vsplit, unsigned fetch)
 
 #define FUNC vsplit_run_uint
 #define ELT_TYPE uint
-#define ADD_CACHE(vsplit, fetch) vsplit_add_cache_uint(vsplit, fetch)
+#define ADD_CACHE(vsplit, fetch) vsplit_add_cache(vsplit, fetch)
 #include "draw_pt_vsplit_tmp.h"
 
 
@@ -175,6 +170,16 @@ static void vsplit_prepare(struct draw_pt_front_end *frontend,
    middle->prepare(middle, vsplit->prim, opt, &vsplit->max_vertices);
 
    vsplit->segment_size = MIN2(SEGMENT_SIZE, vsplit->max_vertices);
+
+   /* The draw elements of a segment may be emitted with a single
+    * draw_elements() call.  Stay within the back end's limit, unless it
+    * is below the 1024 elements segments have always had.
+    */
+   if (vsplit->draw->render) {
+      vsplit->segment_size = MIN2(vsplit->segment_size,
+                                  MAX2(vsplit->draw->render->max_indices,
+                                       1024));
+   }
 }
 
 
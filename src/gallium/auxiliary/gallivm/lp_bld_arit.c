@@ -151,6 +151,18 @@ lp_build_min_simple(struct lp_build_context *bld,
             intrinsic = "llvm.x86.sse41.pminsd";
          }
       }
+      if (util_cpu_caps.has_avx2 && type.width * type.length > 128) {
+         intr_size = 256;
+         if (type.width == 8) {
+            intrinsic = type.sign ? "llvm.x86.avx2.pmins.b" : "llvm.x86.avx2.pminu.b";
+         }
+         else if (type.width == 16) {
+            intrinsic = type.sign ? "llvm.x86.avx2.pmins.w" : "llvm.x86.avx2.pminu.w";
+         }
+         else if (type.width == 32) {
+            intrinsic = type.sign ? "llvm.x86.avx2.pmins.d" : "llvm.x86.avx2.pminu.d";
+         }
+      }
    } else if (util_cpu_caps.has_altivec) {
      intr_size = 128;
      if (type.width == 8) {
@@ -268,6 +280,18 @@ lp_build_max_simple(struct lp_build_context *bld,
             intrinsic = "llvm.x86.sse41.pmaxsd";
          }
       }
+      if (util_cpu_caps.has_avx2 && type.width * type.length > 128) {
+         intr_size = 256;
+         if (type.width == 8) {
+            intrinsic = type.sign ? "llvm.x86.avx2.pmaxs.b" : "llvm.x86.avx2.pmaxu.b";
+         }
+         else if (type.width == 16) {
+            intrinsic = type.sign ? "llvm.x86.avx2.pmaxs.w" : "llvm.x86.avx2.pmaxu.w";
+         }
+         else if (type.width == 32) {
+            intrinsic = type.sign ? "llvm.x86.avx2.pmaxs.d" : "llvm.x86.avx2.pmaxu.d";
+         }
+      }
    } else if (util_cpu_caps.has_altivec) {
      intr_size = 128;
      if (type.width == 8) {
@@ -381,6 +405,14 @@ lp_build_add(struct lp_build_context *bld,
               intrinsic = type.sign ? "llvm.ppc.altivec.vaddsws" : "llvm.ppc.altivec.vadduws";
          }
       }
+      else if (type.width * type.length == 256 &&
+               !type.floating && !type.fixed &&
+               util_cpu_caps.has_avx2) {
+         if(type.width == 8)
+            intrinsic = type.sign ? "llvm.x86.avx2.padds.b" : "llvm.x86.avx2.paddus.b";
+         if(type.width == 16)
+            intrinsic = type.sign ? "llvm.x86.avx2.padds.w" : "llvm.x86.avx2.paddus.w";
+      }
    
       if(intrinsic)
          return lp_build_intrinsic_binary(builder, intrinsic, lp_build_vec_type(bld->gallivm, bld->type), a, b);
@@ -658,6 +690,14 @@ lp_build_sub(struct lp_build_context *bld,
               intrinsic = type.sign ? "llvm.ppc.altivec.vsubsws" : "llvm.ppc.altivec.vsubuws";
          }
       }
+      else if (type.width * type.length == 256 &&
+               !type.floating && !type.fixed &&
+               util_cpu_caps.has_avx2) {
+         if(type.width == 8)
+            intrinsic = type.sign ? "llvm.x86.avx2.psubs.b" : "llvm.x86.avx2.psubus.b";
+         if(type.width == 16)
+            intrinsic = type.sign ? "llvm.x86.avx2.psubs.w" : "llvm.x86.avx2.psubus.w";
+      }
    
       if(intrinsic)
          return lp_build_intrinsic_binary(builder, intrinsic, lp_build_vec_type(bld->gallivm, bld->type), a, b);
@@ -913,6 +953,53 @@ lp_build_mul_imm(struct lp_build_context *bld,
 }
 
 
+/**
+ * Generate a * b + c.
+ *
+ * Floating point vectors get a fused multiply-add when the CPU has FMA,
+ * which is both faster and more precise.
+ */
+LLVMValueRef
+lp_build_mad(struct lp_build_context *bld,
+             LLVMValueRef a,
+             LLVMValueRef b,
+             LLVMValueRef c)
+{
+   const struct lp_type type = bld->type;
+
+   assert(lp_check_value(type, a));
+   assert(lp_check_value(type, b));
+   assert(lp_check_value(type, c));
+
+   if (type.floating && !type.norm &&
+       (type.width == 32 || type.width == 64) &&
+       util_cpu_caps.has_fma &&
+       a != bld->zero && a != bld->one && a != bld->undef &&
+       b != bld->zero && b != bld->one && b != bld->undef &&
+       c != bld->zero && c != bld->undef &&
+       !(LLVMIsConstant(a) && LLVMIsConstant(b))) {
+      char intrinsic[32];
+      LLVMValueRef args[3];
+
+      if (type.length == 1)
+         util_snprintf(intrinsic, sizeof intrinsic, "llvm.fma.f%u",
+                       type.width);
+      else
+         util_snprintf(intrinsic, sizeof intrinsic, "llvm.fma.v%uf%u",
+                       type.length, type.width);
+
+      args[0] = a;
+      args[1] = b;
+      args[2] = c;
+
+      return lp_build_intrinsic(bld->gallivm->builder, intrinsic,
+                                bld->vec_type, args, Elements(args));
+   }
+
+   return lp_build_add(bld, lp_build_mul(bld, a, b), c);
+}
+
+
 /**
  * Generate a / b
  */
@@ -1007,12 +1094,11 @@ lp_build_lerp_simple(struct lp_build_context *bld,
           */
          res = lp_build_mul_norm(bld->gallivm, bld->type, x, delta);
       }
+      res = lp_build_add(bld, v0, res);
    } else {
-      res = lp_build_mul(bld, x, delta);
+      res = lp_build_mad(bld, x, delta, v0);
    }
 
-   res = lp_build_add(bld, v0, res);
-
    if ((normalized && !bld->type.sign) || bld->type.fixed) {
       /* We need to mask out the high order bits when lerping 8bit normalized colors stored on 16bits */
       /* XXX: This step is necessary for lerping 8bit colors stored on 16bits,
@@ -1221,6 +1307,16 @@ lp_build_abs(struct lp_build_context *bld,
          return lp_build_intrinsic_unary(builder, "llvm.x86.ssse3.pabs.d.128", vec_type, a);
       }
    }
+   else if(type.width*type.length == 256 && util_cpu_caps.has_avx2) {
+      switch(type.width) {
+      case 8:
+         return lp_build_intrinsic_unary(builder, "llvm.x86.avx2.pabs.b", vec_type, a);
+      case 16:
+         return lp_build_intrinsic_unary(builder, "llvm.x86.avx2.pabs.w", vec_type, a);
+      case 32:
+         return lp_build_intrinsic_unary(builder, "llvm.x86.avx2.pabs.d", vec_type, a);
+      }
+   }
    else if (type.width*type.length == 256 && util_cpu_caps.has_ssse3 &&
             (gallivm_debug & GALLIVM_DEBUG_PERF) &&
             (type.width == 8 || type.width == 16 || type.width == 32)) {
@@ -2723,19 +2819,19 @@ lp_build_polynomial(struct lp_build_context *bld,
 
       if (i % 2 == 0) {
          if (even)
-            even = lp_build_add(bld, coeff, lp_build_mul(bld, x2, even));
+            even = lp_build_mad(bld, x2, even, coeff);
          else
             even = coeff;
       } else {
          if (odd)
-            odd = lp_build_add(bld, coeff, lp_build_mul(bld, x2, odd));
+            odd = lp_build_mad(bld, x2, odd, coeff);
          else
             odd = coeff;
       }
    }
 
    if (odd)
-      return lp_build_add(bld, lp_build_mul(bld, odd, x), even);
+      return lp_build_mad(bld, odd, x, even);
    else if (even)
       return even;
    else
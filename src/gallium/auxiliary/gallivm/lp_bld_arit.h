@@ -80,6 +80,12 @@ lp_build_mul_imm(struct lp_build_context *bld,
                  LLVMValueRef a,
                  int b);
 
+LLVMValueRef
+lp_build_mad(struct lp_build_context *bld,
+             LLVMValueRef a,
+             LLVMValueRef b,
+             LLVMValueRef c);
+
 LLVMValueRef
 lp_build_div(struct lp_build_context *bld,
              LLVMValueRef a,
@@ -204,7 +204,7 @@ lp_const_eps(struct lp_type type)
    if (type.floating) {
       switch(type.width) {
       case 16:
-         return 2E-10;
+         return 9.765625E-4; /* 2^-10 */
       case 32:
          return FLT_EPSILON;
       case 64:
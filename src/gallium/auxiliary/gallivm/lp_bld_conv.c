@@ -155,18 +155,14 @@ lp_build_bswap_vec(struct gallivm_state *gallivm,
 
 
 /**
- * Converts int16 half-float to float32
- * Note this can be performed in 1 instruction if vcvtph2ps exists (sse5 i think?)
- * [llvm.x86.vcvtph2ps / _mm_cvtph_ps]
- *
- * @param src           value to convert
+ * Converts int16 half-float to float32 with plain integer/float ops.
  *
  * ref http://fgiesen.wordpress.com/2012/03/28/half-to-float-done-quic/
  * ref https://gist.github.com/2144712
  */
-LLVMValueRef
-lp_build_half_to_float(struct gallivm_state *gallivm,
-                       LLVMValueRef src)
+static LLVMValueRef
+lp_build_half_to_float_soft(struct gallivm_state *gallivm,
+                            LLVMValueRef src)
 {
    int src_length = LLVMGetVectorSize(LLVMTypeOf(src));
 
@@ -214,9 +210,39 @@ lp_build_half_to_float(struct gallivm_state *gallivm,
 }
 
 
+/**
+ * Converts int16 half-float to float32
+ * This is a single vcvtph2ps instruction on CPUs with F16C
+ * [llvm.x86.vcvtph2ps / _mm_cvtph_ps]
+ *
+ * @param src           value to convert
+ */
+LLVMValueRef
+lp_build_half_to_float(struct gallivm_state *gallivm,
+                       LLVMValueRef src)
+{
+   int src_length = LLVMGetVectorSize(LLVMTypeOf(src));
+
+   if (util_cpu_caps.has_f16c &&
+       (src_length == 4 || src_length == 8)) {
+      struct lp_type f32_type = lp_type_float_vec(32, 32 * src_length);
+      const char *intrinsic = src_length == 4 ? "llvm.x86.vcvtph2ps.128"
+                                              : "llvm.x86.vcvtph2ps.256";
+      /* the source is always a full 8 x i16 register */
+      if (src_length == 4)
+         src = lp_build_pad_vector(gallivm, src, 8);
+      return lp_build_intrinsic_unary(gallivm->builder, intrinsic,
+                                      lp_build_vec_type(gallivm, f32_type),
+                                      src);
+   }
+
+   return lp_build_half_to_float_soft(gallivm, src);
+}
+
+
 /**
  * Converts float32 to int16 half-float
- * Note this can be performed in 1 instruction if vcvtps2ph exists (sse5 i think?)
+ * This is a single vcvtps2ph instruction on CPUs with F16C
  * [llvm.x86.vcvtps2ph / _mm_cvtps_ph]
  *
  * @param src           value to convert
@@ -244,6 +270,21 @@ lp_build_float_to_half(struct gallivm_state *gallivm,
    struct lp_build_context u32_bld;
    LLVMValueRef result;
 
+   if (util_cpu_caps.has_f16c &&
+       (length == 4 || length == 8)) {
+      const char *intrinsic = length == 4 ? "llvm.x86.vcvtps2ph.128"
+                                          : "llvm.x86.vcvtps2ph.256";
+      LLVMTypeRef i16x8_type = LLVMVectorType(LLVMInt16TypeInContext(gallivm->context), 8);
+      /* round to nearest even */
+      LLVMValueRef rounding = lp_build_const_int32(gallivm, 0);
+
+      result = lp_build_intrinsic_binary(builder, intrinsic, i16x8_type,
+                                         src, rounding);
+      if (length == 4)
+         result = lp_build_extract_range(gallivm, result, 0, 4);
+      return result;
+   }
+
    lp_build_context_init(&f32_bld, gallivm, f32_type);
    lp_build_context_init(&u32_bld, gallivm, u32_type);
 
@@ -749,6 +790,22 @@ lp_build_conv(struct gallivm_state *gallivm,
          a = lp_build_iround(&bld, a);
          b = lp_build_iround(&bld, b);
 
+         if (util_cpu_caps.has_avx2) {
+            /* pack the whole 8 x i32 vectors at once */
+            struct lp_type int32x8_type = int32_type;
+            struct lp_type int16x16_type = int16_type;
+            LLVMValueRef ab;
+
+            int32x8_type.length *= 2;
+            int16x16_type.length *= 2;
+
+            ab = lp_build_pack2(gallivm, int32x8_type, int16x16_type, a, b);
+            lo = lp_build_extract_range(gallivm, ab, 0, 8);
+            hi = lp_build_extract_range(gallivm, ab, 8, 8);
+            dst[i] = lp_build_pack2(gallivm, int16_type, dst_type, lo, hi);
+            continue;
+         }
+
          tmp[0] = lp_build_extract_range(gallivm, a, 0, 4);
          tmp[1] = lp_build_extract_range(gallivm, a, 4, 4);
          tmp[2] = lp_build_extract_range(gallivm, b, 0, 4);
@@ -32,6 +32,7 @@
 #include "util/u_debug.h"
 #include "util/u_memory.h"
 #include "util/u_simple_list.h"
+#include "os/os_time.h"
 #include "lp_bld.h"
 #include "lp_bld_debug.h"
 #include "lp_bld_misc.h"
@@ -39,6 +40,7 @@
 
 #include <llvm-c/Analysis.h>
 #include <llvm-c/Transforms/Scalar.h>
+#include <llvm-c/BitReader.h>
 #include <llvm-c/BitWriter.h>
 
 
@@ -63,6 +65,12 @@
 #  define HAVE_AVX 0
 #endif
 
+/**
+ * AVX2, FMA3 and F16C code generation is only relied upon from LLVM 3.3,
+ * whose X86 backend knows the full set of their intrinsics.
+ */
+#define HAVE_AVX2 (HAVE_AVX && HAVE_LLVM >= 0x0303)
+
 
 #if USE_MCJIT
 void LLVMLinkInMCJIT();
@@ -115,6 +123,15 @@ enum LLVM_CodeGenOpt_Level {
 };
 
 
+/**
+ * Max number of functions JIT'd from a state shared with
+ * gallivm_batch_get().  The module keeps the declarations of the functions
+ * and the engine the bookkeeping of their code, so batches are retired
+ * after a while, to let their memory be freed once their users are gone.
+ */
+#define GALLIVM_BATCH_MAX_FUNCTIONS 64
+
+
 #if HAVE_LLVM <= 0x0206
 /**
  * LLVM 2.6 permits only one ExecutionEngine to be created.  So use the
@@ -141,7 +158,8 @@ create_pass_manager(struct gallivm_state *gallivm)
 
    LLVMAddTargetData(gallivm->target, gallivm->passmgr);
 
-   if ((gallivm_debug & GALLIVM_DEBUG_NO_OPT) == 0) {
+   if ((gallivm_debug & GALLIVM_DEBUG_NO_OPT) == 0 &&
+       !gallivm->fast_compile) {
       /* These are the passes currently listed in llvm-c/Transforms/Scalar.h,
        * but there are more on SVN.
        * TODO: Add more passes.
@@ -214,6 +232,10 @@ free_gallivm_state(struct gallivm_state *gallivm)
       LLVMDisposeModule(gallivm->module);
    }
 
+   if (gallivm->code_size_listener) {
+      lp_destroy_code_size_jit_event_listener(gallivm->code_size_listener);
+   }
+
 #if !USE_MCJIT
    /* Don't free the TargetData, it's owned by the exec engine */
 #else
@@ -239,6 +261,7 @@ free_gallivm_state(struct gallivm_state *gallivm)
    gallivm->passmgr = NULL;
    gallivm->context = NULL;
    gallivm->builder = NULL;
+   gallivm->code_size_listener = NULL;
 }
 
 
@@ -251,7 +274,8 @@ init_gallivm_engine(struct gallivm_state *gallivm)
       char *error = NULL;
       int ret;
 
-      if (gallivm_debug & GALLIVM_DEBUG_NO_OPT) {
+      if ((gallivm_debug & GALLIVM_DEBUG_NO_OPT) ||
+          gallivm->fast_compile) {
          optlevel = None;
       }
       else {
@@ -277,6 +301,10 @@ init_gallivm_engine(struct gallivm_state *gallivm)
 #if defined(DEBUG) || defined(PROFILE)
       lp_register_oprofile_jit_event_listener(gallivm->engine);
 #endif
+
+      gallivm->code_size_listener =
+         lp_create_code_size_jit_event_listener(gallivm->engine,
+                                                &gallivm->code_size);
    }
 
    LLVMAddModuleProvider(gallivm->engine, gallivm->provider);//new
@@ -328,28 +356,63 @@ fail:
 static LLVMContextRef gallivm_context = NULL;
 
 
+/**
+ * Read a module previously written with gallivm_write_bitcode().
+ */
+static LLVMModuleRef
+read_bitcode(LLVMContextRef context, const char *filename)
+{
+   LLVMMemoryBufferRef buffer;
+   LLVMModuleRef module = NULL;
+   char *error = NULL;
+
+   if (LLVMCreateMemoryBufferWithContentsOfFile(filename, &buffer, &error)) {
+      LLVMDisposeMessage(error);
+      return NULL;
+   }
+
+   if (LLVMParseBitcodeInContext(context, buffer, &module, &error)) {
+      LLVMDisposeMessage(error);
+      module = NULL;
+   }
+
+   LLVMDisposeMemoryBuffer(buffer);
+
+   return module;
+}
+
+
 /**
  * Allocate gallivm LLVM objects.
+ * \param bitcode_filename  start with the module read from this file
+ *                          instead of an empty one, or NULL
  * \return  TRUE for success, FALSE for failure
  */
 static boolean
-init_gallivm_state(struct gallivm_state *gallivm)
+init_gallivm_state(struct gallivm_state *gallivm,
+                   const char *bitcode_filename)
 {
-   assert(!gallivm->context);
    assert(!gallivm->module);
    assert(!gallivm->provider);
 
    lp_build_init();
 
-   if (!gallivm_context) {
-      gallivm_context = LLVMContextCreate();
+   if (!gallivm->context) {
+      if (!gallivm_context) {
+         gallivm_context = LLVMContextCreate();
+      }
+      gallivm->context = gallivm_context;
+      if (!gallivm->context)
+         goto fail;
    }
-   gallivm->context = gallivm_context;
-   if (!gallivm->context)
-      goto fail;
 
-   gallivm->module = LLVMModuleCreateWithNameInContext("gallivm",
-                                                       gallivm->context);
+   if (bitcode_filename) {
+      gallivm->module = read_bitcode(gallivm->context, bitcode_filename);
+   }
+   else {
+      gallivm->module = LLVMModuleCreateWithNameInContext("gallivm",
+                                                          gallivm->context);
+   }
    if (!gallivm->module)
       goto fail;
 
@@ -468,6 +531,15 @@ lp_build_init(void)
       util_cpu_caps.has_avx = 0;
    }
 
+   if (!HAVE_AVX2 || !util_cpu_caps.has_avx) {
+      /* The AVX2, FMA and F16C instructions are all VEX encoded, so they
+       * are hidden along with AVX.
+       */
+      util_cpu_caps.has_avx2 = 0;
+      util_cpu_caps.has_fma = 0;
+      util_cpu_caps.has_f16c = 0;
+   }
+
 #ifdef PIPE_ARCH_PPC_64
    /* Set the NJ bit in VSCR to 0 so denormalized values are handled as
     * specified by IEEE standard (PowerISA 2.06 - Section 6.3). This garantees
@@ -495,6 +567,9 @@ lp_build_init(void)
    util_cpu_caps.has_ssse3 = 0;
    util_cpu_caps.has_sse4_1 = 0;
    util_cpu_caps.has_avx = 0;
+   util_cpu_caps.has_avx2 = 0;
+   util_cpu_caps.has_fma = 0;
+   util_cpu_caps.has_f16c = 0;
 #endif
 }
 
@@ -517,7 +592,8 @@ gallivm_create(void)
 
    gallivm = CALLOC_STRUCT(gallivm_state);
    if (gallivm) {
-      if (!init_gallivm_state(gallivm)) {
+      gallivm->refcount = 1;
+      if (!init_gallivm_state(gallivm, NULL)) {
          FREE(gallivm);
          gallivm = NULL;
       }
@@ -532,7 +608,89 @@ gallivm_create(void)
 
 
 /**
- * Destroy a gallivm_state object.
+ * Create a new gallivm_state object, with more control than
+ * gallivm_create().
+ *
+ * \param context  LLVM context to use instead of the shared one, or NULL.
+ *                 LLVM contexts aren't thread safe, so states used by
+ *                 different threads at the same time need different
+ *                 contexts.  Like the shared one, the context must never
+ *                 be freed.
+ * \param fast_compile  only run the IR passes the backends need and
+ *                 generate code at -O0, for code needed right away.
+ */
+struct gallivm_state *
+gallivm_create_ext(LLVMContextRef context, boolean fast_compile)
+{
+#if HAVE_LLVM <= 0x206
+   (void) context;
+   (void) fast_compile;
+   return gallivm_create();
+#else
+   struct gallivm_state *gallivm;
+
+   gallivm = CALLOC_STRUCT(gallivm_state);
+   if (gallivm) {
+      gallivm->refcount = 1;
+      gallivm->context = context;
+      gallivm->fast_compile = fast_compile;
+      if (!init_gallivm_state(gallivm, NULL)) {
+         FREE(gallivm);
+         gallivm = NULL;
+      }
+   }
+
+   return gallivm;
+#endif
+}
+
+
+/**
+ * Create a new gallivm_state object whose module is read from a bitcode
+ * file written by gallivm_write_bitcode().  The functions in it have
+ * already been optimized, so they only need to be compiled.
+ * \return NULL if the file can't be read.
+ */
+struct gallivm_state *
+gallivm_create_from_bitcode(const char *filename)
+{
+#if HAVE_LLVM <= 0x206
+   /* The singleton's module can't be replaced */
+   (void) filename;
+   return NULL;
+#else
+   struct gallivm_state *gallivm;
+
+   gallivm = CALLOC_STRUCT(gallivm_state);
+   if (gallivm) {
+      gallivm->refcount = 1;
+      if (!init_gallivm_state(gallivm, filename)) {
+         FREE(gallivm);
+         gallivm = NULL;
+      }
+   }
+
+   return gallivm;
+#endif
+}
+
+
+/**
+ * Save the (optimized, not yet compiled) module to a bitcode file.
+ */
+boolean
+gallivm_write_bitcode(struct gallivm_state *gallivm,
+                      const char *filename)
+{
+   assert(!gallivm->uses_host_pointers);
+
+   return LLVMWriteBitcodeToFile(gallivm->module, filename) == 0;
+}
+
+
+/**
+ * Destroy a gallivm_state object, or drop a reference to it if it's
+ * shared, see gallivm_batch_get().
  */
 void
 gallivm_destroy(struct gallivm_state *gallivm)
@@ -541,12 +699,70 @@ gallivm_destroy(struct gallivm_state *gallivm)
    /* No-op: don't destroy the singleton */
    (void) gallivm;
 #else
+   assert(gallivm->refcount);
+   if (--gallivm->refcount)
+      return;
+
    free_gallivm_state(gallivm);
    FREE(gallivm);
 #endif
 }
 
 
+/**
+ * Whether more functions can be built in the module of a state.
+ * MC-JIT compiles the whole module at once, so nothing can be added to it
+ * once it is compiled.
+ */
+static boolean
+gallivm_can_add_functions(const struct gallivm_state *gallivm)
+{
+   if (USE_MCJIT && gallivm->compiled)
+      return FALSE;
+
+   return gallivm->num_functions < GALLIVM_BATCH_MAX_FUNCTIONS;
+}
+
+
+/**
+ * Get a state to build functions in, shared with the other users of
+ * 'batch', instead of creating one per function or group of functions.
+ * All of them then share a single module, pass manager and execution
+ * engine, whose setup cost and memory are paid once per batch.
+ *
+ * The functions must be built, compiled and JIT'd by one user at a time,
+ * from a single thread, and each user must free its functions with
+ * gallivm_free_function() and release the state with gallivm_destroy().
+ *
+ * \param batch  the current shared state, NULL at first.  It holds a
+ *               reference of its own, to be dropped with gallivm_destroy()
+ *               when done with the batch.
+ */
+struct gallivm_state *
+gallivm_batch_get(struct gallivm_state **batch)
+{
+#if HAVE_LLVM <= 0x0206
+   /* Everything is shared already */
+   (void) batch;
+   return gallivm_create();
+#else
+   if (*batch && !gallivm_can_add_functions(*batch)) {
+      gallivm_destroy(*batch);
+      *batch = NULL;
+   }
+
+   if (!*batch) {
+      *batch = gallivm_create();
+      if (!*batch)
+         return NULL;
+   }
+
+   (*batch)->refcount++;
+   return *batch;
+#endif
+}
+
+
 /**
  * Validate and optimze a function.
  */
@@ -580,6 +796,13 @@ void
 gallivm_verify_function(struct gallivm_state *gallivm,
                         LLVMValueRef func)
 {
+   int64_t t0, t1;
+
+   t0 = os_time_get();
+   if (gallivm->build_start) {
+      gallivm->stats.build_time += t0 - gallivm->build_start;
+   }
+
    /* Verify the LLVM IR.  If invalid, dump and abort */
 #ifdef DEBUG
    if (LLVMVerifyFunction(func, LLVMPrintMessageAction)) {
@@ -591,18 +814,28 @@ gallivm_verify_function(struct gallivm_state *gallivm,
 
    gallivm_optimize_function(gallivm, func);
 
+   t1 = os_time_get();
+   gallivm->stats.opt_time += t1 - t0;
+
    if (gallivm_debug & GALLIVM_DEBUG_IR) {
       /* Print the LLVM IR to stderr */
       lp_debug_dump_value(func);
       debug_printf("\n");
    }
+
+   /* The next function, if any, is built from now on */
+   gallivm->build_start = os_time_get();
 }
 
 
+/**
+ * Make the functions built so far ready to be JIT'd.  With states shared
+ * by several users, each user calls this after building its functions.
+ */
 void
 gallivm_compile_module(struct gallivm_state *gallivm)
 {
-#if HAVE_LLVM > 0x206
+#if USE_MCJIT
    assert(!gallivm->compiled);
 #endif
 
@@ -614,9 +847,16 @@ gallivm_compile_module(struct gallivm_state *gallivm)
    }
 
 #if USE_MCJIT
-   assert(!gallivm->engine);
-   if (!init_gallivm_engine(gallivm)) {
-      assert(0);
+   {
+      int64_t t0 = os_time_get();
+
+      assert(!gallivm->engine);
+      if (!init_gallivm_engine(gallivm)) {
+         assert(0);
+      }
+
+      /* MC-JIT generates the code of the whole module here */
+      gallivm->stats.codegen_time += os_time_get() - t0;
    }
 #endif
    assert(gallivm->engine);
@@ -631,14 +871,30 @@ gallivm_jit_function(struct gallivm_state *gallivm,
 {
    void *code;
    func_pointer jit_func;
+   int64_t t0;
 
    assert(gallivm->compiled);
    assert(gallivm->engine);
 
+   /* The JIT generates the code of the function here */
+   gallivm->code_size = 0;
+   t0 = os_time_get();
+
    code = LLVMGetPointerToGlobal(gallivm->engine, func);
    assert(code);
    jit_func = pointer_to_func(code);
 
+   gallivm->stats.codegen_time += os_time_get() - t0;
+   gallivm->stats.code_size = gallivm->code_size;
+   gallivm->stats.num_functions = 1;
+   gallivm_stats_add(&gallivm->stats);
+
+   /* Don't count the times twice, should the shader have more functions */
+   gallivm->stats.build_time = 0;
+   gallivm->stats.opt_time = 0;
+   gallivm->stats.codegen_time = 0;
+   gallivm->build_start = 0;
+
    if (gallivm_debug & GALLIVM_DEBUG_ASM) {
       lp_disassemble(code);
    }
@@ -646,6 +902,8 @@ gallivm_jit_function(struct gallivm_state *gallivm,
    /* Free the function body to save memory */
    lp_func_delete_body(func);
 
+   ++gallivm->num_functions;
+
    return jit_func;
 }
 
@@ -33,6 +33,7 @@
 #include "pipe/p_compiler.h"
 #include "util/u_pointer.h" // for func_pointer
 #include "lp_bld.h"
+#include "lp_bld_stats.h"
 #include <llvm-c/ExecutionEngine.h>
 
 
@@ -46,6 +47,20 @@ struct gallivm_state
    LLVMContextRef context;
    LLVMBuilderRef builder;
    unsigned compiled;
+   /** The IR embeds addresses of this process, so it can't be saved */
+   boolean uses_host_pointers;
+   /** Quick to compile rather than quick to run, see gallivm_create_ext() */
+   boolean fast_compile;
+   /** Number of users, see gallivm_batch_get() */
+   unsigned refcount;
+   /** Number of functions JIT'd from the module so far */
+   unsigned num_functions;
+
+   /** Statistics of the functions being compiled, see gallivm_stats_begin() */
+   struct gallivm_shader_stats stats;
+   int64_t build_start;         /**< when the current function was started */
+   size_t code_size;            /**< code emitted, see code_size_listener */
+   void *code_size_listener;
 };
 
 
@@ -56,9 +71,22 @@ lp_build_init(void);
 struct gallivm_state *
 gallivm_create(void);
 
+struct gallivm_state *
+gallivm_create_ext(LLVMContextRef context, boolean fast_compile);
+
+struct gallivm_state *
+gallivm_create_from_bitcode(const char *filename);
+
+boolean
+gallivm_write_bitcode(struct gallivm_state *gallivm,
+                      const char *filename);
+
 void
 gallivm_destroy(struct gallivm_state *gallivm);
 
+struct gallivm_state *
+gallivm_batch_get(struct gallivm_state **batch);
+
 
 void
 gallivm_verify_function(struct gallivm_state *gallivm,
@@ -53,6 +53,7 @@
 #endif
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/PrettyStackTrace.h>
+#include <llvm/Support/Threading.h>
 
 #if HAVE_LLVM >= 0x0300
 #include <llvm/Support/TargetSelect.h>
@@ -89,6 +90,59 @@ lp_register_oprofile_jit_event_listener(LLVMExecutionEngineRef EE)
 }
 
 
+#if HAVE_LLVM >= 0x0207
+namespace {
+
+/**
+ * Adds up the size of the machine code of the functions emitted by the
+ * JIT.  MC-JIT emits whole objects instead, which aren't accounted for.
+ */
+class CodeSizeJITEventListener : public llvm::JITEventListener {
+public:
+   CodeSizeJITEventListener(size_t *size) : Size(size) {}
+
+   virtual void NotifyFunctionEmitted(const llvm::Function &F,
+                                      void *Code, size_t CodeSize,
+                                      const EmittedFunctionDetails &Details)
+   {
+      *Size += CodeSize;
+   }
+
+private:
+   size_t *Size;
+};
+
+}
+#endif
+
+
+/**
+ * Register a listener adding the size of the code the engine emits to
+ * *size.  It must be destroyed after the engine.
+ */
+extern "C" void *
+lp_create_code_size_jit_event_listener(LLVMExecutionEngineRef EE,
+                                       size_t *size)
+{
+#if HAVE_LLVM >= 0x0207
+   CodeSizeJITEventListener *listener = new CodeSizeJITEventListener(size);
+   llvm::unwrap(EE)->RegisterJITEventListener(listener);
+   return listener;
+#else
+   return NULL;
+#endif
+}
+
+
+extern "C" void
+lp_destroy_code_size_jit_event_listener(void *listener)
+{
+#if HAVE_LLVM >= 0x0207
+   delete static_cast<CodeSizeJITEventListener *>(listener);
+#endif
+}
+
+
 extern "C" void
 lp_set_target_options(void)
 {
@@ -195,6 +249,21 @@ lp_set_target_options(void)
 }
 
 
+/**
+ * Make LLVM safe to use from several threads at once, each with its own
+ * LLVMContext.  Must be called before the threads start using LLVM.
+ */
+extern "C" boolean
+lp_build_start_multithreaded(void)
+{
+#if HAVE_LLVM >= 0x0305
+   return llvm::llvm_is_multithreaded();
+#else
+   return llvm::llvm_start_multithreaded();
+#endif
+}
+
+
 extern "C" void
 lp_func_delete_body(LLVMValueRef FF)
 {
@@ -282,7 +351,7 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
        builder.setUseMCJIT(true);
    }
 
-   llvm::SmallVector<std::string, 1> MAttrs;
+   llvm::SmallVector<std::string, 4> MAttrs;
    if (util_cpu_caps.has_avx) {
       /*
        * AVX feature is not automatically detected from CPUID by the X86 target
@@ -291,6 +360,16 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
        * add set this attribute.
        */
       MAttrs.push_back("+avx");
+      /*
+       * Same for the extensions built on it.  lp_build_init() hides them
+       * when the LLVM version can't be relied on to generate them.
+       */
+      if (util_cpu_caps.has_avx2)
+         MAttrs.push_back("+avx2");
+      if (util_cpu_caps.has_fma)
+         MAttrs.push_back("+fma");
+      if (util_cpu_caps.has_f16c)
+         MAttrs.push_back("+f16c");
       builder.setMAttrs(MAttrs);
    }
    builder.setJITMemoryManager(JITMemoryManager::CreateDefaultMemManager());
@@ -43,9 +43,19 @@ extern "C" {
 extern void
 lp_register_oprofile_jit_event_listener(LLVMExecutionEngineRef EE);
 
+extern void *
+lp_create_code_size_jit_event_listener(LLVMExecutionEngineRef EE,
+                                       size_t *size);
+
+extern void
+lp_destroy_code_size_jit_event_listener(void *listener);
+
 extern void
 lp_set_target_options(void);
 
+extern boolean
+lp_build_start_multithreaded(void);
+
 
 extern void
 lp_func_delete_body(LLVMValueRef func);
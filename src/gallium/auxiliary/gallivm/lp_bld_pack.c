@@ -438,6 +438,35 @@ lp_build_pack2(struct gallivm_state *gallivm,
    assert(src_type.length * 2 == dst_type.length);
 
    /* Check for special cases first */
+   if (util_cpu_caps.has_avx2 &&
+       src_type.width * src_type.length == 256 &&
+       (src_type.width == 32 || src_type.width == 16)) {
+      const char *intrinsic;
+      LLVMTypeRef intr_vec_type = lp_build_vec_type(gallivm, intr_type);
+      LLVMTypeRef i64x4_type = LLVMVectorType(LLVMInt64TypeInContext(gallivm->context), 4);
+      LLVMValueRef elems[4];
+
+      if (src_type.width == 32)
+         intrinsic = dst_type.sign ? "llvm.x86.avx2.packssdw" : "llvm.x86.avx2.packusdw";
+      else
+         intrinsic = dst_type.sign ? "llvm.x86.avx2.packsswb" : "llvm.x86.avx2.packuswb";
+
+      /*
+       * The 256-bit packs work within each 128-bit lane, giving
+       * l0 l1 h0 h1 in 64-bit units, which one cross-lane permute
+       * puts back in order.
+       */
+      res = lp_build_intrinsic_binary(builder, intrinsic, intr_vec_type, lo, hi);
+      res = LLVMBuildBitCast(builder, res, i64x4_type, "");
+      elems[0] = lp_build_const_int32(gallivm, 0);
+      elems[1] = lp_build_const_int32(gallivm, 2);
+      elems[2] = lp_build_const_int32(gallivm, 1);
+      elems[3] = lp_build_const_int32(gallivm, 3);
+      res = LLVMBuildShuffleVector(builder, res, LLVMGetUndef(i64x4_type),
+                                   LLVMConstVector(elems, 4), "");
+      return LLVMBuildBitCast(builder, res, dst_vec_type, "");
+   }
+
    if((util_cpu_caps.has_sse2 || util_cpu_caps.has_altivec) &&
        src_type.width * src_type.length >= 128) {
       const char *intrinsic = NULL;
@@ -53,6 +53,12 @@
  */
 #define BRILINEAR_FACTOR 2
 
+/*
+ * Sample budget of anisotropic filtering.  The samplers' max_anisotropy is
+ * clamped to it, which makes the filtering cheaper, and blurrier.
+ */
+DEBUG_GET_ONCE_NUM_OPTION(max_anisotropy, "LP_MAX_ANISOTROPY", LP_MAX_ANISOTROPY)
+
 /**
  * Does the given texture wrap mode allow sampling the texture border color?
  * XXX maybe move this into gallium util code.
@@ -168,12 +174,48 @@ lp_sampler_static_state(struct lp_sampler_static_state *state,
 
    state->normalized_coords = sampler->normalized_coords;
 
+   /*
+    * Anisotropic filtering is only done for mipmapped 2D textures, where
+    * the footprint is stretched along one axis.
+    */
+   if (sampler->max_anisotropy > 1 &&
+       state->min_mip_filter != PIPE_TEX_MIPFILTER_NONE &&
+       !state->min_max_lod_equal &&
+       (texture->target == PIPE_TEXTURE_2D ||
+        texture->target == PIPE_TEXTURE_2D_ARRAY)) {
+      long max_aniso = MIN3((long)sampler->max_anisotropy,
+                            debug_get_option_max_anisotropy(),
+                            LP_MAX_ANISOTROPY);
+      if (max_aniso > 1) {
+         state->max_aniso = max_aniso;
+      }
+   }
+
    /*
     * FIXME: Handle the remainder of pipe_sampler_view.
     */
 }
 
 
+/**
+ * Size of the texture's base level, as a float (vector).
+ */
+static LLVMValueRef
+lp_build_base_level_size(struct lp_build_sample_context *bld,
+                         unsigned unit)
+{
+   struct lp_build_context *int_size_bld = &bld->int_size_in_bld;
+   LLVMValueRef first_level, first_level_vec;
+   LLVMValueRef int_size;
+
+   first_level = bld->dynamic_state->first_level(bld->dynamic_state,
+                                                 bld->gallivm, unit);
+   first_level_vec = lp_build_broadcast_scalar(int_size_bld, first_level);
+   int_size = lp_build_minify(int_size_bld, bld->int_size, first_level_vec);
+   return lp_build_int_to_float(&bld->float_size_in_bld, int_size);
+}
+
+
 /**
  * Generate code to compute coordinate gradient (rho).
  * \param derivs  partial derivatives of (s, t, r, q) with respect to X and Y
@@ -186,7 +228,6 @@ lp_build_rho(struct lp_build_sample_context *bld,
              const struct lp_derivatives *derivs)
 {
    struct gallivm_state *gallivm = bld->gallivm;
-   struct lp_build_context *int_size_bld = &bld->int_size_in_bld;
    struct lp_build_context *float_size_bld = &bld->float_size_in_bld;
    struct lp_build_context *float_bld = &bld->float_bld;
    struct lp_build_context *coord_bld = &bld->coord_bld;
@@ -199,9 +240,8 @@ lp_build_rho(struct lp_build_sample_context *bld,
    LLVMValueRef index1 = LLVMConstInt(i32t, 1, 0);
    LLVMValueRef index2 = LLVMConstInt(i32t, 2, 0);
    LLVMValueRef rho_vec;
-   LLVMValueRef int_size, float_size;
+   LLVMValueRef float_size;
    LLVMValueRef rho;
-   LLVMValueRef first_level, first_level_vec;
    LLVMValueRef abs_ddx_ddy[2];
    unsigned length = coord_bld->type.length;
    unsigned num_quads = length / 4;
@@ -263,11 +303,7 @@ lp_build_rho(struct lp_build_sample_context *bld,
 
    rho_vec = lp_build_max(coord_bld, rho_xvec, rho_yvec);
 
-   first_level = bld->dynamic_state->first_level(bld->dynamic_state,
-                                                 bld->gallivm, unit);
-   first_level_vec = lp_build_broadcast_scalar(int_size_bld, first_level);
-   int_size = lp_build_minify(int_size_bld, bld->int_size, first_level_vec);
-   float_size = lp_build_int_to_float(float_size_bld, int_size);
+   float_size = lp_build_base_level_size(bld, unit);
 
    if (bld->coord_type.length > 4) {
       /* expand size to each quad */
@@ -348,6 +384,111 @@ lp_build_rho(struct lp_build_sample_context *bld,
 }
 
 
+/**
+ * Generate code to compute the anisotropic footprint of a 2D texture,
+ * following EXT_texture_filter_anisotropic:
+ *
+ *   Px = |(ds/dx, dt/dx)|, Py = |(ds/dy, dt/dy)|  (in texels)
+ *   N = min(ceil(Pmax/Pmin), max_aniso)
+ *   rho = Pmax/N
+ *
+ * N is kept at one for magnified quads, so only quads which are actually
+ * minified anisotropically take more than one sample.
+ *
+ * The resulting rho is scalar per quad.  The number of samples and the
+ * major axis are returned in 'aniso', as coord vectors.
+ */
+static LLVMValueRef
+lp_build_aniso_rho(struct lp_build_sample_context *bld,
+                   unsigned unit,
+                   const struct lp_derivatives *derivs,
+                   struct lp_aniso_footprint *aniso)
+{
+   struct gallivm_state *gallivm = bld->gallivm;
+   struct lp_build_context *coord_bld = &bld->coord_bld;
+   struct lp_build_context *int_coord_bld = &bld->int_coord_bld;
+   /* ds/dx, ds/dy, dt/dx, dt/dy for each quad */
+   LLVMValueRef ddx_ddy = derivs->ddx_ddy[0];
+   static const unsigned char swizzle_wwhh[] = { 0, 0, 1, 1 };
+   static const unsigned char swizzle_lo[] = {
+      0, 1, LP_BLD_SWIZZLE_DONTCARE, LP_BLD_SWIZZLE_DONTCARE
+   };
+   static const unsigned char swizzle_hi[] = {
+      2, 3, LP_BLD_SWIZZLE_DONTCARE, LP_BLD_SWIZZLE_DONTCARE
+   };
+   static const unsigned char swizzle_dx[] = {
+      0, 2, LP_BLD_SWIZZLE_DONTCARE, LP_BLD_SWIZZLE_DONTCARE
+   };
+   static const unsigned char swizzle_dy[] = {
+      1, 3, LP_BLD_SWIZZLE_DONTCARE, LP_BLD_SWIZZLE_DONTCARE
+   };
+   static const unsigned char swizzle_x[] = { 0, 0, 0, 0 };
+   static const unsigned char swizzle_y[] = { 1, 1, 1, 1 };
+   unsigned num_quads = coord_bld->type.length / 4;
+   LLVMValueRef float_size, texel_derivs, len, px, py;
+   LLVMValueRef pmax, pmin, x_major, ratio, num_samples, axis, rho;
+
+   assert(bld->dims == 2);
+
+   float_size = lp_build_base_level_size(bld, unit);
+   if (num_quads > 1) {
+      LLVMValueRef src[LP_MAX_VECTOR_LENGTH/4];
+      unsigned i;
+      for (i = 0; i < num_quads; i++) {
+         src[i] = float_size;
+      }
+      float_size = lp_build_concat(gallivm, src, bld->float_size_in_bld.type,
+                                   num_quads);
+   }
+   float_size = lp_build_swizzle_aos(coord_bld, float_size, swizzle_wwhh);
+
+   /* lengths of the x and y derivatives, in texels */
+   texel_derivs = lp_build_mul(coord_bld, ddx_ddy, float_size);
+   texel_derivs = lp_build_mul(coord_bld, texel_derivs, texel_derivs);
+   len = lp_build_add(coord_bld,
+                      lp_build_swizzle_aos(coord_bld, texel_derivs, swizzle_lo),
+                      lp_build_swizzle_aos(coord_bld, texel_derivs, swizzle_hi));
+   len = lp_build_sqrt(coord_bld, len);
+   px = lp_build_swizzle_aos(coord_bld, len, swizzle_x);
+   py = lp_build_swizzle_aos(coord_bld, len, swizzle_y);
+
+   pmax = lp_build_max(coord_bld, px, py);
+   pmin = lp_build_min(coord_bld, px, py);
+   x_major = lp_build_compare(gallivm, coord_bld->type, PIPE_FUNC_GEQUAL,
+                              px, py);
+
+   /*
+    * N = ceil(min(Pmax/Pmin, max_aniso, max(Pmax, 1))).  Pmin is kept away
+    * from zero, so degenerate footprints just get the most samples.
+    */
+   pmin = lp_build_max(coord_bld, pmin,
+                       lp_build_const_vec(gallivm, coord_bld->type, 1.0/1024));
+   ratio = lp_build_div(coord_bld, pmax, pmin);
+   ratio = lp_build_min(coord_bld, ratio,
+                        lp_build_const_vec(gallivm, coord_bld->type,
+                                           bld->static_state->max_aniso));
+   ratio = lp_build_min(coord_bld, ratio,
+                        lp_build_max(coord_bld, pmax, coord_bld->one));
+   num_samples = lp_build_iceil(coord_bld, ratio);
+   num_samples = lp_build_max(int_coord_bld, num_samples, int_coord_bld->one);
+   num_samples = lp_build_int_to_float(coord_bld, num_samples);
+
+   /* the major axis, in normalized texture coords */
+   axis = lp_build_select(coord_bld, x_major,
+                          lp_build_swizzle_aos(coord_bld, ddx_ddy, swizzle_dx),
+                          lp_build_swizzle_aos(coord_bld, ddx_ddy, swizzle_dy));
+
+   aniso->num_samples = num_samples;
+   aniso->axis_s = lp_build_swizzle_aos(coord_bld, axis, swizzle_x);
+   aniso->axis_t = lp_build_swizzle_aos(coord_bld, axis, swizzle_y);
+
+   rho = lp_build_div(coord_bld, pmax, num_samples);
+
+   return lp_build_pack_aos_scalars(gallivm, coord_bld->type,
+                                    bld->perquadf_bld.type, rho, 0);
+}
+
+
 /*
  * Bri-linear lod computation
  *
@@ -483,6 +624,9 @@ lp_build_brilinear_rho(struct lp_build_context *bld,
  * \param width  scalar int texture width
  * \param height  scalar int texture height
  * \param depth  scalar int texture depth
+ * \param aniso  optional, returns the anisotropic footprint when the lod
+ *               is computed from the derivatives of a sampler with
+ *               max_aniso set, otherwise its num_samples is NULL
  *
  * The resulting lod is scalar per quad, so only the first value per quad
  * passed in from lod_bias, explicit_lod is used.
@@ -494,6 +638,7 @@ lp_build_lod_selector(struct lp_build_sample_context *bld,
                       LLVMValueRef lod_bias, /* optional */
                       LLVMValueRef explicit_lod, /* optional */
                       unsigned mip_filter,
+                      struct lp_aniso_footprint *aniso, /* optional */
                       LLVMValueRef *out_lod_ipart,
                       LLVMValueRef *out_lod_fpart)
 
@@ -505,6 +650,10 @@ lp_build_lod_selector(struct lp_build_sample_context *bld,
    *out_lod_ipart = bld->perquadi_bld.zero;
    *out_lod_fpart = perquadf_bld->zero;
 
+   if (aniso) {
+      memset(aniso, 0, sizeof *aniso);
+   }
+
    if (bld->static_state->min_max_lod_equal) {
       /* User is forcing sampling from a particular mipmap level.
        * This is hit during mipmap generation.
@@ -522,7 +671,12 @@ lp_build_lod_selector(struct lp_build_sample_context *bld,
       else {
          LLVMValueRef rho;
 
-         rho = lp_build_rho(bld, unit, derivs);
+         if (aniso && bld->static_state->max_aniso) {
+            rho = lp_build_aniso_rho(bld, unit, derivs, aniso);
+         }
+         else {
+            rho = lp_build_rho(bld, unit, derivs);
+         }
 
          /*
           * Compute lod = log2(rho)
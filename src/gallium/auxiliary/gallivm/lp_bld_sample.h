@@ -60,6 +60,22 @@ struct lp_derivatives
 };
 
 
+/** Most samples taken for one anisotropic texture lookup */
+#define LP_MAX_ANISOTROPY 16
+
+
+/**
+ * Anisotropic filtering footprint, see lp_build_lod_selector().
+ * These are coord vectors, with the same value for all pixels of a quad.
+ */
+struct lp_aniso_footprint
+{
+   LLVMValueRef num_samples;  /**< float, NULL if filtering isotropically */
+   LLVMValueRef axis_s;       /**< major axis, in texture coords */
+   LLVMValueRef axis_t;
+};
+
+
 /**
  * Sampler static state.
  *
@@ -95,6 +111,7 @@ struct lp_sampler_static_state
    unsigned lod_bias_non_zero:1;
    unsigned apply_min_lod:1;  /**< min_lod > 0 ? */
    unsigned apply_max_lod:1;  /**< max_lod < last_level ? */
+   unsigned max_aniso:5;      /**< max anisotropic samples, 0 if disabled */
 
    /* Hacks */
    unsigned force_nearest_s:1;
@@ -350,6 +367,7 @@ lp_build_lod_selector(struct lp_build_sample_context *bld,
                       LLVMValueRef lod_bias, /* optional */
                       LLVMValueRef explicit_lod, /* optional */
                       unsigned mip_filter,
+                      struct lp_aniso_footprint *aniso, /* optional */
                       LLVMValueRef *out_lod_ipart,
                       LLVMValueRef *out_lod_fpart);
 
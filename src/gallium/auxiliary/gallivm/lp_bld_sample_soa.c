@@ -974,6 +974,93 @@ lp_build_sample_mipmap(struct lp_build_sample_context *bld,
 }
 
 
+/**
+ * Sample the texture like lp_build_sample_mipmap(), but average
+ * aniso->num_samples samples spread along the major axis of the footprint.
+ * The loop runs as many times as the most anisotropic quad needs, quads
+ * which need fewer samples ignore the extra ones.
+ */
+static void
+lp_build_sample_aniso(struct lp_build_sample_context *bld,
+                      unsigned unit,
+                      unsigned img_filter,
+                      unsigned mip_filter,
+                      LLVMValueRef s,
+                      LLVMValueRef t,
+                      LLVMValueRef r,
+                      LLVMValueRef ilevel0,
+                      LLVMValueRef ilevel1,
+                      LLVMValueRef lod_fpart,
+                      const struct lp_aniso_footprint *aniso,
+                      LLVMValueRef *colors_out)
+{
+   struct gallivm_state *gallivm = bld->gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *coord_bld = &bld->coord_bld;
+   struct lp_build_context *texel_bld = &bld->texel_bld;
+   LLVMValueRef num_samples = aniso->num_samples;
+   LLVMValueRef max_samples = NULL;
+   LLVMValueRef rcp_num_samples, half;
+   LLVMValueRef colors[4];
+   struct lp_build_loop_state loop_state;
+   unsigned chan, i;
+
+   for (chan = 0; chan < 4; chan++) {
+      colors[chan] = lp_build_alloca(gallivm, texel_bld->vec_type, "");
+      LLVMBuildStore(builder, texel_bld->zero, colors_out[chan]);
+   }
+
+   for (i = 0; i < coord_bld->type.length; i += 4) {
+      LLVMValueRef n = LLVMBuildExtractElement(builder, num_samples,
+                                               lp_build_const_int32(gallivm, i), "");
+      max_samples = max_samples ? lp_build_max(&bld->float_bld, max_samples, n) : n;
+   }
+   max_samples = LLVMBuildFPToSI(builder, max_samples, bld->int_bld.vec_type, "");
+
+   rcp_num_samples = lp_build_div(coord_bld, coord_bld->one, num_samples);
+   half = lp_build_const_vec(gallivm, coord_bld->type, 0.5);
+
+   lp_build_loop_begin(&loop_state, gallivm, lp_build_const_int32(gallivm, 0));
+   {
+      LLVMValueRef index, offset, active, s_i, t_i;
+
+      index = LLVMBuildSIToFP(builder, loop_state.counter,
+                              bld->float_bld.vec_type, "");
+      index = lp_build_broadcast_scalar(coord_bld, index);
+      active = lp_build_compare(gallivm, coord_bld->type, PIPE_FUNC_LESS,
+                                index, num_samples);
+
+      /* sample i is at (i + 0.5)/n - 0.5 along the axis */
+      offset = lp_build_add(coord_bld, index, half);
+      offset = lp_build_mul(coord_bld, offset, rcp_num_samples);
+      offset = lp_build_sub(coord_bld, offset, half);
+      s_i = lp_build_mad(coord_bld, aniso->axis_s, offset, s);
+      t_i = lp_build_mad(coord_bld, aniso->axis_t, offset, t);
+
+      lp_build_sample_mipmap(bld, unit,
+                             img_filter, mip_filter,
+                             s_i, t_i, r,
+                             ilevel0, ilevel1, lod_fpart,
+                             colors);
+
+      for (chan = 0; chan < 4; chan++) {
+         LLVMValueRef sum = LLVMBuildLoad(builder, colors_out[chan], "");
+         LLVMValueRef color = LLVMBuildLoad(builder, colors[chan], "");
+         color = lp_build_add(texel_bld, sum, color);
+         sum = lp_build_select(texel_bld, active, color, sum);
+         LLVMBuildStore(builder, sum, colors_out[chan]);
+      }
+   }
+   lp_build_loop_end_cond(&loop_state, max_samples, NULL, LLVMIntSGE);
+
+   for (chan = 0; chan < 4; chan++) {
+      LLVMValueRef sum = LLVMBuildLoad(builder, colors_out[chan], "");
+      sum = lp_build_mul(texel_bld, sum, rcp_num_samples);
+      LLVMBuildStore(builder, sum, colors_out[chan]);
+   }
+}
+
+
 /**
  * Clamp layer coord to valid values.
  */
@@ -1007,6 +1094,7 @@ lp_build_sample_common(struct lp_build_sample_context *bld,
                        const struct lp_derivatives *derivs,
                        LLVMValueRef lod_bias, /* optional */
                        LLVMValueRef explicit_lod, /* optional */
+                       struct lp_aniso_footprint *aniso, /* optional */
                        LLVMValueRef *lod_ipart,
                        LLVMValueRef *lod_fpart,
                        LLVMValueRef *ilevel0,
@@ -1047,6 +1135,10 @@ lp_build_sample_common(struct lp_build_sample_context *bld,
       *r = lp_build_layer_coord(bld, unit, *r);
    }
 
+   if (aniso) {
+      memset(aniso, 0, sizeof *aniso);
+   }
+
    /*
     * Compute the level of detail (float).
     */
@@ -1057,7 +1149,7 @@ lp_build_sample_common(struct lp_build_sample_context *bld,
        */
       lp_build_lod_selector(bld, unit, derivs,
                             lod_bias, explicit_lod,
-                            mip_filter,
+                            mip_filter, aniso,
                             lod_ipart, lod_fpart);
    } else {
       *lod_ipart = bld->perquadi_bld.zero;
@@ -1117,6 +1209,7 @@ lp_build_sample_general(struct lp_build_sample_context *bld,
                         LLVMValueRef lod_fpart,
                         LLVMValueRef ilevel0,
                         LLVMValueRef ilevel1,
+                        const struct lp_aniso_footprint *aniso,
                         LLVMValueRef *colors_out)
 {
    struct lp_build_context *int_bld = &bld->int_bld;
@@ -1136,13 +1229,27 @@ lp_build_sample_general(struct lp_build_sample_context *bld,
      lp_build_name(texels[chan], "sampler%u_texel_%c_var", unit, "xyzw"[chan]);
    }
 
+   if (aniso && !aniso->num_samples) {
+      aniso = NULL;
+   }
+
    if (min_filter == mag_filter) {
       /* no need to distinguish between minification and magnification */
-      lp_build_sample_mipmap(bld, unit,
-                             min_filter, mip_filter,
-                             s, t, r,
-                             ilevel0, ilevel1, lod_fpart,
-                             texels);
+      if (aniso) {
+         /* magnified quads only take one sample */
+         lp_build_sample_aniso(bld, unit,
+                               min_filter, mip_filter,
+                               s, t, r,
+                               ilevel0, ilevel1, lod_fpart,
+                               aniso, texels);
+      }
+      else {
+         lp_build_sample_mipmap(bld, unit,
+                                min_filter, mip_filter,
+                                s, t, r,
+                                ilevel0, ilevel1, lod_fpart,
+                                texels);
+      }
    }
    else {
       /* Emit conditional to choose min image filter or mag image filter
@@ -1171,11 +1278,20 @@ lp_build_sample_general(struct lp_build_sample_context *bld,
       lp_build_if(&if_ctx, bld->gallivm, minify);
       {
          /* Use the minification filter */
-         lp_build_sample_mipmap(bld, unit,
-                                min_filter, mip_filter,
-                                s, t, r,
-                                ilevel0, ilevel1, lod_fpart,
-                                texels);
+         if (aniso) {
+            lp_build_sample_aniso(bld, unit,
+                                  min_filter, mip_filter,
+                                  s, t, r,
+                                  ilevel0, ilevel1, lod_fpart,
+                                  aniso, texels);
+         }
+         else {
+            lp_build_sample_mipmap(bld, unit,
+                                   min_filter, mip_filter,
+                                   s, t, r,
+                                   ilevel0, ilevel1, lod_fpart,
+                                   texels);
+         }
       }
       lp_build_else(&if_ctx);
       {
@@ -1518,9 +1634,12 @@ lp_build_sample_soa(struct gallivm_state *gallivm,
    else {
       LLVMValueRef lod_ipart = NULL, lod_fpart = NULL;
       LLVMValueRef ilevel0 = NULL, ilevel1 = NULL;
+      struct lp_aniso_footprint aniso;
+      /* the AoS path doesn't do anisotropic filtering */
       boolean use_aos = util_format_fits_8unorm(bld.format_desc) &&
                         lp_is_simple_wrap_mode(static_state->wrap_s) &&
-                        lp_is_simple_wrap_mode(static_state->wrap_t);
+                        lp_is_simple_wrap_mode(static_state->wrap_t) &&
+                        !static_state->max_aniso;
 
       if ((gallivm_debug & GALLIVM_DEBUG_PERF) &&
           !use_aos && util_format_fits_8unorm(bld.format_desc)) {
@@ -1548,7 +1667,7 @@ lp_build_sample_soa(struct gallivm_state *gallivm,
 
       lp_build_sample_common(&bld, unit,
                              &s, &t, &r,
-                             derivs, lod_bias, explicit_lod,
+                             derivs, lod_bias, explicit_lod, &aniso,
                              &lod_ipart, &lod_fpart,
                              &ilevel0, &ilevel1);
 
@@ -1584,6 +1703,7 @@ lp_build_sample_soa(struct gallivm_state *gallivm,
                                     s, t, r,
                                     lod_ipart, lod_fpart,
                                     ilevel0, ilevel1,
+                                    &aniso,
                                     texel_out);
          }
       }
@@ -1672,6 +1792,7 @@ lp_build_sample_soa(struct gallivm_state *gallivm,
                                        s4, t4, r4,
                                        lod_iparts, lod_fparts,
                                        ilevel0s, ilevel1s,
+                                       NULL,
                                        texelout4);
             }
             for (j = 0; j < 4; j++) {
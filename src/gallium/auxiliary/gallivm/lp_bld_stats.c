@@ -0,0 +1,274 @@
+/**************************************************************************
+ *
+ * Copyright 2013 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/**
+ * @file
+ * Compilation statistics, aggregated per shader.
+ *
+ * gallivm_compile_module() and gallivm_jit_function() measure each
+ * function and add it to the statistics of the shader set with
+ * gallivm_stats_begin().  They can be read with gallivm_stats_get(), and
+ * are printed at exit if the GALLIVM_STATS environment variable is set.
+ */
+
+
+#include <stdlib.h>
+
+#include "os/os_thread.h"
+#include "os/os_time.h"
+#include "util/u_debug.h"
+#include "util/u_hash_table.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "lp_bld_init.h"
+#include "lp_bld_stats.h"
+
+
+DEBUG_GET_ONCE_BOOL_OPTION(gallivm_stats, "GALLIVM_STATS", FALSE)
+
+
+pipe_static_mutex(stats_mutex);
+
+/** All the shaders' statistics, keyed by themselves */
+static struct util_hash_table *stats_table = NULL;
+
+
+static unsigned
+stats_hash(void *key)
+{
+   const struct gallivm_shader_stats *stats = key;
+   return stats->hash ^ stats->kind;
+}
+
+
+static int
+stats_compare(void *key1, void *key2)
+{
+   const struct gallivm_shader_stats *a = key1;
+   const struct gallivm_shader_stats *b = key2;
+   return a->kind != b->kind || a->hash != b->hash;
+}
+
+
+static const char *
+kind_name(enum gallivm_stats_kind kind)
+{
+   switch (kind) {
+   case GALLIVM_STATS_FS:
+      return "fs";
+   case GALLIVM_STATS_SETUP:
+      return "setup";
+   case GALLIVM_STATS_VS:
+      return "vs";
+   case GALLIVM_STATS_GS:
+      return "gs";
+   default:
+      return "other";
+   }
+}
+
+
+static void
+dump_at_exit(void)
+{
+   gallivm_stats_dump();
+}
+
+
+/**
+ * Attribute the functions built next in a state to a shader.  The state
+ * may be shared, see gallivm_batch_get(), so this must be called by each
+ * user before it starts building its functions.
+ *
+ * \param hash  identifies the shader within its kind, typically a hash of
+ *              its tokens, so that the variants of a shader add up.
+ */
+void
+gallivm_stats_begin(struct gallivm_state *gallivm,
+                    enum gallivm_stats_kind kind,
+                    unsigned hash)
+{
+   memset(&gallivm->stats, 0, sizeof gallivm->stats);
+   gallivm->stats.kind = kind;
+   gallivm->stats.hash = hash;
+   gallivm->build_start = os_time_get();
+}
+
+
+/**
+ * Add the statistics of some functions to their shader's.
+ */
+void
+gallivm_stats_add(const struct gallivm_shader_stats *stats)
+{
+   struct gallivm_shader_stats *total;
+
+   pipe_mutex_lock(stats_mutex);
+
+   if (!stats_table) {
+      stats_table = util_hash_table_create(stats_hash, stats_compare);
+      if (!stats_table)
+         goto out;
+
+      if (debug_get_option_gallivm_stats())
+         atexit(dump_at_exit);
+   }
+
+   total = util_hash_table_get(stats_table, (void *) stats);
+   if (!total) {
+      total = CALLOC_STRUCT(gallivm_shader_stats);
+      if (!total)
+         goto out;
+      total->kind = stats->kind;
+      total->hash = stats->hash;
+      if (util_hash_table_set(stats_table, total, total) != PIPE_OK) {
+         FREE(total);
+         goto out;
+      }
+   }
+
+   total->num_functions += stats->num_functions;
+   total->build_time += stats->build_time;
+   total->opt_time += stats->opt_time;
+   total->codegen_time += stats->codegen_time;
+   total->code_size += stats->code_size;
+
+out:
+   pipe_mutex_unlock(stats_mutex);
+}
+
+
+struct get_stats_data
+{
+   struct gallivm_shader_stats *stats;
+   unsigned max_stats;
+   unsigned num_stats;
+};
+
+
+static enum pipe_error
+get_stats_callback(void *key, void *value, void *data)
+{
+   struct get_stats_data *get = data;
+
+   if (get->num_stats < get->max_stats)
+      get->stats[get->num_stats] = *(const struct gallivm_shader_stats *) value;
+   get->num_stats++;
+
+   return PIPE_OK;
+}
+
+
+/**
+ * Get the statistics of every shader compiled so far, in no particular
+ * order.
+ *
+ * \param stats  filled with up to max_stats shaders, may be NULL if
+ *               max_stats is 0
+ * \return the number of shaders, which may be more than max_stats
+ */
+unsigned
+gallivm_stats_get(struct gallivm_shader_stats *stats, unsigned max_stats)
+{
+   struct get_stats_data get;
+
+   get.stats = stats;
+   get.max_stats = max_stats;
+   get.num_stats = 0;
+
+   pipe_mutex_lock(stats_mutex);
+   if (stats_table)
+      util_hash_table_foreach(stats_table, get_stats_callback, &get);
+   pipe_mutex_unlock(stats_mutex);
+
+   return get.num_stats;
+}
+
+
+static int
+compare_total_time(const void *p1, const void *p2)
+{
+   const struct gallivm_shader_stats *a = p1;
+   const struct gallivm_shader_stats *b = p2;
+   int64_t ta = a->build_time + a->opt_time + a->codegen_time;
+   int64_t tb = b->build_time + b->opt_time + b->codegen_time;
+
+   return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+
+/**
+ * Print the statistics of all the shaders, most expensive first.
+ */
+void
+gallivm_stats_dump(void)
+{
+   struct gallivm_shader_stats *stats, total;
+   unsigned num_stats, i;
+
+   num_stats = gallivm_stats_get(NULL, 0);
+   if (!num_stats)
+      return;
+
+   stats = MALLOC(num_stats * sizeof *stats);
+   if (!stats)
+      return;
+
+   /* More shaders may have been compiled in the meantime */
+   num_stats = MIN2(num_stats, gallivm_stats_get(stats, num_stats));
+
+   qsort(stats, num_stats, sizeof *stats, compare_total_time);
+
+   memset(&total, 0, sizeof total);
+
+   debug_printf("gallivm: compile statistics (times in ms)\n");
+   debug_printf("  kind   hash      funcs     build       opt   codegen"
+                "      size\n");
+   for (i = 0; i < num_stats; i++) {
+      debug_printf("  %-6s %08x %6u %9.3f %9.3f %9.3f %9u\n",
+                   kind_name(stats[i].kind), stats[i].hash,
+                   stats[i].num_functions,
+                   stats[i].build_time / 1000.0,
+                   stats[i].opt_time / 1000.0,
+                   stats[i].codegen_time / 1000.0,
+                   stats[i].code_size);
+      total.num_functions += stats[i].num_functions;
+      total.build_time += stats[i].build_time;
+      total.opt_time += stats[i].opt_time;
+      total.codegen_time += stats[i].codegen_time;
+      total.code_size += stats[i].code_size;
+   }
+   debug_printf("  total           %6u %9.3f %9.3f %9.3f %9u\n",
+                total.num_functions,
+                total.build_time / 1000.0,
+                total.opt_time / 1000.0,
+                total.codegen_time / 1000.0,
+                total.code_size);
+
+   FREE(stats);
+}
@@ -0,0 +1,91 @@
+/**************************************************************************
+ *
+ * Copyright 2013 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/**
+ * @file
+ * Statistics of the compilation of the generated code: how much time is
+ * spent building, optimizing and compiling the functions of each shader,
+ * and how much machine code they end up as.
+ */
+
+#ifndef LP_BLD_STATS_H
+#define LP_BLD_STATS_H
+
+
+#include "pipe/p_compiler.h"
+
+
+struct gallivm_state;
+
+
+/**
+ * What the compiled functions implement.
+ */
+enum gallivm_stats_kind
+{
+   GALLIVM_STATS_OTHER = 0,
+   GALLIVM_STATS_FS,          /**< llvmpipe fragment shader variants */
+   GALLIVM_STATS_SETUP,       /**< llvmpipe triangle setup variants */
+   GALLIVM_STATS_VS,          /**< draw vertex shader variants */
+   GALLIVM_STATS_GS,          /**< draw geometry shader variants */
+   GALLIVM_STATS_NUM_KINDS
+};
+
+
+/**
+ * Compilation statistics of all the functions compiled for a shader.
+ * Times are in microseconds.
+ */
+struct gallivm_shader_stats
+{
+   enum gallivm_stats_kind kind;
+   unsigned hash;             /**< identifies the shader within its kind */
+   unsigned num_functions;    /**< functions JIT'd for it */
+   int64_t build_time;        /**< building the IR */
+   int64_t opt_time;          /**< running the IR optimization passes */
+   int64_t codegen_time;      /**< generating machine code */
+   unsigned code_size;        /**< bytes of machine code generated */
+};
+
+
+void
+gallivm_stats_begin(struct gallivm_state *gallivm,
+                    enum gallivm_stats_kind kind,
+                    unsigned hash);
+
+void
+gallivm_stats_add(const struct gallivm_shader_stats *stats);
+
+unsigned
+gallivm_stats_get(struct gallivm_shader_stats *stats, unsigned max_stats);
+
+void
+gallivm_stats_dump(void);
+
+
+#endif /* !LP_BLD_STATS_H */
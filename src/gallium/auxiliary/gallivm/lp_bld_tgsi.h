@@ -204,6 +204,56 @@ struct lp_build_sampler_aos
 };
 
 
+struct lp_build_tgsi_context;
+
+/**
+ * Callbacks through which a geometry shader generated by
+ * lp_build_tgsi_soa() reads its input vertices and emits its output.
+ * Each vector element runs the shader for one input primitive.
+ * The code calling lp_build_tgsi_soa() decides on the memory layouts.
+ */
+struct lp_build_tgsi_gs_iface
+{
+   /** Fetch channel 'swizzle' of input 'attrib' of vertex 'vertex' */
+   LLVMValueRef (*fetch_input)(const struct lp_build_tgsi_gs_iface *gs_iface,
+                               struct lp_build_tgsi_context *bld_base,
+                               unsigned vertex,
+                               unsigned attrib,
+                               unsigned swizzle);
+
+   /**
+    * Store the current outputs as vertex 'vertex_index' of the elements
+    * enabled in 'mask'.  Disabled elements must not be stored.
+    */
+   void (*emit_vertex)(const struct lp_build_tgsi_gs_iface *gs_iface,
+                       struct lp_build_tgsi_context *bld_base,
+                       LLVMValueRef (*outputs)[4],
+                       LLVMValueRef vertex_index,
+                       LLVMValueRef mask);
+
+   /**
+    * Record primitive 'prim_index', made of the last 'num_vertices'
+    * vertices, for the elements enabled in 'mask'.
+    */
+   void (*end_primitive)(const struct lp_build_tgsi_gs_iface *gs_iface,
+                         struct lp_build_tgsi_context *bld_base,
+                         LLVMValueRef num_vertices,
+                         LLVMValueRef prim_index,
+                         LLVMValueRef mask);
+
+   /** Called at the end of the shader with the number of emitted vertices
+    * and primitives of each element.
+    */
+   void (*epilogue)(const struct lp_build_tgsi_gs_iface *gs_iface,
+                    struct lp_build_tgsi_context *bld_base,
+                    LLVMValueRef total_vertices,
+                    LLVMValueRef total_prims);
+
+   /** Vertices emitted past this many are dropped */
+   unsigned max_output_vertices;
+};
+
+
 void
 lp_build_tgsi_info(const struct tgsi_token *tokens,
                    struct lp_tgsi_info *info);
@@ -220,7 +270,8 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
                   const LLVMValueRef (*inputs)[4],
                   LLVMValueRef (*outputs)[4],
                   struct lp_build_sampler_soa *sampler,
-                  const struct tgsi_shader_info *info);
+                  const struct tgsi_shader_info *info,
+                  const struct lp_build_tgsi_gs_iface *gs_iface);
 
 
 void
@@ -401,6 +452,12 @@ struct lp_build_tgsi_soa_context
 
    uint num_immediates;
 
+   /** Geometry shaders only, see struct lp_build_tgsi_gs_iface */
+   const struct lp_build_tgsi_gs_iface *gs_iface;
+   LLVMValueRef max_output_vertices_vec;
+   LLVMValueRef emitted_vertices_vec_ptr;       /**< of the current prim */
+   LLVMValueRef total_emitted_vertices_vec_ptr;
+   LLVMValueRef emitted_prims_vec_ptr;
 };
 
 void
@@ -700,7 +700,16 @@ emit_fetch_input(
                                           &reg->Indirect);
    }
 
-   if (reg->Register.Indirect) {
+   if (bld->gs_iface) {
+      /* geometry shader inputs are indexed by vertex, then by attribute */
+      assert(reg->Register.Dimension && !reg->Dimension.Indirect);
+      assert(!reg->Register.Indirect);
+      res = bld->gs_iface->fetch_input(bld->gs_iface, bld_base,
+                                       reg->Dimension.Index,
+                                       reg->Register.Index,
+                                       swizzle);
+   }
+   else if (reg->Register.Indirect) {
       LLVMValueRef swizzle_vec =
          lp_build_const_int_vec(gallivm, uint_bld->type, swizzle);
       LLVMValueRef length_vec =
@@ -2021,6 +2030,121 @@ cont_emit(
    lp_exec_continue(&bld->exec_mask);
 }
 
+
+/**
+ * The execution mask of geometry shader instructions, all ones outside
+ * of control flow.
+ */
+static LLVMValueRef
+gs_exec_mask(struct lp_build_tgsi_soa_context *bld)
+{
+   if (bld->exec_mask.has_mask)
+      return bld->exec_mask.exec_mask;
+   return LLVMConstAllOnes(bld->bld_base.int_bld.vec_type);
+}
+
+
+/**
+ * Add one to the elements of the counter vector enabled in mask.
+ */
+static void
+increment_vec_ptr(struct lp_build_tgsi_soa_context *bld,
+                  LLVMValueRef ptr,
+                  LLVMValueRef mask)
+{
+   LLVMBuilderRef builder = bld->bld_base.base.gallivm->builder;
+   LLVMValueRef current_vec = LLVMBuildLoad(builder, ptr, "");
+
+   /* enabled mask elements are ~0, i.e. -1 */
+   current_vec = LLVMBuildSub(builder, current_vec, mask, "");
+   LLVMBuildStore(builder, current_vec, ptr);
+}
+
+
+static void
+emit_vertex(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   LLVMValueRef outputs[PIPE_MAX_SHADER_OUTPUTS][TGSI_NUM_CHANNELS];
+   LLVMValueRef total_emitted_vertices_vec, mask;
+   unsigned index, chan;
+
+   assert(bld->gs_iface);
+
+   total_emitted_vertices_vec =
+      LLVMBuildLoad(builder, bld->total_emitted_vertices_vec_ptr, "");
+
+   /* drop the vertices past the maximum */
+   mask = lp_build_cmp(&bld_base->uint_bld, PIPE_FUNC_LESS,
+                       total_emitted_vertices_vec,
+                       bld->max_output_vertices_vec);
+   mask = LLVMBuildAnd(builder, mask, gs_exec_mask(bld), "");
+
+   for (index = 0; index < bld_base->info->num_outputs; ++index) {
+      for (chan = 0; chan < TGSI_NUM_CHANNELS; ++chan) {
+         outputs[index][chan] = lp_get_output_ptr(bld, index, chan);
+      }
+   }
+
+   bld->gs_iface->emit_vertex(bld->gs_iface, bld_base, outputs,
+                              total_emitted_vertices_vec, mask);
+
+   increment_vec_ptr(bld, bld->emitted_vertices_vec_ptr, mask);
+   increment_vec_ptr(bld, bld->total_emitted_vertices_vec_ptr, mask);
+}
+
+
+/**
+ * End the current primitive of the elements enabled in mask.  Primitives
+ * without vertices are not recorded.
+ */
+static void
+end_primitive_masked(struct lp_build_tgsi_soa_context *bld,
+                     LLVMValueRef mask)
+{
+   LLVMBuilderRef builder = bld->bld_base.base.gallivm->builder;
+   struct lp_build_context *uint_bld = &bld->bld_base.uint_bld;
+   LLVMValueRef emitted_vertices_vec =
+      LLVMBuildLoad(builder, bld->emitted_vertices_vec_ptr, "");
+   LLVMValueRef emitted_prims_vec =
+      LLVMBuildLoad(builder, bld->emitted_prims_vec_ptr, "");
+   LLVMValueRef has_vertices;
+
+   has_vertices = lp_build_cmp(uint_bld, PIPE_FUNC_NOTEQUAL,
+                               emitted_vertices_vec, uint_bld->zero);
+   mask = LLVMBuildAnd(builder, mask, has_vertices, "");
+
+   bld->gs_iface->end_primitive(bld->gs_iface, &bld->bld_base,
+                                emitted_vertices_vec, emitted_prims_vec,
+                                mask);
+
+   increment_vec_ptr(bld, bld->emitted_prims_vec_ptr, mask);
+
+   emitted_vertices_vec = lp_build_select(uint_bld, mask, uint_bld->zero,
+                                          emitted_vertices_vec);
+   LLVMBuildStore(builder, emitted_vertices_vec,
+                  bld->emitted_vertices_vec_ptr);
+}
+
+
+static void
+end_primitive(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+
+   assert(bld->gs_iface);
+
+   end_primitive_masked(bld, gs_exec_mask(bld));
+}
+
+
 /* XXX: Refactor and move it to lp_bld_tgsi_action.c
  *
  * XXX: What do the comments about xmm registers mean?  Maybe they are left over
@@ -2137,6 +2261,21 @@ static void emit_prologue(struct lp_build_tgsi_context * bld_base)
                                                 "output_array");
    }
 
+   if (bld->gs_iface) {
+      struct lp_build_context *uint_bld = &bld_base->uint_bld;
+
+      bld->max_output_vertices_vec =
+         lp_build_const_int_vec(gallivm, uint_bld->type,
+                                bld->gs_iface->max_output_vertices);
+      bld->emitted_vertices_vec_ptr =
+         lp_build_alloca(gallivm, uint_bld->vec_type, "emitted_vertices");
+      bld->total_emitted_vertices_vec_ptr =
+         lp_build_alloca(gallivm, uint_bld->vec_type,
+                         "total_emitted_vertices");
+      bld->emitted_prims_vec_ptr =
+         lp_build_alloca(gallivm, uint_bld->vec_type, "emitted_prims");
+   }
+
    /* If we have indirect addressing in inputs we need to copy them into
     * our alloca array to be able to iterate over them */
    if (bld->indirect_files & (1 << TGSI_FILE_INPUT)) {
@@ -2187,6 +2326,24 @@ static void emit_epilogue(struct lp_build_tgsi_context * bld_base)
          }
       }
    }
+
+   if (bld->gs_iface) {
+      LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+      LLVMValueRef total_emitted_vertices_vec, emitted_prims_vec;
+
+      /* the shader's end ends the current primitive */
+      end_primitive_masked(bld,
+                           LLVMConstAllOnes(bld_base->int_bld.vec_type));
+
+      total_emitted_vertices_vec =
+         LLVMBuildLoad(builder, bld->total_emitted_vertices_vec_ptr, "");
+      emitted_prims_vec =
+         LLVMBuildLoad(builder, bld->emitted_prims_vec_ptr, "");
+
+      bld->gs_iface->epilogue(bld->gs_iface, bld_base,
+                              total_emitted_vertices_vec,
+                              emitted_prims_vec);
+   }
 }
 
 void
@@ -2200,7 +2357,8 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
                   const LLVMValueRef (*inputs)[TGSI_NUM_CHANNELS],
                   LLVMValueRef (*outputs)[TGSI_NUM_CHANNELS],
                   struct lp_build_sampler_soa *sampler,
-                  const struct tgsi_shader_info *info)
+                  const struct tgsi_shader_info *info,
+                  const struct lp_build_tgsi_gs_iface *gs_iface)
 {
    struct lp_build_tgsi_soa_context bld;
 
@@ -2269,6 +2427,14 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
    bld.bld_base.op_actions[TGSI_OPCODE_TXQ].emit = txq_emit;
    bld.bld_base.op_actions[TGSI_OPCODE_TXF].emit = txf_emit;
 
+   if (gs_iface) {
+      /* inputs are fetched through the interface */
+      assert(!(bld.indirect_files & (1 << TGSI_FILE_INPUT)));
+      bld.gs_iface = gs_iface;
+      bld.bld_base.op_actions[TGSI_OPCODE_EMIT].emit = emit_vertex;
+      bld.bld_base.op_actions[TGSI_OPCODE_ENDPRIM].emit = end_primitive;
+   }
+
    lp_exec_mask_init(&bld.exec_mask, &bld.bld_base.base);
 
    bld.system_values = *system_values;
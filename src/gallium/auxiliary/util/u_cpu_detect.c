@@ -211,6 +211,67 @@ cpuid(uint32_t ax, uint32_t *p)
    p[3] = 0;
 #endif
 }
+
+/**
+ * Same as cpuid() for the leaves which have sub-leaves, selected by cx.
+ */
+static INLINE void
+cpuid_count(uint32_t ax, uint32_t cx, uint32_t *p)
+{
+#if (defined(PIPE_CC_GCC) || defined(PIPE_CC_SUNPRO)) && defined(PIPE_ARCH_X86)
+   __asm __volatile (
+     "xchgl %%ebx, %1\n\t"
+     "cpuid\n\t"
+     "xchgl %%ebx, %1"
+     : "=a" (p[0]),
+       "=S" (p[1]),
+       "=c" (p[2]),
+       "=d" (p[3])
+     : "0" (ax), "2" (cx)
+   );
+#elif (defined(PIPE_CC_GCC) || defined(PIPE_CC_SUNPRO)) && defined(PIPE_ARCH_X86_64)
+   __asm __volatile (
+     "cpuid\n\t"
+     : "=a" (p[0]),
+       "=b" (p[1]),
+       "=c" (p[2]),
+       "=d" (p[3])
+     : "0" (ax), "2" (cx)
+   );
+#elif defined(PIPE_CC_MSVC)
+   __cpuidex(p, ax, cx);
+#else
+   p[0] = 0;
+   p[1] = 0;
+   p[2] = 0;
+   p[3] = 0;
+#endif
+}
+
+/**
+ * Read the XCR0 register, which tells which register states the OS saves
+ * on context switches.  Only valid when CPUID reports OSXSAVE.
+ */
+static INLINE uint64_t
+xgetbv(void)
+{
+#if defined(PIPE_CC_GCC) || defined(PIPE_CC_SUNPRO)
+   uint32_t eax, edx;
+
+   __asm __volatile (
+     ".byte 0x0f, 0x01, 0xd0" /* xgetbv, unknown to older assemblers */
+     : "=a" (eax),
+       "=d" (edx)
+     : "c" (0)
+   );
+
+   return ((uint64_t)edx << 32) | eax;
+#elif defined(PIPE_CC_MSVC) && defined(_XCR_XFEATURE_ENABLED_MASK)
+   return _xgetbv(_XCR_XFEATURE_ENABLED_MASK);
+#else
+   return 0;
+#endif
+}
 #endif /* X86 or X86_64 */
 
 void
@@ -278,9 +339,24 @@ util_cpu_detect(void)
          util_cpu_caps.has_ssse3  = (regs2[2] >>  9) & 1; /* 0x0000020 */
          util_cpu_caps.has_sse4_1 = (regs2[2] >> 19) & 1;
          util_cpu_caps.has_sse4_2 = (regs2[2] >> 20) & 1;
-         util_cpu_caps.has_avx    = (regs2[2] >> 28) & 1;
          util_cpu_caps.has_mmx2   = util_cpu_caps.has_sse; /* SSE cpus supports mmxext too */
 
+         /* AVX and the extensions using the same registers also need the
+          * OS to save the YMM state (OSXSAVE, and XCR0 bits 1 and 2).
+          */
+         if (((regs2[2] >> 27) & 1) &&
+             (xgetbv() & 0x6) == 0x6) {
+            util_cpu_caps.has_avx  = (regs2[2] >> 28) & 1;
+            util_cpu_caps.has_fma  = (regs2[2] >> 12) & 1;
+            util_cpu_caps.has_f16c = (regs2[2] >> 29) & 1;
+
+            if (regs[0] >= 0x00000007) {
+               uint32_t regs7[4];
+               cpuid_count(0x00000007, 0x00000000, regs7);
+               util_cpu_caps.has_avx2 = (regs7[1] >> 5) & 1;
+            }
+         }
+
          cacheline = ((regs2[1] >> 8) & 0xFF) * 8;
          if (cacheline > 0)
             util_cpu_caps.cacheline = cacheline;
@@ -314,6 +390,12 @@ util_cpu_detect(void)
          util_cpu_caps.has_ssse3 = 0;
          util_cpu_caps.has_sse4_1 = 0;
       }
+
+      if (!util_cpu_caps.has_avx) {
+         util_cpu_caps.has_avx2 = 0;
+         util_cpu_caps.has_fma = 0;
+         util_cpu_caps.has_f16c = 0;
+      }
    }
 #endif /* PIPE_ARCH_X86 || PIPE_ARCH_X86_64 */
 
@@ -338,6 +420,9 @@ util_cpu_detect(void)
       debug_printf("util_cpu_caps.has_sse4_1 = %u\n", util_cpu_caps.has_sse4_1);
       debug_printf("util_cpu_caps.has_sse4_2 = %u\n", util_cpu_caps.has_sse4_2);
       debug_printf("util_cpu_caps.has_avx = %u\n", util_cpu_caps.has_avx);
+      debug_printf("util_cpu_caps.has_avx2 = %u\n", util_cpu_caps.has_avx2);
+      debug_printf("util_cpu_caps.has_fma = %u\n", util_cpu_caps.has_fma);
+      debug_printf("util_cpu_caps.has_f16c = %u\n", util_cpu_caps.has_f16c);
       debug_printf("util_cpu_caps.has_3dnow = %u\n", util_cpu_caps.has_3dnow);
       debug_printf("util_cpu_caps.has_3dnow_ext = %u\n", util_cpu_caps.has_3dnow_ext);
       debug_printf("util_cpu_caps.has_altivec = %u\n", util_cpu_caps.has_altivec);
@@ -0,0 +1,192 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/**
+ * Placement of the rasterizer threads on CPUs and NUMA nodes.
+ *
+ * With LP_PIN_THREADS each rasterizer thread is pinned to a CPU, filling
+ * one NUMA node before moving on to the next, so that threads with
+ * neighbouring indices share a node.  Together with the per-thread bin
+ * queues of the scene (see lp_scene_bin_iter_begin()) a tile is then
+ * rasterized on the same CPU scene after scene, and the framebuffer
+ * pages of the tiles a thread owns get allocated on its node when first
+ * touched.
+ *
+ * Only Linux is supported; elsewhere no CPUs are reported and the
+ * threads are left to the OS scheduler.
+ */
+
+
+#include "pipe/p_config.h"
+
+#if defined(PIPE_OS_LINUX)
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+#include "util/u_debug.h"
+#include "lp_affinity.h"
+
+
+#if defined(PIPE_OS_LINUX)
+
+/**
+ * Return the NUMA node of a CPU, from the nodeN link in its sysfs
+ * directory, or 0 if the kernel has no NUMA support.
+ */
+static unsigned
+get_cpu_node(unsigned cpu)
+{
+   char path[64];
+   DIR *dir;
+   struct dirent *entry;
+   unsigned node = 0;
+
+   snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%u", cpu);
+
+   dir = opendir(path);
+   if (!dir)
+      return 0;
+
+   while ((entry = readdir(dir)) != NULL) {
+      if (strncmp(entry->d_name, "node", 4) == 0 &&
+          entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+         node = strtoul(entry->d_name + 4, NULL, 10);
+         break;
+      }
+   }
+
+   closedir(dir);
+   return node;
+}
+
+
+static int
+compare_cpus(const void *a, const void *b)
+{
+   const struct lp_affinity_cpu *cpu_a = (const struct lp_affinity_cpu *) a;
+   const struct lp_affinity_cpu *cpu_b = (const struct lp_affinity_cpu *) b;
+
+   if (cpu_a->node != cpu_b->node)
+      return cpu_a->node < cpu_b->node ? -1 : 1;
+   return cpu_a->cpu < cpu_b->cpu ? -1 : (cpu_a->cpu > cpu_b->cpu);
+}
+
+#endif /* PIPE_OS_LINUX */
+
+
+/**
+ * Get the CPUs the process is allowed to run on, ordered by NUMA node
+ * and then by CPU number.
+ * \return the number of CPUs stored in cpus, 0 if unknown
+ */
+unsigned
+lp_affinity_get_cpus(struct lp_affinity_cpu *cpus, unsigned max_cpus)
+{
+   unsigned num_cpus = 0;
+#if defined(PIPE_OS_LINUX)
+   cpu_set_t set;
+   unsigned cpu;
+
+   if (sched_getaffinity(0, sizeof set, &set) != 0)
+      return 0;
+
+   for (cpu = 0; cpu < CPU_SETSIZE && num_cpus < max_cpus; cpu++) {
+      if (CPU_ISSET(cpu, &set)) {
+         cpus[num_cpus].cpu = cpu;
+         cpus[num_cpus].node = get_cpu_node(cpu);
+         num_cpus++;
+      }
+   }
+
+   qsort(cpus, num_cpus, sizeof cpus[0], compare_cpus);
+#else
+   (void) cpus;
+   (void) max_cpus;
+#endif
+   return num_cpus;
+}
+
+
+/**
+ * Restrict the calling thread to the given CPU.
+ */
+boolean
+lp_affinity_pin_thread(unsigned cpu)
+{
+#if defined(PIPE_OS_LINUX)
+   cpu_set_t set;
+
+   CPU_ZERO(&set);
+   CPU_SET(cpu, &set);
+   if (sched_setaffinity(0, sizeof set, &set) == 0)
+      return TRUE;
+
+   debug_printf("llvmpipe: couldn't pin thread to cpu %u\n", cpu);
+#else
+   (void) cpu;
+#endif
+   return FALSE;
+}
+
+
+/**
+ * Order in which a thread takes bins from the threads' bin queues: its
+ * own queue first, then the queues of the threads on the same node, then
+ * those on the other nodes, nearest thread index first within each group
+ * (threads with neighbouring indices rasterize neighbouring tiles).
+ *
+ * \param nodes   NUMA node of each thread
+ * \param order   receives the num_threads queue indices
+ */
+void
+lp_affinity_steal_order(const unsigned *nodes, unsigned num_threads,
+                        unsigned thread, unsigned *order)
+{
+   unsigned n = 0, remote, dist, i;
+
+   order[n++] = thread;
+
+   for (remote = 0; remote < 2; remote++) {
+      for (dist = 1; dist < num_threads; dist++) {
+         for (i = 0; i < 2; i++) {
+            int other = i ? (int) thread + (int) dist : (int) thread - (int) dist;
+
+            if (other < 0 || other >= (int) num_threads)
+               continue;
+
+            if ((nodes[other] != nodes[thread]) == remote)
+               order[n++] = other;
+         }
+      }
+   }
+
+   assert(n == num_threads);
+}
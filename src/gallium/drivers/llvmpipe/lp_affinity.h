@@ -1,7 +1,8 @@
 /**************************************************************************
- * 
- * Copyright 2010 VMware, Inc.  All Rights Reserved.
- * 
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
  * Permission is hereby granted, free of charge, to any person obtaining a
  * copy of this software and associated documentation files (the
  * "Software"), to deal in the Software without restriction, including
@@ -9,53 +10,51 @@
  * distribute, sub license, and/or sell copies of the Software, and to
  * permit persons to whom the Software is furnished to do so, subject to
  * the following conditions:
- * 
+ *
  * The above copyright notice and this permission notice (including the
  * next paragraph) shall be included in all copies or substantial portions
  * of the Software.
- * 
+ *
  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
  * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
  * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
- * IN NO EVENT SHALL THE AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
  * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
  * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
- * 
+ *
  **************************************************************************/
 
 
-#ifndef LP_TILE_IMAGE_H
-#define LP_TILE_IMAGE_H
+/**
+ * Placement of the rasterizer threads on CPUs and NUMA nodes.
+ */
 
+#ifndef LP_AFFINITY_H
+#define LP_AFFINITY_H
 
-#define TILE_VECTOR_HEIGHT 4
-#define TILE_VECTOR_WIDTH 4
+#include "pipe/p_compiler.h"
 
 
-void
-lp_tiled_to_linear(const void *src, void *dst,
-                   unsigned x, unsigned y,
-                   unsigned width, unsigned height,
-                   enum pipe_format format,
-                   unsigned dst_stride,
-                   unsigned tiles_per_row);
+/**
+ * A CPU the process may run on, and the NUMA node it belongs to.
+ */
+struct lp_affinity_cpu
+{
+   unsigned cpu;
+   unsigned node;
+};
 
 
-void
-lp_linear_to_tiled(const void *src, void *dst,
-                   unsigned x, unsigned y,
-                   unsigned width, unsigned height,
-                   enum pipe_format format,
-                   unsigned src_stride,
-                   unsigned tiles_per_row);
+unsigned
+lp_affinity_get_cpus(struct lp_affinity_cpu *cpus, unsigned max_cpus);
 
+boolean
+lp_affinity_pin_thread(unsigned cpu);
 
 void
-test_tiled_linear_conversion(void *data,
-                             enum pipe_format format,
-                             unsigned width, unsigned height,
-                             unsigned stride);
+lp_affinity_steal_order(const unsigned *nodes, unsigned num_threads,
+                        unsigned thread, unsigned *order);
 
 
-#endif /* LP_TILE_IMAGE_H */
+#endif /* LP_AFFINITY_H */
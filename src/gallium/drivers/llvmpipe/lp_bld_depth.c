@@ -36,9 +36,11 @@
  * flushing would avoid this, but it would most likely result in depth fighting
  * artifacts.
  *
- * We are free to use a different pixel layout though. Since our basic
- * processing unit is a quad (2x2 pixel block) we store the depth/stencil
- * values tiled, a quad at time. That is, a depth buffer containing 
+ * The depth/stencil buffer is stored linearly, like any other texture, so
+ * that it can be sampled and mapped without conversion.  Since our basic
+ * processing unit is a quad (2x2 pixel block) the values of a quad are
+ * gathered from two rows of the buffer when loaded, and scattered back when
+ * stored.  That is, for a depth buffer containing
  *
  *  Z11 Z12 Z13 Z14 ...
  *  Z21 Z22 Z23 Z24 ...
@@ -46,7 +48,7 @@
  *  Z41 Z42 Z43 Z44 ...
  *  ... ... ... ... ...
  *
- * will actually be stored in memory as
+ * the vectors operated on hold
  *
  *  Z11 Z12 Z21 Z22 Z13 Z14 Z23 Z24 ...
  *  Z31 Z32 Z41 Z42 Z33 Z34 Z43 Z44 ...
@@ -71,6 +73,7 @@
 #include "gallivm/lp_bld_intr.h"
 #include "gallivm/lp_bld_debug.h"
 #include "gallivm/lp_bld_swizzle.h"
+#include "gallivm/lp_bld_pack.h"
 
 #include "lp_bld_depth.h"
 
@@ -517,6 +520,126 @@ lp_build_occlusion_count(struct gallivm_state *gallivm,
 
 
 
+/**
+ * Compute the addresses of the rows of the quads held in a vector of
+ * depth/stencil values: two rows of two values per quad, in the order the
+ * quads are processed in a 4x4 block (see lp_bld_interp.c).
+ *
+ * \param depth_ptr  pointer to the 4x4 block in the linear buffer
+ * \param depth_stride  stride of the buffer in bytes
+ * \param loop_counter  index of the vector in the 4x4 block
+ */
+static void
+lp_build_depth_stencil_row_ptrs(struct gallivm_state *gallivm,
+                                struct lp_type z_type,
+                                LLVMValueRef depth_ptr,
+                                LLVMValueRef depth_stride,
+                                LLVMValueRef loop_counter,
+                                LLVMValueRef *row_ptrs)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   const unsigned num_quads = z_type.length / 4;
+   LLVMTypeRef row_ptr_type;
+   LLVMValueRef quad;
+   unsigned i;
+
+   assert(num_quads >= 1 && num_quads <= 4);
+
+   row_ptr_type = LLVMPointerType(LLVMVectorType(lp_build_elem_type(gallivm, z_type),
+                                                 2), 0);
+
+   quad = LLVMBuildMul(builder, loop_counter,
+                       lp_build_const_int32(gallivm, num_quads), "");
+
+   for (i = 0; i < num_quads; i++) {
+      LLVMValueRef q, x_offset, y_offset, offset, ptr;
+
+      q = LLVMBuildAdd(builder, quad, lp_build_const_int32(gallivm, i), "");
+
+      /* quad x = (q & 1) * 2, quad y = (q & 2) */
+      x_offset = LLVMBuildAnd(builder, q, lp_build_const_int32(gallivm, 1), "");
+      x_offset = LLVMBuildMul(builder, x_offset,
+                              lp_build_const_int32(gallivm, 2 * z_type.width / 8), "");
+      y_offset = LLVMBuildAnd(builder, q, lp_build_const_int32(gallivm, 2), "");
+      y_offset = LLVMBuildMul(builder, y_offset, depth_stride, "");
+      offset = LLVMBuildAdd(builder, x_offset, y_offset, "");
+
+      ptr = LLVMBuildGEP(builder, depth_ptr, &offset, 1, "");
+      row_ptrs[2*i + 0] = LLVMBuildBitCast(builder, ptr, row_ptr_type, "");
+      ptr = LLVMBuildGEP(builder, ptr, &depth_stride, 1, "");
+      row_ptrs[2*i + 1] = LLVMBuildBitCast(builder, ptr, row_ptr_type, "");
+   }
+}
+
+
+/**
+ * Load a vector of depth/stencil values, in quad order, from the linear
+ * depth/stencil buffer.
+ *
+ * \param z_src_type  the type of the fragment depth values
+ * \param depth_ptr  pointer to the 4x4 block in the linear buffer
+ * \param depth_stride  stride of the buffer in bytes
+ * \param loop_counter  index of the vector in the 4x4 block
+ */
+LLVMValueRef
+lp_build_depth_stencil_load_swizzled(struct gallivm_state *gallivm,
+                                     struct lp_type z_src_type,
+                                     const struct util_format_description *format_desc,
+                                     LLVMValueRef depth_ptr,
+                                     LLVMValueRef depth_stride,
+                                     LLVMValueRef loop_counter)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_type z_type, row_type;
+   LLVMValueRef row_ptrs[LP_MAX_VECTOR_LENGTH / 2];
+   LLVMValueRef rows[LP_MAX_VECTOR_LENGTH / 2];
+   unsigned num_rows, i;
+
+   z_type = lp_depth_type(format_desc, z_src_type.width*z_src_type.length);
+   num_rows = z_type.length / 2;
+
+   lp_build_depth_stencil_row_ptrs(gallivm, z_type, depth_ptr, depth_stride,
+                                   loop_counter, row_ptrs);
+
+   for (i = 0; i < num_rows; i++) {
+      rows[i] = LLVMBuildLoad(builder, row_ptrs[i], "");
+   }
+
+   row_type = z_type;
+   row_type.length = 2;
+
+   return lp_build_concat(gallivm, rows, row_type, num_rows);
+}
+
+
+/**
+ * Store a vector of depth/stencil values, in quad order, to the linear
+ * depth/stencil buffer.
+ */
+static void
+lp_build_depth_stencil_write_swizzled(struct gallivm_state *gallivm,
+                                      struct lp_type z_type,
+                                      LLVMValueRef depth_ptr,
+                                      LLVMValueRef depth_stride,
+                                      LLVMValueRef loop_counter,
+                                      LLVMValueRef zs_value)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef row_ptrs[LP_MAX_VECTOR_LENGTH / 2];
+   unsigned num_rows, i;
+
+   num_rows = z_type.length / 2;
+
+   lp_build_depth_stencil_row_ptrs(gallivm, z_type, depth_ptr, depth_stride,
+                                   loop_counter, row_ptrs);
+
+   for (i = 0; i < num_rows; i++) {
+      LLVMValueRef row = lp_build_extract_range(gallivm, zs_value, 2*i, 2);
+      LLVMBuildStore(builder, row, row_ptrs[i]);
+   }
+}
+
+
 /**
  * Generate code for performing depth and/or stencil tests.
  * We operate on a vector of values (typically n 2x2 quads).
@@ -528,7 +651,8 @@ lp_build_occlusion_count(struct gallivm_state *gallivm,
  * \param mask  the alive/dead pixel mask for the quad (vector)
  * \param stencil_refs  the front/back stencil ref values (scalar)
  * \param z_src  the incoming depth/stencil values (n 2x2 quad values, float32)
- * \param zs_dst_ptr  pointer to depth/stencil values in framebuffer
+ * \param zs_dst  the current depth/stencil values (n 2x2 quad values),
+ *                see lp_build_depth_stencil_load_swizzled()
  * \param face  contains boolean value indicating front/back facing polygon
  */
 void
@@ -540,7 +664,7 @@ lp_build_depth_stencil_test(struct gallivm_state *gallivm,
                             struct lp_build_mask_context *mask,
                             LLVMValueRef stencil_refs[2],
                             LLVMValueRef z_src,
-                            LLVMValueRef zs_dst_ptr,
+                            LLVMValueRef zs_dst,
                             LLVMValueRef face,
                             LLVMValueRef *zs_value,
                             boolean do_branch)
@@ -551,7 +675,7 @@ lp_build_depth_stencil_test(struct gallivm_state *gallivm,
    struct lp_build_context s_bld;
    struct lp_type s_type;
    unsigned z_shift = 0, z_width = 0, z_mask = 0;
-   LLVMValueRef zs_dst, z_dst = NULL;
+   LLVMValueRef z_dst = NULL;
    LLVMValueRef stencil_vals = NULL;
    LLVMValueRef z_bitmask = NULL, stencil_shift = NULL;
    LLVMValueRef z_pass = NULL, s_pass_mask = NULL;
@@ -630,12 +754,6 @@ lp_build_depth_stencil_test(struct gallivm_state *gallivm,
    s_type = lp_int_type(z_type);
    lp_build_context_init(&s_bld, gallivm, s_type);
 
-   /* Load current z/stencil value from z/stencil buffer */
-   zs_dst_ptr = LLVMBuildBitCast(builder,
-                                 zs_dst_ptr,
-                                 LLVMPointerType(z_bld.vec_type, 0), "");
-   zs_dst = LLVMBuildLoad(builder, zs_dst_ptr, "");
-
    lp_build_name(zs_dst, "zs_dst");
 
 
@@ -850,15 +968,21 @@ lp_build_depth_stencil_test(struct gallivm_state *gallivm,
 
 
 void
-lp_build_depth_write(LLVMBuilderRef builder,
+lp_build_depth_write(struct gallivm_state *gallivm,
+                     struct lp_type z_src_type,
                      const struct util_format_description *format_desc,
-                     LLVMValueRef zs_dst_ptr,
+                     LLVMValueRef depth_ptr,
+                     LLVMValueRef depth_stride,
+                     LLVMValueRef loop_counter,
                      LLVMValueRef zs_value)
 {
-   zs_dst_ptr = LLVMBuildBitCast(builder, zs_dst_ptr,
-                                 LLVMPointerType(LLVMTypeOf(zs_value), 0), "");
+   struct lp_type z_type;
+
+   z_type = lp_depth_type(format_desc, z_src_type.width*z_src_type.length);
 
-   LLVMBuildStore(builder, zs_value, zs_dst_ptr);
+   lp_build_depth_stencil_write_swizzled(gallivm, z_type,
+                                         depth_ptr, depth_stride,
+                                         loop_counter, zs_value);
 }
 
 
@@ -867,24 +991,27 @@ lp_build_deferred_depth_write(struct gallivm_state *gallivm,
                               struct lp_type z_src_type,
                               const struct util_format_description *format_desc,
                               struct lp_build_mask_context *mask,
-                              LLVMValueRef zs_dst_ptr,
+                              LLVMValueRef depth_ptr,
+                              LLVMValueRef depth_stride,
+                              LLVMValueRef loop_counter,
                               LLVMValueRef zs_value)
 {
    struct lp_type z_type;
    struct lp_build_context z_bld;
    LLVMValueRef z_dst;
-   LLVMBuilderRef builder = gallivm->builder;
 
    /* XXX: pointlessly redo type logic:
     */
    z_type = lp_depth_type(format_desc, z_src_type.width*z_src_type.length);
    lp_build_context_init(&z_bld, gallivm, z_type);
 
-   zs_dst_ptr = LLVMBuildBitCast(builder, zs_dst_ptr,
-                                 LLVMPointerType(z_bld.vec_type, 0), "");
-
-   z_dst = LLVMBuildLoad(builder, zs_dst_ptr, "zsbufval");
+   z_dst = lp_build_depth_stencil_load_swizzled(gallivm, z_src_type,
+                                                format_desc, depth_ptr,
+                                                depth_stride, loop_counter);
+   lp_build_name(z_dst, "zsbufval");
    z_dst = lp_build_select(&z_bld, lp_build_mask_value(mask), zs_value, z_dst);
 
-   LLVMBuildStore(builder, z_dst, zs_dst_ptr);
+   lp_build_depth_stencil_write_swizzled(gallivm, z_type,
+                                         depth_ptr, depth_stride,
+                                         loop_counter, z_dst);
 }
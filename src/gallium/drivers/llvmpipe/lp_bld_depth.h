@@ -63,15 +63,26 @@ lp_build_depth_stencil_test(struct gallivm_state *gallivm,
                             struct lp_build_mask_context *mask,
                             LLVMValueRef stencil_refs[2],
                             LLVMValueRef zs_src,
-                            LLVMValueRef zs_dst_ptr,
+                            LLVMValueRef zs_dst,
                             LLVMValueRef facing,
                             LLVMValueRef *zs_value,
                             boolean do_branch);
 
+LLVMValueRef
+lp_build_depth_stencil_load_swizzled(struct gallivm_state *gallivm,
+                                     struct lp_type z_src_type,
+                                     const struct util_format_description *format_desc,
+                                     LLVMValueRef depth_ptr,
+                                     LLVMValueRef depth_stride,
+                                     LLVMValueRef loop_counter);
+
 void
-lp_build_depth_write(LLVMBuilderRef builder,
+lp_build_depth_write(struct gallivm_state *gallivm,
+                     struct lp_type z_src_type,
                      const struct util_format_description *format_desc,
-                     LLVMValueRef zs_dst_ptr,
+                     LLVMValueRef depth_ptr,
+                     LLVMValueRef depth_stride,
+                     LLVMValueRef loop_counter,
                      LLVMValueRef zs_value);
 
 void
@@ -79,7 +90,9 @@ lp_build_deferred_depth_write(struct gallivm_state *gallivm,
                               struct lp_type z_src_type,
                               const struct util_format_description *format_desc,
                               struct lp_build_mask_context *mask,
-                              LLVMValueRef zs_dst_ptr,
+                              LLVMValueRef depth_ptr,
+                              LLVMValueRef depth_stride,
+                              LLVMValueRef loop_counter,
                               LLVMValueRef zs_value);
 
 void
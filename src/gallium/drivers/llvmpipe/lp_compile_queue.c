@@ -0,0 +1,260 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/**
+ * Background LLVM compilation.
+ *
+ * Jobs are run first come, first served by a small pool of threads.
+ * LLVM contexts can't be used by two threads at once, so each thread has
+ * an LLVM context of its own, and holds its context mutex while running
+ * a job.  The gallivm states a job creates live in that context, and
+ * must be destroyed under the same mutex, see
+ * lp_compile_job_destroy_gallivm().
+ */
+
+
+#include "os/os_thread.h"
+#include "util/u_debug.h"
+#include "util/u_memory.h"
+#include "gallivm/lp_bld_init.h"
+#include "gallivm/lp_bld_misc.h"
+#include "lp_compile_queue.h"
+
+
+enum {
+   JOB_IDLE = 0,
+   JOB_QUEUED,
+   JOB_RUNNING
+};
+
+
+struct lp_compile_thread
+{
+   struct lp_compile_queue *queue;
+   pipe_thread thread;
+   pipe_mutex context_mutex;
+   LLVMContextRef context;
+};
+
+
+struct lp_compile_queue
+{
+   pipe_mutex mutex;
+   pipe_condvar cond;   /**< signalled when a job is added or finished */
+   struct lp_compile_job *head, *tail;
+   boolean exit_flag;
+
+   unsigned num_threads;
+   struct lp_compile_thread *threads;
+};
+
+
+static PIPE_THREAD_ROUTINE( compile_thread_function, init_data )
+{
+   struct lp_compile_thread *thread = (struct lp_compile_thread *) init_data;
+   struct lp_compile_queue *queue = thread->queue;
+
+   pipe_mutex_lock(queue->mutex);
+
+   while (!queue->exit_flag) {
+      struct lp_compile_job *job = queue->head;
+
+      if (!job) {
+         pipe_condvar_wait(queue->cond, queue->mutex);
+         continue;
+      }
+
+      queue->head = job->next;
+      if (!queue->head)
+         queue->tail = NULL;
+      job->next = NULL;
+      job->state = JOB_RUNNING;
+      job->thread = thread;
+
+      pipe_mutex_unlock(queue->mutex);
+
+      pipe_mutex_lock(thread->context_mutex);
+      job->run(job, thread->context);
+      pipe_mutex_unlock(thread->context_mutex);
+
+      pipe_mutex_lock(queue->mutex);
+      job->state = JOB_IDLE;
+      pipe_condvar_broadcast(queue->cond);
+   }
+
+   pipe_mutex_unlock(queue->mutex);
+
+   return NULL;
+}
+
+
+/**
+ * Create a queue and start its threads.
+ */
+struct lp_compile_queue *
+lp_compile_queue_create(unsigned num_threads)
+{
+   struct lp_compile_queue *queue;
+   unsigned i;
+
+   assert(num_threads);
+
+   /* The contexts are created here, before any thread uses LLVM */
+   lp_build_init();
+   if (!lp_build_start_multithreaded())
+      return NULL;
+
+   queue = CALLOC_STRUCT(lp_compile_queue);
+   if (!queue)
+      return NULL;
+
+   queue->threads = CALLOC(num_threads, sizeof queue->threads[0]);
+   if (!queue->threads) {
+      FREE(queue);
+      return NULL;
+   }
+
+   pipe_mutex_init(queue->mutex);
+   pipe_condvar_init(queue->cond);
+
+   for (i = 0; i < num_threads; i++) {
+      struct lp_compile_thread *thread = &queue->threads[i];
+
+      /* Never freed, see gallivm_create_ext() */
+      thread->context = LLVMContextCreate();
+      if (!thread->context)
+         break;
+
+      thread->queue = queue;
+      pipe_mutex_init(thread->context_mutex);
+      thread->thread = pipe_thread_create(compile_thread_function, thread);
+      queue->num_threads++;
+   }
+
+   if (!queue->num_threads) {
+      lp_compile_queue_destroy(queue);
+      return NULL;
+   }
+
+   return queue;
+}
+
+
+/**
+ * Stop the threads and free the queue.  All jobs must be finished or
+ * cancelled.
+ */
+void
+lp_compile_queue_destroy(struct lp_compile_queue *queue)
+{
+   unsigned i;
+
+   pipe_mutex_lock(queue->mutex);
+   assert(!queue->head);
+   queue->exit_flag = TRUE;
+   pipe_condvar_broadcast(queue->cond);
+   pipe_mutex_unlock(queue->mutex);
+
+   for (i = 0; i < queue->num_threads; i++) {
+      pipe_thread_wait(queue->threads[i].thread);
+      pipe_mutex_destroy(queue->threads[i].context_mutex);
+   }
+
+   pipe_condvar_destroy(queue->cond);
+   pipe_mutex_destroy(queue->mutex);
+   FREE(queue->threads);
+   FREE(queue);
+}
+
+
+void
+lp_compile_queue_add(struct lp_compile_queue *queue,
+                     struct lp_compile_job *job)
+{
+   pipe_mutex_lock(queue->mutex);
+
+   assert(job->state == JOB_IDLE);
+   job->state = JOB_QUEUED;
+   job->next = NULL;
+   if (queue->tail)
+      queue->tail->next = job;
+   else
+      queue->head = job;
+   queue->tail = job;
+
+   pipe_condvar_signal(queue->cond);
+   pipe_mutex_unlock(queue->mutex);
+}
+
+
+/**
+ * Make sure a job is neither queued nor running: take it off the queue,
+ * or wait for it to finish.
+ */
+void
+lp_compile_queue_cancel(struct lp_compile_queue *queue,
+                        struct lp_compile_job *job)
+{
+   pipe_mutex_lock(queue->mutex);
+
+   if (job->state == JOB_QUEUED) {
+      struct lp_compile_job **p = &queue->head, *prev = NULL;
+
+      while (*p != job) {
+         prev = *p;
+         p = &(*p)->next;
+      }
+      *p = job->next;
+      if (queue->tail == job)
+         queue->tail = prev;
+      job->next = NULL;
+      job->state = JOB_IDLE;
+   }
+
+   while (job->state == JOB_RUNNING)
+      pipe_condvar_wait(queue->cond, queue->mutex);
+
+   pipe_mutex_unlock(queue->mutex);
+}
+
+
+/**
+ * Destroy a gallivm state created by a finished job, while no other job
+ * uses the LLVM context it lives in.
+ */
+void
+lp_compile_job_destroy_gallivm(struct lp_compile_job *job,
+                               struct gallivm_state *gallivm)
+{
+   assert(job->thread);
+   assert(job->state == JOB_IDLE);
+
+   pipe_mutex_lock(job->thread->context_mutex);
+   gallivm_destroy(gallivm);
+   pipe_mutex_unlock(job->thread->context_mutex);
+}
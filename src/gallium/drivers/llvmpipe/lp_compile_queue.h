@@ -0,0 +1,79 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#ifndef LP_COMPILE_QUEUE_H
+#define LP_COMPILE_QUEUE_H
+
+#include "pipe/p_compiler.h"
+#include "gallivm/lp_bld.h"
+
+struct lp_compile_queue;
+struct lp_compile_thread;
+struct gallivm_state;
+
+
+/**
+ * A piece of LLVM work to do in the background.  Embedded in the object
+ * it works for.
+ */
+struct lp_compile_job
+{
+   /**
+    * Do the work.  Any gallivm state created must use the given LLVM
+    * context and be destroyed with lp_compile_job_destroy_gallivm().
+    */
+   void (*run)(struct lp_compile_job *job, LLVMContextRef context);
+   void *data;
+
+   /* private, protected by the queue's mutex */
+   unsigned state;
+   struct lp_compile_thread *thread;  /**< the thread that ran the job */
+   struct lp_compile_job *next;
+};
+
+
+struct lp_compile_queue *
+lp_compile_queue_create(unsigned num_threads);
+
+void
+lp_compile_queue_destroy(struct lp_compile_queue *queue);
+
+void
+lp_compile_queue_add(struct lp_compile_queue *queue,
+                     struct lp_compile_job *job);
+
+void
+lp_compile_queue_cancel(struct lp_compile_queue *queue,
+                        struct lp_compile_job *job);
+
+void
+lp_compile_job_destroy_gallivm(struct lp_compile_job *job,
+                               struct gallivm_state *gallivm);
+
+
+#endif /* LP_COMPILE_QUEUE_H */
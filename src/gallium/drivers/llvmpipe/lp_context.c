@@ -32,13 +32,16 @@
 
 #include "draw/draw_context.h"
 #include "draw/draw_vbuf.h"
+#include "gallivm/lp_bld_init.h"
 #include "pipe/p_defines.h"
+#include "util/u_hash_table.h"
 #include "util/u_inlines.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/u_simple_list.h"
 #include "lp_clear.h"
 #include "lp_context.h"
+#include "lp_debug.h"
 #include "lp_flush.h"
 #include "lp_perf.h"
 #include "lp_state.h"
@@ -58,6 +61,20 @@ static void llvmpipe_destroy( struct pipe_context *pipe )
 
    lp_print_counters();
 
+   if (LP_DEBUG & DEBUG_COUNTERS) {
+      debug_printf("llvmpipe: fs variant lookups:           %9u\n",
+                   llvmpipe->fs_variant_stats.nr_lookups);
+      debug_printf("llvmpipe: fs variant hits:              %9u\n",
+                   llvmpipe->fs_variant_stats.nr_hits);
+      debug_printf("llvmpipe: fs variant compiles:          %9u (%.3f sec)\n",
+                   llvmpipe->fs_variant_stats.nr_compiles,
+                   llvmpipe->fs_variant_stats.compile_time / 1.0e6);
+      debug_printf("llvmpipe: fs variant evictions:         %9u\n",
+                   llvmpipe->fs_variant_stats.nr_evictions);
+      debug_printf("llvmpipe: fs variant evicted recompiles:%9u\n",
+                   llvmpipe->fs_variant_stats.nr_evicted_recompiles);
+   }
+
    if (llvmpipe->blitter) {
       util_blitter_destroy(llvmpipe->blitter);
    }
@@ -93,6 +110,12 @@ static void llvmpipe_destroy( struct pipe_context *pipe )
 
    lp_delete_setup_variants(llvmpipe);
 
+   if (llvmpipe->gallivm_batch)
+      gallivm_destroy(llvmpipe->gallivm_batch);
+
+   if (llvmpipe->fs_variants_table)
+      util_hash_table_destroy(llvmpipe->fs_variants_table);
+
    align_free( llvmpipe );
 }
 
@@ -158,6 +181,11 @@ llvmpipe_create_context( struct pipe_screen *screen, void *priv )
    llvmpipe_init_context_resource_funcs( &llvmpipe->pipe );
    llvmpipe_init_surface_functions(llvmpipe);
 
+   llvmpipe->fs_variants_table =
+      util_hash_table_create(lp_fs_variant_id_hash, lp_fs_variant_id_compare);
+   if (!llvmpipe->fs_variants_table)
+      goto fail;
+
    /*
     * Create drawing context and plug our rendering stage into it.
     */
@@ -38,12 +38,14 @@
 
 #include "lp_tex_sample.h"
 #include "lp_jit.h"
+#include "lp_limits.h"
 #include "lp_setup.h"
 #include "lp_state_fs.h"
 #include "lp_state_setup.h"
 
 
 struct llvmpipe_vbuf_render;
+struct util_hash_table;
 struct draw_context;
 struct draw_stage;
 struct lp_fragment_shader;
@@ -93,6 +95,9 @@ struct llvmpipe_context {
    struct pipe_query_data_so_statistics so_stats;
    unsigned num_primitives_generated;
 
+   /** Running totals for PIPE_QUERY_PIPELINE_STATISTICS */
+   struct pipe_query_data_pipeline_statistics pipeline_statistics;
+
    unsigned dirty; /**< Mask of LP_NEW_x flags */
 
    unsigned active_occlusion_query;
@@ -132,9 +137,32 @@ struct llvmpipe_context {
    unsigned nr_fs_variants;
    unsigned nr_fs_instrs;
 
+   /** All fragment shader variants, keyed by struct lp_fs_variant_id */
+   struct util_hash_table *fs_variants_table;
+
+   /** Priority of the last evicted variant, see llvmpipe_update_fs() */
+   double fs_variants_clock;
+
+   /** Hashes of recently evicted variants, to detect their recompilation */
+   unsigned fs_variants_evicted[LP_FS_EVICTED_HISTORY];
+
+   struct {
+      unsigned nr_lookups;
+      unsigned nr_hits;
+      unsigned nr_compiles;
+      unsigned nr_evictions;
+      unsigned nr_evicted_recompiles;   /**< compiles of evicted variants */
+      int64_t compile_time;             /**< in microseconds */
+   } fs_variant_stats;
+
    struct lp_setup_variant_list_item setup_variants_list;
    unsigned nr_setup_variants;
 
+   /** State shared by the setup and fragment shader variants built by this
+    * context, see gallivm_batch_get().
+    */
+   struct gallivm_state *gallivm_batch;
+
    /** Conditional query object and mode */
    struct pipe_query *render_cond_query;
    uint render_cond_mode;
@@ -59,6 +59,9 @@ st_print_current(void);
 #define PERF_NO_BLEND       0x20  	/* disable blending */
 #define PERF_NO_DEPTH       0x40  	/* disable depth buffering entirely */
 #define PERF_NO_ALPHATEST   0x80  	/* disable alpha testing */
+#define PERF_NO_HIZ         0x100 	/* disable hierarchical Z */
+#define PERF_NO_TRI_BATCH   0x200 	/* bin small triangles one by one */
+#define PERF_NO_FAST_CLEAR  0x400 	/* write cleared tiles immediately */
 
 
 extern int LP_PERF;
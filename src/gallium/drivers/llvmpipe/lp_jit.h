@@ -162,9 +162,12 @@ enum {
  * @param dady          shader input dady
  * @param color         color buffer
  * @param depth         depth buffer
- * @param mask          mask of visible pixels in block
+ * @param depth_stride  depth buffer row stride in bytes
+ * @param depth_sample_stride  depth buffer sample stride in bytes
+ * @param mask          mask of visible pixels in block, 16 bits per sample
  * @param thread_data   task thread data
  * @param stride        color buffer row stride in bytes
+ * @param sample_stride color buffer sample stride in bytes
  */
 typedef void
 (*lp_jit_frag_func)(const struct lp_jit_context *context,
@@ -176,9 +179,12 @@ typedef void
                     const void *dady,
                     uint8_t **color,
                     void *depth,
-                    uint32_t mask,
+                    uint32_t depth_stride,
+                    uint32_t depth_sample_stride,
+                    uint64_t mask,
                     uint32_t *counter,
-                    unsigned *stride);
+                    unsigned *stride,
+                    unsigned *sample_stride);
 
 
 void
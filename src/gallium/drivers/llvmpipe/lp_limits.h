@@ -40,6 +40,20 @@
 #define TILE_SIZE (1 << TILE_ORDER)
 
 
+/**
+ * Size of the blocks of pixels the fragment shader is run on.
+ */
+#define TILE_VECTOR_HEIGHT 4
+#define TILE_VECTOR_WIDTH 4
+
+
+/**
+ * Number of samples of multisampled surfaces.  The per-sample coverage
+ * masks of a 4x4 block must fit in 64 bits.
+ */
+#define LP_MAX_SAMPLES 4
+
+
 /**
  * Max texture sizes
  */
@@ -61,9 +75,6 @@
 #define LP_MAX_WIDTH  (1 << (LP_MAX_TEXTURE_LEVELS - 1))
 
 
-#define LP_MAX_THREADS 8
-
-
 /**
  * Max bytes per scene.  This may be replaced by a runtime parameter.
  */
@@ -81,6 +92,12 @@
  */
 #define LP_MAX_SHADER_INSTRUCTIONS (128*1024)
 
+/**
+ * Number of evicted fragment shader variants remembered per context, to
+ * count the variants that get recompiled after being evicted.
+ */
+#define LP_FS_EVICTED_HISTORY 256
+
 /**
  * Max number of setup variants that will be kept around.
  *
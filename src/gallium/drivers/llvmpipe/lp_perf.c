@@ -26,8 +26,10 @@
  **************************************************************************/
 
 #include "util/u_debug.h"
+#include "util/u_math.h"
 #include "lp_debug.h"
 #include "lp_perf.h"
+#include "lp_shader_cache.h"
 
 
 
@@ -106,5 +108,70 @@ lp_print_counters(void)
       debug_printf("llvmpipe: total LLVM compile time:      %.2f sec\n", lp_count.llvm_compile_time / 1000000.0);
       debug_printf("llvmpipe: average LLVM compile time:    %.2f sec\n", lp_count.llvm_compile_time / 1000000.0 / lp_count.nr_llvm_compiles);
 
+      {
+         struct lp_shader_cache_stats stats;
+         lp_shader_cache_get_stats(&stats);
+         debug_printf("llvmpipe: shader cache hits:            %9u\n", stats.hits);
+         debug_printf("llvmpipe: shader cache misses:          %9u\n", stats.misses);
+         debug_printf("llvmpipe: shader cache stores:          %9u\n", stats.stores);
+         debug_printf("llvmpipe: shader cache uncacheable:     %9u\n", stats.uncacheable);
+      }
+
    }
 }
+
+
+/**
+ * Add the counts of src to dst.
+ */
+void
+lp_perf_add_counters(struct lp_perf_counters *dst,
+                     const struct lp_perf_counters *src)
+{
+   dst->nr_draws += src->nr_draws;
+   dst->nr_prims += src->nr_prims;
+   dst->nr_culled_prims += src->nr_culled_prims;
+   dst->setup_time += src->setup_time;
+   dst->nr_scenes += src->nr_scenes;
+   dst->scene_bytes += src->scene_bytes;
+   dst->max_scene_bytes = MAX2(dst->max_scene_bytes, src->max_scene_bytes);
+
+   dst->nr_tiles += src->nr_tiles;
+   dst->nr_commands += src->nr_commands;
+   dst->nr_blocks_shaded += src->nr_blocks_shaded;
+   dst->raster_time += src->raster_time;
+   dst->shade_time += src->shade_time;
+}
+
+
+/**
+ * Print the counters, in all builds.
+ */
+void
+lp_perf_print_counters(const char *name,
+                       const struct lp_perf_counters *counters)
+{
+   const struct lp_perf_counters *c = counters;
+
+   _debug_printf("llvmpipe: %s: draws %llu prims %llu culled %llu "
+                "setup %.3f s\n",
+                name,
+                (unsigned long long) c->nr_draws,
+                (unsigned long long) c->nr_prims,
+                (unsigned long long) c->nr_culled_prims,
+                c->setup_time / 1.0e9);
+   _debug_printf("llvmpipe: %s: scenes %llu scene memory %llu KB "
+                "(max %llu KB)\n",
+                name,
+                (unsigned long long) c->nr_scenes,
+                (unsigned long long) (c->scene_bytes >> 10),
+                (unsigned long long) (c->max_scene_bytes >> 10));
+   _debug_printf("llvmpipe: %s: tiles %llu commands %llu blocks shaded %llu "
+                "raster %.3f s shade %.3f s\n",
+                name,
+                (unsigned long long) c->nr_tiles,
+                (unsigned long long) c->nr_commands,
+                (unsigned long long) c->nr_blocks_shaded,
+                c->raster_time / 1.0e9,
+                c->shade_time / 1.0e9);
+}
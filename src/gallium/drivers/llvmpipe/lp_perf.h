@@ -68,6 +68,42 @@ struct lp_counters
 extern struct lp_counters lp_count;
 
 
+/**
+ * Profiling counters which, unlike lp_count, are compiled into all builds.
+ *
+ * Each thread counts into a struct of its own: setup into its context's,
+ * and each rasterizer thread into its task's.  The rasterizer adds the
+ * counts of a scene to the scene once all threads are done with it, and
+ * setup adds them to the context's counts when it takes the scene back,
+ * so the counters of a context only cover the work done for it.
+ */
+struct lp_perf_counters
+{
+   /* setup and binning */
+   uint64_t nr_draws;
+   uint64_t nr_prims;          /**< primitives handed to setup */
+   uint64_t nr_culled_prims;   /**< ... culled before binning */
+   uint64_t setup_time;        /**< nsecs spent setting up and binning */
+   uint64_t nr_scenes;         /**< scenes queued for rasterization */
+   uint64_t scene_bytes;       /**< total scene and texture storage queued */
+   uint64_t max_scene_bytes;   /**< ... for the largest scene */
+
+   /* rasterization */
+   uint64_t nr_tiles;          /**< non-empty tiles rasterized */
+   uint64_t nr_commands;       /**< bin commands executed */
+   uint64_t nr_blocks_shaded;  /**< 4x4 blocks run through the shader */
+   uint64_t raster_time;       /**< nsecs spent rasterizing tiles */
+   uint64_t shade_time;        /**< nsecs of that in the shader, sampled */
+};
+
+
+/**
+ * One in this many shaded blocks is timed, and its time is counted for
+ * all of them, to keep the clock reads off the fast path.
+ */
+#define LP_PERF_SHADE_SAMPLE_RATE 64
+
+
 /** Increment the named counter (only for debug builds) */
 #ifdef DEBUG
 #define LP_COUNT(counter) lp_count.counter++
@@ -88,4 +124,14 @@ extern void
 lp_print_counters(void);
 
 
+extern void
+lp_perf_add_counters(struct lp_perf_counters *dst,
+                     const struct lp_perf_counters *src);
+
+
+extern void
+lp_perf_print_counters(const char *name,
+                       const struct lp_perf_counters *counters);
+
+
 #endif /* LP_PERF_H */
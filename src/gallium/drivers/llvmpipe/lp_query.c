@@ -38,6 +38,7 @@
 #include "lp_flush.h"
 #include "lp_fence.h"
 #include "lp_query.h"
+#include "lp_screen.h"
 #include "lp_state.h"
 
 
@@ -46,6 +47,77 @@ static struct llvmpipe_query *llvmpipe_query( struct pipe_query *p )
    return (struct llvmpipe_query *)p;
 }
 
+
+static struct lp_query_results *
+lp_query_results_create(unsigned type, unsigned num_threads)
+{
+   struct lp_query_results *results = CALLOC_STRUCT(lp_query_results);
+
+   if (!results)
+      return NULL;
+
+   results->type = type;
+   results->thread = align_malloc(num_threads * sizeof results->thread[0],
+                                  sizeof results->thread[0]);
+   if (!results->thread) {
+      FREE(results);
+      return NULL;
+   }
+   memset(results->thread, 0, num_threads * sizeof results->thread[0]);
+
+   return results;
+}
+
+
+static void
+lp_query_results_destroy(struct lp_query_results *results)
+{
+   lp_fence_reference(&results->fence, NULL);
+   align_free(results->thread);
+   FREE(results);
+}
+
+
+/**
+ * Wait for the scenes writing the results, flushing the current scene
+ * first if it is one of them.
+ */
+static void
+lp_query_results_wait(struct pipe_context *pipe,
+                      struct lp_query_results *results)
+{
+   if (results->fence) {
+      if (!lp_fence_issued(results->fence))
+         llvmpipe_flush(pipe, NULL, __FUNCTION__);
+
+      if (!lp_fence_signalled(results->fence))
+         lp_fence_wait(results->fence);
+   }
+}
+
+
+/**
+ * Free the query's earlier results once the rasterizer is done with them.
+ */
+static void
+lp_query_free_retired(struct llvmpipe_query *pq)
+{
+   struct lp_query_results **prev = &pq->retired;
+
+   while (*prev) {
+      struct lp_query_results *results = *prev;
+
+      if (lp_fence_signalled(results->fence)) {
+         *prev = results->next;
+         lp_query_results_destroy(results);
+      }
+      else {
+         prev = &results->next;
+      }
+   }
+}
+
+
 static struct pipe_query *
 llvmpipe_create_query(struct pipe_context *pipe, 
                       unsigned type)
@@ -57,6 +129,15 @@ llvmpipe_create_query(struct pipe_context *pipe,
    pq = CALLOC_STRUCT( llvmpipe_query );
 
    if (pq) {
+      /* One result per rasterizer thread, or a single one when
+       * rasterizing synchronously.
+       */
+      pq->num_threads = MAX2(1, llvmpipe_screen(pipe->screen)->num_threads);
+      pq->results = lp_query_results_create(type, pq->num_threads);
+      if (!pq->results) {
+         FREE(pq);
+         return NULL;
+      }
       pq->type = type;
    }
 
@@ -72,16 +153,15 @@ llvmpipe_destroy_query(struct pipe_context *pipe, struct pipe_query *q)
    /* Ideally we would refcount queries & not get destroyed until the
     * last scene had finished with us.
     */
-   if (pq->fence) {
-      if (!lp_fence_issued(pq->fence))
-         llvmpipe_flush(pipe, NULL, __FUNCTION__);
-
-      if (!lp_fence_signalled(pq->fence))
-         lp_fence_wait(pq->fence);
-
-      lp_fence_reference(&pq->fence, NULL);
+   while (pq->retired) {
+      struct lp_query_results *results = pq->retired;
+      pq->retired = results->next;
+      lp_query_results_wait(pipe, results);
+      lp_query_results_destroy(results);
    }
 
+   lp_query_results_wait(pipe, pq->results);
+   lp_query_results_destroy(pq->results);
    FREE(pq);
 }
 
@@ -93,23 +173,27 @@ llvmpipe_get_query_result(struct pipe_context *pipe,
                           union pipe_query_result *vresult)
 {
    struct llvmpipe_query *pq = llvmpipe_query(q);
+   const struct lp_query_results *results = pq->results;
    uint64_t *result = (uint64_t *)vresult;
-   int i;
+   unsigned i;
 
-   if (!pq->fence) {
+   if (!results->fence) {
       /* no fence because there was no scene, so results is zero */
-      *result = 0;
+      if (pq->type == PIPE_QUERY_PIPELINE_STATISTICS)
+         vresult->pipeline_statistics = pq->stats;
+      else
+         *result = 0;
       return TRUE;
    }
 
-   if (!lp_fence_signalled(pq->fence)) {
-      if (!lp_fence_issued(pq->fence))
+   if (!lp_fence_signalled(results->fence)) {
+      if (!lp_fence_issued(results->fence))
          llvmpipe_flush(pipe, NULL, __FUNCTION__);
 
       if (!wait)
          return FALSE;
 
-      lp_fence_wait(pq->fence);
+      lp_fence_wait(results->fence);
    }
 
    /* Sum the results from each of the threads:
@@ -118,21 +202,21 @@ llvmpipe_get_query_result(struct pipe_context *pipe,
 
    switch (pq->type) {
    case PIPE_QUERY_OCCLUSION_COUNTER:
-      for (i = 0; i < LP_MAX_THREADS; i++) {
-         *result += pq->count[i];
+      for (i = 0; i < pq->num_threads; i++) {
+         *result += results->thread[i].count;
       }
       break;
    case PIPE_QUERY_TIME_ELAPSED:
-      for (i = 0; i < LP_MAX_THREADS; i++) {
-         if (pq->count[i] > *result) {
-            *result = pq->count[i];
+      for (i = 0; i < pq->num_threads; i++) {
+         if (results->thread[i].count > *result) {
+            *result = results->thread[i].count;
          }
       }
       break;
    case PIPE_QUERY_TIMESTAMP:
-      for (i = 0; i < LP_MAX_THREADS; i++) {
-         if (pq->count[i] > *result) {
-            *result = pq->count[i];
+      for (i = 0; i < pq->num_threads; i++) {
+         if (results->thread[i].count > *result) {
+            *result = results->thread[i].count;
          }
          if (*result == 0)
             *result = os_time_get_nano();
@@ -144,6 +228,13 @@ llvmpipe_get_query_result(struct pipe_context *pipe,
    case PIPE_QUERY_PRIMITIVES_EMITTED:
       *result = pq->num_primitives_written;
       break;
+   case PIPE_QUERY_PIPELINE_STATISTICS:
+      vresult->pipeline_statistics = pq->stats;
+      for (i = 0; i < pq->num_threads; i++) {
+         vresult->pipeline_statistics.ps_invocations +=
+            results->thread[i].ps_invocations;
+      }
+      break;
    default:
       assert(0);
       break;
@@ -158,17 +249,30 @@ llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
 {
    struct llvmpipe_context *llvmpipe = llvmpipe_context( pipe );
    struct llvmpipe_query *pq = llvmpipe_query(q);
+   struct lp_query_results *results = pq->results;
+
+   lp_query_free_retired(pq);
 
-   /* Check if the query is already in the scene.  If so, we need to
-    * flush the scene now.  Real apps shouldn't re-use a query in a
-    * frame of rendering.
+   /* The scenes writing the previous results may still be queued, or even
+    * be the current scene.  Rather than waiting for them, leave them the
+    * old results and start new ones.
     */
-   if (pq->fence && !lp_fence_issued(pq->fence)) {
-      llvmpipe_finish(pipe, __FUNCTION__);
+   if (results->fence && !lp_fence_signalled(results->fence)) {
+      struct lp_query_results *fresh =
+         lp_query_results_create(pq->type, pq->num_threads);
+
+      if (fresh) {
+         results->next = pq->retired;
+         pq->retired = results;
+         pq->results = results = fresh;
+      }
+      else {
+         lp_query_results_wait(pipe, results);
+      }
    }
 
-
-   memset(pq->count, 0, sizeof(pq->count));
+   lp_fence_reference(&results->fence, NULL);
+   memset(results->thread, 0, pq->num_threads * sizeof results->thread[0]);
    lp_setup_begin_query(llvmpipe->setup, pq);
 
    if (pq->type == PIPE_QUERY_PRIMITIVES_EMITTED) {
@@ -181,6 +285,12 @@ llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
       llvmpipe->num_primitives_generated = 0;
    }
 
+   if (pq->type == PIPE_QUERY_PIPELINE_STATISTICS) {
+      draw_get_pipeline_statistics(llvmpipe->draw,
+                                   &llvmpipe->pipeline_statistics);
+      pq->stats = llvmpipe->pipeline_statistics;
+   }
+
    if (pq->type == PIPE_QUERY_OCCLUSION_COUNTER) {
       llvmpipe->active_occlusion_query = TRUE;
       llvmpipe->dirty |= LP_NEW_OCCLUSION_QUERY;
@@ -204,6 +314,19 @@ llvmpipe_end_query(struct pipe_context *pipe, struct pipe_query *q)
       pq->num_primitives_generated = llvmpipe->num_primitives_generated;
    }
 
+   if (pq->type == PIPE_QUERY_PIPELINE_STATISTICS) {
+      const struct pipe_query_data_pipeline_statistics *stats =
+         &llvmpipe->pipeline_statistics;
+
+      draw_get_pipeline_statistics(llvmpipe->draw,
+                                   &llvmpipe->pipeline_statistics);
+      pq->stats.ia_vertices = stats->ia_vertices - pq->stats.ia_vertices;
+      pq->stats.vs_invocations =
+         stats->vs_invocations - pq->stats.vs_invocations;
+      pq->stats.c_invocations = stats->c_invocations - pq->stats.c_invocations;
+      pq->stats.c_primitives = stats->c_primitives - pq->stats.c_primitives;
+   }
+
    if (pq->type == PIPE_QUERY_OCCLUSION_COUNTER) {
       assert(llvmpipe->active_occlusion_query);
       llvmpipe->active_occlusion_query = FALSE;
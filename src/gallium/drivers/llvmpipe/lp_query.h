@@ -35,18 +35,49 @@
 
 #include <limits.h>
 #include "os/os_thread.h"
+#include "pipe/p_defines.h"
 #include "lp_limits.h"
 
 
 struct llvmpipe_context;
 
 
-struct llvmpipe_query {
-   uint64_t count[LP_MAX_THREADS];  /* a counter for each thread */
+/**
+ * One rasterizer thread's share of a query result.  Each thread has a
+ * cache line of its own, so the threads never write to the same line.
+ */
+struct lp_query_thread_result {
+   uint64_t count;                  /* samples passed, elapsed or end time */
+   uint64_t ps_invocations;         /* fragments shaded */
+   uint64_t pad[6];
+};
+
+
+/**
+ * The results of one begin_query/end_query pair, written by the
+ * rasterizer threads.  A query which is begun again while the scenes
+ * writing its previous results are still queued gets new results, so
+ * that it needn't wait for them.
+ */
+struct lp_query_results {
+   unsigned type;                   /* PIPE_QUERY_* */
+   struct lp_query_thread_result *thread;  /* one per rasterizer thread */
    struct lp_fence *fence;          /* fence from last scene this was binned in */
+   struct lp_query_results *next;   /* list of results still in use */
+};
+
+
+struct llvmpipe_query {
+   struct lp_query_results *results;   /* of the current begin/end pair */
+   struct lp_query_results *retired;   /* earlier ones, still being written */
+   unsigned num_threads;            /* number of entries in results->thread[] */
    unsigned type;                   /* PIPE_QUERY_* */
    unsigned num_primitives_generated;
    unsigned num_primitives_written;
+   /* setup's counts for PIPE_QUERY_PIPELINE_STATISTICS, at begin_query
+    * and then the difference at end_query
+    */
+   struct pipe_query_data_pipeline_statistics stats;
 };
 
 
@@ -31,9 +31,11 @@
 #include "util/u_rect.h"
 #include "util/u_surface.h"
 #include "util/u_pack_color.h"
+#include "util/u_string.h"
 
 #include "os/os_time.h"
 
+#include "lp_affinity.h"
 #include "lp_scene_queue.h"
 #include "lp_debug.h"
 #include "lp_fence.h"
@@ -46,6 +48,13 @@
 #include "lp_tex_sample.h"
 
 
+/**
+ * Max number of scenes, from all contexts, waiting to be rasterized before
+ * lp_rast_queue_scene() blocks.
+ */
+#define RAST_MAX_QUEUED_SCENES 64
+
+
 #ifdef DEBUG
 int jit_line = 0;
 const struct lp_rast_state *jit_state = NULL;
@@ -53,6 +62,14 @@ const struct lp_rasterizer_task *jit_task = NULL;
 #endif
 
 
+const int lp_sample_pos[LP_MAX_SAMPLES][2] = {
+   { -2, -6 },
+   {  6, -2 },
+   { -6,  2 },
+   {  2,  6 }
+};
+
+
 /**
  * Begin rasterizing a scene.
  * Called once per scene by one thread.
@@ -67,16 +84,191 @@ lp_rast_begin( struct lp_rasterizer *rast,
    LP_DBG(DEBUG_RAST, "%s\n", __FUNCTION__);
 
    lp_scene_begin_rasterization( scene );
-   lp_scene_bin_iter_begin( scene );
+   lp_scene_bin_iter_begin( scene, MAX2(1, rast->num_threads) );
 }
 
 
+/**
+ * Finish rasterizing a scene: unmap the framebuffer, signal the scene's
+ * fence and hand the scene back to the setup module which queued it.
+ * Called once per scene by one thread, after all threads are done.
+ */
 static void
 lp_rast_end( struct lp_rasterizer *rast )
 {
-   lp_scene_end_rasterization( rast->curr_scene );
+   struct lp_scene *scene = rast->curr_scene;
+   struct lp_fence *fence = NULL;
+   unsigned i;
+
+   lp_scene_end_rasterization( scene );
+
+   /* All threads are done with the scene, collect their counts */
+   pipe_mutex_lock(rast->perf_mutex);
+   for (i = 0; i < MAX2(1, rast->num_threads); i++) {
+      struct lp_rasterizer_task *task = &rast->tasks[i];
+
+      lp_perf_add_counters(&scene->perf, &task->perf);
+      lp_perf_add_counters(&task->perf_total, &task->perf);
+      memset(&task->perf, 0, sizeof task->perf);
+   }
+   pipe_mutex_unlock(rast->perf_mutex);
 
    rast->curr_scene = NULL;
+
+   /* Setup may reset the scene, and drop its fence reference, as soon
+    * as the scene is in the empty queue.
+    */
+   lp_fence_reference(&fence, scene->fence);
+
+   lp_scene_enqueue( scene->empty_queue, scene );
+
+   if (fence) {
+      lp_fence_signal(fence);
+      lp_fence_reference(&fence, NULL);
+   }
+}
+
+
+/**
+ * Set all the hierarchical Z bounds of the tile.
+ */
+static void
+lp_rast_hiz_set(struct lp_rasterizer_task *task, float zmax)
+{
+   unsigned i;
+
+   task->hiz.zmax_64 = zmax;
+   for (i = 0; i < Elements(task->hiz.zmax_16); i++)
+      task->hiz.zmax_16[i] = zmax;
+   for (i = 0; i < Elements(task->hiz.zmax_4); i++)
+      task->hiz.zmax_4[i] = zmax;
+}
+
+
+/**
+ * Set up hierarchical Z for a new tile.  The depth buffer contents are
+ * not known until the tile is cleared or fully covered.
+ */
+static void
+lp_rast_hiz_begin_tile(struct lp_rasterizer_task *task)
+{
+   const struct pipe_surface *zsbuf = task->scene->fb.zsbuf;
+   const struct util_format_description *desc;
+
+   task->hiz.enabled = FALSE;
+
+   if (!zsbuf || !task->depth_tile || (LP_PERF & PERF_NO_HIZ))
+      return;
+
+   /* The bounds don't account for the sample positions */
+   if (task->scene->nr_samples > 1)
+      return;
+
+   desc = util_format_description(zsbuf->format);
+   if (!util_format_has_depth(desc) || desc->block.bits > 32)
+      return;
+
+   if (desc->channel[desc->swizzle[0]].type == UTIL_FORMAT_TYPE_FLOAT) {
+      task->hiz.eps = 0.0f;
+   }
+   else {
+      /* Allow for the rounding of the clear value and the fragments'
+       * depth to the format.
+       */
+      task->hiz.eps = (float)
+         (2.0 / (ldexp(1.0, desc->channel[desc->swizzle[0]].size) - 1.0));
+   }
+
+   task->hiz.enabled = TRUE;
+   lp_rast_hiz_set(task, LP_HIZ_UNKNOWN);
+}
+
+
+/**
+ * Fast clear state of the current tile of a framebuffer surface's resource.
+ */
+static INLINE struct llvmpipe_tile_clear *
+lp_rast_tile_clear(const struct lp_rasterizer_task *task,
+                   const struct llvmpipe_resource *lpr)
+{
+   const unsigned tx = task->x / TILE_SIZE;
+   const unsigned ty = task->y / TILE_SIZE;
+
+   assert(tx < lpr->tiles_x);
+   assert(ty < lpr->tiles_y);
+
+   return &lpr->tile_clear[ty * lpr->tiles_x + tx];
+}
+
+
+/**
+ * Write the pixels of a surface's pending clear of the current tile.
+ */
+static void
+lp_rast_fill_tile_clear(struct lp_rasterizer_task *task,
+                        struct llvmpipe_resource *lpr,
+                        uint8_t *map, unsigned stride)
+{
+   struct llvmpipe_tile_clear *tc = lp_rast_tile_clear(task, lpr);
+
+   if (tc->pending) {
+      util_fill_rect(map, lpr->base.format, stride,
+                     task->x, task->y, TILE_SIZE, TILE_SIZE,
+                     &tc->value);
+      tc->pending = FALSE;
+   }
+}
+
+
+/**
+ * Write the pending clears of the current tile before a command which
+ * renders to it.  An opaque whole tile shade overwrites all of the (only)
+ * color buffer and doesn't touch the depth buffer, so it simply cancels
+ * the color clear.
+ */
+static void
+lp_rast_resolve_tile_clears(struct lp_rasterizer_task *task,
+                            unsigned cmd,
+                            const union lp_rast_cmd_arg arg)
+{
+   const struct lp_scene *scene = task->scene;
+   struct llvmpipe_resource *lpr;
+   unsigned i;
+
+   switch (cmd) {
+   case LP_RAST_OP_CLEAR_COLOR:
+   case LP_RAST_OP_CLEAR_ZSTENCIL:
+   case LP_RAST_OP_BEGIN_QUERY:
+   case LP_RAST_OP_END_QUERY:
+   case LP_RAST_OP_SET_STATE:
+      return;
+   case LP_RAST_OP_SHADE_TILE_OPAQUE:
+      if (arg.shade_tile->disable)
+         return;
+      assert(scene->fb.nr_cbufs == 1);
+      lpr = scene->cbufs[0].fast_clear;
+      if (lpr)
+         lp_rast_tile_clear(task, lpr)->pending = FALSE;
+      lpr = scene->zsbuf.fast_clear;
+      task->clear_pending = lpr && lp_rast_tile_clear(task, lpr)->pending;
+      return;
+   default:
+      break;
+   }
+
+   for (i = 0; i < scene->fb.nr_cbufs; i++) {
+      lpr = scene->cbufs[i].fast_clear;
+      if (lpr)
+         lp_rast_fill_tile_clear(task, lpr, scene->cbufs[i].map,
+                                 scene->cbufs[i].stride);
+   }
+
+   lpr = scene->zsbuf.fast_clear;
+   if (lpr)
+      lp_rast_fill_tile_clear(task, lpr, scene->zsbuf.map,
+                              scene->zsbuf.stride);
+
+   task->clear_pending = FALSE;
 }
 
 
@@ -90,7 +282,7 @@ lp_rast_tile_begin(struct lp_rasterizer_task *task,
                    const struct cmd_bin *bin)
 {
    const struct lp_scene *scene = task->scene;
-   enum lp_texture_usage usage;
+   unsigned i;
 
    LP_DBG(DEBUG_RAST, "%s %d,%d\n", __FUNCTION__, bin->x, bin->y);
 
@@ -102,38 +294,28 @@ lp_rast_tile_begin(struct lp_rasterizer_task *task,
    memset(task->color_tiles, 0, sizeof(task->color_tiles));
 
    /* get pointer to depth/stencil tile */
-   {
-      struct pipe_surface *zsbuf = task->scene->fb.zsbuf;
-      if (zsbuf) {
-         struct llvmpipe_resource *lpt = llvmpipe_resource(zsbuf->texture);
-
-         if (scene->has_depthstencil_clear)
-            usage = LP_TEX_USAGE_WRITE_ALL;
-         else
-            usage = LP_TEX_USAGE_READ_WRITE;
-
-         /* "prime" the tile: convert data from linear to tiled if necessary
-          * and update the tile's layout info.
-          */
-         (void) llvmpipe_get_texture_tile(lpt,
-                                          zsbuf->u.tex.first_layer,
-                                          zsbuf->u.tex.level,
-                                          usage,
-                                          task->x,
-                                          task->y);
-         /* Get actual pointer to the tile data.  Note that depth/stencil
-          * data is tiled differently than color data.
-          */
-         task->depth_tile = lp_rast_get_depth_block_pointer(task,
-                                                            task->x,
-                                                            task->y);
+   if (scene->fb.zsbuf) {
+      task->depth_tile = lp_rast_get_depth_block_pointer(task,
+                                                         task->x,
+                                                         task->y);
+      assert(task->depth_tile);
+   }
+   else {
+      task->depth_tile = NULL;
+   }
 
-         assert(task->depth_tile);
-      }
-      else {
-         task->depth_tile = NULL;
-      }
+   /* Tiles cleared by earlier scenes may still have to be filled */
+   task->clear_pending = FALSE;
+   for (i = 0; i < scene->fb.nr_cbufs; i++) {
+      if (scene->cbufs[i].fast_clear &&
+          lp_rast_tile_clear(task, scene->cbufs[i].fast_clear)->pending)
+         task->clear_pending = TRUE;
    }
+   if (scene->zsbuf.fast_clear &&
+       lp_rast_tile_clear(task, scene->zsbuf.fast_clear)->pending)
+      task->clear_pending = TRUE;
+
+   lp_rast_hiz_begin_tile(task);
 }
 
 
@@ -163,18 +345,34 @@ lp_rast_clear_color(struct lp_rasterizer_task *task,
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
       const struct lp_scene *scene = task->scene;
       union util_color uc;
+      unsigned s;
 
       util_pack_color(arg.clear_color,
                       scene->fb.cbufs[i]->format, &uc);
 
-      util_fill_rect(scene->cbufs[i].map,
-                     scene->fb.cbufs[i]->format,
-                     scene->cbufs[i].stride,
-                     task->x,
-                     task->y,
-                     TILE_SIZE,
-                     TILE_SIZE,
-                     &uc);
+      /* Just record the clear value, see lp_rast_resolve_tile_clears() */
+      if (scene->cbufs[i].fast_clear) {
+         struct llvmpipe_resource *lpr = scene->cbufs[i].fast_clear;
+         struct llvmpipe_tile_clear *tc = lp_rast_tile_clear(task, lpr);
+
+         tc->value = uc;
+         tc->pending = TRUE;
+         lpr->clear_pending = TRUE;
+         task->clear_pending = TRUE;
+         continue;
+      }
+
+      for (s = 0; s < scene->nr_samples; s++) {
+         util_fill_rect(scene->cbufs[i].map +
+                        s * scene->cbufs[i].sample_stride,
+                        scene->fb.cbufs[i]->format,
+                        scene->cbufs[i].stride,
+                        task->x,
+                        task->y,
+                        TILE_SIZE,
+                        TILE_SIZE,
+                        &uc);
+      }
    }
 
    LP_COUNT(nr_color_tile_clear);
@@ -186,42 +384,24 @@ lp_rast_clear_color(struct lp_rasterizer_task *task,
 
 
 /**
- * Clear the rasterizer's current z/stencil tile.
- * This is a bin command called during bin processing.
+ * Clear a tile sized area of one sample of the z/stencil buffer, a row at
+ * a time.
  */
 static void
-lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
-                       const union lp_rast_cmd_arg arg)
+clear_zstencil_tile(uint8_t *dst, unsigned dst_stride, unsigned block_size,
+                    uint32_t clear_value, uint32_t clear_mask)
 {
-   const struct lp_scene *scene = task->scene;
-   uint32_t clear_value = arg.clear_zstencil.value;
-   uint32_t clear_mask = arg.clear_zstencil.mask;
-   const unsigned height = TILE_SIZE / TILE_VECTOR_HEIGHT;
-   const unsigned width = TILE_SIZE * TILE_VECTOR_HEIGHT;
-   const unsigned block_size = scene->zsbuf.blocksize;
-   const unsigned dst_stride = scene->zsbuf.stride * TILE_VECTOR_HEIGHT;
-   uint8_t *dst;
+   const unsigned height = TILE_SIZE;
+   const unsigned width = TILE_SIZE;
    unsigned i, j;
 
-   LP_DBG(DEBUG_RAST, "%s: value=0x%08x, mask=0x%08x\n",
-           __FUNCTION__, clear_value, clear_mask);
-
-   /*
-    * Clear the area of the swizzled depth/depth buffer matching this tile, in
-    * stripes of TILE_VECTOR_HEIGHT x TILE_SIZE at a time.
-    *
-    * The swizzled depth format is such that the depths for
-    * TILE_VECTOR_HEIGHT x TILE_VECTOR_WIDTH pixels have consecutive offsets.
-    */
-
-   dst = task->depth_tile;
-
-   clear_value &= clear_mask;
-
    switch (block_size) {
    case 1:
       assert(clear_mask == 0xff);
-      memset(dst, (uint8_t) clear_value, height * width);
+      for (i = 0; i < height; i++) {
+         memset(dst, (uint8_t) clear_value, width);
+         dst += dst_stride;
+      }
       break;
    case 2:
       if (clear_mask == 0xffff) {
@@ -270,6 +450,95 @@ lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
 }
 
 
+/**
+ * Clear the rasterizer's current z/stencil tile.
+ * This is a bin command called during bin processing.
+ */
+static void
+lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
+                       const union lp_rast_cmd_arg arg)
+{
+   const struct lp_scene *scene = task->scene;
+   uint32_t clear_value = arg.clear_zstencil.value;
+   uint32_t clear_mask = arg.clear_zstencil.mask;
+   const unsigned block_size = scene->zsbuf.blocksize;
+   const unsigned dst_stride = scene->zsbuf.stride;
+   struct llvmpipe_resource *lpr;
+   uint8_t *dst;
+   unsigned s;
+
+   LP_DBG(DEBUG_RAST, "%s: value=0x%08x, mask=0x%08x\n",
+           __FUNCTION__, clear_value, clear_mask);
+
+   dst = task->depth_tile;
+
+   clear_value &= clear_mask;
+
+   if (task->hiz.enabled) {
+      enum pipe_format format = scene->fb.zsbuf->format;
+      uint32_t z_mask = util_pack_mask_z(format, 0xffffffff);
+
+      if ((clear_mask & z_mask) == z_mask &&
+          !(task->state && (task->state->variant->hiz & LP_HIZ_INVALIDATE))) {
+         union {
+            uint32_t ui;
+            uint16_t us;
+         } packed;
+         float z;
+
+         if (block_size == 2)
+            packed.us = (uint16_t) clear_value;
+         else
+            packed.ui = clear_value;
+
+         util_format_description(format)->unpack_z_float(&z, 0,
+                                                          (uint8_t *) &packed,
+                                                          0, 1, 1);
+         lp_rast_hiz_set(task, z + task->hiz.eps);
+      }
+      else if (clear_mask & z_mask) {
+         lp_rast_hiz_set(task, LP_HIZ_UNKNOWN);
+      }
+   }
+
+   lpr = scene->zsbuf.fast_clear;
+   if (lpr) {
+      const uint32_t full_mask =
+         block_size == 4 ? 0xffffffff : (1 << (block_size * 8)) - 1;
+
+      if (block_size <= 4 && clear_mask == full_mask) {
+         /* Just record the clear value, see lp_rast_resolve_tile_clears() */
+         struct llvmpipe_tile_clear *tc = lp_rast_tile_clear(task, lpr);
+
+         switch (block_size) {
+         case 1:
+            tc->value.ub = (uint8_t) clear_value;
+            break;
+         case 2:
+            tc->value.us = (uint16_t) clear_value;
+            break;
+         default:
+            tc->value.ui = clear_value;
+            break;
+         }
+         tc->pending = TRUE;
+         lpr->clear_pending = TRUE;
+         task->clear_pending = TRUE;
+         return;
+      }
+
+      /* The bits not cleared must hold their values */
+      lp_rast_fill_tile_clear(task, lpr, scene->zsbuf.map,
+                              scene->zsbuf.stride);
+   }
+
+   for (s = 0; s < scene->nr_samples; s++) {
+      clear_zstencil_tile(dst + s * scene->zsbuf.sample_stride,
+                          dst_stride, block_size, clear_value, clear_mask);
+   }
+}
+
+
 
 /**
  * Run the shader on all blocks in a tile.  This is used when a tile is
@@ -301,17 +570,26 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
    }
    variant = state->variant;
 
+   if (lp_rast_hiz_occluded(task, inputs, tile_x, tile_y, TILE_SIZE))
+      return;
+
    /* render the whole 64x64 tile in 4x4 chunks */
    for (y = 0; y < TILE_SIZE; y += 4){
       for (x = 0; x < TILE_SIZE; x += 4) {
          uint8_t *color[PIPE_MAX_COLOR_BUFS];
          unsigned stride[PIPE_MAX_COLOR_BUFS];
+         unsigned sample_stride[PIPE_MAX_COLOR_BUFS];
          uint32_t *depth;
+         int64_t start;
          unsigned i;
 
+         if (lp_rast_hiz_occluded(task, inputs, tile_x + x, tile_y + y, 4))
+            continue;
+
          /* color buffer */
          for (i = 0; i < scene->fb.nr_cbufs; i++){
             stride[i] = scene->cbufs[i].stride;
+            sample_stride[i] = scene->cbufs[i].sample_stride;
 
             color[i] = lp_rast_get_unswizzled_color_block_pointer(task, i, tile_x + x, tile_y + y);
          }
@@ -319,6 +597,9 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
          /* depth buffer */
          depth = lp_rast_get_depth_block_pointer(task, tile_x + x, tile_y + y);
 
+         task->ps_invocations += 16;
+         start = lp_rast_shade_begin(task);
+
          /* run shader on 4x4 block */
          BEGIN_JIT_CALL(state, task);
          variant->jit_function[RAST_WHOLE]( &state->jit_context,
@@ -329,12 +610,24 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
                                             GET_DADY(inputs),
                                             color,
                                             depth,
-                                            0xffff,
+                                            scene->zsbuf.stride,
+                                            scene->zsbuf.sample_stride,
+                                            LP_RAST_MASK_ALL,
                                             &task->vis_counter,
-                                            stride);
+                                            stride,
+                                            sample_stride);
          END_JIT_CALL();
+         lp_rast_shade_end(task, start);
+
+         lp_rast_hiz_update(task, inputs, tile_x + x, tile_y + y, 4);
       }
    }
+
+   for (y = 0; y < TILE_SIZE; y += 16) {
+      for (x = 0; x < TILE_SIZE; x += 16)
+         lp_rast_hiz_update(task, inputs, tile_x + x, tile_y + y, 16);
+   }
+   lp_rast_hiz_update(task, inputs, tile_x, tile_y, TILE_SIZE);
 }
 
 
@@ -363,19 +656,22 @@ lp_rast_shade_tile_opaque(struct lp_rasterizer_task *task,
  * This is a bin command called during bin processing.
  * \param x  X position of quad in window coords
  * \param y  Y position of quad in window coords
+ * \param mask  pixels to shade, 16 bits for each sample of the framebuffer
  */
 void
 lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
                          const struct lp_rast_shader_inputs *inputs,
                          unsigned x, unsigned y,
-                         unsigned mask)
+                         uint64_t mask)
 {
    const struct lp_rast_state *state = task->state;
    struct lp_fragment_shader_variant *variant = state->variant;
    const struct lp_scene *scene = task->scene;
    uint8_t *color[PIPE_MAX_COLOR_BUFS];
    unsigned stride[PIPE_MAX_COLOR_BUFS];
+   unsigned sample_stride[PIPE_MAX_COLOR_BUFS];
    void *depth;
+   int64_t start;
    unsigned i;
 
    assert(state);
@@ -389,9 +685,13 @@ lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
    assert((x % 4) == 0);
    assert((y % 4) == 0);
 
+   if (lp_rast_hiz_occluded(task, inputs, x, y, 4))
+      return;
+
    /* color buffer */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
       stride[i] = scene->cbufs[i].stride;
+      sample_stride[i] = scene->cbufs[i].sample_stride;
 
       color[i] = lp_rast_get_unswizzled_color_block_pointer(task, i, x, y);
    }
@@ -402,6 +702,9 @@ lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
 
    assert(lp_check_alignment(state->jit_context.u8_blend_color, 16));
 
+   task->ps_invocations += lp_rast_mask_pixels(mask);
+   start = lp_rast_shade_begin(task);
+
    /* run shader on 4x4 block */
    BEGIN_JIT_CALL(state, task);
    variant->jit_function[RAST_EDGE_TEST](&state->jit_context,
@@ -412,10 +715,94 @@ lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
                                          GET_DADY(inputs),
                                          color,
                                          depth,
+                                         scene->zsbuf.stride,
+                                         scene->zsbuf.sample_stride,
                                          mask,
                                          &task->vis_counter,
-                                         stride);
+                                         stride,
+                                         sample_stride);
    END_JIT_CALL();
+   lp_rast_shade_end(task, start);
+}
+
+
+
+/**
+ * Compute shading for several 4x4 blocks of pixels inside triangles of the
+ * current state.  Equivalent to calling lp_rast_shade_quads_mask() for
+ * each block, but the state and color tile lookups are done once.
+ */
+void
+lp_rast_shade_quads_masks(struct lp_rasterizer_task *task,
+                          const struct lp_rast_block_mask *blocks,
+                          unsigned count)
+{
+   const struct lp_rast_state *state = task->state;
+   const struct lp_scene *scene = task->scene;
+   lp_jit_frag_func jit_function;
+   uint8_t *color_tile[PIPE_MAX_COLOR_BUFS];
+   unsigned format_bytes[PIPE_MAX_COLOR_BUFS];
+   unsigned stride[PIPE_MAX_COLOR_BUFS];
+   unsigned sample_stride[PIPE_MAX_COLOR_BUFS];
+   unsigned i, j;
+
+   assert(state);
+
+   if (!count)
+      return;
+
+   jit_function = state->variant->jit_function[RAST_EDGE_TEST];
+
+   for (i = 0; i < scene->fb.nr_cbufs; i++) {
+      stride[i] = scene->cbufs[i].stride;
+      sample_stride[i] = scene->cbufs[i].sample_stride;
+      format_bytes[i] = util_format_get_blocksize(scene->fb.cbufs[i]->format);
+      color_tile[i] = lp_rast_get_unswizzled_color_tile_pointer(task, i,
+                                                   LP_TEX_USAGE_READ_WRITE);
+   }
+
+   for (j = 0; j < count; j++) {
+      const struct lp_rast_block_mask *block = &blocks[j];
+      const struct lp_rast_shader_inputs *inputs = block->inputs;
+      const unsigned px = block->x % TILE_SIZE;
+      const unsigned py = block->y % TILE_SIZE;
+      uint8_t *color[PIPE_MAX_COLOR_BUFS];
+      void *depth;
+      int64_t start;
+
+      assert(block->x % 4 == 0);
+      assert(block->y % 4 == 0);
+
+      if (lp_rast_hiz_occluded(task, inputs, block->x, block->y, 4))
+         continue;
+
+      for (i = 0; i < scene->fb.nr_cbufs; i++)
+         color[i] = color_tile[i] + px * format_bytes[i] + py * stride[i];
+
+      depth = lp_rast_get_depth_block_pointer(task, block->x, block->y);
+
+      task->ps_invocations += lp_rast_mask_pixels(block->mask);
+      start = lp_rast_shade_begin(task);
+
+      /* run shader on 4x4 block */
+      BEGIN_JIT_CALL(state, task);
+      jit_function(&state->jit_context,
+                   block->x, block->y,
+                   inputs->frontfacing,
+                   GET_A0(inputs),
+                   GET_DADX(inputs),
+                   GET_DADY(inputs),
+                   color,
+                   depth,
+                   scene->zsbuf.stride,
+                   scene->zsbuf.sample_stride,
+                   block->mask,
+                   &task->vis_counter,
+                   stride,
+                   sample_stride);
+      END_JIT_CALL();
+      lp_rast_shade_end(task, start);
+   }
 }
 
 
@@ -429,17 +816,20 @@ static void
 lp_rast_begin_query(struct lp_rasterizer_task *task,
                     const union lp_rast_cmd_arg arg)
 {
-   struct llvmpipe_query *pq = arg.query_obj;
+   struct lp_query_results *results = arg.query_results;
 
-   assert(task->query[pq->type] == NULL);
+   assert(task->query[results->type] == NULL);
 
-   switch (pq->type) {
+   switch (results->type) {
    case PIPE_QUERY_OCCLUSION_COUNTER:
       task->vis_counter = 0;
       break;
    case PIPE_QUERY_TIME_ELAPSED:
       task->query_start = os_time_get_nano();
       break;
+   case PIPE_QUERY_PIPELINE_STATISTICS:
+      task->ps_invocations = 0;
+      break;
    case PIPE_QUERY_PRIMITIVES_GENERATED:
    case PIPE_QUERY_PRIMITIVES_EMITTED:
       break;
@@ -448,7 +838,7 @@ lp_rast_begin_query(struct lp_rasterizer_task *task,
       break;
    }
 
-   task->query[pq->type] = pq;
+   task->query[results->type] = results;
 }
 
 
@@ -461,18 +851,25 @@ static void
 lp_rast_end_query(struct lp_rasterizer_task *task,
                   const union lp_rast_cmd_arg arg)
 {
-   struct llvmpipe_query *pq = arg.query_obj;
-   assert(task->query[pq->type] == pq || pq->type == PIPE_QUERY_TIMESTAMP);
+   struct lp_query_results *results = arg.query_results;
+   struct lp_query_thread_result *result =
+      &results->thread[task->thread_index];
+
+   assert(task->query[results->type] == results ||
+          results->type == PIPE_QUERY_TIMESTAMP);
 
-   switch (pq->type) {
+   switch (results->type) {
    case PIPE_QUERY_OCCLUSION_COUNTER:
-      pq->count[task->thread_index] += task->vis_counter;
+      result->count += task->vis_counter;
       break;
    case PIPE_QUERY_TIME_ELAPSED:
-      pq->count[task->thread_index] = os_time_get_nano() - task->query_start;
+      result->count = os_time_get_nano() - task->query_start;
       break;
    case PIPE_QUERY_TIMESTAMP:
-      pq->count[task->thread_index] = os_time_get_nano();
+      result->count = os_time_get_nano();
+      break;
+   case PIPE_QUERY_PIPELINE_STATISTICS:
+      result->ps_invocations += task->ps_invocations;
       break;
    case PIPE_QUERY_PRIMITIVES_GENERATED:
    case PIPE_QUERY_PRIMITIVES_EMITTED:
@@ -482,8 +879,8 @@ lp_rast_end_query(struct lp_rasterizer_task *task,
       break;
    }
 
-   if (task->query[pq->type] == pq) {
-      task->query[pq->type] = NULL;
+   if (task->query[results->type] == results) {
+      task->query[results->type] = NULL;
    }
 }
 
@@ -493,6 +890,12 @@ lp_rast_set_state(struct lp_rasterizer_task *task,
                   const union lp_rast_cmd_arg arg)
 {
    task->state = arg.state;
+
+   /* The hierarchical Z bounds only hold while the depth values can't
+    * increase.
+    */
+   if (task->hiz.enabled && (task->state->variant->hiz & LP_HIZ_INVALIDATE))
+      lp_rast_hiz_set(task, LP_HIZ_UNKNOWN);
 }
 
 
@@ -538,6 +941,7 @@ static lp_rast_cmd_func dispatch[LP_RAST_OP_MAX] =
    lp_rast_begin_query,
    lp_rast_end_query,
    lp_rast_set_state,
+   lp_rast_triangle_batch,
 };
 
 
@@ -552,7 +956,10 @@ do_rasterize_bin(struct lp_rasterizer_task *task,
       lp_debug_bin(bin);
 
    for (block = bin->head; block; block = block->next) {
+      task->perf.nr_commands += block->count;
       for (k = 0; k < block->count; k++) {
+         if (task->clear_pending)
+            lp_rast_resolve_tile_clears(task, block->cmd[k], block->arg[k]);
          dispatch[block->cmd[k]]( task, block->arg[k] );
       }
    }
@@ -570,12 +977,17 @@ static void
 rasterize_bin(struct lp_rasterizer_task *task,
               const struct cmd_bin *bin )
 {
+   int64_t start = os_time_get_nano();
+
    lp_rast_tile_begin( task, bin );
 
    do_rasterize_bin(task, bin);
 
    lp_rast_tile_end(task);
 
+   task->perf.nr_tiles++;
+   task->perf.raster_time += os_time_get_nano() - start;
+
 
    /* Debug/Perf flags:
     */
@@ -610,37 +1022,37 @@ static void
 rasterize_scene(struct lp_rasterizer_task *task,
                 struct lp_scene *scene)
 {
+   int64_t start = os_time_get();
+
    task->scene = scene;
+   task->stats.nr_scenes++;
 
    if (!task->rast->no_rast && !scene->discard) {
       /* loop over scene bins, rasterize each */
-#if 0
-      {
-         unsigned i, j;
-         for (i = 0; i < scene->tiles_x; i++) {
-            for (j = 0; j < scene->tiles_y; j++) {
-               struct cmd_bin *bin = lp_scene_get_bin(scene, i, j);
-               rasterize_bin(task, bin, i, j);
-            }
+      const unsigned num_queues = MAX2(1, task->rast->num_threads);
+      struct cmd_bin *bin;
+      unsigned queue;
+
+      assert(scene);
+      while ((bin = lp_scene_bin_iter_next(scene,
+                                           task->bin_queue_order, num_queues,
+                                           &queue,
+                                           &task->stats.nr_bin_retries))) {
+         if (queue > 0) {
+            const unsigned owner = task->bin_queue_order[queue];
+            task->stats.nr_stolen_bins++;
+            if (task->rast->tasks[owner].node != task->node)
+               task->stats.nr_remote_bins++;
          }
-      }
-#else
-      {
-         struct cmd_bin *bin;
-
-         assert(scene);
-         while ((bin = lp_scene_bin_iter_next(scene))) {
-            if (!is_empty_bin( bin ))
-               rasterize_bin(task, bin);
+
+         if (!is_empty_bin( bin )) {
+            rasterize_bin(task, bin);
+            task->stats.nr_bins++;
          }
       }
-#endif
    }
 
-
-   if (scene->fence) {
-      lp_fence_signal(scene->fence);
-   }
+   task->stats.busy_time += os_time_get() - start;
 
    task->scene = NULL;
 }
@@ -648,6 +1060,9 @@ rasterize_scene(struct lp_rasterizer_task *task,
 
 /**
  * Called by setup module when it has something for us to render.
+ * With rasterizer threads this returns as soon as the scene is queued;
+ * the scene's fence is signalled and the scene is put on its empty queue
+ * once it has been rasterized.
  */
 void
 lp_rast_queue_scene( struct lp_rasterizer *rast,
@@ -682,23 +1097,6 @@ lp_rast_queue_scene( struct lp_rasterizer *rast,
 }
 
 
-void
-lp_rast_finish( struct lp_rasterizer *rast )
-{
-   if (rast->num_threads == 0) {
-      /* nothing to do */
-   }
-   else {
-      int i;
-
-      /* wait for work to complete */
-      for (i = 0; i < rast->num_threads; i++) {
-         pipe_semaphore_wait(&rast->tasks[i].work_done);
-      }
-   }
-}
-
-
 /**
  * This is the thread's main entrypoint.
  * It's a simple loop:
@@ -711,6 +1109,10 @@ static PIPE_THREAD_ROUTINE( thread_function, init_data )
    struct lp_rasterizer_task *task = (struct lp_rasterizer_task *) init_data;
    struct lp_rasterizer *rast = task->rast;
    boolean debug = false;
+   int64_t idle_start;
+
+   if (task->cpu >= 0)
+      lp_affinity_pin_thread(task->cpu);
 
    while (1) {
       /* wait for work */
@@ -733,7 +1135,9 @@ static PIPE_THREAD_ROUTINE( thread_function, init_data )
       /* Wait for all threads to get here so that threads[1+] don't
        * get a null rast->curr_scene pointer.
        */
+      idle_start = os_time_get();
       pipe_barrier_wait( &rast->barrier );
+      task->stats.idle_time += os_time_get() - idle_start;
 
       /* do work */
       if (debug)
@@ -743,19 +1147,16 @@ static PIPE_THREAD_ROUTINE( thread_function, init_data )
                       rast->curr_scene);
       
       /* wait for all threads to finish with this scene */
+      idle_start = os_time_get();
       pipe_barrier_wait( &rast->barrier );
+      task->stats.idle_time += os_time_get() - idle_start;
 
-      /* XXX: shouldn't be necessary:
-       */
       if (task->thread_index == 0) {
          lp_rast_end( rast );
       }
 
-      /* signal done with work */
       if (debug)
          debug_printf("thread %d done working\n", task->thread_index);
-
-      pipe_semaphore_signal(&task->work_done);
    }
 
    return NULL;
@@ -773,7 +1174,6 @@ create_rast_threads(struct lp_rasterizer *rast)
    /* NOTE: if num_threads is zero, we won't use any threads */
    for (i = 0; i < rast->num_threads; i++) {
       pipe_semaphore_init(&rast->tasks[i].work_ready, 0);
-      pipe_semaphore_init(&rast->tasks[i].work_done, 0);
       rast->threads[i] = pipe_thread_create(thread_function,
                                             (void *) &rast->tasks[i]);
    }
@@ -781,6 +1181,73 @@ create_rast_threads(struct lp_rasterizer *rast)
 
 
 
+/**
+ * Place the threads on CPUs and work out the order in which each thread
+ * takes bins from the bin queues, see lp_scene_bin_iter_begin().
+ * With LP_PIN_THREADS the threads are pinned to the CPUs the process may
+ * run on, filling one NUMA node after the other.
+ */
+static boolean
+setup_thread_affinity(struct lp_rasterizer *rast)
+{
+   const unsigned num_tasks = MAX2(1, rast->num_threads);
+   struct lp_affinity_cpu *cpus = NULL;
+   unsigned *nodes;
+   unsigned num_cpus = 0;
+   unsigned i;
+
+   nodes = CALLOC(num_tasks, sizeof nodes[0]);
+   if (!nodes)
+      return FALSE;
+
+   if (rast->num_threads &&
+       debug_get_bool_option("LP_PIN_THREADS", FALSE)) {
+      const unsigned max_cpus = 1024;
+      cpus = MALLOC(max_cpus * sizeof cpus[0]);
+      if (cpus)
+         num_cpus = lp_affinity_get_cpus(cpus, max_cpus);
+   }
+
+   for (i = 0; i < num_tasks; i++) {
+      struct lp_rasterizer_task *task = &rast->tasks[i];
+
+      if (num_cpus) {
+         task->cpu = cpus[i % num_cpus].cpu;
+         task->node = cpus[i % num_cpus].node;
+      }
+      nodes[i] = task->node;
+   }
+
+   FREE(cpus);
+
+   for (i = 0; i < num_tasks; i++) {
+      struct lp_rasterizer_task *task = &rast->tasks[i];
+
+      task->bin_queue_order = MALLOC(num_tasks * sizeof(unsigned));
+      if (!task->bin_queue_order) {
+         FREE(nodes);
+         return FALSE;
+      }
+
+      lp_affinity_steal_order(nodes, num_tasks, i, task->bin_queue_order);
+   }
+
+   FREE(nodes);
+   return TRUE;
+}
+
+
+static void
+free_thread_affinity(struct lp_rasterizer *rast)
+{
+   unsigned i;
+
+   for (i = 0; i < MAX2(1, rast->num_threads); i++) {
+      FREE(rast->tasks[i].bin_queue_order);
+   }
+}
+
+
 /**
  * Create new lp_rasterizer.  If num_threads is zero, don't create any
  * new threads, do rendering synchronously.
@@ -797,32 +1264,64 @@ lp_rast_create( unsigned num_threads )
       goto no_rast;
    }
 
-   rast->full_scenes = lp_scene_queue_create();
+   rast->full_scenes = lp_scene_queue_create(RAST_MAX_QUEUED_SCENES);
    if (!rast->full_scenes) {
       goto no_full_scenes;
    }
 
-   for (i = 0; i < Elements(rast->tasks); i++) {
+   rast->num_threads = num_threads;
+
+   /* The tasks are sized from the number of threads rather than a
+    * compile-time limit.  Task[0] is also used when there are no threads.
+    */
+   rast->tasks = CALLOC(MAX2(1, num_threads), sizeof rast->tasks[0]);
+   if (!rast->tasks) {
+      goto no_tasks;
+   }
+
+   if (num_threads) {
+      rast->threads = CALLOC(num_threads, sizeof rast->threads[0]);
+      if (!rast->threads) {
+         goto no_threads;
+      }
+   }
+
+   for (i = 0; i < MAX2(1, num_threads); i++) {
       struct lp_rasterizer_task *task = &rast->tasks[i];
       task->rast = rast;
       task->thread_index = i;
+      task->cpu = -1;
    }
 
-   rast->num_threads = num_threads;
+   if (!setup_thread_affinity(rast)) {
+      goto no_affinity;
+   }
 
    rast->no_rast = debug_get_bool_option("LP_NO_RAST", FALSE);
 
+   if (debug_get_bool_option("LP_JIT_RAST", TRUE)) {
+      /* Falls back to the C code if this fails */
+      rast->jit = lp_rast_jit_create();
+   }
+
+   pipe_mutex_init( rast->perf_mutex );
+
    create_rast_threads(rast);
 
    /* for synchronizing rasterization threads */
    pipe_barrier_init( &rast->barrier, rast->num_threads );
 
-   memset(lp_swizzled_cbuf, 0, sizeof lp_swizzled_cbuf);
-
    memset(lp_dummy_tile, 0, sizeof lp_dummy_tile);
 
    return rast;
 
+no_affinity:
+   free_thread_affinity(rast);
+   FREE(rast->threads);
+no_threads:
+   FREE(rast->tasks);
+no_tasks:
+   lp_scene_queue_destroy(rast->full_scenes);
 no_full_scenes:
    FREE(rast);
 no_rast:
@@ -830,12 +1329,61 @@ no_rast:
 }
 
 
+/**
+ * Print the per-thread bin distribution statistics.
+ */
+static void
+lp_rast_print_stats( struct lp_rasterizer *rast )
+{
+   unsigned i;
+
+   for (i = 0; i < MAX2(1, rast->num_threads); i++) {
+      const struct lp_rasterizer_task *task = &rast->tasks[i];
+      int64_t total = task->stats.busy_time + task->stats.idle_time;
+
+      debug_printf("llvmpipe: thread %2u: scenes %8u bins %10u "
+                   "bin retries %8u busy %8.3f s idle %8.3f s (%3.0f%%)\n",
+                   i,
+                   task->stats.nr_scenes,
+                   task->stats.nr_bins,
+                   task->stats.nr_bin_retries,
+                   task->stats.busy_time / 1000000.0,
+                   task->stats.idle_time / 1000000.0,
+                   total ? 100.0 * task->stats.idle_time / total : 0.0);
+      debug_printf("llvmpipe: thread %2u: cpu %3d node %2u "
+                   "stolen bins %8u (remote node %8u)\n",
+                   i,
+                   task->cpu,
+                   task->node,
+                   task->stats.nr_stolen_bins,
+                   task->stats.nr_remote_bins);
+      debug_printf("llvmpipe: thread %2u: hiz culled 64x64 %8u 16x16 %8u "
+                   "4x4 %10u\n",
+                   i,
+                   task->stats.nr_hiz_culled_64,
+                   task->stats.nr_hiz_culled_16,
+                   task->stats.nr_hiz_culled_4);
+   }
+
+   for (i = 0; i < MAX2(1, rast->num_threads); i++) {
+      char name[16];
+
+      util_snprintf(name, sizeof name, "thread %u", i);
+      lp_perf_print_counters(name, &rast->tasks[i].perf_total);
+   }
+}
+
+
 /* Shutdown:
  */
 void lp_rast_destroy( struct lp_rasterizer *rast )
 {
    unsigned i;
 
+   if (LP_DEBUG & DEBUG_COUNTERS) {
+      lp_rast_print_stats(rast);
+   }
+
    /* Set exit_flag and signal each thread's work_ready semaphore.
     * Each thread will be woken up, notice that the exit_flag is set and
     * break out of its main loop.  The thread will then exit.
@@ -853,14 +1401,21 @@ void lp_rast_destroy( struct lp_rasterizer *rast )
    /* Clean up per-thread data */
    for (i = 0; i < rast->num_threads; i++) {
       pipe_semaphore_destroy(&rast->tasks[i].work_ready);
-      pipe_semaphore_destroy(&rast->tasks[i].work_done);
    }
 
    /* for synchronizing rasterization threads */
    pipe_barrier_destroy( &rast->barrier );
 
+   pipe_mutex_destroy( rast->perf_mutex );
+
    lp_scene_queue_destroy(rast->full_scenes);
 
+   if (rast->jit)
+      lp_rast_jit_destroy(rast->jit);
+
+   free_thread_affinity(rast);
+   FREE(rast->threads);
+   FREE(rast->tasks);
    FREE(rast);
 }
 
@@ -873,3 +1428,20 @@ lp_rast_get_num_threads( struct lp_rasterizer *rast )
 }
 
 
+/**
+ * Get the profiling counters of a thread, for all the scenes it has
+ * finished, of any context.  Thread 0 is the calling thread if there
+ * are no rasterization threads.
+ */
+void
+lp_rast_get_perf_counters( struct lp_rasterizer *rast,
+                           unsigned thread,
+                           struct lp_perf_counters *counters )
+{
+   assert(thread < MAX2(1, rast->num_threads));
+   pipe_mutex_lock(rast->perf_mutex);
+   *counters = rast->tasks[thread].perf_total;
+   pipe_mutex_unlock(rast->perf_mutex);
+}
+
+
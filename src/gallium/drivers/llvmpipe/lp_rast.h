@@ -39,11 +39,14 @@
 
 #include "pipe/p_compiler.h"
 #include "lp_jit.h"
+#include "lp_limits.h"
 
 
 struct lp_rasterizer;
 struct lp_scene;
 struct lp_fence;
+struct lp_query_results;
+struct lp_perf_counters;
 struct cmd_bin;
 
 /** For sub-pixel positioning */
@@ -102,6 +105,57 @@ struct lp_rast_plane {
    int eo;
 };
 
+
+/**
+ * Sample positions of multisampled framebuffers (the usual rotated grid
+ * pattern), relative to the pixel center, in 1/16 pixel units.  No
+ * offset is larger than LP_SAMPLE_POS_MAX.
+ */
+extern const int lp_sample_pos[LP_MAX_SAMPLES][2];
+
+#define LP_SAMPLE_POS_MAX 6
+
+
+/**
+ * Difference between a plane's value at a sample and at the pixel center.
+ * This is exact for the triangle and line edges, whose dcdx/dcdy are
+ * multiples of FIXED_ONE, and zero for the scissor and point planes which
+ * are evaluated per pixel.
+ */
+static INLINE int
+lp_rast_sample_offset(const struct lp_rast_plane *plane, unsigned sample)
+{
+   return (plane->dcdy * lp_sample_pos[sample][1] -
+           plane->dcdx * lp_sample_pos[sample][0]) / 16;
+}
+
+
+/**
+ * Range of lp_rast_sample_offset() over all the samples, by which the
+ * trivial reject and accept tests of a plane must be widened so that
+ * they hold for every sample of the pixels.  Zero for single sample
+ * framebuffers.
+ */
+static INLINE void
+lp_rast_sample_offset_range(const struct lp_rast_plane *plane,
+                            unsigned nr_samples,
+                            int *lo, int *hi)
+{
+   unsigned s;
+
+   *lo = 0;
+   *hi = 0;
+
+   if (nr_samples > 1) {
+      *lo = *hi = lp_rast_sample_offset(plane, 0);
+      for (s = 1; s < nr_samples; s++) {
+         int offset = lp_rast_sample_offset(plane, s);
+         if (offset < *lo) *lo = offset;
+         if (offset > *hi) *hi = offset;
+      }
+   }
+}
+
 /**
  * Rasterization information for a triangle known to be in this bin,
  * plus inputs to run the shader:
@@ -137,12 +191,30 @@ lp_rast_destroy( struct lp_rasterizer * );
 unsigned
 lp_rast_get_num_threads( struct lp_rasterizer * );
 
+void
+lp_rast_get_perf_counters( struct lp_rasterizer *rast,
+                           unsigned thread,
+                           struct lp_perf_counters *counters );
+
 void 
 lp_rast_queue_scene( struct lp_rasterizer *rast,
                      struct lp_scene *scene );
 
-void
-lp_rast_finish( struct lp_rasterizer *rast );
+
+
+/** Max number of triangles in a LP_RAST_OP_TRIANGLE_BATCH command */
+#define LP_RAST_BATCH_SIZE 16
+
+/**
+ * Consecutive small triangles binned with the same state, rasterized by a
+ * single command.  See lp_scene_bin_small_triangle().
+ */
+struct lp_rast_triangle_batch {
+   unsigned count;
+   uint8_t cmd[LP_RAST_BATCH_SIZE];     /**< LP_RAST_OP_TRIANGLE_3_4/3_16 */
+   const struct lp_rast_triangle *tri[LP_RAST_BATCH_SIZE];
+   unsigned plane_mask[LP_RAST_BATCH_SIZE];
+};
 
 
 union lp_rast_cmd_arg {
@@ -151,6 +223,7 @@ union lp_rast_cmd_arg {
       const struct lp_rast_triangle *tri;
       unsigned plane_mask;
    } triangle;
+   struct lp_rast_triangle_batch *triangle_batch;
    const struct lp_rast_state *set_state;
    float clear_color[4];
    struct {
@@ -159,7 +232,7 @@ union lp_rast_cmd_arg {
    } clear_zstencil;
    const struct lp_rast_state *state;
    struct lp_fence *fence;
-   struct llvmpipe_query *query_obj;
+   struct lp_query_results *query_results;
 };
 
 
@@ -199,6 +272,14 @@ lp_rast_arg_triangle_contained( const struct lp_rast_triangle *triangle,
    return arg;
 }
 
+static INLINE union lp_rast_cmd_arg
+lp_rast_arg_triangle_batch( struct lp_rast_triangle_batch *batch )
+{
+   union lp_rast_cmd_arg arg;
+   arg.triangle_batch = batch;
+   return arg;
+}
+
 static INLINE union lp_rast_cmd_arg
 lp_rast_arg_state( const struct lp_rast_state *state )
 {
@@ -227,10 +308,10 @@ lp_rast_arg_clearzs( unsigned value, unsigned mask )
 
 
 static INLINE union lp_rast_cmd_arg
-lp_rast_arg_query( struct llvmpipe_query *pq )
+lp_rast_arg_query( struct lp_query_results *results )
 {
    union lp_rast_cmd_arg arg;
-   arg.query_obj = pq;
+   arg.query_results = results;
    return arg;
 }
 
@@ -266,8 +347,9 @@ lp_rast_arg_null( void )
 #define LP_RAST_OP_BEGIN_QUERY       0xf
 #define LP_RAST_OP_END_QUERY         0x10
 #define LP_RAST_OP_SET_STATE         0x11
+#define LP_RAST_OP_TRIANGLE_BATCH    0x12
 
-#define LP_RAST_OP_MAX               0x12
+#define LP_RAST_OP_MAX               0x13
 #define LP_RAST_OP_MASK              0xff
 
 void
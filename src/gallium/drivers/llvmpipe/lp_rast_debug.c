@@ -43,6 +43,7 @@ static const char *cmd_names[LP_RAST_OP_MAX] =
    "begin_query",
    "end_query",
    "set_state",
+   "triangle_batch",
 };
 
 static const char *cmd_name(unsigned cmd)
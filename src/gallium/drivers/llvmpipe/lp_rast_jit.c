@@ -0,0 +1,306 @@
+/**************************************************************************
+ *
+ * Copyright 2013 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/**
+ * Generated code for the rasterizer's coverage computations.
+ *
+ * The edge functions of a triangle's planes are evaluated at every pixel
+ * of a 16x16 block at once, in vectors of the native width, and the sign
+ * bits of the pixels outside any plane are gathered into a mask for each
+ * 4x4 block, ready to be handed to the fragment shader.  A function is
+ * generated for each number of planes, so the plane loop is unrolled.
+ */
+
+
+#include "util/u_debug.h"
+#include "util/u_memory.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_string.h"
+#include "gallivm/lp_bld_const.h"
+#include "gallivm/lp_bld_debug.h"
+#include "gallivm/lp_bld_init.h"
+#include "gallivm/lp_bld_intr.h"
+#include "gallivm/lp_bld_swizzle.h"
+#include "gallivm/lp_bld_type.h"
+#include "lp_rast.h"
+#include "lp_rast_jit.h"
+
+
+/**
+ * Gather the sign bits of a vector of int32 into an int32.
+ */
+static LLVMValueRef
+build_sign_bits(struct gallivm_state *gallivm,
+                struct lp_type type,
+                LLVMValueRef value)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef int32_type = LLVMInt32TypeInContext(gallivm->context);
+   struct lp_type float_type = type;
+   LLVMValueRef bits;
+   unsigned i;
+
+   float_type.floating = TRUE;
+
+   if (util_cpu_caps.has_sse && type.length == 4) {
+      value = LLVMBuildBitCast(builder, value,
+                               lp_build_vec_type(gallivm, float_type), "");
+      return lp_build_intrinsic_unary(builder, "llvm.x86.sse.movmsk.ps",
+                                      int32_type, value);
+   }
+
+   if (util_cpu_caps.has_avx && type.length == 8) {
+      value = LLVMBuildBitCast(builder, value,
+                               lp_build_vec_type(gallivm, float_type), "");
+      return lp_build_intrinsic_unary(builder, "llvm.x86.avx.movmsk.ps.256",
+                                      int32_type, value);
+   }
+
+   bits = lp_build_const_int32(gallivm, 0);
+   for (i = 0; i < type.length; i++) {
+      LLVMValueRef bit;
+      bit = LLVMBuildExtractElement(builder, value,
+                                    lp_build_const_int32(gallivm, i), "");
+      bit = LLVMBuildLShr(builder, bit, lp_build_const_int32(gallivm, 31), "");
+      bit = LLVMBuildShl(builder, bit, lp_build_const_int32(gallivm, i), "");
+      bits = LLVMBuildOr(builder, bits, bit, "");
+   }
+
+   return bits;
+}
+
+
+/**
+ * Generate the lp_jit_rast_block_16_func for 'nr_planes' planes.
+ */
+static LLVMValueRef
+generate_block_16(struct gallivm_state *gallivm, unsigned nr_planes)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMContextRef context = gallivm->context;
+   LLVMTypeRef int32_type = LLVMInt32TypeInContext(context);
+   LLVMTypeRef int16_type = LLVMInt16TypeInContext(context);
+   const struct lp_type type = lp_type_int_vec(32, lp_native_vector_width);
+   LLVMTypeRef vec_type = lp_build_vec_type(gallivm, type);
+   /* Rows of a 4x4 block in each vector */
+   const unsigned rows = type.length / 4;
+   LLVMTypeRef arg_types[3];
+   LLVMTypeRef func_type;
+   LLVMValueRef function, plane_ptr, c_ptr, masks_ptr;
+   LLVMValueRef dcdx[LP_RAST_MAX_PLANES], dcdy[LP_RAST_MAX_PLANES];
+   LLVMValueRef c0[LP_RAST_MAX_PLANES];
+   LLVMValueRef lane_x, lane_y;
+   LLVMBasicBlockRef block;
+   char func_name[64];
+   unsigned i, j, bx, by, r;
+
+   assert(type.length == 4 || type.length == 8);
+   assert(sizeof(struct lp_rast_plane) == 4 * sizeof(int32_t));
+
+   util_snprintf(func_name, sizeof func_name, "rast_block_16_%u", nr_planes);
+
+   arg_types[0] = LLVMPointerType(int32_type, 0);  /* plane */
+   arg_types[1] = LLVMPointerType(int32_type, 0);  /* c */
+   arg_types[2] = LLVMPointerType(int16_type, 0);  /* masks */
+
+   func_type = LLVMFunctionType(LLVMVoidTypeInContext(context),
+                                arg_types, Elements(arg_types), 0);
+
+   function = LLVMAddFunction(gallivm->module, func_name, func_type);
+   LLVMSetFunctionCallConv(function, LLVMCCallConv);
+
+   plane_ptr = LLVMGetParam(function, 0);
+   c_ptr = LLVMGetParam(function, 1);
+   masks_ptr = LLVMGetParam(function, 2);
+
+   lp_build_name(plane_ptr, "plane");
+   lp_build_name(c_ptr, "c");
+   lp_build_name(masks_ptr, "masks");
+
+   block = LLVMAppendBasicBlockInContext(context, function, "entry");
+   LLVMPositionBuilderAtEnd(builder, block);
+
+   /* Position of each lane within its row(s) of a 4x4 block */
+   {
+      LLVMValueRef x[LP_MAX_VECTOR_LENGTH], y[LP_MAX_VECTOR_LENGTH];
+      for (i = 0; i < type.length; i++) {
+         x[i] = lp_build_const_int32(gallivm, i % 4);
+         y[i] = lp_build_const_int32(gallivm, i / 4);
+      }
+      lane_x = LLVMConstVector(x, type.length);
+      lane_y = LLVMConstVector(y, type.length);
+   }
+
+   /* The edge functions at the first pixel of each lane, minus one so
+    * that the sign bit is set exactly for the pixels outside the plane.
+    */
+   for (j = 0; j < nr_planes; j++) {
+      LLVMValueRef index, c, step;
+
+      index = lp_build_const_int32(gallivm, j);
+      c = LLVMBuildLoad(builder, LLVMBuildGEP(builder, c_ptr, &index, 1, ""),
+                        "");
+      c = LLVMBuildSub(builder, c, lp_build_const_int32(gallivm, 1), "");
+
+      index = lp_build_const_int32(gallivm, 4 * j + 1);
+      dcdx[j] = LLVMBuildLoad(builder,
+                              LLVMBuildGEP(builder, plane_ptr, &index, 1, ""),
+                              "dcdx");
+      dcdx[j] = LLVMBuildNeg(builder, dcdx[j], "");
+
+      index = lp_build_const_int32(gallivm, 4 * j + 2);
+      dcdy[j] = LLVMBuildLoad(builder,
+                              LLVMBuildGEP(builder, plane_ptr, &index, 1, ""),
+                              "dcdy");
+
+      step = LLVMBuildAdd(builder,
+                          LLVMBuildMul(builder,
+                                       lp_build_broadcast(gallivm, vec_type,
+                                                          dcdx[j]),
+                                       lane_x, ""),
+                          LLVMBuildMul(builder,
+                                       lp_build_broadcast(gallivm, vec_type,
+                                                          dcdy[j]),
+                                       lane_y, ""), "");
+
+      c0[j] = LLVMBuildAdd(builder,
+                           lp_build_broadcast(gallivm, vec_type, c),
+                           step, "c0");
+   }
+
+   for (by = 0; by < 4; by++) {
+      for (bx = 0; bx < 4; bx++) {
+         LLVMValueRef mask = lp_build_const_int32(gallivm, 0);
+         LLVMValueRef index;
+
+         for (r = 0; r < 4; r += rows) {
+            LLVMValueRef outside = NULL;
+            LLVMValueRef bits;
+
+            for (j = 0; j < nr_planes; j++) {
+               LLVMValueRef offset, value;
+
+               /* -dcdx * px + dcdy * py at the first pixel of the vector */
+               offset = LLVMBuildAdd(builder,
+                           LLVMBuildMul(builder, dcdx[j],
+                                        lp_build_const_int32(gallivm, 4 * bx),
+                                        ""),
+                           LLVMBuildMul(builder, dcdy[j],
+                                        lp_build_const_int32(gallivm,
+                                                             4 * by + r),
+                                        ""), "");
+
+               value = LLVMBuildAdd(builder, c0[j],
+                                    lp_build_broadcast(gallivm, vec_type,
+                                                       offset), "");
+
+               /* The sign bit is set if outside any of the planes */
+               outside = outside ? LLVMBuildOr(builder, outside, value, "")
+                                 : value;
+            }
+
+            bits = build_sign_bits(gallivm, type, outside);
+            bits = LLVMBuildShl(builder, bits,
+                                lp_build_const_int32(gallivm, 4 * r), "");
+            mask = LLVMBuildOr(builder, mask, bits, "");
+         }
+
+         mask = LLVMBuildNot(builder, mask, "");
+         mask = LLVMBuildTrunc(builder, mask, int16_type, "");
+
+         index = lp_build_const_int32(gallivm, 4 * by + bx);
+         LLVMBuildStore(builder, mask,
+                        LLVMBuildGEP(builder, masks_ptr, &index, 1, ""));
+      }
+   }
+
+   LLVMBuildRetVoid(builder);
+
+   gallivm_verify_function(gallivm, function);
+
+   return function;
+}
+
+
+/**
+ * Generate the rasterizer's functions for the native vector width.
+ * \return NULL if they can't be generated, in which case the rasterizer
+ *         computes the coverage in C.
+ */
+struct lp_rast_jit *
+lp_rast_jit_create(void)
+{
+   struct lp_rast_jit *jit;
+   unsigned i;
+
+   if (lp_native_vector_width != 128 && lp_native_vector_width != 256)
+      return NULL;
+
+   jit = CALLOC_STRUCT(lp_rast_jit);
+   if (!jit)
+      return NULL;
+
+   jit->gallivm = gallivm_create();
+   if (!jit->gallivm) {
+      FREE(jit);
+      return NULL;
+   }
+
+   gallivm_stats_begin(jit->gallivm, GALLIVM_STATS_OTHER, 0);
+
+   for (i = 1; i <= LP_RAST_MAX_PLANES; i++) {
+      jit->block_16_function[i] = generate_block_16(jit->gallivm, i);
+   }
+
+   gallivm_compile_module(jit->gallivm);
+
+   for (i = 1; i <= LP_RAST_MAX_PLANES; i++) {
+      jit->block_16[i] = (lp_jit_rast_block_16_func)
+         gallivm_jit_function(jit->gallivm, jit->block_16_function[i]);
+   }
+
+   return jit;
+}
+
+
+void
+lp_rast_jit_destroy(struct lp_rast_jit *jit)
+{
+   unsigned i;
+
+   for (i = 1; i <= LP_RAST_MAX_PLANES; i++) {
+      if (jit->block_16_function[i]) {
+         gallivm_free_function(jit->gallivm,
+                               jit->block_16_function[i],
+                               jit->block_16[i]);
+      }
+   }
+
+   gallivm_destroy(jit->gallivm);
+   FREE(jit);
+}
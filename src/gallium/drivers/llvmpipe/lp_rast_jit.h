@@ -0,0 +1,81 @@
+/**************************************************************************
+ *
+ * Copyright 2013 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/**
+ * Generated code for the rasterizer's coverage computations.
+ */
+
+#ifndef LP_RAST_JIT_H
+#define LP_RAST_JIT_H
+
+
+#include "gallivm/lp_bld.h"
+#include "pipe/p_compiler.h"
+
+
+struct gallivm_state;
+struct lp_rast_plane;
+
+
+/** Most planes of a triangle: 3 edges, 4 scissor planes and a spare */
+#define LP_RAST_MAX_PLANES 8
+
+
+/**
+ * Compute the coverage of the sixteen 4x4 blocks of a 16x16 block.
+ *
+ * \param plane  the triangle's planes, only dcdx and dcdy are used
+ * \param c      value of each plane at the 16x16 block's origin
+ * \param masks  returns the pixels covered in each 4x4 block, blocks and
+ *               pixels both in row major order
+ */
+typedef void
+(*lp_jit_rast_block_16_func)(const struct lp_rast_plane *plane,
+                             const int *c,
+                             uint16_t *masks);
+
+
+struct lp_rast_jit
+{
+   struct gallivm_state *gallivm;
+
+   LLVMValueRef block_16_function[LP_RAST_MAX_PLANES + 1];
+
+   /** Indexed by the number of planes, NULL for 0 planes */
+   lp_jit_rast_block_16_func block_16[LP_RAST_MAX_PLANES + 1];
+};
+
+
+struct lp_rast_jit *
+lp_rast_jit_create(void);
+
+void
+lp_rast_jit_destroy(struct lp_rast_jit *jit);
+
+
+#endif /* LP_RAST_JIT_H */
@@ -28,15 +28,19 @@
 #ifndef LP_RAST_PRIV_H
 #define LP_RAST_PRIV_H
 
+#include <float.h>
 #include "os/os_thread.h"
+#include "os/os_time.h"
 #include "util/u_format.h"
+#include "util/u_math.h"
 #include "gallivm/lp_bld_debug.h"
 #include "lp_memory.h"
+#include "lp_perf.h"
 #include "lp_rast.h"
+#include "lp_rast_jit.h"
 #include "lp_scene.h"
 #include "lp_state.h"
 #include "lp_texture.h"
-#include "lp_tile_image.h"
 #include "lp_limits.h"
 
 
@@ -88,19 +92,61 @@ struct lp_rasterizer_task
    uint8_t *color_tiles[PIPE_MAX_COLOR_BUFS];
    uint8_t *depth_tile;
 
+   /** Some framebuffer surface's clear of the tile is still pending */
+   boolean clear_pending;
+
    /** "back" pointer */
    struct lp_rasterizer *rast;
 
    /** "my" index */
    unsigned thread_index;
 
+   /** CPU the thread is pinned to with LP_PIN_THREADS, or -1 */
+   int cpu;
+   unsigned node;                /**< NUMA node of cpu, 0 if not pinned */
+   unsigned *bin_queue_order;    /**< see lp_affinity_steal_order() */
+
    /* occlude counter for visiable pixels */
    uint32_t vis_counter;
    uint64_t query_start;
-   struct llvmpipe_query *query[PIPE_QUERY_TYPES];
+   uint64_t ps_invocations;      /**< fragments shaded since begin_query */
+   struct lp_query_results *query[PIPE_QUERY_TYPES];
+
+   /** Bin distribution statistics, printed with LP_DEBUG=counters */
+   struct {
+      unsigned nr_scenes;
+      unsigned nr_bins;          /**< non-empty bins rasterized */
+      unsigned nr_bin_retries;   /**< lost races for the next bin */
+      unsigned nr_stolen_bins;   /**< bins taken from other threads */
+      unsigned nr_remote_bins;   /**< ... of which from another node */
+      int64_t busy_time;         /**< usecs spent rasterizing scenes */
+      int64_t idle_time;         /**< usecs waiting for the other threads */
+      unsigned nr_hiz_culled_64; /**< blocks skipped by hierarchical Z */
+      unsigned nr_hiz_culled_16;
+      unsigned nr_hiz_culled_4;
+   } stats;
+
+   /**
+    * Profiling counters of the current scene, added to the scene and to
+    * perf_total by lp_rast_end().
+    */
+   struct lp_perf_counters perf;
+   struct lp_perf_counters perf_total;
+
+   /**
+    * Hierarchical Z: upper bounds of the depth values in the current tile,
+    * for the whole tile and for each of its 16x16 and 4x4 blocks, in the
+    * same [0,1] units as the interpolated depth, or LP_HIZ_UNKNOWN.
+    */
+   struct {
+      boolean enabled;
+      float eps;         /**< two steps of the depth format, 0 for floats */
+      float zmax_64;
+      float zmax_16[(TILE_SIZE / 16) * (TILE_SIZE / 16)];
+      float zmax_4[(TILE_SIZE / 4) * (TILE_SIZE / 4)];
+   } hiz;
 
    pipe_semaphore work_ready;
-   pipe_semaphore work_done;
 };
 
 
@@ -120,14 +166,38 @@ struct lp_rasterizer
    /** The scene currently being rasterized by the threads */
    struct lp_scene *curr_scene;
 
-   /** A task object for each rasterization thread */
-   struct lp_rasterizer_task tasks[LP_MAX_THREADS];
+   /**
+    * A task object for each rasterization thread.  There is always at
+    * least one task, even when rasterizing synchronously (num_threads == 0).
+    */
+   struct lp_rasterizer_task *tasks;
 
    unsigned num_threads;
-   pipe_thread threads[LP_MAX_THREADS];
+   pipe_thread *threads;
 
    /** For synchronizing the rasterization threads */
    pipe_barrier barrier;
+
+   /** Protects the tasks' perf_total, read by lp_rast_get_perf_counters() */
+   pipe_mutex perf_mutex;
+
+   /** Generated coverage code, NULL to compute it in C */
+   struct lp_rast_jit *jit;
+};
+
+
+/** Coverage mask of a 4x4 block with all the pixels and samples covered */
+#define LP_RAST_MASK_ALL (~(uint64_t) 0)
+
+
+/**
+ * A 4x4 block of a triangle to shade, see lp_rast_shade_quads_masks().
+ */
+struct lp_rast_block_mask
+{
+   const struct lp_rast_shader_inputs *inputs;
+   unsigned x, y;             /**< window coords */
+   unsigned mask;             /**< pixels to shade */
 };
 
 
@@ -135,7 +205,12 @@ void
 lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
                          const struct lp_rast_shader_inputs *inputs,
                          unsigned x, unsigned y,
-                         unsigned mask);
+                         uint64_t mask);
+
+void
+lp_rast_shade_quads_masks(struct lp_rasterizer_task *task,
+                          const struct lp_rast_block_mask *blocks,
+                          unsigned count);
 
 
 
@@ -169,7 +244,7 @@ lp_rast_get_depth_block_pointer(struct lp_rasterizer_task *task,
 
    depth = (scene->zsbuf.map +
             scene->zsbuf.stride * y +
-            scene->zsbuf.blocksize * x * TILE_VECTOR_HEIGHT);
+            scene->zsbuf.blocksize * x);
 
    assert(lp_check_alignment(depth, 16));
    return depth;
@@ -238,6 +313,200 @@ lp_rast_get_unswizzled_color_block_pointer(struct lp_rasterizer_task *task,
 
 
 
+#define LP_HIZ_UNKNOWN FLT_MAX
+
+
+/**
+ * Get the hierarchical Z depth bound of a block of the current tile.
+ * \param x, y location of the block in window coords
+ * \param size TILE_SIZE, 16 or 4
+ */
+static INLINE float *
+lp_rast_hiz_bound(struct lp_rasterizer_task *task,
+                  unsigned x, unsigned y, unsigned size)
+{
+   x &= TILE_SIZE - 1;
+   y &= TILE_SIZE - 1;
+
+   switch (size) {
+   case TILE_SIZE:
+      return &task->hiz.zmax_64;
+   case 16:
+      return &task->hiz.zmax_16[(y / 16) * (TILE_SIZE / 16) + x / 16];
+   default:
+      assert(size == 4);
+      return &task->hiz.zmax_4[(y / 4) * (TILE_SIZE / 4) + x / 4];
+   }
+}
+
+
+/**
+ * Compute the range of the triangle's interpolated depth over a block,
+ * widened by the rounding error of the interpolation in the shader.
+ */
+static INLINE void
+lp_rast_hiz_tri_range(const struct lp_rast_shader_inputs *inputs,
+                      unsigned x, unsigned y, unsigned size,
+                      float *zmin, float *zmax)
+{
+   const float a0 = GET_A0(inputs)[0][2];
+   const float dzdx = GET_DADX(inputs)[0][2];
+   const float dzdy = GET_DADY(inputs)[0][2];
+   const float zx0 = dzdx * (float) x, zx1 = dzdx * (float) (x + size);
+   const float zy0 = dzdy * (float) y, zy1 = dzdy * (float) (y + size);
+   const float err = (fabsf(a0) + fabsf(zx1) + fabsf(zy1)) * (1.0f / (1 << 20));
+
+   *zmin = a0 + MIN2(zx0, zx1) + MIN2(zy0, zy1) - err;
+   *zmax = a0 + MAX2(zx0, zx1) + MAX2(zy0, zy1) + err;
+}
+
+
+/**
+ * Check whether all of the triangle's fragments in a block would fail
+ * the depth test, so that the block needn't be shaded.
+ * \param x, y location of the block in window coords
+ * \param size TILE_SIZE, 16 or 4
+ */
+static INLINE boolean
+lp_rast_hiz_occluded(struct lp_rasterizer_task *task,
+                     const struct lp_rast_shader_inputs *inputs,
+                     unsigned x, unsigned y, unsigned size)
+{
+   const struct lp_fragment_shader_variant *variant = task->state->variant;
+   float bound, zmin, zmax;
+   boolean occluded;
+
+   if (!task->hiz.enabled || !(variant->hiz & LP_HIZ_TEST))
+      return FALSE;
+
+   bound = *lp_rast_hiz_bound(task, x, y, size);
+   if (bound == LP_HIZ_UNKNOWN)
+      return FALSE;
+
+   lp_rast_hiz_tri_range(inputs, x, y, size, &zmin, &zmax);
+
+   /* The shader clamps the interpolated depth to 1.0 */
+   zmin = MIN2(zmin, 1.0f);
+
+   if (variant->key.depth.func == PIPE_FUNC_LESS)
+      occluded = zmin >= bound;
+   else
+      occluded = zmin > bound + task->hiz.eps;
+
+   if (occluded) {
+      if (size == TILE_SIZE)
+         task->stats.nr_hiz_culled_64++;
+      else if (size == 16)
+         task->stats.nr_hiz_culled_16++;
+      else
+         task->stats.nr_hiz_culled_4++;
+   }
+
+   return occluded;
+}
+
+
+/**
+ * Lower the depth bound of a block after the triangle covered all of it.
+ */
+static INLINE void
+lp_rast_hiz_update(struct lp_rasterizer_task *task,
+                   const struct lp_rast_shader_inputs *inputs,
+                   unsigned x, unsigned y, unsigned size)
+{
+   float *bound, zmin, zmax;
+
+   if (!task->hiz.enabled || !(task->state->variant->hiz & LP_HIZ_UPDATE))
+      return;
+
+   bound = lp_rast_hiz_bound(task, x, y, size);
+   lp_rast_hiz_tri_range(inputs, x, y, size, &zmin, &zmax);
+
+   /* The shader clamps the depth values to 0.0 */
+   *bound = MIN2(*bound, MAX2(zmax, 0.0f));
+}
+
+
+/**
+ * Lower the depth bound of a 16x16 block to the largest bound of its
+ * 4x4 blocks.
+ */
+static INLINE void
+lp_rast_hiz_update_16(struct lp_rasterizer_task *task,
+                      unsigned x, unsigned y)
+{
+   float *bound = lp_rast_hiz_bound(task, x, y, 16);
+   const float *zmax_4 = lp_rast_hiz_bound(task, x, y, 4);
+   float zmax = 0.0f;
+   unsigned i, j;
+
+   if (!task->hiz.enabled || !(task->state->variant->hiz & LP_HIZ_UPDATE))
+      return;
+
+   for (i = 0; i < 4; i++) {
+      for (j = 0; j < 4; j++)
+         zmax = MAX2(zmax, zmax_4[i * (TILE_SIZE / 4) + j]);
+   }
+
+   *bound = MIN2(*bound, zmax);
+}
+
+
+/**
+ * Lower the depth bound of the tile to the largest bound of its 16x16
+ * blocks.
+ */
+static INLINE void
+lp_rast_hiz_update_64(struct lp_rasterizer_task *task)
+{
+   float zmax = 0.0f;
+   unsigned i;
+
+   if (!task->hiz.enabled || !(task->state->variant->hiz & LP_HIZ_UPDATE))
+      return;
+
+   for (i = 0; i < Elements(task->hiz.zmax_16); i++)
+      zmax = MAX2(zmax, task->hiz.zmax_16[i]);
+
+   task->hiz.zmax_64 = MIN2(task->hiz.zmax_64, zmax);
+}
+
+
+/**
+ * Number of pixels with any sample covered in a 4x4 block mask, see
+ * lp_rast_shade_quads_mask().
+ */
+static INLINE unsigned
+lp_rast_mask_pixels(uint64_t mask)
+{
+   mask |= mask >> 32;
+   mask |= mask >> 16;
+   return util_bitcount((unsigned) mask & 0xffff);
+}
+
+
+/**
+ * Count a 4x4 block about to be shaded.  Returns the start time of the
+ * block if it is one of the sampled ones, otherwise 0.
+ */
+static INLINE int64_t
+lp_rast_shade_begin(struct lp_rasterizer_task *task)
+{
+   if (++task->perf.nr_blocks_shaded % LP_PERF_SHADE_SAMPLE_RATE)
+      return 0;
+   return os_time_get_nano();
+}
+
+
+static INLINE void
+lp_rast_shade_end(struct lp_rasterizer_task *task, int64_t start)
+{
+   if (start)
+      task->perf.shade_time +=
+         (os_time_get_nano() - start) * LP_PERF_SHADE_SAMPLE_RATE;
+}
+
+
 /**
  * Shade all pixels in a 4x4 block.  The fragment code omits the
  * triangle in/out tests.
@@ -253,18 +522,27 @@ lp_rast_shade_quads_all( struct lp_rasterizer_task *task,
    struct lp_fragment_shader_variant *variant = state->variant;
    uint8_t *color[PIPE_MAX_COLOR_BUFS];
    unsigned stride[PIPE_MAX_COLOR_BUFS];
+   unsigned sample_stride[PIPE_MAX_COLOR_BUFS];
    void *depth;
+   int64_t start;
    unsigned i;
 
+   if (lp_rast_hiz_occluded(task, inputs, x, y, 4))
+      return;
+
    /* color buffer */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
       stride[i] = scene->cbufs[i].stride;
+      sample_stride[i] = scene->cbufs[i].sample_stride;
 
       color[i] = lp_rast_get_unswizzled_color_block_pointer(task, i, x, y);
    }
 
    depth = lp_rast_get_depth_block_pointer(task, x, y);
 
+   task->ps_invocations += 16;
+   start = lp_rast_shade_begin(task);
+
    /* run shader on 4x4 block */
    BEGIN_JIT_CALL(state, task);
    variant->jit_function[RAST_WHOLE]( &state->jit_context,
@@ -275,10 +553,16 @@ lp_rast_shade_quads_all( struct lp_rasterizer_task *task,
                                       GET_DADY(inputs),
                                       color,
                                       depth,
-                                      0xffff,
+                                      scene->zsbuf.stride,
+                                      scene->zsbuf.sample_stride,
+                                      LP_RAST_MASK_ALL,
                                       &task->vis_counter,
-                                      stride );
+                                      stride,
+                                      sample_stride );
    END_JIT_CALL();
+   lp_rast_shade_end(task, start);
+
+   lp_rast_hiz_update(task, inputs, x, y, 4);
 }
 
 void lp_rast_triangle_1( struct lp_rasterizer_task *, 
@@ -307,6 +591,9 @@ void lp_rast_triangle_3_16( struct lp_rasterizer_task *,
 void lp_rast_triangle_4_16( struct lp_rasterizer_task *, 
                             const union lp_rast_cmd_arg );
 
+void lp_rast_triangle_batch( struct lp_rasterizer_task *,
+                             const union lp_rast_cmd_arg );
+
 void
 lp_rast_set_state(struct lp_rasterizer_task *task,
                   const union lp_rast_cmd_arg arg);
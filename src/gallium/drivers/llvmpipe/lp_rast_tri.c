@@ -61,9 +61,15 @@ block_full_16(struct lp_rasterizer_task *task,
    unsigned ix, iy;
    assert(x % 16 == 0);
    assert(y % 16 == 0);
+
+   if (lp_rast_hiz_occluded(task, &tri->inputs, x, y, 16))
+      return;
+
    for (iy = 0; iy < 16; iy += 4)
       for (ix = 0; ix < 16; ix += 4)
 	 block_full_4(task, tri, x + ix, y + iy);
+
+   lp_rast_hiz_update(task, &tri->inputs, x, y, 16);
 }
 
 #if !defined(PIPE_ARCH_SSE)
@@ -138,6 +144,19 @@ lp_rast_triangle_3_4(struct lp_rasterizer_task *task,
    lp_rast_triangle_3_16(task, arg);
 }
 
+void
+lp_rast_triangle_batch(struct lp_rasterizer_task *task,
+                       const union lp_rast_cmd_arg arg)
+{
+   const struct lp_rast_triangle_batch *batch = arg.triangle_batch;
+   unsigned i;
+
+   for (i = 0; i < batch->count; i++) {
+      lp_rast_triangle_3_16(task, lp_rast_arg_triangle(batch->tri[i],
+                                                       batch->plane_mask[i]));
+   }
+}
+
 #else
 #include <emmintrin.h>
 #include "util/u_sse.h"
@@ -247,9 +266,15 @@ sign_bits4(const __m128i *cstep, int cdiff)
 
 
 
-void
-lp_rast_triangle_3_16(struct lp_rasterizer_task *task,
-                      const union lp_rast_cmd_arg arg)
+/**
+ * Compute the coverage masks of the 4x4 blocks of a triangle contained in
+ * a 16x16 block.
+ * \return number of blocks written to out[16]
+ */
+static unsigned
+triangle_3_16_blocks(struct lp_rasterizer_task *task,
+                     const union lp_rast_cmd_arg arg,
+                     struct lp_rast_block_mask *out)
 {
    const struct lp_rast_triangle *tri = arg.triangle.tri;
    const struct lp_rast_plane *plane = GET_PLANES(tri);
@@ -257,7 +282,6 @@ lp_rast_triangle_3_16(struct lp_rasterizer_task *task,
    int y = (arg.triangle.plane_mask >> 8) + task->y;
    unsigned i, j;
 
-   struct { unsigned mask:16; unsigned i:8; unsigned j:8; } out[16];
    unsigned nr = 0;
 
    __m128i p0 = _mm_load_si128((__m128i *)&plane[0]); /* c, dcdx, dcdy, eo */
@@ -337,11 +361,13 @@ lp_rast_triangle_3_16(struct lp_rasterizer_task *task,
 
             unsigned mask = _mm_movemask_epi8(c_0123);
 
-            out[nr].i = i;
-            out[nr].j = j;
-            out[nr].mask = mask;
-            if (mask != 0xffff)
+            if (mask != 0xffff) {
+               out[nr].inputs = &tri->inputs;
+               out[nr].x = x + 4 * j;
+               out[nr].y = y + 4 * i;
+               out[nr].mask = 0xffff & ~mask;
                nr++;
+            }
          }
          cx = _mm_add_epi32(cx, _mm_slli_epi32(dcdx, 2));
       }
@@ -349,21 +375,32 @@ lp_rast_triangle_3_16(struct lp_rasterizer_task *task,
       c = _mm_add_epi32(c, _mm_slli_epi32(dcdy, 2));
    }
 
-   for (i = 0; i < nr; i++)
-      lp_rast_shade_quads_mask(task,
-                               &tri->inputs,
-                               x + 4 * out[i].j,
-                               y + 4 * out[i].i,
-                               0xffff & ~out[i].mask);
+   return nr;
+}
+
+
+void
+lp_rast_triangle_3_16(struct lp_rasterizer_task *task,
+                      const union lp_rast_cmd_arg arg)
+{
+   struct lp_rast_block_mask blocks[16];
+   unsigned nr = triangle_3_16_blocks(task, arg, blocks);
+
+   lp_rast_shade_quads_masks(task, blocks, nr);
 }
 
 
 
 
 
-void
-lp_rast_triangle_3_4(struct lp_rasterizer_task *task,
-                     const union lp_rast_cmd_arg arg)
+/**
+ * Compute the coverage mask of a triangle contained in a 4x4 block.
+ * \return number of blocks written to out[1]
+ */
+static unsigned
+triangle_3_4_blocks(struct lp_rasterizer_task *task,
+                    const union lp_rast_cmd_arg arg,
+                    struct lp_rast_block_mask *out)
 {
    const struct lp_rast_triangle *tri = arg.triangle.tri;
    const struct lp_rast_plane *plane = GET_PLANES(tri);
@@ -437,15 +474,60 @@ lp_rast_triangle_3_4(struct lp_rasterizer_task *task,
 
       unsigned mask = _mm_movemask_epi8(c_0123);
 
-      if (mask != 0xffff)
-         lp_rast_shade_quads_mask(task,
-                                  &tri->inputs,
-                                  x,
-                                  y,
-                                  0xffff & ~mask);
+      if (mask == 0xffff)
+         return 0;
+
+      out->inputs = &tri->inputs;
+      out->x = x;
+      out->y = y;
+      out->mask = 0xffff & ~mask;
+      return 1;
    }
 }
 
+
+void
+lp_rast_triangle_3_4(struct lp_rasterizer_task *task,
+                     const union lp_rast_cmd_arg arg)
+{
+   struct lp_rast_block_mask block;
+
+   if (triangle_3_4_blocks(task, arg, &block))
+      lp_rast_shade_quads_masks(task, &block, 1);
+}
+
+
+/**
+ * Rasterize a batch of small triangles.  The coverage masks of all the
+ * triangles are computed first, then all the blocks are shaded together.
+ */
+void
+lp_rast_triangle_batch(struct lp_rasterizer_task *task,
+                       const union lp_rast_cmd_arg arg)
+{
+   const struct lp_rast_triangle_batch *batch = arg.triangle_batch;
+   struct lp_rast_block_mask blocks[64];
+   unsigned nr = 0;
+   unsigned i;
+
+   for (i = 0; i < batch->count; i++) {
+      const union lp_rast_cmd_arg tri_arg =
+         lp_rast_arg_triangle(batch->tri[i], batch->plane_mask[i]);
+
+      if (nr > Elements(blocks) - 16) {
+         lp_rast_shade_quads_masks(task, blocks, nr);
+         nr = 0;
+      }
+
+      if (batch->cmd[i] == LP_RAST_OP_TRIANGLE_3_4)
+         nr += triangle_3_4_blocks(task, tri_arg, &blocks[nr]);
+      else
+         nr += triangle_3_16_blocks(task, tri_arg, &blocks[nr]);
+   }
+
+   lp_rast_shade_quads_masks(task, blocks, nr);
+}
+
 #undef NR_PLANES
 #endif
 
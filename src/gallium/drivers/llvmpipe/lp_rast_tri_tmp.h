@@ -46,9 +46,31 @@ TAG(do_block_4)(struct lp_rasterizer_task *task,
                 int x, int y,
                 const int *c)
 {
+   const unsigned nr_samples = task->scene->nr_samples;
    unsigned mask = 0xffff;
    int j;
 
+   if (nr_samples > 1) {
+      /* Coverage of each sample, 16 bits per sample */
+      uint64_t sample_mask = 0;
+      unsigned s;
+
+      for (s = 0; s < nr_samples; s++) {
+         mask = 0xffff;
+         for (j = 0; j < NR_PLANES; j++) {
+            mask &= ~build_mask_linear(c[j] - 1 +
+                                       lp_rast_sample_offset(&plane[j], s),
+                                       -plane[j].dcdx,
+                                       plane[j].dcdy);
+         }
+         sample_mask |= (uint64_t) mask << (16 * s);
+      }
+
+      if (sample_mask)
+         lp_rast_shade_quads_mask(task, &tri->inputs, x, y, sample_mask);
+      return;
+   }
+
    for (j = 0; j < NR_PLANES; j++) {
       mask &= ~build_mask_linear(c[j] - 1, 
 				 -plane[j].dcdx,
@@ -61,6 +83,46 @@ TAG(do_block_4)(struct lp_rasterizer_task *task,
       lp_rast_shade_quads_mask(task, &tri->inputs, x, y, mask);
 }
 
+/**
+ * Shade the partially covered 4x4 blocks of a 16x16 block of pixels, with
+ * the coverage of all its pixels computed by the generated code.  The
+ * blocks are still depth tested against the HiZ bounds when shaded.
+ */
+static void
+TAG(do_block_16_jit)(struct lp_rasterizer_task *task,
+                     const struct lp_rast_triangle *tri,
+                     const struct lp_rast_plane *plane,
+                     int x, int y,
+                     const int *c,
+                     unsigned partial_mask)
+{
+   PIPE_ALIGN_VAR(16) uint16_t masks[16];
+
+   task->rast->jit->block_16[NR_PLANES](plane, c, masks);
+
+   while (partial_mask) {
+      const int i = ffs(partial_mask) - 1;
+      const unsigned mask = masks[i];
+      const int px = x + (i & 3) * 4;
+      const int py = y + (i >> 2) * 4;
+
+      partial_mask &= ~(1 << i);
+
+      if (mask == 0xffff) {
+         LP_COUNT(nr_fully_covered_4);
+         block_full_4(task, tri, px, py);
+      }
+      else if (mask) {
+         LP_COUNT(nr_partially_covered_4);
+         lp_rast_shade_quads_mask(task, &tri->inputs, px, py, mask);
+      }
+      else {
+         LP_COUNT(nr_empty_4);
+      }
+   }
+}
+
+
 /**
  * Evaluate a 16x16 block of pixels to determine which 4x4 subblocks are in/out
  * of the triangle's bounds.
@@ -75,6 +137,9 @@ TAG(do_block_16)(struct lp_rasterizer_task *task,
    unsigned outmask, inmask, partmask, partial_mask;
    unsigned j;
 
+   if (lp_rast_hiz_occluded(task, &tri->inputs, x, y, 16))
+      return;
+
    outmask = 0;                 /* outside one or more trivial reject planes */
    partmask = 0;                /* outside one or more trivial accept planes */
 
@@ -84,9 +149,13 @@ TAG(do_block_16)(struct lp_rasterizer_task *task,
       const int cox = plane[j].eo * 4;
       const int ei = plane[j].dcdy - plane[j].dcdx - plane[j].eo;
       const int cio = ei * 4 - 1;
+      int slo, shi;
+
+      lp_rast_sample_offset_range(&plane[j], task->scene->nr_samples,
+                                  &slo, &shi);
 
-      build_masks(c[j] + cox,
-		  cio - cox,
+      build_masks(c[j] + cox + shi,
+		  cio - cox + slo - shi,
 		  dcdx, dcdy, 
 		  &outmask,   /* sign bits from c[i][0..15] + cox */
 		  &partmask); /* sign bits from c[i][0..15] + cio */
@@ -108,8 +177,14 @@ TAG(do_block_16)(struct lp_rasterizer_task *task,
 
    LP_COUNT_ADD(nr_empty_4, util_bitcount(0xffff & ~(partial_mask | inmask)));
 
-   /* Iterate over partials:
+   /* Iterate over partials, with the generated code when there is some,
+    * which only knows about pixel centers:
     */
+   if (partial_mask && task->rast->jit && task->scene->nr_samples == 1) {
+      TAG(do_block_16_jit)(task, tri, plane, x, y, c, partial_mask);
+      partial_mask = 0;
+   }
+
    while (partial_mask) {
       int i = ffs(partial_mask) - 1;
       int ix = (i & 3) * 4;
@@ -144,6 +219,8 @@ TAG(do_block_16)(struct lp_rasterizer_task *task,
       LP_COUNT(nr_fully_covered_4);
       block_full_4(task, tri, px, py);
    }
+
+   lp_rast_hiz_update_16(task, x, y);
 }
 
 
@@ -169,6 +246,9 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
       return;
    }
 
+   if (lp_rast_hiz_occluded(task, &tri->inputs, x, y, TILE_SIZE))
+      return;
+
    outmask = 0;                 /* outside one or more trivial reject planes */
    partmask = 0;                /* outside one or more trivial accept planes */
 
@@ -184,9 +264,13 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
 	 const int cox = plane[j].eo * 16;
          const int ei = plane[j].dcdy - plane[j].dcdx - plane[j].eo;
          const int cio = ei * 16 - 1;
+         int slo, shi;
 
-	 build_masks(c[j] + cox,
-		     cio - cox,
+         lp_rast_sample_offset_range(&plane[j], task->scene->nr_samples,
+                                     &slo, &shi);
+
+	 build_masks(c[j] + cox + shi,
+		     cio - cox + slo - shi,
 		     dcdx, dcdy, 
 		     &outmask,   /* sign bits from c[i][0..15] + cox */
 		     &partmask); /* sign bits from c[i][0..15] + cio */
@@ -246,6 +330,8 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
       LP_COUNT(nr_fully_covered_16);
       block_full_16(task, tri, px, py);
    }
+
+   lp_rast_hiz_update_64(task);
 }
 
 #if defined(PIPE_ARCH_SSE) && defined(TRI_16)
@@ -27,6 +27,7 @@
 
 #include "util/u_framebuffer.h"
 #include "util/u_math.h"
+#include "util/u_atomic.h"
 #include "util/u_memory.h"
 #include "util/u_inlines.h"
 #include "util/u_simple_list.h"
@@ -34,6 +35,7 @@
 #include "lp_scene.h"
 #include "lp_fence.h"
 #include "lp_debug.h"
+#include "lp_texture.h"
 
 
 #define RESOURCE_REF_SZ 32
@@ -51,19 +53,19 @@ struct resource_ref {
  * \param queue  the queue to put newly rendered/emptied scenes into
  */
 struct lp_scene *
-lp_scene_create( struct pipe_context *pipe )
+lp_scene_create( struct pipe_context *pipe,
+                 struct lp_scene_queue *empty_queue )
 {
    struct lp_scene *scene = CALLOC_STRUCT(lp_scene);
    if (!scene)
       return NULL;
 
    scene->pipe = pipe;
+   scene->empty_queue = empty_queue;
 
    scene->data.head =
       CALLOC_STRUCT(data_block);
 
-   pipe_mutex_init(scene->mutex);
-
    return scene;
 }
 
@@ -75,9 +77,9 @@ void
 lp_scene_destroy(struct lp_scene *scene)
 {
    lp_fence_reference(&scene->fence, NULL);
-   pipe_mutex_destroy(scene->mutex);
    assert(scene->data.head->next == NULL);
    FREE(scene->data.head);
+   align_free(scene->bin_queues);
    FREE(scene);
 }
 
@@ -131,10 +133,29 @@ lp_scene_bin_reset(struct lp_scene *scene, unsigned x, unsigned y)
 }
 
 
+/**
+ * The surface's resource if the rasterizer can defer clearing its tiles,
+ * otherwise NULL.
+ */
+static struct llvmpipe_resource *
+surface_fast_clear(const struct pipe_surface *surf)
+{
+   struct llvmpipe_resource *lpr = llvmpipe_resource(surf->texture);
+
+   if (!lpr->tile_clear ||
+       surf->u.tex.level != 0 ||
+       surf->u.tex.first_layer != 0)
+      return NULL;
+
+   return lpr;
+}
+
+
 void
 lp_scene_begin_rasterization(struct lp_scene *scene)
 {
    const struct pipe_framebuffer_state *fb = &scene->fb;
+   const struct resource_ref *ref;
    int i;
 
    //LP_DBG(DEBUG_RAST, "%s\n", __FUNCTION__);
@@ -148,8 +169,10 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
       scene->cbufs[i].map = llvmpipe_resource_map(cbuf->texture,
                                                   cbuf->u.tex.level,
                                                   cbuf->u.tex.first_layer,
-                                                  LP_TEX_USAGE_READ_WRITE,
-                                                  LP_TEX_LAYOUT_LINEAR);
+                                                  LP_TEX_USAGE_READ_WRITE);
+      scene->cbufs[i].sample_stride =
+         llvmpipe_resource_sample_stride(cbuf->texture);
+      scene->cbufs[i].fast_clear = surface_fast_clear(cbuf);
    }
 
    if (fb->zsbuf) {
@@ -162,8 +185,19 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
       scene->zsbuf.map = llvmpipe_resource_map(zsbuf->texture,
                                                zsbuf->u.tex.level,
                                                zsbuf->u.tex.first_layer,
-                                               LP_TEX_USAGE_READ_WRITE,
-                                               LP_TEX_LAYOUT_NONE);
+                                               LP_TEX_USAGE_READ_WRITE);
+      scene->zsbuf.sample_stride =
+         llvmpipe_resource_sample_stride(zsbuf->texture);
+      scene->zsbuf.fast_clear = surface_fast_clear(zsbuf);
+   }
+
+   /* The textures sampled by the scene must hold their pixels.  The
+    * rasterizer threads haven't started on the scene yet, and the earlier
+    * scenes are done.
+    */
+   for (ref = scene->resources; ref; ref = ref->next) {
+      for (i = 0; i < ref->count; i++)
+         llvmpipe_resource_resolve_clears(ref->resource[i]);
    }
 }
 
@@ -171,12 +205,14 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
 
 
 /**
- * Free all the temporary data in a scene.
+ * Unmap the framebuffer surfaces.
+ * Called by the rasterizer once it is done with the scene.  The scene's
+ * other data stays valid until lp_scene_reset().
  */
 void
 lp_scene_end_rasterization(struct lp_scene *scene )
 {
-   int i, j;
+   int i;
 
    /* Unmap color buffers */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
@@ -186,6 +222,7 @@ lp_scene_end_rasterization(struct lp_scene *scene )
                                  cbuf->u.tex.level,
                                  cbuf->u.tex.first_layer);
          scene->cbufs[i].map = NULL;
+         scene->cbufs[i].fast_clear = NULL;
       }
    }
 
@@ -196,7 +233,24 @@ lp_scene_end_rasterization(struct lp_scene *scene )
                               zsbuf->u.tex.level,
                               zsbuf->u.tex.first_layer);
       scene->zsbuf.map = NULL;
+      scene->zsbuf.fast_clear = NULL;
    }
+}
+
+
+/**
+ * Free all the temporary data in a scene.
+ * Called by setup when it takes a scene back for binning, so that setup
+ * can keep inspecting the framebuffer and resources of the scenes still
+ * queued for rasterization.
+ */
+void
+lp_scene_reset(struct lp_scene *scene )
+{
+   int i, j;
+
+   assert(scene->cbufs[0].map == NULL);
+   assert(scene->zsbuf.map == NULL);
 
    /* Reset all command lists:
     */
@@ -271,6 +325,67 @@ lp_scene_end_rasterization(struct lp_scene *scene )
 
 
 
+/**
+ * Append the commands binned into another scene onto the bins of this
+ * scene and take over the other scene's malloc'd data blocks, which the
+ * commands point into.  Used to merge the scenes of the parallel setup
+ * threads in submission order.  The other scene is left with empty bins
+ * and a single, empty data block.
+ *
+ * \param base_size  other->scene_size before binning started
+ */
+void
+lp_scene_append(struct lp_scene *scene,
+                struct lp_scene *other,
+                unsigned base_size)
+{
+   struct data_block *block, *last = NULL;
+   int i, j;
+
+   assert(scene->tiles_x == other->tiles_x);
+   assert(scene->tiles_y == other->tiles_y);
+
+   for (i = 0; i < scene->tiles_x; i++) {
+      for (j = 0; j < scene->tiles_y; j++) {
+         struct cmd_bin *src = lp_scene_get_bin(other, i, j);
+         struct cmd_bin *dst;
+
+         if (!src->head)
+            continue;
+
+         dst = lp_scene_get_bin(scene, i, j);
+         if (dst->tail)
+            dst->tail->next = src->head;
+         else
+            dst->head = src->head;
+         dst->tail = src->tail;
+         dst->last_state = src->last_state;
+
+         src->head = NULL;
+         src->tail = NULL;
+         src->last_state = NULL;
+      }
+   }
+
+   /* Take over all but the oldest data block, which the other scene
+    * keeps for its next use.  The other scene must have started binning
+    * in a new block to leave that one unused.
+    */
+   for (block = other->data.head; block->next; block = block->next)
+      last = block;
+
+   if (last) {
+      assert(block->used == 0);
+      last->next = scene->data.head->next;
+      scene->data.head->next = other->data.head;
+      other->data.head = block;
+   }
+
+   scene->scene_size += other->scene_size - base_size;
+   other->scene_size = base_size;
+}
+
+
 struct cmd_block *
 lp_scene_new_cmd_block( struct lp_scene *scene,
                         struct cmd_bin *bin )
@@ -415,59 +530,182 @@ lp_scene_is_resource_referenced(const struct lp_scene *scene,
 
 
 
-/** advance curr_x,y to the next bin */
-static boolean
-next_bin(struct lp_scene *scene)
+/**
+ * Sort bins by decreasing cost.
+ */
+static int
+compare_bin_cost(const void *a, const void *b)
 {
-   scene->curr_x++;
-   if (scene->curr_x >= scene->tiles_x) {
-      scene->curr_x = 0;
-      scene->curr_y++;
-   }
-   if (scene->curr_y >= scene->tiles_y) {
-      /* no more bins */
-      return FALSE;
+   const struct cmd_bin *bin_a = *(const struct cmd_bin * const *) a;
+   const struct cmd_bin *bin_b = *(const struct cmd_bin * const *) b;
+
+   if (bin_a->cost != bin_b->cost)
+      return bin_a->cost < bin_b->cost ? 1 : -1;
+
+   /* keep scan order between bins of equal cost */
+   return bin_a < bin_b ? -1 : (bin_a > bin_b);
+}
+
+
+/**
+ * Get the bin queues for the next scene, allocating more if needed.
+ * \return the number of queues to use, 1 when out of memory
+ */
+static unsigned
+get_bin_queues( struct lp_scene *scene, unsigned num_queues )
+{
+   if (num_queues > scene->max_bin_queues) {
+      align_free(scene->bin_queues);
+      scene->bin_queues = align_malloc(num_queues * sizeof scene->bin_queues[0],
+                                       sizeof scene->bin_queues[0]);
+      scene->max_bin_queues = scene->bin_queues ? num_queues : 0;
    }
-   return TRUE;
+
+   if (num_queues <= 1 || !scene->bin_queues)
+      return 1;
+
+   return num_queues;
 }
 
 
+/**
+ * Prepare the lists of bins to be handed out to the rasterizer threads.
+ *
+ * Empty bins are left out altogether.  The remaining bins are split in
+ * num_queues queues, one per rasterizer thread, each holding a band of
+ * tiles contiguous in scan order.  The split only depends on the
+ * framebuffer size, so from one scene to the next a tile is rasterized
+ * by the same thread, whose caches (and NUMA node, see lp_affinity.c)
+ * still hold the tile's color and depth lines.
+ *
+ * Within each queue the bins are ordered by their number of commands,
+ * costliest first, so that the long running bins get started early and
+ * the cheap ones fill the gaps at the end of the scene.  A thread that
+ * runs out of bins steals the cheap ones off the back of the other
+ * queues.  The commands within a bin have to be executed in order by a
+ * single thread, so a heavy bin can't be split further.
+ *
+ * Called once per scene, before the threads start rasterizing.
+ */
 void
-lp_scene_bin_iter_begin( struct lp_scene *scene )
+lp_scene_bin_iter_begin( struct lp_scene *scene, unsigned num_queues )
 {
-   scene->curr_x = scene->curr_y = -1;
+   const unsigned num_bins = scene->tiles_x * scene->tiles_y;
+   struct lp_bin_queue *queues;
+   unsigned x, y, q, begin;
+
+   num_queues = get_bin_queues(scene, num_queues);
+   queues = num_queues > 1 ? scene->bin_queues : &scene->single_bin_queue;
+   scene->num_bin_queues = num_queues;
+   scene->num_active_bins = 0;
+
+   /* The queues are filled in scan order, so each one gets a contiguous
+    * range of active_bins.
+    */
+   q = 0;
+   begin = 0;
+   for (y = 0; y < scene->tiles_y; y++) {
+      for (x = 0; x < scene->tiles_x; x++) {
+         struct cmd_bin *bin = lp_scene_get_bin(scene, x, y);
+         unsigned home = (y * scene->tiles_x + x) * num_queues / num_bins;
+         const struct cmd_block *block;
+
+         while (q < home) {
+            queues[q++].range = LP_BIN_QUEUE_RANGE(begin,
+                                                   scene->num_active_bins);
+            begin = scene->num_active_bins;
+         }
+
+         if (!bin->head)
+            continue;
+
+         bin->cost = 0;
+         for (block = bin->head; block; block = block->next) {
+            bin->cost += block->count;
+         }
+
+         scene->active_bins[scene->num_active_bins++] = bin;
+      }
+   }
+
+   while (q < num_queues) {
+      queues[q++].range = LP_BIN_QUEUE_RANGE(begin, scene->num_active_bins);
+      begin = scene->num_active_bins;
+   }
+
+   for (q = 0; q < num_queues; q++) {
+      unsigned first = LP_BIN_QUEUE_BEGIN(queues[q].range);
+      unsigned count = LP_BIN_QUEUE_END(queues[q].range) - first;
+
+      if (count > 1) {
+         qsort(scene->active_bins + first, count,
+               sizeof scene->active_bins[0], compare_bin_cost);
+      }
+   }
 }
 
 
 /**
- * Return pointer to next bin to be rendered.
- * The lp_scene::curr_x and ::curr_y fields will be advanced.
+ * Return pointer to next bin to be rendered, or NULL when there are no
+ * more bins.
  * Multiple rendering threads will call this function to get a chunk
- * of work (a bin) to work on.
+ * of work (a bin) to work on.  This is lock-free: the range of a queue
+ * is shrunk with compare-and-swap.
+ * \param order    the queues to take bins from, in order of preference;
+ *                 the first is the thread's own queue, whose bins are
+ *                 taken from the front, the bins of the others are taken
+ *                 from the back.  Queues the scene doesn't have are skipped.
+ * \param queue    returns the position in order of the queue the bin
+ *                 was taken from (may be NULL)
+ * \param retries  incremented by the number of times the compare-and-swap
+ *                 lost against another thread (may be NULL)
  */
 struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene )
+lp_scene_bin_iter_next( struct lp_scene *scene,
+                        const unsigned *order, unsigned num_queues,
+                        unsigned *queue, unsigned *retries )
 {
-   struct cmd_bin *bin = NULL;
+   struct lp_bin_queue *queues = scene->num_bin_queues > 1 ?
+      scene->bin_queues : &scene->single_bin_queue;
+   unsigned i;
 
-   pipe_mutex_lock(scene->mutex);
+   for (i = 0; i < num_queues; i++) {
+      struct lp_bin_queue *q;
+      boolean steal = i > 0;
 
-   if (scene->curr_x < 0) {
-      /* first bin */
-      scene->curr_x = 0;
-      scene->curr_y = 0;
-   }
-   else if (!next_bin(scene)) {
-      /* no more bins left */
-      goto end;
-   }
+      if (order[i] >= scene->num_bin_queues)
+         continue;
+
+      q = &queues[order[i]];
+
+      while (1) {
+         int32_t range = p_atomic_read(&q->range);
+         unsigned begin = LP_BIN_QUEUE_BEGIN(range);
+         unsigned end = LP_BIN_QUEUE_END(range);
+         int32_t next;
+
+         if (begin >= end) {
+            /* no more bins left in this queue */
+            break;
+         }
+
+         if (steal)
+            next = LP_BIN_QUEUE_RANGE(begin, end - 1);
+         else
+            next = LP_BIN_QUEUE_RANGE(begin + 1, end);
+
+         if (p_atomic_cmpxchg(&q->range, range, next) == range) {
+            if (queue)
+               *queue = i;
+            return scene->active_bins[steal ? end - 1 : begin];
+         }
 
-   bin = lp_scene_get_bin(scene, scene->curr_x, scene->curr_y);
+         if (retries)
+            (*retries)++;
+      }
+   }
 
-end:
-   /*printf("return bin %p at %d, %d\n", (void *) bin, *bin_x, *bin_y);*/
-   pipe_mutex_unlock(scene->mutex);
-   return bin;
+   return NULL;
 }
 
 
@@ -478,6 +716,7 @@ void lp_scene_begin_binning( struct lp_scene *scene,
 
    scene->discard = discard;
    util_copy_framebuffer_state(&scene->fb, fb);
+   scene->nr_samples = llvmpipe_framebuffer_nr_samples(fb);
 
    scene->tiles_x = align(fb->width, TILE_SIZE) / TILE_SIZE;
    scene->tiles_y = align(fb->height, TILE_SIZE) / TILE_SIZE;
@@ -38,9 +38,11 @@
 #include "os/os_thread.h"
 #include "lp_rast.h"
 #include "lp_debug.h"
+#include "lp_perf.h"
 
 struct lp_scene_queue;
 struct lp_rast_state;
+struct llvmpipe_resource;
 
 /* We're limited to 2K by 2K for 32bit fixed point rasterization.
  * Will need a 64-bit version for larger framebuffers.
@@ -61,6 +63,13 @@ struct lp_rast_state;
  */
 #define LP_SCENE_MAX_RESOURCE_SIZE (64*1024*1024)
 
+/* Setup stops queueing scenes for rasterization once the queued scenes
+ * use this much scene storage plus referenced texture storage, and
+ * waits for the rasterizer to catch up instead:
+ */
+#define LP_SCENE_MAX_QUEUED_SIZE (4 * (LP_SCENE_MAX_SIZE + \
+                                       LP_SCENE_MAX_RESOURCE_SIZE))
+
 
 /* switch to a non-pointer value for this:
  */
@@ -94,6 +103,7 @@ struct data_block {
 struct cmd_bin {
    ushort x;
    ushort y;
+   unsigned cost;       /**< estimated raster cost, see lp_scene_bin_iter_begin */
    const struct lp_rast_state *last_state;       /* most recent state set in bin */
    struct cmd_block *head;
    struct cmd_block *tail;
@@ -117,6 +127,24 @@ struct data_block_list {
 
 struct resource_ref;
 
+
+/**
+ * A range of lp_scene::active_bins still to be rasterized, as the index
+ * of the first bin in the low 16 bits and the index past the last bin in
+ * the high 16 bits, so that both ends can be updated with a single
+ * compare-and-swap.  The owner thread takes bins from the front (the
+ * costliest), the other threads steal them from the back.  Padded to a
+ * cache line so that the threads don't contend for their queues' lines.
+ */
+struct lp_bin_queue {
+   int32_t range;
+   uint8_t pad[64 - sizeof(int32_t)];
+};
+
+#define LP_BIN_QUEUE_RANGE(begin, end) ((int32_t) ((end) << 16 | (begin)))
+#define LP_BIN_QUEUE_BEGIN(range) ((unsigned) (range) & 0xffff)
+#define LP_BIN_QUEUE_END(range) ((unsigned) (range) >> 16)
+
 /**
  * All bins and bin data are contained here.
  * Per-bin data goes into the 'tile' bins.
@@ -129,6 +157,15 @@ struct lp_scene {
    struct pipe_context *pipe;
    struct lp_fence *fence;
 
+   /** The queue the rasterizer puts the scene into when it's done with it */
+   struct lp_scene_queue *empty_queue;
+
+   /** Scene and resource size accounted to setup while the scene is queued */
+   unsigned queued_size;
+
+   /** Rasterization counts, taken by setup with the scene, see lp_perf.h */
+   struct lp_perf_counters perf;
+
    /* Framebuffer mappings - valid only between begin_rasterization()
     * and end_rasterization().
     */
@@ -136,11 +173,17 @@ struct lp_scene {
       uint8_t *map;
       unsigned stride;
       unsigned blocksize;
+      unsigned sample_stride;    /**< see llvmpipe_resource::sample_stride */
+      struct llvmpipe_resource *fast_clear;  /**< the surface's resource if
+                                                  it defers tile clears */
    } zsbuf, cbufs[PIPE_MAX_COLOR_BUFS];
    
    /** the framebuffer to render the scene into */
    struct pipe_framebuffer_state fb;
 
+   /** number of samples of the framebuffer surfaces, 1 or LP_MAX_SAMPLES */
+   unsigned nr_samples;
+
    /** list of resources referenced by the scene commands */
    struct resource_ref *resources;
 
@@ -164,8 +207,22 @@ struct lp_scene {
     */
    unsigned tiles_x, tiles_y;
 
-   int curr_x, curr_y;  /**< for iterating over bins */
-   pipe_mutex mutex;
+   /**
+    * The non-empty bins, for iterating over bins.  They are split in
+    * ranges, one per bin queue, each sorted costliest first.
+    */
+   struct cmd_bin *active_bins[TILES_X * TILES_Y];
+   unsigned num_active_bins;
+
+   /**
+    * One queue of bins per rasterizer thread, see lp_scene_bin_iter_begin.
+    * Allocated for max_bin_queues queues; single_bin_queue is used when
+    * that fails.
+    */
+   struct lp_bin_queue *bin_queues;
+   unsigned num_bin_queues;
+   unsigned max_bin_queues;
+   struct lp_bin_queue single_bin_queue;
 
    struct cmd_bin tile[TILES_X][TILES_Y];
    struct data_block_list data;
@@ -173,7 +230,8 @@ struct lp_scene {
 
 
 
-struct lp_scene *lp_scene_create(struct pipe_context *pipe);
+struct lp_scene *lp_scene_create(struct pipe_context *pipe,
+                                 struct lp_scene_queue *empty_queue);
 
 void lp_scene_destroy(struct lp_scene *scene);
 
@@ -343,6 +401,61 @@ lp_scene_bin_cmd_with_state( struct lp_scene *scene,
 }
 
 
+/**
+ * Add a LP_RAST_OP_TRIANGLE_3_4 or LP_RAST_OP_TRIANGLE_3_16 command to
+ * bin[x][y].  If the bin's last command is another such triangle with the
+ * same state, the two are merged into a LP_RAST_OP_TRIANGLE_BATCH command,
+ * and later ones appended to it, to save the per-command overhead of
+ * small triangles in the rasterizer.
+ */
+static INLINE boolean
+lp_scene_bin_small_triangle( struct lp_scene *scene,
+                             unsigned x, unsigned y,
+                             const struct lp_rast_state *state,
+                             unsigned cmd,
+                             union lp_rast_cmd_arg arg )
+{
+   struct cmd_bin *bin = lp_scene_get_bin(scene, x, y);
+   struct cmd_block *tail = bin->tail;
+
+   assert(cmd == LP_RAST_OP_TRIANGLE_3_4 ||
+          cmd == LP_RAST_OP_TRIANGLE_3_16);
+
+   if (state == bin->last_state && tail && tail->count) {
+      const unsigned last = tail->count - 1;
+      struct lp_rast_triangle_batch *batch = NULL;
+
+      if (tail->cmd[last] == LP_RAST_OP_TRIANGLE_BATCH) {
+         batch = tail->arg[last].triangle_batch;
+      }
+      else if (tail->cmd[last] == LP_RAST_OP_TRIANGLE_3_4 ||
+               tail->cmd[last] == LP_RAST_OP_TRIANGLE_3_16) {
+         batch = lp_scene_alloc(scene, sizeof *batch);
+         if (!batch)
+            return FALSE;
+
+         batch->cmd[0] = tail->cmd[last];
+         batch->tri[0] = tail->arg[last].triangle.tri;
+         batch->plane_mask[0] = tail->arg[last].triangle.plane_mask;
+         batch->count = 1;
+
+         tail->cmd[last] = LP_RAST_OP_TRIANGLE_BATCH;
+         tail->arg[last] = lp_rast_arg_triangle_batch(batch);
+      }
+
+      if (batch && batch->count < LP_RAST_BATCH_SIZE) {
+         batch->cmd[batch->count] = cmd;
+         batch->tri[batch->count] = arg.triangle.tri;
+         batch->plane_mask[batch->count] = arg.triangle.plane_mask;
+         batch->count++;
+         return TRUE;
+      }
+   }
+
+   return lp_scene_bin_cmd_with_state( scene, x, y, state, cmd, arg );
+}
+
+
 /* Add a command to all active bins.
  */
 static INLINE boolean
@@ -370,10 +483,12 @@ lp_scene_get_num_bins( const struct lp_scene *scene )
 
 
 void
-lp_scene_bin_iter_begin( struct lp_scene *scene );
+lp_scene_bin_iter_begin( struct lp_scene *scene, unsigned num_queues );
 
 struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene );
+lp_scene_bin_iter_next( struct lp_scene *scene,
+                        const unsigned *order, unsigned num_queues,
+                        unsigned *queue, unsigned *retries );
 
 
 
@@ -396,6 +511,14 @@ lp_scene_begin_rasterization(struct lp_scene *scene);
 void
 lp_scene_end_rasterization(struct lp_scene *scene );
 
+void
+lp_scene_reset(struct lp_scene *scene );
+
+void
+lp_scene_append(struct lp_scene *scene,
+                struct lp_scene *other,
+                unsigned base_size);
+
 
 
 
@@ -33,13 +33,12 @@
  */
 
 #include "util/u_ringbuffer.h"
+#include "util/u_math.h"
 #include "util/u_memory.h"
 #include "lp_scene_queue.h"
 
 
 
-#define MAX_SCENE_QUEUE 4
-
 struct scene_packet {
    struct util_packet header;
    struct lp_scene *scene;
@@ -55,16 +54,23 @@ struct lp_scene_queue
 
 
 
-/** Allocate a new scene queue */
+/**
+ * Allocate a new scene queue.
+ * \param max_scenes  number of scenes the queue holds before
+ *                    lp_scene_enqueue() blocks
+ */
 struct lp_scene_queue *
-lp_scene_queue_create(void)
+lp_scene_queue_create(unsigned max_scenes)
 {
    struct lp_scene_queue *queue = CALLOC_STRUCT(lp_scene_queue);
    if (queue == NULL)
       return NULL;
 
-   queue->ring = util_ringbuffer_create( MAX_SCENE_QUEUE * 
-                                         sizeof( struct scene_packet ) / 4);
+   /* The ring keeps one dword free and must be a power of two in size.
+    */
+   queue->ring = util_ringbuffer_create(
+      util_next_power_of_two((max_scenes + 1) *
+                             sizeof( struct scene_packet ) / 4));
    if (queue->ring == NULL)
       goto fail;
 
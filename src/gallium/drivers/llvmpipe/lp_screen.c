@@ -40,6 +40,7 @@
 #include "os/os_time.h"
 #include "lp_texture.h"
 #include "lp_fence.h"
+#include "lp_compile_queue.h"
 #include "lp_jit.h"
 #include "lp_screen.h"
 #include "lp_context.h"
@@ -80,6 +81,9 @@ static const struct debug_named_value lp_perf_flags[] = {
    { "no_blend",       PERF_NO_BLEND, NULL },
    { "no_depth",       PERF_NO_DEPTH, NULL },
    { "no_alphatest",   PERF_NO_ALPHATEST, NULL },
+   { "no_hiz",         PERF_NO_HIZ, NULL },
+   { "no_tri_batch",   PERF_NO_TRI_BATCH, NULL },
+   { "no_fast_clear",  PERF_NO_FAST_CLEAR, NULL },
    DEBUG_NAMED_VALUE_END
 };
 
@@ -268,7 +272,7 @@ llvmpipe_get_paramf(struct pipe_screen *screen, enum pipe_capf param)
    case PIPE_CAPF_MAX_POINT_WIDTH_AA:
       return 255.0; /* arbitrary */
    case PIPE_CAPF_MAX_TEXTURE_ANISOTROPY:
-      return 16.0; /* not actually signficant at this time */
+      return 16.0; /* LP_MAX_ANISOTROPY may lower the actual sample count */
    case PIPE_CAPF_MAX_TEXTURE_LOD_BIAS:
       return 16.0; /* arbitrary */
    case PIPE_CAPF_GUARD_BAND_LEFT:
@@ -316,8 +320,19 @@ llvmpipe_is_format_supported( struct pipe_screen *_screen,
           target == PIPE_TEXTURE_3D ||
           target == PIPE_TEXTURE_CUBE);
 
-   if (sample_count > 1)
-      return FALSE;
+   /* Multisampling is supported for 2D render targets and depth/stencil
+    * buffers, with LP_MAX_SAMPLES samples.
+    */
+   if (sample_count > 1) {
+      if (sample_count != LP_MAX_SAMPLES)
+         return FALSE;
+
+      if (target != PIPE_TEXTURE_2D && target != PIPE_TEXTURE_RECT)
+         return FALSE;
+
+      if (bind & PIPE_BIND_DISPLAY_TARGET)
+         return FALSE;
+   }
 
    if (bind & PIPE_BIND_RENDER_TARGET) {
       if (format_desc->colorspace != UTIL_FORMAT_COLORSPACE_RGB)
@@ -382,8 +397,17 @@ llvmpipe_flush_frontbuffer(struct pipe_screen *_screen,
    struct llvmpipe_resource *texture = llvmpipe_resource(resource);
 
    assert(texture->dt);
-   if (texture->dt)
+   if (texture->dt) {
+      /* Scenes are rasterized asynchronously, so wait for the last one
+       * rendering to the display target.
+       */
+      if (texture->dt_fence)
+         lp_fence_wait(texture->dt_fence);
+
+      llvmpipe_resource_resolve_clears(resource);
+
       winsys->displaytarget_display(winsys, texture->dt, context_private);
+   }
 }
 
 
@@ -396,6 +420,9 @@ llvmpipe_destroy_screen( struct pipe_screen *_screen )
    if (screen->rast)
       lp_rast_destroy(screen->rast);
 
+   if (screen->compile_queue)
+      lp_compile_queue_destroy(screen->compile_queue);
+
    lp_jit_screen_cleanup(screen);
 
    if(winsys->destroy)
@@ -464,6 +491,7 @@ struct pipe_screen *
 llvmpipe_create_screen(struct sw_winsys *winsys)
 {
    struct llvmpipe_screen *screen;
+   unsigned num_compile_threads;
 
 #ifdef PIPE_ARCH_X86
    /* require SSE2 due to LLVM PR6960. */
@@ -510,7 +538,6 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    screen->num_threads = 0;
 #endif
    screen->num_threads = debug_get_num_option("LP_NUM_THREADS", screen->num_threads);
-   screen->num_threads = MIN2(screen->num_threads, LP_MAX_THREADS);
 
    screen->rast = lp_rast_create(screen->num_threads);
    if (!screen->rast) {
@@ -520,6 +547,11 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    }
    pipe_mutex_init(screen->rast_mutex);
 
+   num_compile_threads = debug_get_num_option("LP_NUM_COMPILE_THREADS", 0);
+   if (num_compile_threads) {
+      screen->compile_queue = lp_compile_queue_create(num_compile_threads);
+   }
+
    util_format_s3tc_init();
 
    return &screen->base;
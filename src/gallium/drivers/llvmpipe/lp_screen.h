@@ -39,6 +39,8 @@
 #include "os/os_thread.h"
 #include "gallivm/lp_bld.h"
 
+struct lp_compile_queue;
+
 
 struct sw_winsys;
 
@@ -57,6 +59,9 @@ struct llvmpipe_screen
 
    struct lp_rasterizer *rast;
    pipe_mutex rast_mutex;
+
+   /** Background shader compilation, NULL if disabled */
+   struct lp_compile_queue *compile_queue;
 };
 
 
@@ -39,15 +39,19 @@
 #include "util/u_inlines.h"
 #include "util/u_memory.h"
 #include "util/u_pack_color.h"
+#include "util/u_string.h"
+#include "os/os_time.h"
 #include "draw/draw_pipe.h"
 #include "lp_context.h"
 #include "lp_memory.h"
+#include "lp_perf.h"
 #include "lp_scene.h"
 #include "lp_texture.h"
 #include "lp_debug.h"
 #include "lp_fence.h"
 #include "lp_query.h"
 #include "lp_rast.h"
+#include "lp_scene_queue.h"
 #include "lp_setup_context.h"
 #include "lp_screen.h"
 #include "lp_state.h"
@@ -62,29 +66,85 @@ static boolean set_scene_state( struct lp_setup_context *, enum setup_state,
 static boolean try_update_scene_state( struct lp_setup_context *setup );
 
 
+/**
+ * Take back a scene the rasterizer is done with, free its temporary
+ * data and put it on the free list.
+ */
+static void
+lp_setup_recycle_scene(struct lp_setup_context *setup,
+                       struct lp_scene *scene)
+{
+   assert(setup->num_queued_scenes > 0);
+   assert(setup->queued_scene_size >= scene->queued_size);
+
+   setup->num_queued_scenes--;
+   setup->queued_scene_size -= scene->queued_size;
+   scene->queued_size = 0;
+
+   lp_perf_add_counters(&setup->perf, &scene->perf);
+   memset(&scene->perf, 0, sizeof scene->perf);
+
+   lp_scene_reset(scene);
+
+   assert(setup->num_free_scenes < setup->max_scenes);
+   setup->free_scenes[setup->num_free_scenes++] = scene;
+}
+
+
+/**
+ * Get a scene to bin into.
+ *
+ * Scenes are created on demand, up to setup->max_scenes.  Setup only
+ * waits for the rasterizer when all of them are queued for rasterization,
+ * or when the queued scenes hold more than LP_SCENE_MAX_QUEUED_SIZE bytes
+ * of scene and texture storage.
+ */
 static void
 lp_setup_get_empty_scene(struct lp_setup_context *setup)
 {
    struct llvmpipe_context *lp = llvmpipe_context(setup->pipe);
    boolean discard = lp->rasterizer ? lp->rasterizer->rasterizer_discard : FALSE;
+   struct lp_scene *scene;
 
    assert(setup->scene == NULL);
 
-   setup->scene_idx++;
-   setup->scene_idx %= Elements(setup->scenes);
+   /* take back the scenes the rasterizer is done with, without waiting */
+   while ((scene = lp_scene_dequeue(setup->empty_scenes, FALSE)) != NULL) {
+      lp_setup_recycle_scene(setup, scene);
+   }
 
-   setup->scene = setup->scenes[setup->scene_idx];
+   if (!setup->num_free_scenes &&
+       setup->num_scenes < setup->max_scenes) {
+      scene = lp_scene_create(setup->pipe, setup->empty_scenes);
+      if (scene) {
+         setup->scenes[setup->num_scenes++] = scene;
+         setup->free_scenes[setup->num_free_scenes++] = scene;
+      }
+   }
 
-   if (setup->scene->fence) {
-      if (LP_DEBUG & DEBUG_SETUP)
-         debug_printf("%s: wait for scene %d\n",
-                      __FUNCTION__, setup->scene->fence->id);
+   if (!setup->num_free_scenes ||
+       setup->queued_scene_size > LP_SCENE_MAX_QUEUED_SIZE) {
+      int64_t start = os_time_get();
 
-      lp_fence_wait(setup->scene->fence);
+      do {
+         if (LP_DEBUG & DEBUG_SETUP)
+            debug_printf("%s: wait for scene, %u queued, %u bytes\n",
+                         __FUNCTION__, setup->num_queued_scenes,
+                         setup->queued_scene_size);
+
+         assert(setup->num_queued_scenes);
+         scene = lp_scene_dequeue(setup->empty_scenes, TRUE);
+         lp_setup_recycle_scene(setup, scene);
+      } while (setup->num_queued_scenes &&
+               setup->queued_scene_size > LP_SCENE_MAX_QUEUED_SIZE);
+
+      setup->stats.nr_stalls++;
+      setup->stats.stall_time += os_time_get() - start;
    }
 
+   setup->scene = setup->free_scenes[--setup->num_free_scenes];
+
    lp_scene_begin_binning(setup->scene, &setup->fb, discard);
-   
 }
 
 
@@ -148,7 +208,58 @@ void lp_setup_reset( struct lp_setup_context *setup )
 }
 
 
-/** Rasterize all scene's bins */
+/**
+ * Remember the scene's fence in the display targets it renders to, so
+ * that llvmpipe_flush_frontbuffer() can wait for the scene before the
+ * display target is presented.
+ */
+static void
+lp_setup_fence_display_targets( struct lp_scene *scene )
+{
+   unsigned i;
+
+   for (i = 0; i < scene->fb.nr_cbufs; i++) {
+      struct pipe_surface *cbuf = scene->fb.cbufs[i];
+      if (cbuf) {
+         struct llvmpipe_resource *lpr = llvmpipe_resource(cbuf->texture);
+         if (lpr->dt)
+            lp_fence_reference(&lpr->dt_fence, scene->fence);
+      }
+   }
+}
+
+
+/**
+ * Print the context's and the rasterizer threads' counters with
+ * LP_PERF_DUMP, at most once per interval.
+ */
+static void
+lp_setup_dump_perf_counters(struct lp_setup_context *setup)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(setup->pipe->screen);
+   struct lp_perf_counters counters;
+   int64_t now = os_time_get();
+   unsigned i;
+
+   if (now - setup->perf_last_dump < setup->perf_dump_interval)
+      return;
+
+   setup->perf_last_dump = now;
+
+   lp_setup_get_perf_counters(setup, &counters);
+   lp_perf_print_counters("context", &counters);
+
+   for (i = 0; i < MAX2(1, lp_rast_get_num_threads(screen->rast)); i++) {
+      char name[16];
+
+      lp_rast_get_perf_counters(screen->rast, i, &counters);
+      util_snprintf(name, sizeof name, "thread %u", i);
+      lp_perf_print_counters(name, &counters);
+   }
+}
+
+
+/** Queue the scene's bins for rasterization */
 static void
 lp_setup_rasterize_scene( struct lp_setup_context *setup )
 {
@@ -159,17 +270,36 @@ lp_setup_rasterize_scene( struct lp_setup_context *setup )
 
    lp_fence_reference(&setup->last_fence, scene->fence);
 
-   if (setup->last_fence)
+   if (setup->last_fence) {
       setup->last_fence->issued = TRUE;
+      lp_setup_fence_display_targets(scene);
+   }
+
+   scene->queued_size = scene->scene_size + scene->resource_reference_size;
+   setup->queued_scene_size += scene->queued_size;
+   setup->num_queued_scenes++;
+
+   setup->stats.nr_scenes++;
+   setup->stats.max_queued = MAX2(setup->stats.max_queued,
+                                  setup->num_queued_scenes);
 
+   setup->perf.nr_scenes++;
+   setup->perf.scene_bytes += scene->queued_size;
+   setup->perf.max_scene_bytes = MAX2(setup->perf.max_scene_bytes,
+                                      scene->queued_size);
+
+   /* The scene comes back through setup->empty_scenes once it has been
+    * rasterized.
+    */
    pipe_mutex_lock(screen->rast_mutex);
    lp_rast_queue_scene(screen->rast, scene);
-   lp_rast_finish(screen->rast);
    pipe_mutex_unlock(screen->rast_mutex);
 
-   lp_scene_end_rasterization(setup->scene);
    lp_setup_reset( setup );
 
+   if (setup->perf_dump_interval)
+      lp_setup_dump_perf_counters(setup);
+
    LP_DBG(DEBUG_SETUP, "%s done \n", __FUNCTION__);
 }
 
@@ -186,9 +316,10 @@ begin_binning( struct lp_setup_context *setup )
    assert(scene);
    assert(scene->fence == NULL);
 
-   /* Always create a fence:
+   /* Always create a fence.  The rasterizer signals it once, after all
+    * threads are done with the scene:
     */
-   scene->fence = lp_fence_create(MAX2(1, setup->num_threads));
+   scene->fence = lp_fence_create(1);
    if (!scene->fence)
       return FALSE;
 
@@ -240,10 +371,11 @@ begin_binning( struct lp_setup_context *setup )
    }
 
    for (i = 0; i < PIPE_QUERY_TYPES; ++i) {
-      if (setup->active_query[i]) {
+      struct llvmpipe_query *pq = setup->active_query[i];
+      if (pq) {
          ok = lp_scene_bin_everywhere( scene,
                                        LP_RAST_OP_BEGIN_QUERY,
-                                       lp_rast_arg_query(setup->active_query[i]) );
+                                       lp_rast_arg_query(pq->results) );
          if (!ok)
             return FALSE;
       }
@@ -333,7 +465,8 @@ set_scene_state( struct lp_setup_context *setup,
 
 fail:
    if (setup->scene) {
-      lp_scene_end_rasterization(setup->scene);
+      lp_scene_reset(setup->scene);
+      setup->free_scenes[setup->num_free_scenes++] = setup->scene;
       setup->scene = NULL;
    }
 
@@ -700,14 +833,10 @@ lp_setup_set_fragment_sampler_views(struct lp_setup_context *setup,
             void *mip_ptr;
             int j;
             /*
-             * XXX this is messed up we don't want to accidentally trigger
-             * tiled->linear conversion for levels we don't need.
-             * So ask for first_level data (which will allocate all levels)
+             * Ask for first_level data (which will allocate all levels)
              * then if successful get base ptr.
              */
-            mip_ptr = llvmpipe_get_texture_image_all(lp_tex, view->u.tex.first_level,
-                                                     LP_TEX_USAGE_READ,
-                                                     LP_TEX_LAYOUT_LINEAR);
+            mip_ptr = llvmpipe_get_texture_image_all(lp_tex, view->u.tex.first_level);
             if ((LP_PERF & PERF_TEX_MEM) || !mip_ptr) {
                /* out of memory - use dummy tile memory */
                jit_tex->base = lp_dummy_tile;
@@ -718,18 +847,10 @@ lp_setup_set_fragment_sampler_views(struct lp_setup_context *setup,
                jit_tex->last_level = 0;
             }
             else {
-               jit_tex->base = lp_tex->linear_img.data;
+               jit_tex->base = lp_tex->img.data;
             }
             for (j = view->u.tex.first_level; j <= tex->last_level; j++) {
-               mip_ptr = llvmpipe_get_texture_image_all(lp_tex, j,
-                                                        LP_TEX_USAGE_READ,
-                                                        LP_TEX_LAYOUT_LINEAR);
-               jit_tex->mip_offsets[j] = (uint8_t *)mip_ptr - (uint8_t *)jit_tex->base;
-               /*
-                * could get mip offset directly but need call above to
-                * invoke tiled->linear conversion.
-                */
-               assert(lp_tex->linear_mip_offsets[j] == jit_tex->mip_offsets[j]);
+               jit_tex->mip_offsets[j] = lp_tex->mip_offsets[j];
                jit_tex->row_stride[j] = lp_tex->row_stride[j];
                jit_tex->img_stride[j] = lp_tex->img_stride[j];
 
@@ -814,8 +935,22 @@ lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
       return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
    }
 
+   /* check the render targets of the scenes still queued for rasterization */
+   for (i = 0; i < setup->num_scenes; i++) {
+      const struct pipe_framebuffer_state *fb = &setup->scenes[i]->fb;
+      unsigned j;
+
+      for (j = 0; j < fb->nr_cbufs; j++) {
+         if (fb->cbufs[j] && fb->cbufs[j]->texture == texture)
+            return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+      }
+      if (fb->zsbuf && fb->zsbuf->texture == texture) {
+         return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+      }
+   }
+
    /* check textures referenced by the scene */
-   for (i = 0; i < Elements(setup->scenes); i++) {
+   for (i = 0; i < setup->num_scenes; i++) {
       if (lp_scene_is_resource_referenced(setup->scenes[i], texture)) {
          return LP_REFERENCED_FOR_READ;
       }
@@ -1058,6 +1193,8 @@ lp_setup_destroy( struct lp_setup_context *setup )
 
    lp_setup_reset( setup );
 
+   lp_setup_parallel_destroy( setup );
+
    util_unreference_framebuffer_state(&setup->fb);
 
    for (i = 0; i < Elements(setup->fs.current_tex); i++) {
@@ -1068,16 +1205,36 @@ lp_setup_destroy( struct lp_setup_context *setup )
       pipe_resource_reference(&setup->constants[i].current.buffer, NULL);
    }
 
-   /* free the scenes in the 'empty' queue */
-   for (i = 0; i < Elements(setup->scenes); i++) {
-      struct lp_scene *scene = setup->scenes[i];
+   /* wait for the scenes still being rasterized */
+   while (setup->num_queued_scenes) {
+      lp_setup_recycle_scene(setup,
+                             lp_scene_dequeue(setup->empty_scenes, TRUE));
+   }
 
-      if (scene->fence)
-         lp_fence_wait(scene->fence);
+   if (LP_DEBUG & DEBUG_COUNTERS) {
+      debug_printf("llvmpipe: setup: scenes %u max queued %u "
+                   "stalls %u stalled %.3f s "
+                   "parallel draws %u fallbacks %u\n",
+                   setup->stats.nr_scenes,
+                   setup->stats.max_queued,
+                   setup->stats.nr_stalls,
+                   setup->stats.stall_time / 1000000.0,
+                   setup->stats.nr_parallel_draws,
+                   setup->stats.nr_parallel_fallbacks);
+      lp_perf_print_counters("context", &setup->perf);
+   }
+
+   for (i = 0; i < setup->num_scenes; i++) {
+      struct lp_scene *scene = setup->scenes[i];
 
+      lp_scene_reset(scene);
       lp_scene_destroy(scene);
    }
 
+   FREE(setup->scenes);
+   FREE(setup->free_scenes);
+   lp_scene_queue_destroy(setup->empty_scenes);
+
    lp_fence_reference(&setup->last_fence, NULL);
 
    FREE( setup );
@@ -1095,7 +1252,6 @@ lp_setup_create( struct pipe_context *pipe,
 {
    struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
    struct lp_setup_context *setup;
-   unsigned i;
 
    setup = CALLOC_STRUCT(lp_setup_context);
    if (!setup) {
@@ -1110,6 +1266,14 @@ lp_setup_create( struct pipe_context *pipe,
 
 
    setup->num_threads = screen->num_threads;
+
+   /* Threads are started on the first draw large enough to use them */
+   setup->num_bin_threads = debug_get_num_option("LP_NUM_SETUP_THREADS", 0);
+
+   setup->perf_dump_interval =
+      debug_get_num_option("LP_PERF_DUMP", 0) * (int64_t) 1000;
+   setup->perf_last_dump = os_time_get();
+
    setup->vbuf = draw_vbuf_stage(draw, &setup->base);
    if (!setup->vbuf) {
       goto no_vbuf;
@@ -1118,13 +1282,25 @@ lp_setup_create( struct pipe_context *pipe,
    draw_set_rasterize_stage(draw, setup->vbuf);
    draw_set_render(draw, &setup->base);
 
-   /* create some empty scenes */
-   for (i = 0; i < MAX_SCENES; i++) {
-      setup->scenes[i] = lp_scene_create( pipe );
-      if (!setup->scenes[i]) {
-         goto no_scenes;
-      }
+   /* Create the first scene now so that there's always one to bin into.
+    * More are created as needed, see lp_setup_get_empty_scene().
+    */
+   setup->max_scenes = MAX2(1, debug_get_num_option("LP_MAX_SCENES",
+                                                    MAX_SCENES));
+   setup->scenes = CALLOC(setup->max_scenes, sizeof setup->scenes[0]);
+   setup->free_scenes = CALLOC(setup->max_scenes,
+                               sizeof setup->free_scenes[0]);
+   setup->empty_scenes = lp_scene_queue_create(setup->max_scenes);
+   if (!setup->scenes || !setup->free_scenes || !setup->empty_scenes) {
+      goto no_scenes;
+   }
+
+   setup->scenes[0] = lp_scene_create( pipe, setup->empty_scenes );
+   if (!setup->scenes[0]) {
+      goto no_scenes;
    }
+   setup->num_scenes = 1;
+   setup->free_scenes[setup->num_free_scenes++] = setup->scenes[0];
 
    setup->triangle = first_triangle;
    setup->line     = first_line;
@@ -1135,11 +1311,10 @@ lp_setup_create( struct pipe_context *pipe,
    return setup;
 
 no_scenes:
-   for (i = 0; i < MAX_SCENES; i++) {
-      if (setup->scenes[i]) {
-         lp_scene_destroy(setup->scenes[i]);
-      }
-   }
+   FREE(setup->scenes);
+   FREE(setup->free_scenes);
+   if (setup->empty_scenes)
+      lp_scene_queue_destroy(setup->empty_scenes);
 
    setup->vbuf->destroy(setup->vbuf);
 no_vbuf:
@@ -1171,14 +1346,14 @@ lp_setup_begin_query(struct lp_setup_context *setup,
    if (setup->scene) {
       if (!lp_scene_bin_everywhere(setup->scene,
                                    LP_RAST_OP_BEGIN_QUERY,
-                                   lp_rast_arg_query(pq))) {
+                                   lp_rast_arg_query(pq->results))) {
 
          if (!lp_setup_flush_and_restart(setup))
             return;
 
          if (!lp_scene_bin_everywhere(setup->scene,
                                       LP_RAST_OP_BEGIN_QUERY,
-                                      lp_rast_arg_query(pq))) {
+                                      lp_rast_arg_query(pq->results))) {
             return;
          }
       }
@@ -1205,23 +1380,41 @@ lp_setup_end_query(struct lp_setup_context *setup, struct llvmpipe_query *pq)
     * retry this commands on failure.
     */
    if (setup->scene) {
-      /* pq->fence should be the fence of the *last* scene which
-       * contributed to the query result.
+      /* The results' fence should be the fence of the *last* scene
+       * which contributed to the query result.
        */
-      lp_fence_reference(&pq->fence, setup->scene->fence);
+      lp_fence_reference(&pq->results->fence, setup->scene->fence);
 
       if (!lp_scene_bin_everywhere(setup->scene,
                                    LP_RAST_OP_END_QUERY,
-                                   lp_rast_arg_query(pq))) {
+                                   lp_rast_arg_query(pq->results))) {
          lp_setup_flush(setup, NULL, __FUNCTION__);
       }
    }
    else {
-      lp_fence_reference(&pq->fence, setup->last_fence);
+      lp_fence_reference(&pq->results->fence, setup->last_fence);
    }
 }
 
 
+/**
+ * Get the context's profiling counters, including those of the scenes
+ * the rasterizer is done with.  Scenes still queued aren't waited for.
+ */
+void
+lp_setup_get_perf_counters(struct lp_setup_context *setup,
+                           struct lp_perf_counters *counters)
+{
+   struct lp_scene *scene;
+
+   while ((scene = lp_scene_dequeue(setup->empty_scenes, FALSE)) != NULL) {
+      lp_setup_recycle_scene(setup, scene);
+   }
+
+   *counters = setup->perf;
+}
+
+
 boolean
 lp_setup_flush_and_restart(struct lp_setup_context *setup)
 {
@@ -46,6 +46,7 @@ struct llvmpipe_query;
 struct pipe_fence_handle;
 struct lp_setup_variant;
 struct lp_setup_context;
+struct lp_perf_counters;
 
 void lp_setup_reset( struct lp_setup_context *setup );
 
@@ -153,4 +154,8 @@ void
 lp_setup_end_query(struct lp_setup_context *setup,
                    struct llvmpipe_query *pq);
 
+void
+lp_setup_get_perf_counters(struct lp_setup_context *setup,
+                           struct lp_perf_counters *counters);
+
 #endif
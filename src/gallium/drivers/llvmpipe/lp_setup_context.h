@@ -50,10 +50,15 @@
 
 
 struct lp_setup_variant;
+struct lp_setup_bin_task;
 
 
-/** Max number of scenes */
-#define MAX_SCENES 2
+/**
+ * Default max number of scenes per context, override with LP_MAX_SCENES.
+ * Scenes are created on demand, and the number of scenes actually queued
+ * for rasterization is further limited by LP_SCENE_MAX_QUEUED_SIZE.
+ */
+#define MAX_SCENES 4
 
 
 
@@ -84,13 +89,50 @@ struct lp_setup_context
     */
    struct draw_stage *vbuf;
    unsigned num_threads;
-   unsigned scene_idx;
-   struct lp_scene *scenes[MAX_SCENES];  /**< all the scenes */
+
+   unsigned max_scenes;
+   unsigned num_scenes;
+   struct lp_scene **scenes;             /**< all the scenes [max_scenes] */
    struct lp_scene *scene;               /**< current scene being built */
 
+   /** Reset scenes ready for binning [max_scenes] */
+   struct lp_scene **free_scenes;
+   unsigned num_free_scenes;
+
+   /** Scenes handed back by the rasterizer, not yet reset */
+   struct lp_scene_queue *empty_scenes;
+
+   /** Scenes queued for rasterization and not yet taken back */
+   unsigned num_queued_scenes;
+   unsigned queued_scene_size;   /**< sum of their lp_scene::queued_size */
+
+   struct {
+      unsigned nr_scenes;        /**< scenes queued for rasterization */
+      unsigned max_queued;       /**< most scenes queued at once */
+      unsigned nr_stalls;        /**< times setup waited for a scene */
+      int64_t stall_time;        /**< usecs spent waiting for a scene */
+      unsigned nr_parallel_draws;     /**< draws binned by several threads */
+      unsigned nr_parallel_fallbacks; /**< ... redone serially for lack of memory */
+   } stats;
+
+   /** Profiling counters of the context, see lp_perf.h */
+   struct lp_perf_counters perf;
+   int64_t perf_dump_interval;   /**< usecs between dumps, 0 for none */
+   int64_t perf_last_dump;
+
+   /** Extra threads binning large triangle draws, see lp_setup_parallel.c */
+   unsigned num_bin_threads;
+   struct lp_setup_bin_task *bin_tasks;  /**< [num_bin_threads + 1] */
+   boolean bin_task;                     /**< this is a task's copy */
+
    struct lp_fence *last_fence;
    struct llvmpipe_query *active_query[PIPE_QUERY_TYPES];
 
+   /** Triangles of the current draw culled before binning, for
+    * PIPE_QUERY_PIPELINE_STATISTICS
+    */
+   unsigned nr_culled_prims;
+
    boolean flatshade_first;
    boolean ccw_is_frontface;
    boolean scissor_test;
@@ -169,6 +211,13 @@ boolean lp_setup_update_state( struct lp_setup_context *setup,
 
 void lp_setup_destroy( struct lp_setup_context *setup );
 
+boolean lp_setup_parallel_draw( struct lp_setup_context *setup,
+                                const ushort *indices,
+                                unsigned start,
+                                unsigned nr );
+
+void lp_setup_parallel_destroy( struct lp_setup_context *setup );
+
 boolean lp_setup_flush_and_restart(struct lp_setup_context *setup);
 
 void
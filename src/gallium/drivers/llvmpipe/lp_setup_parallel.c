@@ -0,0 +1,335 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/**
+ * Parallel triangle setup and binning.
+ *
+ * Large triangle list/strip draws are split into contiguous ranges of
+ * triangles, one per task.  The calling thread runs the first task and
+ * the setup threads the others.  Each task bins into a scene of its own,
+ * through a copy of the setup context, so the tasks share nothing but
+ * the (read-only) vertex buffer and the state already stored in the
+ * current scene.  When all tasks are done their bins are appended to the
+ * current scene's bins in task order, so the commands end up in each bin
+ * in the same order as when binning serially.
+ *
+ * A task can't flush the scene when it runs out of memory.  If any task
+ * fails, the results of all the tasks are thrown away and the draw is
+ * binned serially, which flushes as usual.
+ */
+
+
+#include "draw/draw_vertex.h"
+#include "os/os_thread.h"
+#include "util/u_debug.h"
+#include "util/u_memory.h"
+#include "lp_debug.h"
+#include "lp_scene.h"
+#include "lp_setup_context.h"
+
+
+/** Draws with fewer triangles per task than this are binned serially */
+#define MIN_TRIS_PER_TASK 64
+
+
+struct lp_setup_bin_task
+{
+   struct lp_setup_context setup;   /**< copy of the context, binning
+                                         into 'scene' */
+   struct lp_scene *scene;
+   unsigned base_size;              /**< scene->scene_size at the start */
+
+   const ushort *indices;           /**< NULL for non-indexed draws */
+   unsigned first;                  /**< first vertex of non-indexed draws */
+   unsigned start, end;             /**< range of triangles to bin */
+
+   pipe_thread thread;
+   pipe_semaphore work_ready;
+   pipe_semaphore work_done;
+   boolean exit_flag;
+};
+
+
+typedef const float (*const_float4_ptr)[4];
+
+static INLINE const_float4_ptr
+get_vert(const struct lp_setup_bin_task *task, unsigned i, unsigned stride)
+{
+   unsigned index = task->indices ? task->indices[i] : task->first + i;
+   return (const_float4_ptr)((char *)task->setup.vertex_buffer +
+                             index * stride);
+}
+
+
+/**
+ * Bin triangles [start, end) of the draw.  Vertex order matches
+ * lp_setup_draw_elements() and lp_setup_draw_arrays().
+ */
+static void
+bin_triangles(struct lp_setup_bin_task *task)
+{
+   struct lp_setup_context *setup = &task->setup;
+   const unsigned stride = setup->vertex_info->size * sizeof(float);
+   unsigned i;
+
+   switch (setup->prim) {
+   case PIPE_PRIM_TRIANGLES:
+      for (i = 3 * task->start; i < 3 * task->end; i += 3) {
+         setup->triangle( setup,
+                          get_vert(task, i + 0, stride),
+                          get_vert(task, i + 1, stride),
+                          get_vert(task, i + 2, stride) );
+      }
+      break;
+
+   case PIPE_PRIM_TRIANGLE_STRIP:
+      if (setup->flatshade_first) {
+         for (i = task->start + 2; i < task->end + 2; i++) {
+            setup->triangle( setup,
+                             get_vert(task, i - 2, stride),
+                             get_vert(task, i + (i&1) - 1, stride),
+                             get_vert(task, i - (i&1), stride) );
+         }
+      }
+      else {
+         for (i = task->start + 2; i < task->end + 2; i++) {
+            setup->triangle( setup,
+                             get_vert(task, i + (i&1) - 2, stride),
+                             get_vert(task, i - (i&1) - 1, stride),
+                             get_vert(task, i - 0, stride) );
+         }
+      }
+      break;
+
+   default:
+      assert(0);
+   }
+}
+
+
+static PIPE_THREAD_ROUTINE( bin_thread_function, init_data )
+{
+   struct lp_setup_bin_task *task = (struct lp_setup_bin_task *) init_data;
+
+   while (1) {
+      pipe_semaphore_wait(&task->work_ready);
+
+      if (task->exit_flag)
+         break;
+
+      bin_triangles(task);
+
+      pipe_semaphore_signal(&task->work_done);
+   }
+
+   return NULL;
+}
+
+
+/**
+ * Create the tasks' scenes and start the setup threads.
+ */
+static boolean
+create_bin_tasks(struct lp_setup_context *setup)
+{
+   const unsigned num_tasks = setup->num_bin_threads + 1;
+   struct lp_setup_bin_task *tasks;
+   unsigned i;
+
+   tasks = CALLOC(num_tasks, sizeof *tasks);
+   if (!tasks)
+      return FALSE;
+
+   for (i = 0; i < num_tasks; i++) {
+      tasks[i].scene = lp_scene_create(setup->pipe, NULL);
+      if (!tasks[i].scene)
+         goto fail;
+   }
+
+   for (i = 1; i < num_tasks; i++) {
+      pipe_semaphore_init(&tasks[i].work_ready, 0);
+      pipe_semaphore_init(&tasks[i].work_done, 0);
+      tasks[i].thread = pipe_thread_create(bin_thread_function, &tasks[i]);
+   }
+
+   setup->bin_tasks = tasks;
+   return TRUE;
+
+fail:
+   for (i = 0; i < num_tasks; i++) {
+      if (tasks[i].scene)
+         lp_scene_destroy(tasks[i].scene);
+   }
+   FREE(tasks);
+   return FALSE;
+}
+
+
+/**
+ * Bin a triangle list or strip draw on several threads.
+ * Called after lp_setup_update_state() has stored the current state in
+ * the scene.  The draw's vertices are indices[0..nr-1] if indices is
+ * given, otherwise vertices start..start+nr-1.
+ *
+ * \return FALSE if the draw wasn't binned and must be binned serially.
+ */
+boolean
+lp_setup_parallel_draw(struct lp_setup_context *setup,
+                       const ushort *indices,
+                       unsigned start,
+                       unsigned nr)
+{
+   struct lp_scene *scene = setup->scene;
+   unsigned num_tris, num_tasks, free_size, i, x, y;
+   boolean ok = TRUE;
+
+   if (!setup->num_bin_threads)
+      return FALSE;
+
+   switch (setup->prim) {
+   case PIPE_PRIM_TRIANGLES:
+      num_tris = nr / 3;
+      break;
+   case PIPE_PRIM_TRIANGLE_STRIP:
+      num_tris = nr > 2 ? nr - 2 : 0;
+      break;
+   default:
+      return FALSE;
+   }
+
+   num_tasks = MIN2(setup->num_bin_threads + 1, num_tris / MIN_TRIS_PER_TASK);
+   if (num_tasks < 2)
+      return FALSE;
+
+   if (!setup->bin_tasks && !create_bin_tasks(setup)) {
+      setup->num_bin_threads = 0;
+      return FALSE;
+   }
+
+   /* Share the room left in the scene between the tasks, so that the
+    * merged scene stays within LP_SCENE_MAX_SIZE.
+    */
+   free_size = LP_SCENE_MAX_SIZE - MIN2(scene->scene_size, LP_SCENE_MAX_SIZE);
+
+   for (i = 0; i < num_tasks; i++) {
+      struct lp_setup_bin_task *task = &setup->bin_tasks[i];
+
+      lp_scene_begin_binning(task->scene, &setup->fb, scene->discard);
+      task->base_size = LP_SCENE_MAX_SIZE - free_size / num_tasks;
+      task->scene->scene_size = task->base_size;
+
+      /* Start in a new data block, see lp_scene_append() */
+      if (!lp_scene_new_data_block(task->scene))
+         ok = FALSE;
+
+      /* So that the first command in each bin only sets the state if it
+       * differs from the state already set in the current scene.
+       */
+      for (y = 0; y < scene->tiles_y; y++) {
+         for (x = 0; x < scene->tiles_x; x++) {
+            lp_scene_get_bin(task->scene, x, y)->last_state =
+               lp_scene_get_bin(scene, x, y)->last_state;
+         }
+      }
+
+      /* The copy doesn't own any references, it's simply overwritten by
+       * the next draw.
+       */
+      memcpy(&task->setup, setup, sizeof *setup);
+      task->setup.scene = task->scene;
+      task->setup.bin_task = TRUE;
+
+      task->indices = indices;
+      task->first = start;
+      task->start = num_tris * i / num_tasks;
+      task->end = num_tris * (i + 1) / num_tasks;
+   }
+
+   if (ok) {
+      for (i = 1; i < num_tasks; i++)
+         pipe_semaphore_signal(&setup->bin_tasks[i].work_ready);
+
+      bin_triangles(&setup->bin_tasks[0]);
+
+      for (i = 1; i < num_tasks; i++)
+         pipe_semaphore_wait(&setup->bin_tasks[i].work_done);
+
+      for (i = 0; i < num_tasks; i++) {
+         if (lp_scene_is_oom(setup->bin_tasks[i].scene))
+            ok = FALSE;
+      }
+   }
+
+   for (i = 0; i < num_tasks; i++) {
+      struct lp_setup_bin_task *task = &setup->bin_tasks[i];
+
+      if (ok) {
+         lp_scene_append(scene, task->scene, task->base_size);
+         setup->nr_culled_prims += task->setup.nr_culled_prims;
+      }
+
+      lp_scene_reset(task->scene);
+   }
+
+   if (ok)
+      setup->stats.nr_parallel_draws++;
+   else
+      setup->stats.nr_parallel_fallbacks++;
+
+   return ok;
+}
+
+
+/**
+ * Stop the setup threads and free the tasks.
+ */
+void
+lp_setup_parallel_destroy(struct lp_setup_context *setup)
+{
+   const unsigned num_tasks = setup->num_bin_threads + 1;
+   unsigned i;
+
+   if (!setup->bin_tasks)
+      return;
+
+   for (i = 1; i < num_tasks; i++) {
+      setup->bin_tasks[i].exit_flag = TRUE;
+      pipe_semaphore_signal(&setup->bin_tasks[i].work_ready);
+   }
+
+   for (i = 1; i < num_tasks; i++) {
+      pipe_thread_wait(setup->bin_tasks[i].thread);
+      pipe_semaphore_destroy(&setup->bin_tasks[i].work_ready);
+      pipe_semaphore_destroy(&setup->bin_tasks[i].work_done);
+   }
+
+   for (i = 0; i < num_tasks; i++)
+      lp_scene_destroy(setup->bin_tasks[i].scene);
+
+   FREE(setup->bin_tasks);
+   setup->bin_tasks = NULL;
+}
@@ -33,6 +33,7 @@
 #include "util/u_memory.h"
 #include "util/u_rect.h"
 #include "util/u_sse.h"
+#include "lp_debug.h"
 #include "lp_perf.h"
 #include "lp_setup_context.h"
 #include "lp_rast.h"
@@ -269,25 +270,33 @@ do_triangle_ccw(struct lp_setup_context *setup,
        */
       int adj = (setup->pixel_offset != 0) ? 1 : 0;
 
+      /* Pixels whose center is outside the triangle can still have
+       * samples inside it.
+       */
+      int ms = (scene->nr_samples > 1) ?
+               LP_SAMPLE_POS_MAX * FIXED_ONE / 16 : 0;
+
       /* Inclusive x0, exclusive x1 */
-      bbox.x0 =  MIN3(position->x[0], position->x[1], position->x[2]) >> FIXED_ORDER;
-      bbox.x1 = (MAX3(position->x[0], position->x[1], position->x[2]) - 1) >> FIXED_ORDER;
+      bbox.x0 = (MIN3(position->x[0], position->x[1], position->x[2]) - ms) >> FIXED_ORDER;
+      bbox.x1 = (MAX3(position->x[0], position->x[1], position->x[2]) - 1 + ms) >> FIXED_ORDER;
 
       /* Inclusive / exclusive depending upon adj (bottom-left or top-right) */
-      bbox.y0 = (MIN3(position->y[0], position->y[1], position->y[2]) + adj) >> FIXED_ORDER;
-      bbox.y1 = (MAX3(position->y[0], position->y[1], position->y[2]) - 1 + adj) >> FIXED_ORDER;
+      bbox.y0 = (MIN3(position->y[0], position->y[1], position->y[2]) + adj - ms) >> FIXED_ORDER;
+      bbox.y1 = (MAX3(position->y[0], position->y[1], position->y[2]) - 1 + adj + ms) >> FIXED_ORDER;
    }
 
    if (bbox.x1 < bbox.x0 ||
        bbox.y1 < bbox.y0) {
       if (0) debug_printf("empty bounding box\n");
       LP_COUNT(nr_culled_tris);
+      setup->nr_culled_prims++;
       return TRUE;
    }
 
    if (!u_rect_test_intersection(&setup->draw_region, &bbox)) {
       if (0) debug_printf("offscreen\n");
       LP_COUNT(nr_culled_tris);
+      setup->nr_culled_prims++;
       return TRUE;
    }
 
@@ -555,6 +564,25 @@ floor_pot(uint32_t n)
 }
 
 
+/**
+ * Bin a triangle contained in a 4x4 or 16x16 block, batched with the
+ * preceding small triangles of the bin unless LP_PERF=no_tri_batch.
+ */
+static INLINE boolean
+bin_small_triangle(struct lp_setup_context *setup,
+                   unsigned x, unsigned y,
+                   unsigned cmd,
+                   union lp_rast_cmd_arg arg)
+{
+   if (LP_PERF & PERF_NO_TRI_BATCH)
+      return lp_scene_bin_cmd_with_state( setup->scene, x, y,
+                                          setup->fs.stored, cmd, arg );
+
+   return lp_scene_bin_small_triangle( setup->scene, x, y,
+                                       setup->fs.stored, cmd, arg );
+}
+
+
 boolean
 lp_setup_bin_triangle( struct lp_setup_context *setup,
                        struct lp_rast_triangle *tri,
@@ -595,17 +623,20 @@ lp_setup_bin_triangle( struct lp_setup_context *setup,
       assert(iy0 == bbox->y1 / TILE_SIZE &&
 	     ix0 == bbox->x1 / TILE_SIZE);
 
-      if (nr_planes == 3) {
+      /* The small triangle rasterizers only test the pixel centers */
+      if (scene->nr_samples > 1) {
+         /* use the general rasterizer below */
+      }
+      else if (nr_planes == 3) {
          if (sz < 4)
          {
             /* Triangle is contained in a single 4x4 stamp:
              */
             assert(px + 4 <= TILE_SIZE);
             assert(py + 4 <= TILE_SIZE);
-            return lp_scene_bin_cmd_with_state( scene, ix0, iy0,
-                                                setup->fs.stored,
-                                                LP_RAST_OP_TRIANGLE_3_4,
-                                                lp_rast_arg_triangle_contained(tri, px, py) );
+            return bin_small_triangle( setup, ix0, iy0,
+                                       LP_RAST_OP_TRIANGLE_3_4,
+                                       lp_rast_arg_triangle_contained(tri, px, py) );
          }
 
          if (sz < 16)
@@ -624,10 +655,9 @@ lp_setup_bin_triangle( struct lp_setup_context *setup,
             assert(px + 16 <= TILE_SIZE);
             assert(py + 16 <= TILE_SIZE);
 
-            return lp_scene_bin_cmd_with_state( scene, ix0, iy0,
-                                                setup->fs.stored,
-                                                LP_RAST_OP_TRIANGLE_3_16,
-                                                lp_rast_arg_triangle_contained(tri, px, py) );
+            return bin_small_triangle( setup, ix0, iy0,
+                                       LP_RAST_OP_TRIANGLE_3_16,
+                                       lp_rast_arg_triangle_contained(tri, px, py) );
          }
       }
       else if (nr_planes == 4 && sz < 16) 
@@ -668,15 +698,20 @@ lp_setup_bin_triangle( struct lp_setup_context *setup,
       int iy1 = trimmed_box.y1 / TILE_SIZE;
       
       for (i = 0; i < nr_planes; i++) {
+         int slo, shi;
+
+         lp_rast_sample_offset_range(&plane[i], scene->nr_samples,
+                                     &slo, &shi);
+
          c[i] = (plane[i].c + 
                  plane[i].dcdy * iy0 * TILE_SIZE - 
                  plane[i].dcdx * ix0 * TILE_SIZE);
 
-         ei[i] = (plane[i].dcdy - 
-                  plane[i].dcdx - 
-                  plane[i].eo) << TILE_ORDER;
+         ei[i] = ((plane[i].dcdy - 
+                   plane[i].dcdx - 
+                   plane[i].eo) << TILE_ORDER) + slo;
 
-         eo[i] = plane[i].eo << TILE_ORDER;
+         eo[i] = (plane[i].eo << TILE_ORDER) + shi;
          xstep[i] = -(plane[i].dcdx << TILE_ORDER);
          ystep[i] = plane[i].dcdy << TILE_ORDER;
       }
@@ -774,6 +809,12 @@ static void retry_triangle_ccw( struct lp_setup_context *setup,
 {
    if (!do_triangle_ccw( setup, position, v0, v1, v2, front ))
    {
+      if (setup->bin_task) {
+         /* can't flush from a setup thread, the draw is redone serially */
+         setup->scene->alloc_failed = TRUE;
+         return;
+      }
+
       if (!lp_setup_flush_and_restart(setup))
          return;
 
@@ -885,6 +926,8 @@ static void triangle_cw( struct lp_setup_context *setup,
          retry_triangle_ccw(setup, &position, v1, v0, v2, !setup->ccw_is_frontface);
       }
    }
+   else
+      setup->nr_culled_prims++;
 }
 
 
@@ -898,6 +941,8 @@ static void triangle_ccw( struct lp_setup_context *setup,
 
    if (position.area > 0)
       retry_triangle_ccw(setup, &position, v0, v1, v2, setup->ccw_is_frontface);
+   else
+      setup->nr_culled_prims++;
 }
 
 /**
@@ -931,6 +976,8 @@ static void triangle_both( struct lp_setup_context *setup,
          retry_triangle_ccw( setup, &position, v1, v0, v2, !setup->ccw_is_frontface );
       }
    }
+   else
+      setup->nr_culled_prims++;
 }
 
 
@@ -41,10 +41,18 @@
 #include "draw/draw_vbuf.h"
 #include "draw/draw_vertex.h"
 #include "util/u_memory.h"
+#include "os/os_time.h"
 
 
-#define LP_MAX_VBUF_INDEXES 1024
-#define LP_MAX_VBUF_SIZE    4096
+/* The draw module's segments are at most this many elements long, the
+ * longer the more vertices they share.
+ */
+#define LP_MAX_VBUF_INDEXES 4096
+
+/* Large enough for the draw module's full segments, so that draws reach
+ * setup in batches big enough to be binned in parallel.
+ */
+#define LP_MAX_VBUF_SIZE    (256 * 1024)
 
   
 
@@ -120,6 +128,62 @@ lp_setup_set_primitive(struct vbuf_render *vbr, unsigned prim)
    lp_setup_context(vbr)->prim = prim;
 }
 
+/**
+ * Number of points, lines or triangles the draw functions below pass to
+ * setup for nr vertices of the given primitive type.
+ */
+static unsigned
+prims_for_vertices(unsigned prim, unsigned nr)
+{
+   switch (prim) {
+   case PIPE_PRIM_POINTS:
+      return nr;
+   case PIPE_PRIM_LINES:
+      return nr / 2;
+   case PIPE_PRIM_LINE_STRIP:
+      return nr > 1 ? nr - 1 : 0;
+   case PIPE_PRIM_LINE_LOOP:
+      return nr;
+   case PIPE_PRIM_TRIANGLES:
+      return nr / 3;
+   case PIPE_PRIM_TRIANGLE_STRIP:
+   case PIPE_PRIM_TRIANGLE_FAN:
+   case PIPE_PRIM_POLYGON:
+      return nr > 2 ? nr - 2 : 0;
+   case PIPE_PRIM_QUADS:
+      return nr / 4 * 2;
+   case PIPE_PRIM_QUAD_STRIP:
+      return nr > 3 ? (nr - 2) / 2 * 2 : 0;
+   default:
+      return 0;
+   }
+}
+
+
+/**
+ * Add a draw's primitives to the context's pipeline statistics and
+ * profiling counters.
+ * \param t0  os_time_get_nano() when the draw was started
+ */
+static void
+lp_setup_count_prims(struct lp_setup_context *setup, unsigned nr,
+                     int64_t t0)
+{
+   struct llvmpipe_context *lp = llvmpipe_context(setup->pipe);
+   const unsigned prims = prims_for_vertices(setup->prim, nr);
+   const unsigned culled = MIN2(setup->nr_culled_prims, prims);
+
+   lp->pipeline_statistics.c_invocations += prims;
+   lp->pipeline_statistics.c_primitives += prims - culled;
+   setup->nr_culled_prims = 0;
+
+   setup->perf.nr_draws++;
+   setup->perf.nr_prims += prims;
+   setup->perf.nr_culled_prims += culled;
+   setup->perf.setup_time += os_time_get_nano() - t0;
+}
+
+
 typedef const float (*const_float4_ptr)[4];
 
 static INLINE const_float4_ptr get_vert( const void *vertex_buffer,
@@ -139,6 +203,7 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
    const unsigned stride = setup->vertex_info->size * sizeof(float);
    const void *vertex_buffer = setup->vertex_buffer;
    const boolean flatshade_first = setup->flatshade_first;
+   const int64_t t0 = os_time_get_nano();
    unsigned i;
 
    assert(setup->setup.variant);
@@ -146,6 +211,11 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
    if (!lp_setup_update_state(setup, TRUE))
       return;
 
+   if (lp_setup_parallel_draw(setup, indices, 0, nr)) {
+      lp_setup_count_prims(setup, nr, t0);
+      return;
+   }
+
    switch (setup->prim) {
    case PIPE_PRIM_POINTS:
       for (i = 0; i < nr; i++) {
@@ -324,6 +394,8 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
    default:
       assert(0);
    }
+
+   lp_setup_count_prims(setup, nr, t0);
 }
 
 
@@ -339,11 +411,17 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
    const void *vertex_buffer =
       (void *) get_vert(setup->vertex_buffer, start, stride);
    const boolean flatshade_first = setup->flatshade_first;
+   const int64_t t0 = os_time_get_nano();
    unsigned i;
 
    if (!lp_setup_update_state(setup, TRUE))
       return;
 
+   if (lp_setup_parallel_draw(setup, NULL, start, nr)) {
+      lp_setup_count_prims(setup, nr, t0);
+      return;
+   }
+
    switch (setup->prim) {
    case PIPE_PRIM_POINTS:
       for (i = 0; i < nr; i++) {
@@ -519,6 +597,8 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
    default:
       assert(0);
    }
+
+   lp_setup_count_prims(setup, nr, t0);
 }
 
 
@@ -0,0 +1,409 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/**
+ * On-disk cache of shader variants.
+ *
+ * When LP_SHADER_CACHE_DIR is set, the LLVM IR of each shader variant is
+ * written there, after optimization, as a bitcode file.  A later process
+ * compiling the same variant loads the IR instead of translating the
+ * TGSI and optimizing it again, so only machine code generation is left.
+ *
+ * Variants are identified by their key, their TGSI tokens, and everything
+ * else the generated IR depends on: the LLVM version, the vector width
+ * and CPU features it was generated for, the debug and performance
+ * options, and the driver binary.  The
+ * file name is a hash of these, and the full identity is stored in the
+ * module's metadata and compared on load to rule out hash collisions.
+ *
+ * IR that embeds addresses of the process that generated it (calls to C
+ * helpers, debug printfs) is never cached.
+ */
+
+
+#include "pipe/p_config.h"
+
+#include <limits.h>
+
+#if defined(PIPE_OS_UNIX)
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#include "os/os_thread.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_debug.h"
+#include "util/u_hash.h"
+#include "util/u_memory.h"
+#include "util/u_string.h"
+#include "tgsi/tgsi_parse.h"
+#include "gallivm/lp_bld_debug.h"
+#include "gallivm/lp_bld_init.h"
+#include "gallivm/lp_bld_type.h"
+#include "lp_debug.h"
+#include "lp_shader_cache.h"
+
+
+/** Bump when the way variants are cached changes */
+#define LP_SHADER_CACHE_VERSION 1
+
+#define METADATA_NAME "lp_shader_cache_id"
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+
+/**
+ * Protects the lazy initialization and the statistics, as variants are
+ * loaded and stored by the background compile threads too.
+ */
+pipe_static_mutex(cache_mutex);
+
+static boolean cache_initialized = FALSE;
+static const char *cache_dir = NULL;
+static char build_id[64];
+
+static struct lp_shader_cache_stats cache_stats;
+
+
+#define CACHE_STATS_INC(counter) \
+   do { \
+      pipe_mutex_lock(cache_mutex); \
+      cache_stats.counter++; \
+      pipe_mutex_unlock(cache_mutex); \
+   } while (0)
+
+
+/**
+ * Identify the driver binary, so that the cache is invalidated when it
+ * changes and may generate different IR for the same variant.
+ */
+static void
+get_build_id(char *buf, size_t size)
+{
+#if defined(PIPE_OS_UNIX)
+   Dl_info info;
+   struct stat st;
+
+   if (dladdr((void *) get_build_id, &info) &&
+       info.dli_fname &&
+       stat(info.dli_fname, &st) == 0) {
+      util_snprintf(buf, size, "%lx-%lx",
+                    (unsigned long) st.st_mtime,
+                    (unsigned long) st.st_size);
+      return;
+   }
+#endif
+
+   util_snprintf(buf, size, "%s %s", __DATE__, __TIME__);
+}
+
+
+/**
+ * \return the cache directory, or NULL if the cache is disabled.
+ */
+static const char *
+get_cache_dir(void)
+{
+   const char *dir;
+
+   pipe_mutex_lock(cache_mutex);
+
+   if (!cache_initialized) {
+      cache_initialized = TRUE;
+
+#if defined(PIPE_OS_UNIX) && HAVE_LLVM > 0x0206
+      cache_dir = debug_get_option("LP_SHADER_CACHE_DIR", NULL);
+      if (cache_dir && *cache_dir) {
+         if (mkdir(cache_dir, 0755) != 0 && errno != EEXIST) {
+            debug_printf("llvmpipe: can't create shader cache dir %s\n",
+                         cache_dir);
+            cache_dir = NULL;
+         }
+      }
+      else {
+         cache_dir = NULL;
+      }
+
+      get_build_id(build_id, sizeof build_id);
+#endif
+   }
+
+   dir = cache_dir;
+
+   pipe_mutex_unlock(cache_mutex);
+
+   return dir;
+}
+
+
+static unsigned
+cpu_features(void)
+{
+   return (util_cpu_caps.has_sse << 0 |
+           util_cpu_caps.has_sse2 << 1 |
+           util_cpu_caps.has_sse3 << 2 |
+           util_cpu_caps.has_ssse3 << 3 |
+           util_cpu_caps.has_sse4_1 << 4 |
+           util_cpu_caps.has_sse4_2 << 5 |
+           util_cpu_caps.has_avx << 6 |
+           util_cpu_caps.has_altivec << 7 |
+           util_cpu_caps.has_avx2 << 8 |
+           util_cpu_caps.has_fma << 9 |
+           util_cpu_caps.has_f16c << 10);
+}
+
+
+static char *
+append_hex(char *s, const void *data, unsigned size)
+{
+   static const char digits[] = "0123456789abcdef";
+   const ubyte *bytes = (const ubyte *) data;
+   unsigned i;
+
+   for (i = 0; i < size; i++) {
+      *s++ = digits[bytes[i] >> 4];
+      *s++ = digits[bytes[i] & 0xf];
+   }
+   *s = '\0';
+
+   return s;
+}
+
+
+/**
+ * Build the string identifying a variant, and the name of its file.
+ * \return the identity string, to be FREE'd by the caller.
+ */
+static char *
+get_variant_id(const void *key, unsigned key_size,
+               const struct tgsi_token *tokens,
+               char *filename, size_t filename_size)
+{
+   const unsigned tokens_size = tgsi_num_tokens(tokens) * sizeof *tokens;
+   char header[256];
+   unsigned header_len;
+   char *id, *s;
+
+   header_len = util_snprintf(header, sizeof header,
+                              "v%u llvm%x w%u cpu%x dbg%x perf%x build %s ",
+                              LP_SHADER_CACHE_VERSION, HAVE_LLVM,
+                              lp_native_vector_width, cpu_features(),
+                              gallivm_debug, LP_PERF, build_id);
+
+   id = MALLOC(header_len + 2 * (key_size + tokens_size) + 2);
+   if (!id)
+      return NULL;
+
+   memcpy(id, header, header_len);
+   s = append_hex(id + header_len, key, key_size);
+   *s++ = ' ';
+   append_hex(s, tokens, tokens_size);
+
+   util_snprintf(filename, filename_size, "%s/%08x-%08x.bc",
+                 cache_dir,
+                 util_hash_crc32(id, strlen(id)),
+                 util_hash_crc32(tokens, tokens_size));
+
+   return id;
+}
+
+
+static void
+get_function_name(char *name, size_t size, unsigned i)
+{
+   util_snprintf(name, size, "lp_shader_cache_func%u", i);
+}
+
+
+/**
+ * Look for a variant in the cache.
+ *
+ * \param functions  returns the variant's functions, NULL for those it
+ *                   didn't have when it was stored
+ * \return a gallivm state with the variant's module, ready to be compiled,
+ *         or NULL on a cache miss.
+ */
+struct gallivm_state *
+lp_shader_cache_load(const void *key, unsigned key_size,
+                     const struct tgsi_token *tokens,
+                     LLVMValueRef *functions,
+                     unsigned num_functions)
+{
+   struct gallivm_state *gallivm = NULL;
+   char filename[PATH_MAX];
+   char *id;
+   unsigned i;
+
+   if (!get_cache_dir())
+      return NULL;
+
+   id = get_variant_id(key, key_size, tokens, filename, sizeof filename);
+   if (!id)
+      return NULL;
+
+#if defined(PIPE_OS_UNIX)
+   if (access(filename, R_OK) == 0)
+      gallivm = gallivm_create_from_bitcode(filename);
+#endif
+
+   if (gallivm) {
+      LLVMValueRef node = NULL;
+      const char *stored_id = NULL;
+      unsigned stored_len = 0;
+
+      if (LLVMGetNamedMetadataNumOperands(gallivm->module,
+                                          METADATA_NAME) == 1) {
+         LLVMGetNamedMetadataOperands(gallivm->module, METADATA_NAME, &node);
+      }
+      if (node && LLVMGetMDNodeNumOperands(node) == 1) {
+         LLVMValueRef str;
+         LLVMGetMDNodeOperands(node, &str);
+         stored_id = LLVMGetMDString(str, &stored_len);
+      }
+
+      if (!stored_id ||
+          stored_len != strlen(id) ||
+          memcmp(stored_id, id, stored_len) != 0) {
+         /* hash collision, or not one of our files */
+         gallivm_destroy(gallivm);
+         gallivm = NULL;
+      }
+   }
+
+   if (gallivm) {
+      for (i = 0; i < num_functions; i++) {
+         char name[64];
+         get_function_name(name, sizeof name, i);
+         functions[i] = LLVMGetNamedFunction(gallivm->module, name);
+      }
+      CACHE_STATS_INC(hits);
+   }
+   else {
+      CACHE_STATS_INC(misses);
+   }
+
+   FREE(id);
+
+   return gallivm;
+}
+
+
+/**
+ * Save a variant's optimized module to the cache.  Must be called before
+ * the module is compiled, as compilation frees the function bodies.
+ *
+ * The functions are renamed, so that they can be found by
+ * lp_shader_cache_load().
+ */
+void
+lp_shader_cache_store(const void *key, unsigned key_size,
+                      const struct tgsi_token *tokens,
+                      struct gallivm_state *gallivm,
+                      const LLVMValueRef *functions,
+                      unsigned num_functions)
+{
+#if defined(PIPE_OS_UNIX)
+   char filename[PATH_MAX];
+   char tmpname[PATH_MAX + 32];
+   LLVMValueRef str, node;
+   char *id;
+   unsigned i;
+
+   if (!get_cache_dir())
+      return;
+
+   if (gallivm->uses_host_pointers) {
+      CACHE_STATS_INC(uncacheable);
+      return;
+   }
+
+   id = get_variant_id(key, key_size, tokens, filename, sizeof filename);
+   if (!id)
+      return;
+
+   for (i = 0; i < num_functions; i++) {
+      if (functions[i]) {
+         char name[64];
+         get_function_name(name, sizeof name, i);
+         LLVMSetValueName(functions[i], name);
+      }
+   }
+
+   str = LLVMMDStringInContext(gallivm->context, id, strlen(id));
+   node = LLVMMDNodeInContext(gallivm->context, &str, 1);
+   LLVMAddNamedMetadataOperand(gallivm->module, METADATA_NAME, node);
+
+   /* Write to a temporary file and rename it, so that other processes
+    * never see a partially written file.
+    */
+   util_snprintf(tmpname, sizeof tmpname, "%s.%u.tmp",
+                 filename, (unsigned) getpid());
+
+   if (gallivm_write_bitcode(gallivm, tmpname) &&
+       rename(tmpname, filename) == 0) {
+      CACHE_STATS_INC(stores);
+   }
+   else {
+      unlink(tmpname);
+   }
+
+   FREE(id);
+#else
+   (void) key;
+   (void) key_size;
+   (void) tokens;
+   (void) gallivm;
+   (void) functions;
+   (void) num_functions;
+#endif
+}
+
+
+/**
+ * Whether variants are stored in the cache at all.
+ */
+boolean
+lp_shader_cache_enabled(void)
+{
+   return get_cache_dir() != NULL;
+}
+
+
+void
+lp_shader_cache_get_stats(struct lp_shader_cache_stats *stats)
+{
+   pipe_mutex_lock(cache_mutex);
+   *stats = cache_stats;
+   pipe_mutex_unlock(cache_mutex);
+}
@@ -0,0 +1,68 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#ifndef LP_SHADER_CACHE_H
+#define LP_SHADER_CACHE_H
+
+#include "pipe/p_compiler.h"
+#include "gallivm/lp_bld.h"
+
+struct gallivm_state;
+struct tgsi_token;
+
+
+struct lp_shader_cache_stats
+{
+   unsigned hits;          /**< variants loaded from the cache */
+   unsigned misses;        /**< variants not found in the cache */
+   unsigned stores;        /**< variants written to the cache */
+   unsigned uncacheable;   /**< variants whose IR can't be saved */
+};
+
+
+struct gallivm_state *
+lp_shader_cache_load(const void *key, unsigned key_size,
+                     const struct tgsi_token *tokens,
+                     LLVMValueRef *functions,
+                     unsigned num_functions);
+
+void
+lp_shader_cache_store(const void *key, unsigned key_size,
+                      const struct tgsi_token *tokens,
+                      struct gallivm_state *gallivm,
+                      const LLVMValueRef *functions,
+                      unsigned num_functions);
+
+boolean
+lp_shader_cache_enabled(void);
+
+void
+lp_shader_cache_get_stats(struct lp_shader_cache_stats *stats);
+
+
+#endif /* LP_SHADER_CACHE_H */
@@ -58,6 +58,7 @@
  */
 
 #include <limits.h>
+#include <stdlib.h>
 #include "pipe/p_defines.h"
 #include "util/u_inlines.h"
 #include "util/u_memory.h"
@@ -66,6 +67,8 @@
 #include "util/u_dump.h"
 #include "util/u_string.h"
 #include "util/u_simple_list.h"
+#include "util/u_hash.h"
+#include "util/u_hash_table.h"
 #include "os/os_time.h"
 #include "pipe/p_shader_tokens.h"
 #include "draw/draw_context.h"
@@ -94,8 +97,11 @@
 #include "lp_context.h"
 #include "lp_debug.h"
 #include "lp_perf.h"
+#include "lp_screen.h"
 #include "lp_setup.h"
+#include "lp_shader_cache.h"
 #include "lp_state.h"
+#include "lp_rast.h"
 #include "lp_tex_sample.h"
 #include "lp_flush.h"
 #include "lp_state_fs.h"
@@ -230,10 +236,12 @@ generate_fs(struct gallivm_state *gallivm,
             LLVMValueRef *pmask,
             LLVMValueRef (*color)[4],
             LLVMValueRef depth_ptr,
+            LLVMValueRef depth_stride,
             LLVMValueRef facing,
             unsigned partial_mask,
             LLVMValueRef mask_input,
-            LLVMValueRef counter)
+            LLVMValueRef counter,
+            LLVMValueRef z_store)
 {
    const struct util_format_description *zs_format_desc = NULL;
    const struct tgsi_token *tokens = shader->base.tokens;
@@ -241,8 +249,10 @@ generate_fs(struct gallivm_state *gallivm,
    LLVMValueRef consts_ptr;
    LLVMValueRef outputs[PIPE_MAX_SHADER_OUTPUTS][TGSI_NUM_CHANNELS];
    LLVMValueRef z;
+   LLVMValueRef zs_dst;
    LLVMValueRef zs_value = NULL;
    LLVMValueRef stencil_refs[2];
+   LLVMValueRef loop_counter;
    struct lp_build_mask_context mask;
    boolean simple_shader = (shader->info.base.file_count[TGSI_FILE_SAMPLER] == 0 &&
                             shader->info.base.num_inputs < 3 &&
@@ -255,9 +265,15 @@ generate_fs(struct gallivm_state *gallivm,
 
    memset(&system_values, 0, sizeof(system_values));
 
-   if (key->depth.enabled ||
-       key->stencil[0].enabled ||
-       key->stencil[1].enabled) {
+   if (key->multisample) {
+      /* The depth/stencil test is done for each sample afterwards, see
+       * generate_sample_depth_stencil().
+       */
+      depth_mode = 0;
+   }
+   else if (key->depth.enabled ||
+            key->stencil[0].enabled ||
+            key->stencil[1].enabled) {
 
       zs_format_desc = util_format_description(key->zsbuf_format);
       assert(zs_format_desc);
@@ -287,6 +303,8 @@ generate_fs(struct gallivm_state *gallivm,
 
    assert(i < 4);
 
+   loop_counter = lp_build_const_int32(gallivm, i);
+
    stencil_refs[0] = lp_jit_context_stencil_ref_front_value(gallivm, context_ptr);
    stencil_refs[1] = lp_jit_context_stencil_ref_back_value(gallivm, context_ptr);
 
@@ -322,6 +340,10 @@ generate_fs(struct gallivm_state *gallivm,
    z = interp->pos[2];
 
    if (depth_mode & EARLY_DEPTH_TEST) {
+      zs_dst = lp_build_depth_stencil_load_swizzled(gallivm, type,
+                                                    zs_format_desc,
+                                                    depth_ptr, depth_stride,
+                                                    loop_counter);
       lp_build_depth_stencil_test(gallivm,
                                   &key->depth,
                                   key->stencil,
@@ -330,12 +352,14 @@ generate_fs(struct gallivm_state *gallivm,
                                   &mask,
                                   stencil_refs,
                                   z,
-                                  depth_ptr, facing,
+                                  zs_dst, facing,
                                   &zs_value,
                                   !simple_shader);
 
       if (depth_mode & EARLY_DEPTH_WRITE) {
-         lp_build_depth_write(builder, zs_format_desc, depth_ptr, zs_value);
+         lp_build_depth_write(gallivm, type, zs_format_desc,
+                              depth_ptr, depth_stride, loop_counter,
+                              zs_value);
       }
    }
 
@@ -345,7 +369,7 @@ generate_fs(struct gallivm_state *gallivm,
    lp_build_tgsi_soa(gallivm, tokens, type, &mask,
                      consts_ptr, &system_values,
                      interp->pos, interp->inputs,
-                     outputs, sampler, &shader->info.base);
+                     outputs, sampler, &shader->info.base, NULL);
 
    /* Alpha test */
    if (key->alpha.enabled) {
@@ -379,6 +403,10 @@ generate_fs(struct gallivm_state *gallivm,
          z = LLVMBuildLoad(builder, outputs[pos0][2], "output.z");
       }
 
+      zs_dst = lp_build_depth_stencil_load_swizzled(gallivm, type,
+                                                    zs_format_desc,
+                                                    depth_ptr, depth_stride,
+                                                    loop_counter);
       lp_build_depth_stencil_test(gallivm,
                                   &key->depth,
                                   key->stencil,
@@ -387,12 +415,14 @@ generate_fs(struct gallivm_state *gallivm,
                                   &mask,
                                   stencil_refs,
                                   z,
-                                  depth_ptr, facing,
+                                  zs_dst, facing,
                                   &zs_value,
                                   !simple_shader);
       /* Late Z write */
       if (depth_mode & LATE_DEPTH_WRITE) {
-         lp_build_depth_write(builder, zs_format_desc, depth_ptr, zs_value);
+         lp_build_depth_write(gallivm, type, zs_format_desc,
+                              depth_ptr, depth_stride, loop_counter,
+                              zs_value);
       }
    }
    else if ((depth_mode & EARLY_DEPTH_TEST) &&
@@ -407,6 +437,8 @@ generate_fs(struct gallivm_state *gallivm,
                                     zs_format_desc,
                                     &mask,
                                     depth_ptr,
+                                    depth_stride,
+                                    loop_counter,
                                     zs_value);
    }
 
@@ -431,6 +463,19 @@ generate_fs(struct gallivm_state *gallivm,
       }
    }
 
+   /* Fragment depth, for the per-sample depth test */
+   if (z_store) {
+      int pos0 = find_output_by_semantic(&shader->info.base,
+                                         TGSI_SEMANTIC_POSITION,
+                                         0);
+
+      if (pos0 != -1 && outputs[pos0][2]) {
+         z = LLVMBuildLoad(builder, outputs[pos0][2], "output.z");
+      }
+
+      LLVMBuildStore(builder, z, z_store);
+   }
+
    if (counter)
       lp_build_occlusion_count(gallivm, type,
                                lp_build_mask_value(&mask), counter);
@@ -439,6 +484,150 @@ generate_fs(struct gallivm_state *gallivm,
 }
 
 
+/**
+ * Depth/stencil test one sample of the pixels of a multisampled variant,
+ * after the shader ran once per pixel.  The sample's depth is the
+ * interpolated depth at the sample position, or the shader's output
+ * depth.
+ * \param sample  which sample, in [0, LP_MAX_SAMPLES)
+ * \param mask_input  coverage of all the samples, 16 bits per sample
+ * \param fs_mask  the pixels left alive by the shader
+ * \param sample_mask  returns the sample's fragments to write
+ */
+static void
+generate_sample_depth_stencil(struct gallivm_state *gallivm,
+                              struct lp_fragment_shader *shader,
+                              const struct lp_fragment_shader_variant_key *key,
+                              struct lp_type type,
+                              LLVMValueRef context_ptr,
+                              unsigned num_fs,
+                              unsigned sample,
+                              unsigned partial_mask,
+                              LLVMValueRef mask_input,
+                              const LLVMValueRef *fs_mask,
+                              const LLVMValueRef *z_store,
+                              LLVMValueRef dadx_ptr,
+                              LLVMValueRef dady_ptr,
+                              LLVMValueRef depth_ptr,
+                              LLVMValueRef depth_stride,
+                              LLVMValueRef facing,
+                              LLVMValueRef counter,
+                              LLVMValueRef *sample_mask)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   const struct util_format_description *zs_format_desc = NULL;
+   struct lp_build_context bld;
+   LLVMValueRef sample_bits;
+   LLVMValueRef stencil_refs[2];
+   LLVMValueRef dz = NULL;
+   unsigned i;
+
+   lp_build_context_init(&bld, gallivm, type);
+
+   sample_bits = LLVMBuildLShr(builder, mask_input,
+                               LLVMConstInt(LLVMTypeOf(mask_input),
+                                            16 * sample, 0), "");
+   sample_bits = LLVMBuildTrunc(builder, sample_bits,
+                                LLVMInt32TypeInContext(gallivm->context), "");
+
+   if (key->depth.enabled ||
+       key->stencil[0].enabled ||
+       key->stencil[1].enabled) {
+      zs_format_desc = util_format_description(key->zsbuf_format);
+      assert(zs_format_desc);
+
+      stencil_refs[0] = lp_jit_context_stencil_ref_front_value(gallivm, context_ptr);
+      stencil_refs[1] = lp_jit_context_stencil_ref_back_value(gallivm, context_ptr);
+
+      if (!shader->info.base.writes_z) {
+         /* Offset of the depth at the sample from the pixel center, from
+          * the position's (input 0) z gradients.
+          */
+         LLVMValueRef index = lp_build_const_int32(gallivm, 2);
+         LLVMValueRef dzdx, dzdy;
+
+         dzdx = LLVMBuildLoad(builder,
+                              LLVMBuildGEP(builder, dadx_ptr, &index, 1, ""),
+                              "dzdx");
+         dzdy = LLVMBuildLoad(builder,
+                              LLVMBuildGEP(builder, dady_ptr, &index, 1, ""),
+                              "dzdy");
+         dzdx = LLVMBuildFMul(builder, dzdx,
+                              lp_build_const_float(gallivm,
+                                                   lp_sample_pos[sample][0] / 16.0f),
+                              "");
+         dzdy = LLVMBuildFMul(builder, dzdy,
+                              lp_build_const_float(gallivm,
+                                                   lp_sample_pos[sample][1] / 16.0f),
+                              "");
+         dz = lp_build_broadcast_scalar(&bld,
+                                        LLVMBuildFAdd(builder, dzdx, dzdy, ""));
+      }
+   }
+
+   for (i = 0; i < num_fs; i++) {
+      LLVMValueRef mask;
+
+      if (partial_mask) {
+         mask = generate_quad_mask(gallivm, type,
+                                   i*type.length/4, sample_bits);
+      }
+      else {
+         mask = lp_build_const_int_vec(gallivm, type, ~0);
+      }
+      mask = LLVMBuildAnd(builder, mask, fs_mask[i], "");
+
+      if (zs_format_desc || counter) {
+         struct lp_build_mask_context mask_ctx;
+
+         lp_build_mask_begin(&mask_ctx, gallivm, type, mask);
+
+         if (zs_format_desc) {
+            LLVMValueRef loop_counter = lp_build_const_int32(gallivm, i);
+            LLVMValueRef z = LLVMBuildLoad(builder, z_store[i], "z");
+            LLVMValueRef zs_dst;
+            LLVMValueRef zs_value = NULL;
+
+            if (dz)
+               z = lp_build_add(&bld, z, dz);
+
+            zs_dst = lp_build_depth_stencil_load_swizzled(gallivm, type,
+                                                          zs_format_desc,
+                                                          depth_ptr,
+                                                          depth_stride,
+                                                          loop_counter);
+            lp_build_depth_stencil_test(gallivm,
+                                        &key->depth,
+                                        key->stencil,
+                                        type,
+                                        zs_format_desc,
+                                        &mask_ctx,
+                                        stencil_refs,
+                                        z,
+                                        zs_dst, facing,
+                                        &zs_value,
+                                        FALSE);
+
+            /* Only set when depth or stencil are written */
+            if (zs_value) {
+               lp_build_depth_write(gallivm, type, zs_format_desc,
+                                    depth_ptr, depth_stride, loop_counter,
+                                    zs_value);
+            }
+         }
+
+         if (counter)
+            lp_build_occlusion_count(gallivm, type,
+                                     lp_build_mask_value(&mask_ctx), counter);
+
+         mask = lp_build_mask_end(&mask_ctx);
+      }
+
+      sample_mask[i] = mask;
+   }
+}
+
+
 /**
  * Generate the fragment shader, depth/stencil test, and alpha tests.
  */
@@ -455,7 +644,7 @@ generate_fs_loop(struct gallivm_state *gallivm,
                  LLVMValueRef mask_store,
                  LLVMValueRef (*out_color)[4],
                  LLVMValueRef depth_ptr,
-                 unsigned depth_bits,
+                 LLVMValueRef depth_stride,
                  LLVMValueRef facing,
                  LLVMValueRef counter)
 {
@@ -465,10 +654,10 @@ generate_fs_loop(struct gallivm_state *gallivm,
    LLVMValueRef mask_ptr, mask_val;
    LLVMValueRef consts_ptr;
    LLVMValueRef z;
+   LLVMValueRef zs_dst;
    LLVMValueRef zs_value = NULL;
    LLVMValueRef stencil_refs[2];
-   LLVMValueRef depth_ptr_i;
-   LLVMValueRef depth_offset;
+   LLVMValueRef loop_counter;
    LLVMValueRef outputs[PIPE_MAX_SHADER_OUTPUTS][TGSI_NUM_CHANNELS];
    struct lp_build_for_loop_state loop_state;
    struct lp_build_mask_context mask;
@@ -528,16 +717,12 @@ generate_fs_loop(struct gallivm_state *gallivm,
                            num_loop,
                            lp_build_const_int32(gallivm, 1));
 
+   loop_counter = loop_state.counter;
+
    mask_ptr = LLVMBuildGEP(builder, mask_store,
                            &loop_state.counter, 1, "mask_ptr");
    mask_val = LLVMBuildLoad(builder, mask_ptr, "");
 
-   depth_offset = LLVMBuildMul(builder, loop_state.counter,
-                               lp_build_const_int32(gallivm, depth_bits * type.length),
-                               "");
-
-   depth_ptr_i = LLVMBuildGEP(builder, depth_ptr, &depth_offset, 1, "");
-
    memset(outputs, 0, sizeof outputs);
 
    for(cbuf = 0; cbuf < key->nr_cbufs; cbuf++) {
@@ -561,6 +746,10 @@ generate_fs_loop(struct gallivm_state *gallivm,
    z = interp->pos[2];
 
    if (depth_mode & EARLY_DEPTH_TEST) {
+      zs_dst = lp_build_depth_stencil_load_swizzled(gallivm, type,
+                                                    zs_format_desc,
+                                                    depth_ptr, depth_stride,
+                                                    loop_counter);
       lp_build_depth_stencil_test(gallivm,
                                   &key->depth,
                                   key->stencil,
@@ -569,12 +758,14 @@ generate_fs_loop(struct gallivm_state *gallivm,
                                   &mask,
                                   stencil_refs,
                                   z,
-                                  depth_ptr_i, facing,
+                                  zs_dst, facing,
                                   &zs_value,
                                   !simple_shader);
 
       if (depth_mode & EARLY_DEPTH_WRITE) {
-         lp_build_depth_write(builder, zs_format_desc, depth_ptr_i, zs_value);
+         lp_build_depth_write(gallivm, type, zs_format_desc,
+                              depth_ptr, depth_stride, loop_counter,
+                              zs_value);
       }
    }
 
@@ -584,7 +775,7 @@ generate_fs_loop(struct gallivm_state *gallivm,
    lp_build_tgsi_soa(gallivm, tokens, type, &mask,
                      consts_ptr, &system_values,
                      interp->pos, interp->inputs,
-                     outputs, sampler, &shader->info.base);
+                     outputs, sampler, &shader->info.base, NULL);
 
    /* Alpha test */
    if (key->alpha.enabled) {
@@ -618,6 +809,10 @@ generate_fs_loop(struct gallivm_state *gallivm,
          z = LLVMBuildLoad(builder, outputs[pos0][2], "output.z");
       }
 
+      zs_dst = lp_build_depth_stencil_load_swizzled(gallivm, type,
+                                                    zs_format_desc,
+                                                    depth_ptr, depth_stride,
+                                                    loop_counter);
       lp_build_depth_stencil_test(gallivm,
                                   &key->depth,
                                   key->stencil,
@@ -626,12 +821,14 @@ generate_fs_loop(struct gallivm_state *gallivm,
                                   &mask,
                                   stencil_refs,
                                   z,
-                                  depth_ptr_i, facing,
+                                  zs_dst, facing,
                                   &zs_value,
                                   !simple_shader);
       /* Late Z write */
       if (depth_mode & LATE_DEPTH_WRITE) {
-         lp_build_depth_write(builder, zs_format_desc, depth_ptr_i, zs_value);
+         lp_build_depth_write(gallivm, type, zs_format_desc,
+                              depth_ptr, depth_stride, loop_counter,
+                              zs_value);
       }
    }
    else if ((depth_mode & EARLY_DEPTH_TEST) &&
@@ -645,7 +842,9 @@ generate_fs_loop(struct gallivm_state *gallivm,
                                     type,
                                     zs_format_desc,
                                     &mask,
-                                    depth_ptr_i,
+                                    depth_ptr,
+                                    depth_stride,
+                                    loop_counter,
                                     zs_value);
    }
 
@@ -1719,9 +1918,10 @@ generate_fragment(struct llvmpipe_context *lp,
    struct lp_type blend_type;
    LLVMTypeRef fs_elem_type;
    LLVMTypeRef blend_vec_type;
-   LLVMTypeRef arg_types[12];
+   LLVMTypeRef arg_types[15];
    LLVMTypeRef func_type;
    LLVMTypeRef int32_type = LLVMInt32TypeInContext(gallivm->context);
+   LLVMTypeRef int64_type = LLVMInt64TypeInContext(gallivm->context);
    LLVMTypeRef int8_type = LLVMInt8TypeInContext(gallivm->context);
    LLVMValueRef context_ptr;
    LLVMValueRef x;
@@ -1732,21 +1932,27 @@ generate_fragment(struct llvmpipe_context *lp,
    LLVMValueRef color_ptr_ptr;
    LLVMValueRef stride_ptr;
    LLVMValueRef depth_ptr;
+   LLVMValueRef depth_stride;
+   LLVMValueRef depth_sample_stride;
+   LLVMValueRef sample_stride_ptr;
    LLVMValueRef mask_input;
+   LLVMValueRef pixel_mask;
    LLVMValueRef counter = NULL;
    LLVMBasicBlockRef block;
    LLVMBuilderRef builder;
    struct lp_build_sampler_soa *sampler;
    struct lp_build_interp_soa_context interp;
    LLVMValueRef fs_mask[16 / 4];
+   LLVMValueRef fs_z[16 / 4];
    LLVMValueRef fs_out_color[PIPE_MAX_COLOR_BUFS][TGSI_NUM_CHANNELS][16 / 4];
    LLVMValueRef function;
    LLVMValueRef facing;
-   const struct util_format_description *zs_format_desc;
    unsigned num_fs;
+   unsigned nr_samples;
    unsigned i;
    unsigned chan;
    unsigned cbuf;
+   unsigned sample;
    boolean cbuf0_write_all;
    boolean try_loop = TRUE;
 
@@ -1813,9 +2019,12 @@ generate_fragment(struct llvmpipe_context *lp,
    arg_types[6] = LLVMPointerType(fs_elem_type, 0);    /* dady */
    arg_types[7] = LLVMPointerType(LLVMPointerType(blend_vec_type, 0), 0);  /* color */
    arg_types[8] = LLVMPointerType(int8_type, 0);       /* depth */
-   arg_types[9] = int32_type;                          /* mask_input */
-   arg_types[10] = LLVMPointerType(int32_type, 0);     /* counter */
-   arg_types[11] = LLVMPointerType(int32_type, 0);     /* stride */
+   arg_types[9] = int32_type;                          /* depth_stride */
+   arg_types[10] = int32_type;                         /* depth_sample_stride */
+   arg_types[11] = int64_type;                         /* mask_input */
+   arg_types[12] = LLVMPointerType(int32_type, 0);     /* counter */
+   arg_types[13] = LLVMPointerType(int32_type, 0);     /* stride */
+   arg_types[14] = LLVMPointerType(int32_type, 0);     /* sample_stride */
 
    func_type = LLVMFunctionType(LLVMVoidTypeInContext(gallivm->context),
                                 arg_types, Elements(arg_types), 0);
@@ -1841,8 +2050,11 @@ generate_fragment(struct llvmpipe_context *lp,
    dady_ptr     = LLVMGetParam(function, 6);
    color_ptr_ptr = LLVMGetParam(function, 7);
    depth_ptr    = LLVMGetParam(function, 8);
-   mask_input   = LLVMGetParam(function, 9);
-   stride_ptr   = LLVMGetParam(function, 11);
+   depth_stride = LLVMGetParam(function, 9);
+   depth_sample_stride = LLVMGetParam(function, 10);
+   mask_input   = LLVMGetParam(function, 11);
+   stride_ptr   = LLVMGetParam(function, 13);
+   sample_stride_ptr = LLVMGetParam(function, 14);
 
    lp_build_name(context_ptr, "context");
    lp_build_name(x, "x");
@@ -1852,11 +2064,14 @@ generate_fragment(struct llvmpipe_context *lp,
    lp_build_name(dady_ptr, "dady");
    lp_build_name(color_ptr_ptr, "color_ptr_ptr");
    lp_build_name(depth_ptr, "depth");
+   lp_build_name(depth_stride, "depth_stride");
+   lp_build_name(depth_sample_stride, "depth_sample_stride");
    lp_build_name(mask_input, "mask_input");
    lp_build_name(stride_ptr, "stride_ptr");
+   lp_build_name(sample_stride_ptr, "sample_stride_ptr");
 
    if (key->occlusion_count) {
-      counter = LLVMGetParam(function, 10);
+      counter = LLVMGetParam(function, 12);
       lp_build_name(counter, "counter");
    }
 
@@ -1872,7 +2087,26 @@ generate_fragment(struct llvmpipe_context *lp,
    /* code generated texture sampling */
    sampler = lp_llvm_sampler_soa_create(key->sampler, context_ptr);
 
-   zs_format_desc = util_format_description(key->zsbuf_format);
+   if (key->multisample) {
+      /* The shader runs once for the pixels with any sample covered, and
+       * the depth/stencil test and blending are done for each sample.
+       */
+      nr_samples = LP_MAX_SAMPLES;
+      pixel_mask = mask_input;
+      for (sample = 1; sample < nr_samples; sample++) {
+         pixel_mask = LLVMBuildOr(builder, pixel_mask,
+                                  LLVMBuildLShr(builder, mask_input,
+                                                LLVMConstInt(int64_type,
+                                                             16 * sample, 0),
+                                                ""), "");
+      }
+      try_loop = FALSE;
+   }
+   else {
+      nr_samples = 1;
+      pixel_mask = mask_input;
+   }
+   pixel_mask = LLVMBuildTrunc(builder, pixel_mask, int32_type, "pixel_mask");
 
    if (!try_loop) {
       /*
@@ -1891,13 +2125,14 @@ generate_fragment(struct llvmpipe_context *lp,
 
       /* loop over quads in the block */
       for(i = 0; i < num_fs; ++i) {
-         LLVMValueRef depth_offset = LLVMConstInt(int32_type,
-                                                  i*fs_type.length*zs_format_desc->block.bits/8,
-                                                  0);
          LLVMValueRef out_color[PIPE_MAX_COLOR_BUFS][TGSI_NUM_CHANNELS];
-         LLVMValueRef depth_ptr_i;
 
-         depth_ptr_i = LLVMBuildGEP(builder, depth_ptr, &depth_offset, 1, "");
+         fs_z[i] = NULL;
+         if (key->multisample) {
+            fs_z[i] = lp_build_alloca(gallivm,
+                                      lp_build_vec_type(gallivm, fs_type),
+                                      "z");
+         }
 
          generate_fs(gallivm,
                      shader, key,
@@ -1909,11 +2144,13 @@ generate_fragment(struct llvmpipe_context *lp,
                      sampler,
                      &fs_mask[i], /* output */
                      out_color,
-                     depth_ptr_i,
+                     depth_ptr,
+                     depth_stride,
                      facing,
                      partial_mask,
-                     mask_input,
-                     counter);
+                     pixel_mask,
+                     key->multisample ? NULL : counter,
+                     fs_z[i]);
 
          for (cbuf = 0; cbuf < key->nr_cbufs; cbuf++)
             for (chan = 0; chan < TGSI_NUM_CHANNELS; ++chan)
@@ -1922,7 +2159,6 @@ generate_fragment(struct llvmpipe_context *lp,
       }
    }
    else {
-      unsigned depth_bits = zs_format_desc->block.bits/8;
       LLVMValueRef num_loop = lp_build_const_int32(gallivm, num_fs);
       LLVMTypeRef mask_type = lp_build_int_vec_type(gallivm, fs_type);
       LLVMValueRef mask_store = lp_build_array_alloca(gallivm, mask_type,
@@ -1951,7 +2187,7 @@ generate_fragment(struct llvmpipe_context *lp,
 
          if (partial_mask) {
             mask = generate_quad_mask(gallivm, fs_type,
-                                      i*fs_type.length/4, mask_input);
+                                      i*fs_type.length/4, pixel_mask);
          }
          else {
             mask = lp_build_const_int_vec(gallivm, fs_type, ~0);
@@ -1970,7 +2206,7 @@ generate_fragment(struct llvmpipe_context *lp,
                        mask_store, /* output */
                        color_store,
                        depth_ptr,
-                       depth_bits,
+                       depth_stride,
                        facing,
                        counter);
 
@@ -1993,32 +2229,70 @@ generate_fragment(struct llvmpipe_context *lp,
 
    sampler->destroy(sampler);
 
-   /* Loop over color outputs / color buffers to do blending.
+   /* Loop over samples, and color outputs / color buffers to do blending.
     */
-   for(cbuf = 0; cbuf < key->nr_cbufs; cbuf++) {
-      LLVMValueRef color_ptr;
-      LLVMValueRef stride;
-      LLVMValueRef index = lp_build_const_int32(gallivm, cbuf);
-      unsigned rt = key->blend.independent_blend_enable ? cbuf : 0;
-
-      boolean do_branch = ((key->depth.enabled
-                            || key->stencil[0].enabled
-                            || key->alpha.enabled)
-                           && !shader->info.base.uses_kill);
-
-      color_ptr = LLVMBuildLoad(builder,
-                                LLVMBuildGEP(builder, color_ptr_ptr, &index, 1, ""),
-                                "");
+   for (sample = 0; sample < nr_samples; sample++) {
+      LLVMValueRef sample_mask[16 / 4];
+      LLVMValueRef *blend_mask = fs_mask;
 
-      lp_build_name(color_ptr, "color_ptr%d", cbuf);
+      if (key->multisample) {
+         LLVMValueRef offset = LLVMBuildMul(builder, depth_sample_stride,
+                                            lp_build_const_int32(gallivm, sample),
+                                            "");
 
-      stride = LLVMBuildLoad(builder,
-                             LLVMBuildGEP(builder, stride_ptr, &index, 1, ""),
-                             "");
+         generate_sample_depth_stencil(gallivm, shader, key, fs_type,
+                                       context_ptr, num_fs, sample,
+                                       partial_mask, mask_input,
+                                       fs_mask, fs_z,
+                                       dadx_ptr, dady_ptr,
+                                       LLVMBuildGEP(builder, depth_ptr,
+                                                    &offset, 1, ""),
+                                       depth_stride, facing, counter,
+                                       sample_mask);
+         blend_mask = sample_mask;
+      }
+
+      for(cbuf = 0; cbuf < key->nr_cbufs; cbuf++) {
+         LLVMValueRef color_ptr;
+         LLVMValueRef stride;
+         LLVMValueRef index = lp_build_const_int32(gallivm, cbuf);
+         unsigned rt = key->blend.independent_blend_enable ? cbuf : 0;
+
+         boolean do_branch = ((key->depth.enabled
+                               || key->stencil[0].enabled
+                               || key->alpha.enabled)
+                              && !shader->info.base.uses_kill);
+
+         color_ptr = LLVMBuildLoad(builder,
+                                   LLVMBuildGEP(builder, color_ptr_ptr, &index, 1, ""),
+                                   "");
+
+         if (sample > 0) {
+            LLVMValueRef offset;
+
+            offset = LLVMBuildLoad(builder,
+                                   LLVMBuildGEP(builder, sample_stride_ptr,
+                                                &index, 1, ""),
+                                   "");
+            offset = LLVMBuildMul(builder, offset,
+                                  lp_build_const_int32(gallivm, sample), "");
+            color_ptr = LLVMBuildBitCast(builder, color_ptr,
+                                         LLVMPointerType(int8_type, 0), "");
+            color_ptr = LLVMBuildGEP(builder, color_ptr, &offset, 1, "");
+            color_ptr = LLVMBuildBitCast(builder, color_ptr,
+                                         LLVMPointerType(blend_vec_type, 0), "");
+         }
 
-      generate_unswizzled_blend(gallivm, rt, variant, key->cbuf_format[cbuf],
-                                num_fs, fs_type, fs_mask, fs_out_color[cbuf],
-                                context_ptr, color_ptr, stride, partial_mask, do_branch);
+         lp_build_name(color_ptr, "color_ptr%d", cbuf);
+
+         stride = LLVMBuildLoad(builder,
+                                LLVMBuildGEP(builder, stride_ptr, &index, 1, ""),
+                                "");
+
+         generate_unswizzled_blend(gallivm, rt, variant, key->cbuf_format[cbuf],
+                                   num_fs, fs_type, blend_mask, fs_out_color[cbuf],
+                                   context_ptr, color_ptr, stride, partial_mask, do_branch);
+      }
    }
 
    LLVMBuildRetVoid(builder);
@@ -2039,6 +2313,9 @@ dump_fs_variant_key(const struct lp_fragment_shader_variant_key *key)
    if (key->flatshade) {
       debug_printf("flatshade = 1\n");
    }
+   if (key->multisample) {
+      debug_printf("multisample = 1\n");
+   }
    for (i = 0; i < key->nr_cbufs; ++i) {
       debug_printf("cbuf_format[%u] = %s\n", i, util_format_name(key->cbuf_format[i]));
    }
@@ -2122,6 +2399,73 @@ lp_debug_fs_variant(const struct lp_fragment_shader_variant *variant)
 }
 
 
+/**
+ * Compile a variant again with optimizations, on a compile thread.
+ * Until this is done the variant runs the quickly compiled code from
+ * generate_variant().
+ */
+static void
+optimize_variant(struct lp_compile_job *job, LLVMContextRef context)
+{
+   struct lp_fragment_shader_variant *variant =
+      (struct lp_fragment_shader_variant *) job->data;
+   struct lp_fragment_shader *shader = variant->shader;
+   struct lp_fragment_shader_variant *opt;
+   lp_jit_frag_func jit_function[2] = { NULL, NULL };
+   unsigned i;
+
+   /* Build the IR in a scratch variant, in this thread's LLVM context */
+   opt = CALLOC_STRUCT(lp_fragment_shader_variant);
+   if (!opt)
+      return;
+
+   opt->gallivm = gallivm_create_ext(context, FALSE);
+   if (!opt->gallivm) {
+      FREE(opt);
+      return;
+   }
+
+   gallivm_stats_begin(opt->gallivm, GALLIVM_STATS_FS, shader->tokens_hash);
+
+   memcpy(&opt->key, &variant->key, shader->variant_key_size);
+   opt->shader = shader;
+   opt->opaque = variant->opaque;
+   opt->no = variant->no;
+
+   lp_jit_init_types(opt);
+
+   generate_fragment(NULL, shader, opt, RAST_EDGE_TEST);
+   if (opt->opaque) {
+      generate_fragment(NULL, shader, opt, RAST_WHOLE);
+   }
+
+   lp_shader_cache_store(&opt->key, shader->variant_key_size,
+                         shader->base.tokens, opt->gallivm,
+                         opt->function, Elements(opt->function));
+
+   gallivm_compile_module(opt->gallivm);
+
+   for (i = 0; i < Elements(opt->function); i++) {
+      if (opt->function[i]) {
+         jit_function[i] = (lp_jit_frag_func)
+            gallivm_jit_function(opt->gallivm, opt->function[i]);
+      }
+   }
+   if (!jit_function[RAST_WHOLE]) {
+      jit_function[RAST_WHOLE] = jit_function[RAST_EDGE_TEST];
+   }
+
+   /* Scenes being rasterized may still run the old code, so it's kept
+    * until the variant is destroyed.
+    */
+   variant->opt_gallivm = opt->gallivm;
+   variant->jit_function[RAST_EDGE_TEST] = jit_function[RAST_EDGE_TEST];
+   variant->jit_function[RAST_WHOLE] = jit_function[RAST_WHOLE];
+
+   FREE(opt);
+}
+
+
 /**
  * Generate a new fragment shader variant from the shader code and
  * other state indicated by the key.
@@ -2132,17 +2476,38 @@ generate_variant(struct llvmpipe_context *lp,
                  const struct lp_fragment_shader_variant_key *key)
 {
    struct lp_fragment_shader_variant *variant;
+   struct lp_compile_queue *queue =
+      llvmpipe_screen(lp->pipe.screen)->compile_queue;
    const struct util_format_description *cbuf0_format_desc;
    boolean fullcolormask;
+   boolean cached = FALSE;
 
    variant = CALLOC_STRUCT(lp_fragment_shader_variant);
    if(!variant)
       return NULL;
 
-   variant->gallivm = gallivm_create();
-   if (!variant->gallivm) {
-      FREE(variant);
-      return NULL;
+   variant->gallivm = lp_shader_cache_load(key, shader->variant_key_size,
+                                           shader->base.tokens,
+                                           variant->function,
+                                           Elements(variant->function));
+   if (variant->gallivm) {
+      cached = TRUE;
+   }
+   else {
+      /* With a compile queue, compile quickly for now, and optimize in
+       * the background.  Variants which will be stored in the cache need
+       * a module of their own.
+       */
+      if (queue)
+         variant->gallivm = gallivm_create_ext(NULL, TRUE);
+      else if (lp_shader_cache_enabled())
+         variant->gallivm = gallivm_create();
+      else
+         variant->gallivm = gallivm_batch_get(&lp->gallivm_batch);
+      if (!variant->gallivm) {
+         FREE(variant);
+         return NULL;
+      }
    }
 
    variant->shader = shader;
@@ -2171,19 +2536,70 @@ generate_variant(struct llvmpipe_context *lp,
          !shader->info.base.uses_kill
          ? TRUE : FALSE;
 
+   /*
+    * With LESS/LEQUAL depth tests the depth values can only decrease, so
+    * fragments which are behind the known maximum depth of a block would
+    * fail the depth test.  That's only worth telling the shader if they
+    * have no other effect (stencil ops) and their depth is the
+    * interpolated one.
+    */
+   variant->hiz = 0;
+   if (key->depth.enabled) {
+      switch (key->depth.func) {
+      case PIPE_FUNC_LESS:
+      case PIPE_FUNC_LEQUAL:
+         if (!key->stencil[0].enabled &&
+             !shader->info.base.writes_z) {
+            variant->hiz |= LP_HIZ_TEST;
+            if (key->depth.writemask &&
+                !key->alpha.enabled &&
+                !shader->info.base.uses_kill) {
+               variant->hiz |= LP_HIZ_UPDATE;
+            }
+         }
+         break;
+      case PIPE_FUNC_NEVER:
+      case PIPE_FUNC_EQUAL:
+         break;
+      default:
+         if (key->depth.writemask)
+            variant->hiz |= LP_HIZ_INVALIDATE;
+         break;
+      }
+   }
+
    if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
       lp_debug_fs_variant(variant);
    }
 
    lp_jit_init_types(variant);
-   
-   if (variant->jit_function[RAST_EDGE_TEST] == NULL)
-      generate_fragment(lp, shader, variant, RAST_EDGE_TEST);
 
-   if (variant->jit_function[RAST_WHOLE] == NULL) {
-      if (variant->opaque) {
-         /* Specialized shader, which doesn't need to read the color buffer. */
-         generate_fragment(lp, shader, variant, RAST_WHOLE);
+   gallivm_stats_begin(variant->gallivm, GALLIVM_STATS_FS,
+                       shader->tokens_hash);
+
+   if (cached) {
+      unsigned i;
+      for (i = 0; i < Elements(variant->function); i++) {
+         if (variant->function[i])
+            variant->nr_instrs += lp_build_count_instructions(variant->function[i]);
+      }
+   }
+   else {
+      if (variant->jit_function[RAST_EDGE_TEST] == NULL)
+         generate_fragment(lp, shader, variant, RAST_EDGE_TEST);
+
+      if (variant->jit_function[RAST_WHOLE] == NULL) {
+         if (variant->opaque) {
+            /* Specialized shader, which doesn't need to read the color buffer. */
+            generate_fragment(lp, shader, variant, RAST_WHOLE);
+         }
+      }
+
+      if (!variant->gallivm->fast_compile) {
+         lp_shader_cache_store(key, shader->variant_key_size,
+                               shader->base.tokens, variant->gallivm,
+                               variant->function,
+                               Elements(variant->function));
       }
    }
 
@@ -2207,6 +2623,12 @@ generate_variant(struct llvmpipe_context *lp,
       variant->jit_function[RAST_WHOLE] = variant->jit_function[RAST_EDGE_TEST];
    }
 
+   if (variant->gallivm->fast_compile) {
+      variant->compile_job.run = optimize_variant;
+      variant->compile_job.data = variant;
+      lp_compile_queue_add(queue, &variant->compile_job);
+   }
+
    return variant;
 }
 
@@ -2232,6 +2654,9 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
 
    /* we need to keep a local copy of the tokens */
    shader->base.tokens = tgsi_dup_tokens(templ->tokens);
+   shader->tokens_hash = util_hash_crc32(shader->base.tokens,
+                                         tgsi_num_tokens(shader->base.tokens) *
+                                         sizeof(struct tgsi_token));
 
    shader->draw_data = draw_create_fragment_shader(llvmpipe->draw, templ);
    if (shader->draw_data == NULL) {
@@ -2321,9 +2746,41 @@ llvmpipe_bind_fs_state(struct pipe_context *pipe, void *fs)
 }
 
 
+void
+lp_fs_variant_id_init(struct lp_fs_variant_id *id,
+                      const struct lp_fragment_shader *shader,
+                      const struct lp_fragment_shader_variant_key *key)
+{
+   id->shader = shader;
+   id->key = key;
+   id->hash = util_hash_crc32(key, shader->variant_key_size) ^
+              (shader->no * 0x9e3779b9);
+}
+
+
+unsigned
+lp_fs_variant_id_hash(void *id)
+{
+   return ((const struct lp_fs_variant_id *) id)->hash;
+}
+
+
+int
+lp_fs_variant_id_compare(void *id1, void *id2)
+{
+   const struct lp_fs_variant_id *a = id1;
+   const struct lp_fs_variant_id *b = id2;
+
+   if (a->hash != b->hash || a->shader != b->shader)
+      return 1;
+
+   return memcmp(a->key, b->key, a->shader->variant_key_size);
+}
+
+
 /**
- * Remove shader variant from two lists: the shader's variant list
- * and the context's variant list.
+ * Remove shader variant from the context's hash table and from two lists:
+ * the shader's variant list and the context's variant list.
  */
 void
 llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
@@ -2331,6 +2788,11 @@ llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
 {
    unsigned i;
 
+   if (variant->compile_job.run) {
+      lp_compile_queue_cancel(llvmpipe_screen(lp->pipe.screen)->compile_queue,
+                              &variant->compile_job);
+   }
+
    if (gallivm_debug & GALLIVM_DEBUG_IR) {
       debug_printf("llvmpipe: del fs #%u var #%u v created #%u v cached"
                    " #%u v total cached #%u\n",
@@ -2352,11 +2814,17 @@ llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
 
    gallivm_destroy(variant->gallivm);
 
+   if (variant->opt_gallivm) {
+      lp_compile_job_destroy_gallivm(&variant->compile_job,
+                                     variant->opt_gallivm);
+   }
+
    /* remove from shader's list */
    remove_from_list(&variant->list_item_local);
    variant->shader->variants_cached--;
 
    /* remove from context's list */
+   util_hash_table_remove(lp->fs_variants_table, &variant->id);
    remove_from_list(&variant->list_item_global);
    lp->nr_fs_variants--;
    lp->nr_fs_instrs -= variant->nr_instrs;
@@ -2496,6 +2964,7 @@ make_variant_key(struct llvmpipe_context *lp,
    /* alpha.ref_value is passed in jit_context */
 
    key->flatshade = lp->rasterizer->flatshade;
+   key->multisample = llvmpipe_framebuffer_nr_samples(&lp->framebuffer) > 1;
    if (lp->active_occlusion_query) {
       key->occlusion_count = TRUE;
    }
@@ -2563,6 +3032,83 @@ make_variant_key(struct llvmpipe_context *lp,
 
 
 
+/**
+ * Set the eviction priority of a variant that is being used.
+ *
+ * This is the GreedyDual-Size policy: the priority is the context's clock
+ * plus the cost of the variant, and the clock advances to the priority of
+ * each evicted variant.  Variants that haven't been used for a while thus
+ * end up with the lowest priorities, but variants that were slow to compile
+ * for their size survive longer than cheap or big ones.  The code size is
+ * measured in LLVM instructions.
+ */
+static INLINE void
+touch_variant(struct llvmpipe_context *lp,
+              struct lp_fragment_shader_variant *variant)
+{
+   variant->priority = lp->fs_variants_clock +
+      (double) variant->compile_time / MAX2(variant->nr_instrs, 1);
+}
+
+
+static int
+compare_variant_priority(const void *a, const void *b)
+{
+   const struct lp_fragment_shader_variant *va =
+      *(const struct lp_fragment_shader_variant * const *) a;
+   const struct lp_fragment_shader_variant *vb =
+      *(const struct lp_fragment_shader_variant * const *) b;
+
+   if (va->priority < vb->priority)
+      return -1;
+   if (va->priority > vb->priority)
+      return 1;
+   return 0;
+}
+
+
+/**
+ * Free the variants with the lowest priority until there are no more than
+ * max_variants variants and the instruction limit isn't exceeded.
+ * The caller must make sure none of the variants is still binned.
+ */
+static void
+evict_variants(struct llvmpipe_context *lp, unsigned max_variants)
+{
+   struct lp_fragment_shader_variant **variants;
+   struct lp_fs_variant_list_item *li;
+   unsigned nr_variants = 0, i;
+
+   variants = MALLOC(lp->nr_fs_variants * sizeof *variants);
+   if (!variants)
+      return;
+
+   foreach(li, &lp->fs_variants_list) {
+      variants[nr_variants++] = li->base;
+   }
+
+   qsort(variants, nr_variants, sizeof *variants, compare_variant_priority);
+
+   for (i = 0; i < nr_variants; i++) {
+      struct lp_fragment_shader_variant *variant = variants[i];
+
+      if (lp->nr_fs_variants <= max_variants &&
+          lp->nr_fs_instrs < LP_MAX_SHADER_INSTRUCTIONS) {
+         break;
+      }
+
+      lp->fs_variants_clock = variant->priority;
+      lp->fs_variants_evicted[variant->id.hash % LP_FS_EVICTED_HISTORY] =
+         variant->id.hash;
+      lp->fs_variant_stats.nr_evictions++;
+
+      llvmpipe_remove_shader_variant(lp, variant);
+   }
+
+   FREE(variants);
+}
+
+
 /**
  * Update fragment shader state.  This is called just prior to drawing
  * something when some fragment-related state has changed.
@@ -2572,32 +3118,25 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
 {
    struct lp_fragment_shader *shader = lp->fs;
    struct lp_fragment_shader_variant_key key;
-   struct lp_fragment_shader_variant *variant = NULL;
-   struct lp_fs_variant_list_item *li;
+   struct lp_fragment_shader_variant *variant;
+   struct lp_fs_variant_id id;
 
    make_variant_key(lp, shader, &key);
 
-   /* Search the variants for one which matches the key */
-   li = first_elem(&shader->variants);
-   while(!at_end(&shader->variants, li)) {
-      if(memcmp(&li->base->key, &key, shader->variant_key_size) == 0) {
-         variant = li->base;
-         break;
-      }
-      li = next_elem(li);
-   }
+   /* Look for a variant of any shader which matches the key */
+   lp_fs_variant_id_init(&id, shader, &key);
+   variant = util_hash_table_get(lp->fs_variants_table, &id);
+
+   lp->fs_variant_stats.nr_lookups++;
 
    if (variant) {
-      /* Move this variant to the head of the list to implement LRU
-       * deletion of shader's when we have too many.
-       */
-      move_to_head(&lp->fs_variants_list, &variant->list_item_global);
+      lp->fs_variant_stats.nr_hits++;
+      touch_variant(lp, variant);
    }
    else {
       /* variant not found, create it now */
       int64_t t0, t1, dt;
-      unsigned i;
-      unsigned variants_to_cull;
+      unsigned evicted_slot = id.hash % LP_FS_EVICTED_HISTORY;
 
       if (0) {
          debug_printf("%u variants,\t%u instrs,\t%u instrs/variant\n",
@@ -2606,12 +3145,15 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
                       lp->nr_fs_variants ? lp->nr_fs_instrs / lp->nr_fs_variants : 0);
       }
 
+      if (lp->fs_variants_evicted[evicted_slot] == id.hash) {
+         lp->fs_variant_stats.nr_evicted_recompiles++;
+         lp->fs_variants_evicted[evicted_slot] = 0;
+      }
+
       /* First, check if we've exceeded the max number of shader variants.
-       * If so, free 25% of them (the least recently used ones).
+       * If so, free 25% of them (the ones with the lowest priority).
        */
-      variants_to_cull = lp->nr_fs_variants >= LP_MAX_SHADER_VARIANTS ? LP_MAX_SHADER_VARIANTS / 4 : 0;
-
-      if (variants_to_cull ||
+      if (lp->nr_fs_variants >= LP_MAX_SHADER_VARIANTS ||
           lp->nr_fs_instrs >= LP_MAX_SHADER_INSTRUCTIONS) {
          struct pipe_context *pipe = &lp->pipe;
 
@@ -2627,17 +3169,10 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
           * number of shader variants (potentially all of them) could be
           * pending for destruction on flush.
           */
-
-         for (i = 0; i < variants_to_cull || lp->nr_fs_instrs >= LP_MAX_SHADER_INSTRUCTIONS; i++) {
-            struct lp_fs_variant_list_item *item;
-            if (is_empty_list(&lp->fs_variants_list)) {
-               break;
-            }
-            item = last_elem(&lp->fs_variants_list);
-            assert(item);
-            assert(item->base);
-            llvmpipe_remove_shader_variant(lp, item->base);
-         }
+         if (lp->nr_fs_variants >= LP_MAX_SHADER_VARIANTS)
+            evict_variants(lp, LP_MAX_SHADER_VARIANTS - LP_MAX_SHADER_VARIANTS / 4);
+         else
+            evict_variants(lp, lp->nr_fs_variants);
       }
 
       /*
@@ -2650,10 +3185,18 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
       LP_COUNT_ADD(llvm_compile_time, dt);
       LP_COUNT_ADD(nr_llvm_compiles, 2);  /* emit vs. omit in/out test */
 
+      lp->fs_variant_stats.nr_compiles++;
+      lp->fs_variant_stats.compile_time += dt;
+
       llvmpipe_variant_count++;
 
-      /* Put the new variant into the list */
+      /* Put the new variant into the hash table and the lists */
       if (variant) {
+         lp_fs_variant_id_init(&variant->id, shader, &variant->key);
+         variant->compile_time = dt;
+         touch_variant(lp, variant);
+
+         util_hash_table_set(lp->fs_variants_table, &variant->id, variant);
          insert_at_head(&shader->variants, &variant->list_item_local);
          insert_at_head(&lp->fs_variants_list, &variant->list_item_global);
          lp->nr_fs_variants++;
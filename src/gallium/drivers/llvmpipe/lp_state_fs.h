@@ -36,6 +36,7 @@
 #include "gallivm/lp_bld_sample.h" /* for struct lp_sampler_static_state */
 #include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
 #include "lp_bld_interp.h" /* for struct lp_shader_input */
+#include "lp_compile_queue.h"
 
 
 struct tgsi_token;
@@ -47,6 +48,12 @@ struct lp_fragment_shader;
 #define RAST_EDGE_TEST 1
 
 
+/** lp_fragment_shader_variant::hiz flags */
+#define LP_HIZ_TEST       0x1  /**< skip blocks known to be occluded */
+#define LP_HIZ_UPDATE     0x2  /**< covered blocks get at most the tri's z */
+#define LP_HIZ_INVALIDATE 0x4  /**< may increase the depth values */
+
+
 struct lp_fragment_shader_variant_key
 {
    struct pipe_depth_state depth;
@@ -62,6 +69,7 @@ struct lp_fragment_shader_variant_key
    unsigned nr_samplers:8;	/* actually derivable from just the shader */
    unsigned flatshade:1;
    unsigned occlusion_count:1;
+   unsigned multisample:1;      /**< LP_MAX_SAMPLES samples per pixel */
 
    enum pipe_format zsbuf_format;
    enum pipe_format cbuf_format[PIPE_MAX_COLOR_BUFS];
@@ -78,12 +86,29 @@ struct lp_fs_variant_list_item
 };
 
 
+/**
+ * Key of llvmpipe_context::fs_variants_table.  Identifies a variant across
+ * all the fragment shaders of the context.
+ */
+struct lp_fs_variant_id
+{
+   const struct lp_fragment_shader *shader;
+   const struct lp_fragment_shader_variant_key *key;
+   unsigned hash;
+};
+
+
 struct lp_fragment_shader_variant
 {
    struct lp_fragment_shader_variant_key key;
 
+   struct lp_fs_variant_id id;
+
    boolean opaque;
 
+   /** How the rasterizer's hierarchical Z may be used, LP_HIZ_x flags */
+   unsigned hiz;
+
    struct gallivm_state *gallivm;
 
    LLVMTypeRef jit_context_ptr_type;
@@ -94,9 +119,26 @@ struct lp_fragment_shader_variant
 
    lp_jit_frag_func jit_function[2];
 
+   /**
+    * With LP_NUM_COMPILE_THREADS, the variant is first compiled without
+    * optimizations.  This job compiles it again with them, and replaces
+    * jit_function[] with the code in opt_gallivm.
+    */
+   struct lp_compile_job compile_job;
+   struct gallivm_state *opt_gallivm;
+
    /* Total number of LLVM instructions generated */
    unsigned nr_instrs;
 
+   /** Time taken to generate the variant, in microseconds */
+   int64_t compile_time;
+
+   /**
+    * Eviction priority, the variants with the lowest priority are freed
+    * first.  See llvmpipe_update_fs().
+    */
+   double priority;
+
    struct lp_fs_variant_list_item list_item_global, list_item_local;
    struct lp_fragment_shader *shader;
 
@@ -121,6 +163,7 @@ struct lp_fragment_shader
    unsigned no;
    unsigned variants_created;
    unsigned variants_cached;
+   unsigned tokens_hash;    /**< identifies the shader in the compile stats */
 
    /** Fragment shader input interpolation info */
    struct lp_shader_input inputs[PIPE_MAX_SHADER_INPUTS];
@@ -130,6 +173,17 @@ struct lp_fragment_shader
 void
 lp_debug_fs_variant(const struct lp_fragment_shader_variant *variant);
 
+void
+lp_fs_variant_id_init(struct lp_fs_variant_id *id,
+                      const struct lp_fragment_shader *shader,
+                      const struct lp_fragment_shader_variant_key *key);
+
+unsigned
+lp_fs_variant_id_hash(void *id);
+
+int
+lp_fs_variant_id_compare(void *id1, void *id2);
+
 void
 llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
                                struct lp_fragment_shader_variant *variant);
@@ -38,6 +38,8 @@
 #include "lp_screen.h"
 #include "lp_state.h"
 #include "lp_debug.h"
+#include "lp_flush.h"
+#include "lp_texture.h"
 #include "state_tracker/sw_winsys.h"
 
 
@@ -282,26 +284,26 @@ llvmpipe_prepare_vertex_sampling(struct llvmpipe_context *lp,
           */
          pipe_resource_reference(&lp->mapped_vs_tex[i], tex);
 
+         /* Vertices are fetched right away, on this thread, so wait for
+          * the queued scenes rendering to the texture, then fill its
+          * pending clears.
+          */
+         llvmpipe_flush_resource(&lp->pipe, tex, 0, -1,
+                                 TRUE,   /* read_only */
+                                 TRUE,   /* cpu_access */
+                                 FALSE,  /* do_not_block */
+                                 __FUNCTION__);
+         llvmpipe_resource_resolve_clears(tex);
+
          if (!lp_tex->dt) {
             /* regular texture - setup array of mipmap level pointers */
             /* XXX this may fail due to OOM ? */
             int j;
-            void *mip_ptr;
             /* must trigger allocation first before we can get base ptr */
-            mip_ptr = llvmpipe_get_texture_image_all(lp_tex, view->u.tex.first_level,
-                                                     LP_TEX_USAGE_READ,
-                                                     LP_TEX_LAYOUT_LINEAR);
-            addr = lp_tex->linear_img.data;
+            (void) llvmpipe_get_texture_image_all(lp_tex, view->u.tex.first_level);
+            addr = lp_tex->img.data;
             for (j = view->u.tex.first_level; j <= tex->last_level; j++) {
-               mip_ptr = llvmpipe_get_texture_image_all(lp_tex, j,
-                                                        LP_TEX_USAGE_READ,
-                                                        LP_TEX_LAYOUT_LINEAR);
-               mip_offsets[j] = (uint8_t *)mip_ptr - (uint8_t *)addr;
-               /*
-                * could get mip offset directly but need call above to
-                * invoke tiled->linear conversion.
-                */
-               assert(lp_tex->linear_mip_offsets[j] == mip_offsets[j]);
+               mip_offsets[j] = lp_tex->mip_offsets[j];
                row_stride[j] = lp_tex->row_stride[j];
                img_stride[j] = lp_tex->img_stride[j];
             }
@@ -26,6 +26,7 @@
  **************************************************************************/
 
 
+#include "util/u_hash.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/u_simple_list.h"
@@ -685,11 +686,14 @@ generate_setup_variant(struct lp_setup_variant_key *key,
    if (variant == NULL)
       goto fail;
 
-   variant->gallivm = gallivm = gallivm_create();
+   variant->gallivm = gallivm = gallivm_batch_get(&lp->gallivm_batch);
    if (!variant->gallivm) {
       goto fail;
    }
 
+   gallivm_stats_begin(gallivm, GALLIVM_STATS_SETUP,
+                       util_hash_crc32(key, key->size));
+
    builder = gallivm->builder;
 
    if (LP_DEBUG & DEBUG_COUNTERS) {
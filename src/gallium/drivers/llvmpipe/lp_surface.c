@@ -25,6 +25,8 @@
  * 
  **************************************************************************/
 
+#include "util/u_format.h"
+#include "util/u_memory.h"
 #include "util/u_rect.h"
 #include "util/u_surface.h"
 #include "lp_context.h"
@@ -34,22 +36,6 @@
 #include "lp_texture.h"
 
 
-/**
- * Adjust x, y, width, height to lie on tile bounds.
- */
-static void
-adjust_to_tile_bounds(unsigned x, unsigned y, unsigned width, unsigned height,
-                      unsigned *x_tile, unsigned *y_tile,
-                      unsigned *w_tile, unsigned *h_tile)
-{
-   *x_tile = x & ~(TILE_SIZE - 1);
-   *y_tile = y & ~(TILE_SIZE - 1);
-   *w_tile = ((x + width + TILE_SIZE - 1) & ~(TILE_SIZE - 1)) - *x_tile;
-   *h_tile = ((y + height + TILE_SIZE - 1) & ~(TILE_SIZE - 1)) - *y_tile;
-}
-
-
-
 static void
 lp_resource_copy(struct pipe_context *pipe,
                  struct pipe_resource *dst, unsigned dst_level,
@@ -88,6 +74,9 @@ lp_resource_copy(struct pipe_context *pipe,
                            FALSE, /* do_not_block */
                            "blit src");
 
+   llvmpipe_resource_resolve_clears(dst);
+   llvmpipe_resource_resolve_clears(src);
+
    /*
    printf("surface copy from %u lvl %u to %u lvl %u: %u,%u,%u to %u,%u,%u %u x %u x %u\n",
           src_tex->id, src_level, dst_tex->id, dst_level, 
@@ -95,80 +84,312 @@ lp_resource_copy(struct pipe_context *pipe,
           src_box->width, src_box->height, src_box->depth);
    */
 
-   /* set src tiles to linear layout */
+   /* copy */
    {
-      unsigned tx, ty, tw, th;
-      unsigned x, y;
-
-      adjust_to_tile_bounds(src_box->x, src_box->y, width, height,
-                            &tx, &ty, &tw, &th);
-
-      for (y = 0; y < th; y += TILE_SIZE) {
-         for (x = 0; x < tw; x += TILE_SIZE) {
-            (void) llvmpipe_get_texture_tile_linear(src_tex,
-                                                    src_box->z, src_level,
-                                                    LP_TEX_USAGE_READ,
-                                                    tx + x, ty + y);
-         }
+      const ubyte *src_ptr
+         = llvmpipe_get_texture_image(src_tex, src_box->z, src_level);
+      ubyte *dst_ptr
+         = llvmpipe_get_texture_image(dst_tex, dstz, dst_level);
+
+      if (dst_ptr && src_ptr) {
+         util_copy_rect(dst_ptr, format,
+                        llvmpipe_resource_stride(&dst_tex->base, dst_level),
+                        dstx, dsty,
+                        width, height,
+                        src_ptr,
+                        llvmpipe_resource_stride(&src_tex->base, src_level),
+                        src_box->x, src_box->y);
       }
    }
+}
 
-   /* set dst tiles to linear layout */
-   {
-      unsigned tx, ty, tw, th;
-      unsigned x, y;
-      enum lp_texture_usage usage;
-
-      adjust_to_tile_bounds(dstx, dsty, width, height, &tx, &ty, &tw, &th);
-
-      for (y = 0; y < th; y += TILE_SIZE) {
-         boolean contained_y = ty + y >= dsty &&
-                               ty + y + TILE_SIZE <= dsty + height ?
-                               TRUE : FALSE;
-
-         for (x = 0; x < tw; x += TILE_SIZE) {
-            boolean contained_x = tx + x >= dstx &&
-                                  tx + x + TILE_SIZE <= dstx + width ?
-                                  TRUE : FALSE;
-
-            /*
-             * Set the usage mode to WRITE_ALL for the tiles which are
-             * completely contained by the dest rectangle.
-             */
-            if (contained_y && contained_x)
-               usage = LP_TEX_USAGE_WRITE_ALL;
-            else
-               usage = LP_TEX_USAGE_READ_WRITE;
-
-            (void) llvmpipe_get_texture_tile_linear(dst_tex,
-                                                    dstz, dst_level,
-                                                    usage,
-                                                    tx + x, ty + y);
+
+/**
+ * Average the samples of one row of a multisampled 8-bit unorm image.
+ */
+static void
+resolve_row_unorm8(ubyte *dst, const ubyte *src, unsigned sample_stride,
+                   unsigned nr_samples, unsigned size)
+{
+   unsigned i, s;
+
+   for (i = 0; i < size; i++) {
+      unsigned sum = nr_samples / 2;
+      for (s = 0; s < nr_samples; s++) {
+         sum += src[s * sample_stride + i];
+      }
+      dst[i] = sum / nr_samples;
+   }
+}
+
+
+/**
+ * Keep the channels of the destination row the blit mask excludes.
+ */
+static void
+merge_row_float(float *row, const float *old, unsigned mask, unsigned width)
+{
+   unsigned i, c;
+
+   for (i = 0; i < width; i++) {
+      for (c = 0; c < 4; c++) {
+         if (!(mask & (1 << c)))
+            row[4 * i + c] = old[4 * i + c];
+      }
+   }
+}
+
+
+/**
+ * Average the samples of one row of a multisampled image of any color
+ * format, through floats, and write it in the destination format.
+ * 'tmp' holds two rows of width RGBA floats.
+ */
+static void
+resolve_row_float(enum pipe_format src_format, enum pipe_format dst_format,
+                  unsigned mask,
+                  ubyte *dst, const ubyte *src, unsigned sample_stride,
+                  unsigned nr_samples, unsigned width, float *tmp)
+{
+   float *sum = tmp, *row = tmp + 4 * width;
+   const float scale = 1.0f / nr_samples;
+   unsigned i, s;
+
+   memset(sum, 0, 4 * width * sizeof *sum);
+
+   for (s = 0; s < nr_samples; s++) {
+      util_format_read_4f(src_format, row, 0, src + s * sample_stride, 0,
+                          0, 0, width, 1);
+      for (i = 0; i < 4 * width; i++) {
+         sum[i] += row[i];
+      }
+   }
+
+   for (i = 0; i < 4 * width; i++) {
+      sum[i] *= scale;
+   }
+
+   if (mask != PIPE_MASK_RGBA) {
+      util_format_read_4f(dst_format, row, 0, dst, 0, 0, 0, width, 1);
+      merge_row_float(sum, row, mask, width);
+   }
+
+   util_format_write_4f(dst_format, sum, 0, dst, 0, 0, 0, width, 1);
+}
+
+
+/**
+ * Copy the first sample of one row of a multisampled integer image,
+ * converting it to the destination format.  'tmp' holds two rows of
+ * width RGBA integers.
+ */
+static void
+resolve_row_int(enum pipe_format src_format, enum pipe_format dst_format,
+                unsigned mask, boolean sint,
+                ubyte *dst, const ubyte *src, unsigned width, int *tmp)
+{
+   int *row = tmp, *old = tmp + 4 * width;
+   unsigned i, c;
+
+   if (sint)
+      util_format_read_4i(src_format, row, 0, src, 0, 0, 0, width, 1);
+   else
+      util_format_read_4ui(src_format, (unsigned *)row, 0, src, 0,
+                           0, 0, width, 1);
+
+   if (mask != PIPE_MASK_RGBA) {
+      if (sint)
+         util_format_read_4i(dst_format, old, 0, dst, 0, 0, 0, width, 1);
+      else
+         util_format_read_4ui(dst_format, (unsigned *)old, 0, dst, 0,
+                              0, 0, width, 1);
+
+      for (i = 0; i < width; i++) {
+         for (c = 0; c < 4; c++) {
+            if (!(mask & (1 << c)))
+               row[4 * i + c] = old[4 * i + c];
          }
       }
    }
 
-   /* copy */
-   {
-      const ubyte *src_linear_ptr
-         = llvmpipe_get_texture_image_address(src_tex, src_box->z,
-                                              src_level,
-                                              LP_TEX_LAYOUT_LINEAR);
-      ubyte *dst_linear_ptr
-         = llvmpipe_get_texture_image_address(dst_tex, dstz,
-                                              dst_level,
-                                              LP_TEX_LAYOUT_LINEAR);
-
-      if (dst_linear_ptr && src_linear_ptr) {
-         util_copy_rect(dst_linear_ptr, format,
-                        llvmpipe_resource_stride(&dst_tex->base, dst_level),
-                        dstx, dsty,
-                        width, height,
-                        src_linear_ptr,
-                        llvmpipe_resource_stride(&src_tex->base, src_level),
-                        src_box->x, src_box->y);
+   if (sint)
+      util_format_write_4i(dst_format, row, 0, dst, 0, 0, 0, width, 1);
+   else
+      util_format_write_4ui(dst_format, (unsigned *)row, 0, dst, 0,
+                            0, 0, width, 1);
+}
+
+
+/**
+ * Resolve a multisampled resource into a single sample one, on the CPU.
+ * Color samples are averaged and converted to the destination format;
+ * depth, stencil and integer formats, which can't be averaged, take the
+ * first sample.  The blit's scissor and mask are honored.
+ *
+ * \return FALSE if the blit can't be done as a resolve (scaling,
+ * flipping, 3D or compressed images, or conversions between depth,
+ * stencil, integer and other color formats).
+ */
+static boolean
+lp_resolve(struct pipe_context *pipe, const struct pipe_blit_info *info)
+{
+   struct pipe_resource *src = info->src.resource;
+   struct pipe_resource *dst = info->dst.resource;
+   const enum pipe_format src_format = info->src.format;
+   const enum pipe_format dst_format = info->dst.format;
+   const struct util_format_description *src_desc =
+      util_format_description(src_format);
+   const struct util_format_description *dst_desc =
+      util_format_description(dst_format);
+   const unsigned nr_samples = llvmpipe_resource_nr_samples(src);
+   const unsigned sample_stride = llvmpipe_resource_sample_stride(src);
+   const unsigned src_bpp = util_format_get_blocksize(src_format);
+   const unsigned dst_bpp = util_format_get_blocksize(dst_format);
+   const boolean zs = util_format_is_depth_or_stencil(src_format);
+   const boolean integer = util_format_is_pure_integer(src_format);
+   const boolean sint = util_format_is_pure_sint(src_format);
+   boolean do_z = FALSE, do_s = FALSE;
+   unsigned mask = info->mask;
+   int x0, y0, x1, y1;
+   unsigned width, height, src_stride, dst_stride, y;
+   const ubyte *src_ptr;
+   ubyte *dst_ptr;
+   void *tmp = NULL;
+
+   if (info->dst.box.width != info->src.box.width ||
+       info->dst.box.height != info->src.box.height ||
+       info->src.box.width <= 0 || info->src.box.height <= 0 ||
+       info->src.box.depth != 1 ||
+       info->dst.box.depth != 1 ||
+       info->src.box.x < 0 || info->src.box.y < 0 ||
+       info->src.box.x + info->src.box.width >
+          (int)u_minify(src->width0, info->src.level) ||
+       info->src.box.y + info->src.box.height >
+          (int)u_minify(src->height0, info->src.level) ||
+       src_desc->block.width != 1 || src_desc->block.height != 1 ||
+       dst_desc->block.width != 1 || dst_desc->block.height != 1 ||
+       zs != util_format_is_depth_or_stencil(dst_format) ||
+       integer != util_format_is_pure_integer(dst_format) ||
+       sint != util_format_is_pure_sint(dst_format)) {
+      return FALSE;
+   }
+
+   if (zs) {
+      do_z = (mask & PIPE_MASK_Z) &&
+             util_format_has_depth(src_desc) &&
+             util_format_has_depth(dst_desc);
+      do_s = (mask & PIPE_MASK_S) &&
+             util_format_has_stencil(src_desc) &&
+             util_format_has_stencil(dst_desc);
+      if (!do_z && !do_s)
+         return TRUE;
+   }
+   else {
+      mask &= PIPE_MASK_RGBA;
+      if (!mask)
+         return TRUE;
+   }
+
+   /* Clip the destination rectangle to the level and the scissor, the
+    * source follows it.
+    */
+   x0 = MAX2(info->dst.box.x, 0);
+   y0 = MAX2(info->dst.box.y, 0);
+   x1 = MIN2(info->dst.box.x + info->dst.box.width,
+             (int)u_minify(dst->width0, info->dst.level));
+   y1 = MIN2(info->dst.box.y + info->dst.box.height,
+             (int)u_minify(dst->height0, info->dst.level));
+   if (info->scissor_enable) {
+      x0 = MAX2(x0, (int)info->scissor.minx);
+      y0 = MAX2(y0, (int)info->scissor.miny);
+      x1 = MIN2(x1, (int)info->scissor.maxx);
+      y1 = MIN2(y1, (int)info->scissor.maxy);
+   }
+   if (x0 >= x1 || y0 >= y1)
+      return TRUE;
+
+   width = x1 - x0;
+   height = y1 - y0;
+
+   llvmpipe_flush_resource(pipe,
+                           dst, info->dst.level, info->dst.box.z,
+                           FALSE, /* read_only */
+                           TRUE, /* cpu_access */
+                           FALSE, /* do_not_block */
+                           "resolve dest");
+
+   llvmpipe_flush_resource(pipe,
+                           src, info->src.level, info->src.box.z,
+                           TRUE, /* read_only */
+                           TRUE, /* cpu_access */
+                           FALSE, /* do_not_block */
+                           "resolve src");
+
+   llvmpipe_resource_resolve_clears(dst);
+
+   src_ptr = llvmpipe_get_texture_image(llvmpipe_resource(src),
+                                        info->src.box.z, info->src.level);
+   dst_ptr = llvmpipe_get_texture_image(llvmpipe_resource(dst),
+                                        info->dst.box.z, info->dst.level);
+   if (!src_ptr || !dst_ptr)
+      return TRUE;
+
+   src_stride = llvmpipe_resource_stride(src, info->src.level);
+   dst_stride = llvmpipe_resource_stride(dst, info->dst.level);
+   src_ptr += (info->src.box.y + y0 - info->dst.box.y) * src_stride +
+              (info->src.box.x + x0 - info->dst.box.x) * src_bpp;
+   dst_ptr += y0 * dst_stride + x0 * dst_bpp;
+
+   if (src_format == dst_format &&
+       (zs ? do_z == util_format_has_depth(src_desc) &&
+             do_s == util_format_has_stencil(src_desc)
+           : integer && mask == PIPE_MASK_RGBA)) {
+      /* the first sample, as is */
+      util_copy_rect(dst_ptr, dst_format, dst_stride, 0, 0, width, height,
+                     src_ptr, src_stride, 0, 0);
+      return TRUE;
+   }
+
+   if (src_format != dst_format ||
+       mask != PIPE_MASK_RGBA ||
+       zs || integer ||
+       !util_format_is_rgba8_variant(src_desc) ||
+       src_desc->colorspace == UTIL_FORMAT_COLORSPACE_SRGB) {
+      tmp = MALLOC(2 * 4 * width * sizeof(float));
+      if (!tmp)
+         return TRUE;
+   }
+
+   for (y = 0; y < height; y++) {
+      if (zs) {
+         if (do_z) {
+            src_desc->unpack_z_float(tmp, 0, src_ptr, 0, width, 1);
+            dst_desc->pack_z_float(dst_ptr, 0, tmp, 0, width, 1);
+         }
+         if (do_s) {
+            src_desc->unpack_s_8uint(tmp, 0, src_ptr, 0, width, 1);
+            dst_desc->pack_s_8uint(dst_ptr, 0, tmp, 0, width, 1);
+         }
       }
+      else if (integer) {
+         resolve_row_int(src_format, dst_format, mask, sint,
+                         dst_ptr, src_ptr, width, tmp);
+      }
+      else if (tmp) {
+         resolve_row_float(src_format, dst_format, mask,
+                           dst_ptr, src_ptr, sample_stride,
+                           nr_samples, width, tmp);
+      }
+      else {
+         resolve_row_unorm8(dst_ptr, src_ptr, sample_stride,
+                            nr_samples, width * src_bpp);
+      }
+      src_ptr += src_stride;
+      dst_ptr += dst_stride;
    }
+
+   FREE(tmp);
+   return TRUE;
 }
 
 
@@ -179,11 +400,14 @@ static void lp_blit(struct pipe_context *pipe,
    struct pipe_blit_info info = *blit_info;
 
    if (info.src.resource->nr_samples > 1 &&
-       info.dst.resource->nr_samples <= 1 &&
-       !util_format_is_depth_or_stencil(info.src.resource->format) &&
-       !util_format_is_pure_integer(info.src.resource->format)) {
-      debug_printf("llvmpipe: color resolve unimplemented\n");
-      return;
+       info.dst.resource->nr_samples <= 1) {
+      if (lp_resolve(pipe, &info))
+         return; /* done */
+
+      debug_printf("llvmpipe: resolve unsupported %s -> %s, "
+                   "samples won't be averaged\n",
+                   util_format_short_name(info.src.format),
+                   util_format_short_name(info.dst.format));
    }
 
    if (util_try_blit_via_copy_region(pipe, &info)) {
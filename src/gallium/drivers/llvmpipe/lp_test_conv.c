@@ -368,6 +368,11 @@ const struct lp_type conv_types[] = {
    {  FALSE, FALSE, FALSE,  TRUE,    16,   8 },
    {  FALSE, FALSE, FALSE, FALSE,    16,   8 },
 
+   {  FALSE, FALSE,  TRUE,  TRUE,    16,  16 },
+   {  FALSE, FALSE,  TRUE, FALSE,    16,  16 },
+   {  FALSE, FALSE, FALSE,  TRUE,    16,  16 },
+   {  FALSE, FALSE, FALSE, FALSE,    16,  16 },
+
    {  FALSE, FALSE,  TRUE,  TRUE,     8,  16 },
    {  FALSE, FALSE,  TRUE, FALSE,     8,  16 },
    {  FALSE, FALSE, FALSE,  TRUE,     8,  16 },
@@ -377,12 +382,50 @@ const struct lp_type conv_types[] = {
    {  FALSE, FALSE,  TRUE, FALSE,     8,   4 },
    {  FALSE, FALSE, FALSE,  TRUE,     8,   4 },
    {  FALSE, FALSE, FALSE, FALSE,     8,   4 },
+
+   {  FALSE, FALSE,  TRUE,  TRUE,     8,  32 },
+   {  FALSE, FALSE,  TRUE, FALSE,     8,  32 },
+   {  FALSE, FALSE, FALSE,  TRUE,     8,  32 },
+   {  FALSE, FALSE, FALSE, FALSE,     8,  32 },
 };
 
 
 const unsigned num_types = sizeof(conv_types)/sizeof(conv_types[0]);
 
 
+/*
+ * Half floats only convert to/from 32bit floats, so they are tested
+ * separately from the types above.
+ */
+const struct lp_type half_conv_types[][2] = {
+   /*    float, fixed,  sign,  norm, width, len */
+   { {   TRUE, FALSE,  TRUE, FALSE,    32,   4 },
+     {   TRUE, FALSE,  TRUE, FALSE,    16,   4 } },
+   { {   TRUE, FALSE,  TRUE, FALSE,    32,   8 },
+     {   TRUE, FALSE,  TRUE, FALSE,    16,   8 } },
+};
+
+
+const unsigned num_half_types = sizeof(half_conv_types)/sizeof(half_conv_types[0]);
+
+
+static boolean
+test_half(unsigned verbose, FILE *fp)
+{
+   boolean success = TRUE;
+   unsigned i;
+
+   for (i = 0; i < num_half_types; ++i) {
+      if (!test_one(verbose, fp, half_conv_types[i][0], half_conv_types[i][1]))
+         success = FALSE;
+      if (!test_one(verbose, fp, half_conv_types[i][1], half_conv_types[i][0]))
+         success = FALSE;
+   }
+
+   return success;
+}
+
+
 boolean
 test_all(unsigned verbose, FILE *fp)
 {
@@ -404,6 +447,11 @@ test_all(unsigned verbose, FILE *fp)
       }
    }
 
+   if (!test_half(verbose, fp)) {
+      success = FALSE;
+      ++error_count;
+   }
+
    fprintf(stderr, "%d failures\n", error_count);
 
    return success;
@@ -430,6 +478,9 @@ test_some(unsigned verbose, FILE *fp,
         success = FALSE;
    }
 
+   if (!test_half(verbose, fp))
+      success = FALSE;
+
    return success;
 }
 
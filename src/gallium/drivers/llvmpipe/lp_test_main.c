@@ -35,6 +35,7 @@
 
 
 #include "util/u_cpu_detect.h"
+#include "util/u_half.h"
 #include "util/u_math.h"
 
 #include "gallivm/lp_bld_const.h"
@@ -64,6 +65,9 @@ read_elem(struct lp_type type, const void *src, unsigned index)
    assert(index < type.length);
    if (type.floating) {
       switch(type.width) {
+      case 16:
+         value = util_half_to_float(*((const uint16_t *)src + index));
+         break;
       case 32:
          value = *((const float *)src + index);
          break;
@@ -131,6 +135,9 @@ write_elem(struct lp_type type, void *dst, unsigned index, double value)
       value = 1.0;
    if (type.floating) {
       switch(type.width) {
+      case 16:
+         *((uint16_t *)dst + index) = util_float_to_half((float)value);
+         break;
       case 32:
          *((float *)dst + index) = (float)(value);
          break;
@@ -362,6 +369,18 @@ dump_vec(FILE *fp, struct lp_type type, const void *src)
 }
 
 
+static boolean
+run_tests(unsigned verbose, FILE *fp, boolean single, unsigned long n)
+{
+   if (single)
+      return test_single(verbose, fp);
+   else if (n)
+      return test_some(verbose, fp, n);
+   else
+      return test_all(verbose, fp);
+}
+
+
 int main(int argc, char **argv)
 {
    unsigned verbose = 0;
@@ -400,12 +419,36 @@ int main(int argc, char **argv)
       write_tsv_header(fp);
    }
       
-   if (single)
-      success = test_single(verbose, fp);
-   else if (n)
-      success = test_some(verbose, fp, n);
-   else
-      success = test_all(verbose, fp);
+   success = run_tests(verbose, fp, single, n);
+
+   /*
+    * Code generation picks AVX2/FMA/F16C paths at runtime, so also run the
+    * tests with each of these hidden, to cover the fallbacks on this CPU.
+    */
+   if (!fp) {
+      const struct util_cpu_caps caps = util_cpu_caps;
+
+      if (caps.has_f16c) {
+         fprintf(stderr, "Testing without F16C\n");
+         util_cpu_caps.has_f16c = 0;
+         success = run_tests(verbose, fp, single, n) && success;
+         util_cpu_caps = caps;
+      }
+
+      if (caps.has_fma) {
+         fprintf(stderr, "Testing without FMA\n");
+         util_cpu_caps.has_fma = 0;
+         success = run_tests(verbose, fp, single, n) && success;
+         util_cpu_caps = caps;
+      }
+
+      if (caps.has_avx2) {
+         fprintf(stderr, "Testing without AVX2\n");
+         util_cpu_caps.has_avx2 = 0;
+         success = run_tests(verbose, fp, single, n) && success;
+         util_cpu_caps = caps;
+      }
+   }
 
    if(fp)
       fclose(fp);
@@ -0,0 +1,435 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+
+/**
+ * @file
+ * Benchmark of the distribution of the bins of a scene to the rasterizer
+ * threads.
+ *
+ * The same scene is rasterized frame after frame by one thread per CPU,
+ * pinned with lp_affinity_pin_thread(), once with all the threads taking
+ * bins from a single queue, and once with per-thread bin queues (the way
+ * the rasterizer does, see lp_scene_bin_iter_begin()).  Rasterizing a
+ * bin is simulated by reading and writing every pixel of the tile's color
+ * and depth, once per command in the bin.  Reported are the time per
+ * frame, the percentage of the bins rasterized by another thread than in
+ * the previous frame (their tile's cache lines have to move between
+ * cores) and the percentage rasterized on another NUMA node (the lines
+ * cross sockets).
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "os/os_thread.h"
+#include "os/os_time.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "lp_affinity.h"
+#include "lp_scene.h"
+
+#include "lp_test.h"
+
+
+#define FB_WIDTH 1024
+#define FB_HEIGHT 1024
+#define FB_TILES_X (FB_WIDTH / TILE_SIZE)
+#define FB_TILES_Y (FB_HEIGHT / TILE_SIZE)
+
+/** Color and depth, 32 bits each, interleaved */
+#define FB_STRIDE (FB_WIDTH * 2 * sizeof(uint32_t))
+
+
+struct tiles_test;
+
+struct tiles_thread
+{
+   struct tiles_test *test;
+   unsigned index;
+   int cpu;
+   unsigned node;
+   unsigned *order;
+   pipe_thread thread;
+
+   unsigned nr_bins;
+   unsigned nr_migrated;
+   unsigned nr_remote;
+};
+
+
+struct tiles_test
+{
+   struct lp_scene *scene;
+   unsigned num_threads;
+   struct tiles_thread *threads;
+   pipe_barrier barrier;
+
+   /* per frame */
+   unsigned num_queues;
+   boolean exit_flag;
+
+   uint8_t *fb;
+   unsigned last_thread[FB_TILES_Y][FB_TILES_X];
+};
+
+
+/**
+ * Read and write every pixel of the bin's tile, once per command.
+ */
+static void
+rasterize_bin(struct tiles_test *test, const struct cmd_bin *bin)
+{
+   const struct cmd_block *block;
+   unsigned i, x, y;
+
+   for (block = bin->head; block; block = block->next) {
+      for (i = 0; i < block->count; i++) {
+         for (y = 0; y < TILE_SIZE; y++) {
+            uint32_t *row = (uint32_t *)
+               (test->fb + (bin->y * TILE_SIZE + y) * FB_STRIDE) +
+               bin->x * TILE_SIZE * 2;
+            for (x = 0; x < TILE_SIZE * 2; x++) {
+               row[x]++;
+            }
+         }
+      }
+   }
+}
+
+
+static PIPE_THREAD_ROUTINE( tiles_thread_function, init_data )
+{
+   struct tiles_thread *thread = (struct tiles_thread *) init_data;
+   struct tiles_test *test = thread->test;
+
+   if (thread->cpu >= 0)
+      lp_affinity_pin_thread(thread->cpu);
+
+   while (1) {
+      static const unsigned shared_order[1] = { 0 };
+      const unsigned *order;
+      struct cmd_bin *bin;
+      unsigned queue;
+
+      pipe_barrier_wait(&test->barrier);
+
+      if (test->exit_flag)
+         break;
+
+      order = test->num_queues > 1 ? thread->order : shared_order;
+
+      while ((bin = lp_scene_bin_iter_next(test->scene,
+                                           order, test->num_queues,
+                                           &queue, NULL))) {
+         unsigned last = test->last_thread[bin->y][bin->x];
+
+         rasterize_bin(test, bin);
+
+         thread->nr_bins++;
+         if (last != thread->index) {
+            thread->nr_migrated++;
+            if (test->threads[last].node != thread->node)
+               thread->nr_remote++;
+         }
+         test->last_thread[bin->y][bin->x] = thread->index;
+      }
+
+      pipe_barrier_wait(&test->barrier);
+   }
+
+   return NULL;
+}
+
+
+/**
+ * Bin a scene with a few expensive tiles in the middle of the framebuffer
+ * and cheap ones around them.
+ */
+static boolean
+bin_scene(struct lp_scene *scene)
+{
+   struct pipe_framebuffer_state fb;
+   union lp_rast_cmd_arg arg;
+   unsigned x, y, i;
+
+   memset(&fb, 0, sizeof fb);
+   fb.width = FB_WIDTH;
+   fb.height = FB_HEIGHT;
+
+   lp_scene_begin_binning(scene, &fb, FALSE);
+
+   arg.state = NULL;
+   srand(0);
+
+   for (y = 0; y < FB_TILES_Y; y++) {
+      for (x = 0; x < FB_TILES_X; x++) {
+         unsigned cost = 1 + rand() % 4;
+
+         scene->tile[x][y].x = x;
+         scene->tile[x][y].y = y;
+
+         if (x > FB_TILES_X / 4 && x < FB_TILES_X * 3 / 4 &&
+             y > FB_TILES_Y / 4 && y < FB_TILES_Y * 3 / 4)
+            cost *= 4;
+
+         for (i = 0; i < cost; i++) {
+            if (!lp_scene_bin_command(scene, x, y, LP_RAST_OP_SET_STATE, arg))
+               return FALSE;
+         }
+      }
+   }
+
+   lp_scene_end_binning(scene);
+
+   return TRUE;
+}
+
+
+/**
+ * Rasterize the scene num_frames times, with one bin queue per thread or
+ * a single shared queue, and check that every bin was rasterized once
+ * per frame.
+ */
+static boolean
+run_frames(struct tiles_test *test, boolean per_thread_queues,
+           unsigned num_frames, unsigned verbose, FILE *fp)
+{
+   unsigned nr_bins = 0, nr_migrated = 0, nr_remote = 0;
+   int64_t start, end;
+   double ms;
+   unsigned frame, i, x, y;
+   boolean success = TRUE;
+
+   /* A new buffer each run, so that its pages get placed by the first
+    * touch of the threads of this run (calloc doesn't touch the pages of
+    * such a large allocation).
+    */
+   test->fb = CALLOC(FB_HEIGHT, FB_STRIDE);
+   if (!test->fb)
+      return FALSE;
+
+   test->num_queues = per_thread_queues ? test->num_threads : 1;
+
+   for (i = 0; i < test->num_threads; i++) {
+      test->threads[i].nr_bins = 0;
+      test->threads[i].nr_migrated = 0;
+      test->threads[i].nr_remote = 0;
+   }
+
+   start = os_time_get();
+
+   for (frame = 0; frame < num_frames; frame++) {
+      lp_scene_bin_iter_begin(test->scene, test->num_queues);
+
+      /* start the threads and wait for them to finish */
+      pipe_barrier_wait(&test->barrier);
+      pipe_barrier_wait(&test->barrier);
+
+      if (frame == 0) {
+         /* don't count the first touch of the tiles as migrations */
+         for (i = 0; i < test->num_threads; i++) {
+            test->threads[i].nr_bins = 0;
+            test->threads[i].nr_migrated = 0;
+            test->threads[i].nr_remote = 0;
+         }
+         start = os_time_get();
+      }
+   }
+
+   end = os_time_get();
+
+   for (i = 0; i < test->num_threads; i++) {
+      nr_bins += test->threads[i].nr_bins;
+      nr_migrated += test->threads[i].nr_migrated;
+      nr_remote += test->threads[i].nr_remote;
+   }
+
+   /* The first pixel of each tile counts the commands rasterized */
+   for (y = 0; y < FB_TILES_Y; y++) {
+      for (x = 0; x < FB_TILES_X; x++) {
+         const struct cmd_bin *bin = lp_scene_get_bin(test->scene, x, y);
+         const uint32_t *pixel = (const uint32_t *)
+            (test->fb + y * TILE_SIZE * FB_STRIDE) + x * TILE_SIZE * 2;
+         if (*pixel != bin->cost * num_frames) {
+            if (verbose)
+               printf("tile %u,%u rasterized %u times, expected %u\n",
+                      x, y, *pixel, bin->cost * num_frames);
+            success = FALSE;
+         }
+      }
+   }
+
+   FREE(test->fb);
+   test->fb = NULL;
+
+   ms = num_frames > 1 ? (end - start) / 1000.0 / (num_frames - 1) : 0.0;
+
+   printf("%-7s %2u threads: %8.3f ms/frame, %5.1f%% bins migrated, "
+          "%5.1f%% bins from another node%s\n",
+          per_thread_queues ? "affine" : "shared",
+          test->num_threads, ms,
+          nr_bins ? 100.0 * nr_migrated / nr_bins : 0.0,
+          nr_bins ? 100.0 * nr_remote / nr_bins : 0.0,
+          success ? "" : " FAIL");
+
+   if (fp) {
+      fprintf(fp, "%d\t%s\t%u\t%f\t%f\t%f\n",
+              success,
+              per_thread_queues ? "affine" : "shared",
+              test->num_threads, ms,
+              nr_bins ? (double) nr_migrated / nr_bins : 0.0,
+              nr_bins ? (double) nr_remote / nr_bins : 0.0);
+      fflush(fp);
+   }
+
+   return success;
+}
+
+
+static boolean
+test_tiles(unsigned verbose, FILE *fp, unsigned num_frames,
+           boolean shared_queue)
+{
+   struct tiles_test test;
+   struct lp_affinity_cpu *cpus;
+   unsigned *nodes;
+   unsigned num_cpus, i;
+   boolean success = TRUE;
+
+   memset(&test, 0, sizeof test);
+
+   test.num_threads = MAX2(2, util_cpu_caps.nr_cpus);
+   test.threads = CALLOC(test.num_threads, sizeof test.threads[0]);
+   cpus = CALLOC(test.num_threads, sizeof cpus[0]);
+   nodes = CALLOC(test.num_threads, sizeof nodes[0]);
+   test.scene = lp_scene_create(NULL, NULL);
+   if (!test.threads || !cpus || !nodes || !test.scene ||
+       !bin_scene(test.scene)) {
+      success = FALSE;
+      goto out;
+   }
+
+   num_cpus = lp_affinity_get_cpus(cpus, test.num_threads);
+
+   for (i = 0; i < test.num_threads; i++) {
+      struct tiles_thread *thread = &test.threads[i];
+      thread->test = &test;
+      thread->index = i;
+      thread->cpu = num_cpus ? (int) cpus[i % num_cpus].cpu : -1;
+      thread->node = num_cpus ? cpus[i % num_cpus].node : 0;
+      nodes[i] = thread->node;
+   }
+
+   for (i = 0; i < test.num_threads; i++) {
+      struct tiles_thread *thread = &test.threads[i];
+      thread->order = MALLOC(test.num_threads * sizeof thread->order[0]);
+      if (!thread->order) {
+         success = FALSE;
+         goto out;
+      }
+      lp_affinity_steal_order(nodes, test.num_threads, i, thread->order);
+   }
+
+   pipe_barrier_init(&test.barrier, test.num_threads + 1);
+
+   for (i = 0; i < test.num_threads; i++) {
+      test.threads[i].thread = pipe_thread_create(tiles_thread_function,
+                                                  &test.threads[i]);
+   }
+
+   if (shared_queue && !run_frames(&test, FALSE, num_frames, verbose, fp))
+      success = FALSE;
+
+   if (!run_frames(&test, TRUE, num_frames, verbose, fp))
+      success = FALSE;
+
+   test.exit_flag = TRUE;
+   pipe_barrier_wait(&test.barrier);
+
+   for (i = 0; i < test.num_threads; i++) {
+      pipe_thread_wait(test.threads[i].thread);
+   }
+
+   pipe_barrier_destroy(&test.barrier);
+
+out:
+   if (test.scene) {
+      lp_scene_reset(test.scene);
+      lp_scene_destroy(test.scene);
+   }
+   if (test.threads) {
+      for (i = 0; i < test.num_threads; i++) {
+         FREE(test.threads[i].order);
+      }
+   }
+   FREE(test.threads);
+   FREE(cpus);
+   FREE(nodes);
+
+   return success;
+}
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "queues\t"
+           "threads\t"
+           "ms_per_frame\t"
+           "migrated\t"
+           "remote\n");
+
+   fflush(fp);
+}
+
+
+boolean
+test_all(unsigned verbose, FILE *fp)
+{
+   return test_tiles(verbose, fp, 100, TRUE);
+}
+
+
+boolean
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   return test_tiles(verbose, fp, MAX2(2, n), TRUE);
+}
+
+
+boolean
+test_single(unsigned verbose, FILE *fp)
+{
+   return test_tiles(verbose, fp, 10, FALSE);
+}
@@ -30,7 +30,9 @@
 
 
 #include "pipe/p_state.h"
+#include "os/os_thread.h"
 #include "util/u_debug.h"
+#include "util/u_pack_color.h"
 #include "lp_limits.h"
 
 
@@ -42,16 +44,6 @@ enum lp_texture_usage
 };
 
 
-/** Per-tile layout mode */
-enum lp_texture_layout
-{
-   LP_TEX_LAYOUT_NONE = 0,  /**< no layout for the tile data yet */
-   LP_TEX_LAYOUT_TILED,     /**< the tile data is in tiled layout */
-   LP_TEX_LAYOUT_LINEAR,    /**< the tile data is in linear layout */
-   LP_TEX_LAYOUT_BOTH       /**< the tile data is in both modes */
-};
-
-
 struct pipe_context;
 struct pipe_screen;
 struct llvmpipe_context;
@@ -60,10 +52,10 @@ struct sw_displaytarget;
 
 
 /**
- * We keep one or two copies of the texture image data:  one in a simple
- * linear layout (for texture sampling) and another in a tiled layout (for
- * render targets).  We keep track of whether each image tile is linear
- * or tiled on a per-tile basis.
+ * Texture image data is kept in a single, linear layout which is used
+ * directly for texture sampling, rendering (color and depth/stencil) and
+ * transfers, so rendering to a texture and sampling from it never needs
+ * any conversion.
  */
 
 
@@ -74,12 +66,25 @@ struct llvmpipe_texture_image
 };
 
 
+/**
+ * Fast clear state of one tile of a render target.  Clearing a whole tile
+ * only records the clear value here, the tile's pixels are written when
+ * the tile is next rendered to or read.
+ */
+struct llvmpipe_tile_clear
+{
+   boolean pending;          /**< the tile's pixels aren't written yet */
+   union util_color value;   /**< clear value, packed in the tile's format */
+};
+
+
 /**
  * llvmpipe subclass of pipe_resource.  A texture, drawing surface,
  * vertex buffer, const buffer, etc.
  * Textures are stored differently than othere types of objects such as
  * vertex buffers and const buffers.
- * The former are tiled and have per-tile layout flags.
+ * The former have per-level strides and offsets and are allocated on
+ * demand.
  * The later are simple malloc'd blocks of memory.
  */
 struct llvmpipe_resource
@@ -90,13 +95,17 @@ struct llvmpipe_resource
    unsigned row_stride[LP_MAX_TEXTURE_LEVELS];
    /** Image stride (for cube maps, array or 3D textures) in bytes */
    unsigned img_stride[LP_MAX_TEXTURE_LEVELS];
-   unsigned tiles_per_row[LP_MAX_TEXTURE_LEVELS];
-   unsigned tiles_per_image[LP_MAX_TEXTURE_LEVELS];
    /** Number of 3D slices or cube faces per level */
    unsigned num_slices_faces[LP_MAX_TEXTURE_LEVELS];
    /** Offset to start of mipmap level, in bytes */
-   unsigned tiled_mip_offsets[LP_MAX_TEXTURE_LEVELS];
-   unsigned linear_mip_offsets[LP_MAX_TEXTURE_LEVELS];
+   unsigned mip_offsets[LP_MAX_TEXTURE_LEVELS];
+   /**
+    * Distance between the samples of multisampled textures, in bytes.
+    * Each sample is a complete copy of the single sample image data
+    * (all levels and layers), sample i starting at i * sample_stride.
+    * Valid once the image data is allocated.
+    */
+   unsigned sample_stride;
 
    /**
     * Display target, for textures with the PIPE_BIND_DISPLAY_TARGET
@@ -104,20 +113,36 @@ struct llvmpipe_resource
     */
    struct sw_displaytarget *dt;
 
+   /** Fence of the last scene rendering to the display target */
+   struct lp_fence *dt_fence;
+
+   /**
+    * Per tile fast clear state of level 0, layer 0 of single sample 2D
+    * render targets, or NULL.  An entry is only written by the rasterizer
+    * thread rendering its tile, or by the calling thread once the scenes
+    * rendering to the resource are done.
+    */
+   struct llvmpipe_tile_clear *tile_clear;
+   unsigned tiles_x, tiles_y;
+   boolean clear_pending;    /**< any tile_clear[].pending may be set */
+
+   /**
+    * Serializes llvmpipe_resource_resolve_clears(), which rasterizer
+    * thread 0 runs for the textures a scene samples while the calling
+    * thread may map them for reading.  Valid if tile_clear is set.
+    */
+   pipe_mutex clear_mutex;
+
    /**
     * Malloc'ed data for regular textures, or a mapping to dt above.
     */
-   struct llvmpipe_texture_image tiled_img;
-   struct llvmpipe_texture_image linear_img;
+   struct llvmpipe_texture_image img;
 
    /**
     * Data for non-texture resources.
     */
    void *data;
 
-   /** array [level][face or slice][tile_y][tile_x] of layout values) */
-   enum lp_texture_layout *layout[LP_MAX_TEXTURE_LEVELS];
-
    boolean userBuffer;  /** Is this a user-space buffer? */
    unsigned timestamp;
 
@@ -173,12 +198,42 @@ llvmpipe_resource_stride(struct pipe_resource *resource,
 }
 
 
+/**
+ * Number of samples stored for each pixel, 1 for single sample resources.
+ */
+static INLINE unsigned
+llvmpipe_resource_nr_samples(const struct pipe_resource *resource)
+{
+   return resource->nr_samples > 1 ? resource->nr_samples : 1;
+}
+
+
+static INLINE unsigned
+llvmpipe_resource_sample_stride(struct pipe_resource *resource)
+{
+   return llvmpipe_resource(resource)->sample_stride;
+}
+
+
+/**
+ * Number of samples of a framebuffer's surfaces, which must all match.
+ */
+static INLINE unsigned
+llvmpipe_framebuffer_nr_samples(const struct pipe_framebuffer_state *fb)
+{
+   if (fb->nr_cbufs && fb->cbufs[0])
+      return llvmpipe_resource_nr_samples(fb->cbufs[0]->texture);
+   if (fb->zsbuf)
+      return llvmpipe_resource_nr_samples(fb->zsbuf->texture);
+   return 1;
+}
+
+
 void *
 llvmpipe_resource_map(struct pipe_resource *resource,
                       unsigned level,
                       unsigned layer,
-                      enum lp_texture_usage tex_usage,
-                      enum lp_texture_layout layout);
+                      enum lp_texture_usage tex_usage);
 
 void
 llvmpipe_resource_unmap(struct pipe_resource *resource,
@@ -190,38 +245,25 @@ void *
 llvmpipe_resource_data(struct pipe_resource *resource);
 
 
+void
+llvmpipe_resource_resolve_clears(struct pipe_resource *resource);
+
+
 unsigned
 llvmpipe_resource_size(const struct pipe_resource *resource);
 
 
 ubyte *
 llvmpipe_get_texture_image_address(struct llvmpipe_resource *lpr,
-                                    unsigned face_slice, unsigned level,
-                                    enum lp_texture_layout layout);
+                                   unsigned face_slice, unsigned level);
 
 void *
 llvmpipe_get_texture_image(struct llvmpipe_resource *resource,
-                            unsigned face_slice, unsigned level,
-                            enum lp_texture_usage usage,
-                            enum lp_texture_layout layout);
+                           unsigned face_slice, unsigned level);
 
 void *
 llvmpipe_get_texture_image_all(struct llvmpipe_resource *lpr,
-                               unsigned level,
-                               enum lp_texture_usage usage,
-                               enum lp_texture_layout layout);
-
-ubyte *
-llvmpipe_get_texture_tile_linear(struct llvmpipe_resource *lpr,
-                                  unsigned face_slice, unsigned level,
-                                  enum lp_texture_usage usage,
-                                  unsigned x, unsigned y);
-
-ubyte *
-llvmpipe_get_texture_tile(struct llvmpipe_resource *lpr,
-                           unsigned face_slice, unsigned level,
-                           enum lp_texture_usage usage,
-                           unsigned x, unsigned y);
+                               unsigned level);
 
 
 extern void
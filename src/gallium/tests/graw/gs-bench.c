@@ -0,0 +1,292 @@
+/* Geometry shader throughput benchmark.
+ *
+ * Draws a grid of points which a geometry shader expands into small
+ * quads (two-triangle strips) covering the window, and reports the input
+ * point and output triangle rates.  The frames are rendered once with the
+ * draw module's TGSI interpreter and once with its LLVM geometry shader
+ * code (DRAW_LLVM_GS=0 and 1), so the two can be compared in one run.
+ *
+ * Usage: gs-bench [-g gridsize] [-n frames]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "graw_util.h"
+#include "os/os_time.h"
+
+static struct graw_info info;
+
+static const int WIDTH = 1024;
+static const int HEIGHT = 1024;
+
+static unsigned GridSize = 256;
+static unsigned NumFrames = 20;
+
+
+struct vertex {
+   float position[4];
+   float color[4];
+};
+
+
+static unsigned num_vertices(void)
+{
+   return GridSize * GridSize;
+}
+
+
+static void set_vertices( void )
+{
+   struct pipe_vertex_element ve[2];
+   struct pipe_vertex_buffer vbuf;
+   struct vertex *vertices, *v;
+   void *handle;
+   unsigned x, y;
+
+   memset(ve, 0, sizeof ve);
+
+   ve[0].src_offset = Offset(struct vertex, position);
+   ve[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   ve[1].src_offset = Offset(struct vertex, color);
+   ve[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+
+   handle = info.ctx->create_vertex_elements_state(info.ctx, 2, ve);
+   info.ctx->bind_vertex_elements_state(info.ctx, handle);
+
+   vertices = MALLOC(num_vertices() * sizeof *vertices);
+   if (!vertices)
+      exit(1);
+
+   /* One point at the lower left corner of each grid cell, in clip
+    * coordinates [-1, 1].
+    */
+   v = vertices;
+   for (y = 0; y < GridSize; y++) {
+      for (x = 0; x < GridSize; x++) {
+         float fx = (float)x / GridSize;
+         float fy = (float)y / GridSize;
+         v->position[0] = fx * 2.0f - 1.0f;
+         v->position[1] = fy * 2.0f - 1.0f;
+         v->position[2] = 0.0f;
+         v->position[3] = 1.0f;
+         v->color[0] = fx;
+         v->color[1] = fy;
+         v->color[2] = 1.0f - fx;
+         v->color[3] = 1.0f;
+         v++;
+      }
+   }
+
+   memset(&vbuf, 0, sizeof vbuf);
+
+   vbuf.stride = sizeof( struct vertex );
+   vbuf.buffer_offset = 0;
+   vbuf.buffer = pipe_buffer_create_with_data(info.ctx,
+                                              PIPE_BIND_VERTEX_BUFFER,
+                                              PIPE_USAGE_STATIC,
+                                              num_vertices() * sizeof *vertices,
+                                              vertices);
+
+   info.ctx->set_vertex_buffers(info.ctx, 0, 1, &vbuf);
+
+   pipe_resource_reference(&vbuf.buffer, NULL);
+   FREE(vertices);
+}
+
+
+static void set_vertex_shader( void )
+{
+   void *handle;
+   const char *text =
+      "VERT\n"
+      "DCL IN[0]\n"
+      "DCL IN[1]\n"
+      "DCL OUT[0], POSITION\n"
+      "DCL OUT[1], COLOR\n"
+      "  0: MOV OUT[1], IN[1]\n"
+      "  1: MOV OUT[0], IN[0]\n"
+      "  2: END\n";
+
+   handle = graw_parse_vertex_shader(info.ctx, text);
+   info.ctx->bind_vs_state(info.ctx, handle);
+}
+
+
+static void set_fragment_shader( void )
+{
+   void *handle;
+   const char *text =
+      "FRAG\n"
+      "DCL IN[0], COLOR, LINEAR\n"
+      "DCL OUT[0], COLOR\n"
+      "  0: MOV OUT[0], IN[0]\n"
+      "  1: END\n";
+
+   handle = graw_parse_fragment_shader(info.ctx, text);
+   info.ctx->bind_fs_state(info.ctx, handle);
+}
+
+
+/**
+ * Expand each point into a quad the size of a grid cell, whose size is
+ * passed in CONST[0].x.  The last corner gets the inverted color.
+ */
+static void set_geometry_shader( void )
+{
+   void *handle;
+   const char *text =
+      "GEOM\n"
+      "PROPERTY GS_INPUT_PRIMITIVE POINTS\n"
+      "PROPERTY GS_OUTPUT_PRIMITIVE TRIANGLE_STRIP\n"
+      "PROPERTY GS_MAX_OUTPUT_VERTICES 4\n"
+      "DCL IN[][0], POSITION, CONSTANT\n"
+      "DCL IN[][1], COLOR, CONSTANT\n"
+      "DCL OUT[0], POSITION, CONSTANT\n"
+      "DCL OUT[1], COLOR, CONSTANT\n"
+      "DCL CONST[0]\n"
+      "DCL TEMP[0]\n"
+      "IMM FLT32 {     1.0,     0.0,     0.0,     0.0 }\n"
+      " 0: MOV OUT[0], IN[0][0]\n"
+      " 1: MOV OUT[1], IN[0][1]\n"
+      " 2: EMIT\n"
+      " 3: ADD OUT[0], IN[0][0], CONST[0].xwww\n"
+      " 4: MOV OUT[1], IN[0][1]\n"
+      " 5: EMIT\n"
+      " 6: ADD OUT[0], IN[0][0], CONST[0].wxww\n"
+      " 7: MOV OUT[1], IN[0][1]\n"
+      " 8: EMIT\n"
+      " 9: ADD OUT[0], IN[0][0], CONST[0].xxww\n"
+      "10: SUB TEMP[0], IMM[0].xxxx, IN[0][1]\n"
+      "11: MOV OUT[1], TEMP[0]\n"
+      "12: EMIT\n"
+      "13: ENDPRIM\n"
+      "14: END\n";
+
+   handle = graw_parse_geometry_shader(info.ctx, text);
+   info.ctx->bind_gs_state(info.ctx, handle);
+}
+
+
+static void set_constants( void )
+{
+   static float constants[4];
+   struct pipe_constant_buffer cb;
+
+   constants[0] = 2.0f / GridSize;
+
+   memset(&cb, 0, sizeof cb);
+   cb.buffer_size = sizeof constants;
+   cb.user_buffer = constants;
+
+   info.ctx->set_constant_buffer(info.ctx, PIPE_SHADER_GEOMETRY, 0, &cb);
+}
+
+
+static void draw_frame( void )
+{
+   union pipe_color_union clear_color = { {0,0,0,1} };
+
+   info.ctx->clear(info.ctx, PIPE_CLEAR_COLOR, &clear_color, 0, 0);
+   util_draw_arrays(info.ctx, PIPE_PRIM_POINTS, 0, num_vertices());
+}
+
+
+static void finish( void )
+{
+   struct pipe_fence_handle *fence = NULL;
+
+   info.ctx->flush(info.ctx, &fence);
+   if (fence) {
+      info.screen->fence_finish(info.screen, fence, PIPE_TIMEOUT_INFINITE);
+      info.screen->fence_reference(info.screen, &fence, NULL);
+   }
+}
+
+
+static void run( boolean llvm )
+{
+   int64_t start, end;
+   double secs;
+   unsigned i;
+
+   /* The draw module reads this when the geometry shader is created.
+    */
+#ifdef PIPE_OS_WINDOWS
+   _putenv(llvm ? "DRAW_LLVM_GS=1" : "DRAW_LLVM_GS=0");
+#else
+   setenv("DRAW_LLVM_GS", llvm ? "1" : "0", 1);
+#endif
+
+   if (!graw_util_create_window(&info, WIDTH, HEIGHT, 1, FALSE))
+      exit(1);
+
+   graw_util_default_state(&info, FALSE);
+   graw_util_viewport(&info, 0, 0, WIDTH, HEIGHT, 30, 1000);
+
+   set_vertices();
+   set_vertex_shader();
+   set_fragment_shader();
+   set_geometry_shader();
+   set_constants();
+
+   /* warm up: compile shader variants, fault in the framebuffer */
+   draw_frame();
+   finish();
+
+   start = os_time_get();
+   for (i = 0; i < NumFrames; i++) {
+      draw_frame();
+   }
+   finish();
+   end = os_time_get();
+
+   secs = (end - start) / 1.0e6;
+   printf("%-4s: %8.2f ms/frame, %8.2f Mpoint/s, %8.2f Mtri/s\n",
+          llvm ? "llvm" : "tgsi",
+          secs * 1000.0 / NumFrames,
+          (double)num_vertices() * NumFrames / secs / 1.0e6,
+          (double)num_vertices() * 2 * NumFrames / secs / 1.0e6);
+
+   graw_util_flush_front(&info);
+
+   info.ctx->destroy(info.ctx);
+   info.screen->destroy(info.screen);
+}
+
+
+static void args(int argc, char *argv[])
+{
+   int i;
+
+   for (i = 1; i < argc; ) {
+      if (graw_parse_args(&i, argc, argv)) {
+         /* ok */
+      }
+      else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+         GridSize = MAX2(1, atoi(argv[i + 1]));
+         i += 2;
+      }
+      else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+         NumFrames = MAX2(1, atoi(argv[i + 1]));
+         i += 2;
+      }
+      else {
+         printf("Invalid arg %s\n", argv[i]);
+         exit(1);
+      }
+   }
+}
+
+
+int main( int argc, char *argv[] )
+{
+   args(argc, argv);
+
+   printf("%u x %u, %u points/frame, %u frames\n",
+          WIDTH, HEIGHT, num_vertices(), NumFrames);
+
+   run(FALSE);
+   run(TRUE);
+
+   return 0;
+}
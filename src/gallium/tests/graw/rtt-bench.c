@@ -0,0 +1,358 @@
+/* Render-to-texture throughput benchmark.
+ *
+ * Ping-pongs between two render targets, each with its own depth buffer:
+ * every pass draws a full-screen quad into one color/depth texture pair
+ * with the depth test on, sampling the color and the depth texture
+ * rendered by the previous pass.  The last texture is then drawn to the
+ * window.  This measures how quickly the driver can switch a texture
+ * between being rendered to and being sampled from, which is what
+ * post-processing chains and shadow maps do.
+ *
+ * Usage: rtt-bench [-s size] [-p passes] [-n frames]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "graw_util.h"
+#include "os/os_time.h"
+
+static struct graw_info info;
+
+static const int WIDTH = 512;
+static const int HEIGHT = 512;
+
+static unsigned TexSize = 1024;
+static unsigned NumPasses = 8;
+static unsigned NumFrames = 50;
+
+static struct pipe_resource *color_tex[2], *depth_tex[2];
+static struct pipe_surface *color_surf[2], *depth_surf[2];
+static struct pipe_sampler_view *color_view[2], *depth_view[2];
+
+static void *pass_fs, *blit_fs;
+
+
+struct vertex {
+   float position[4];
+   float texcoord[4];
+};
+
+static struct vertex vertices[] =
+{
+   { {-1.0, -1.0, 0.5, 1.0 },
+     { 0, 0, 0, 1 } },
+
+   { { 1.0, -1.0, 0.5, 1.0 },
+     { 1, 0, 0, 1 } },
+
+   { { 1.0,  1.0, 0.5, 1.0 },
+     { 1, 1, 0, 1 } },
+
+   { {-1.0,  1.0, 0.5, 1.0 },
+     { 0, 1, 0, 1 } },
+};
+
+
+static void set_vertices( void )
+{
+   struct pipe_vertex_element ve[2];
+   struct pipe_vertex_buffer vbuf;
+   void *handle;
+
+   memset(ve, 0, sizeof ve);
+
+   ve[0].src_offset = Offset(struct vertex, position);
+   ve[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   ve[1].src_offset = Offset(struct vertex, texcoord);
+   ve[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+
+   handle = info.ctx->create_vertex_elements_state(info.ctx, 2, ve);
+   info.ctx->bind_vertex_elements_state(info.ctx, handle);
+
+   memset(&vbuf, 0, sizeof vbuf);
+
+   vbuf.stride = sizeof( struct vertex );
+   vbuf.buffer_offset = 0;
+   vbuf.buffer = pipe_buffer_create_with_data(info.ctx,
+                                              PIPE_BIND_VERTEX_BUFFER,
+                                              PIPE_USAGE_STATIC,
+                                              sizeof(vertices),
+                                              vertices);
+
+   info.ctx->set_vertex_buffers(info.ctx, 0, 1, &vbuf);
+
+   pipe_resource_reference(&vbuf.buffer, NULL);
+}
+
+
+static void set_vertex_shader( void )
+{
+   void *handle;
+   const char *text =
+      "VERT\n"
+      "DCL IN[0]\n"
+      "DCL IN[1]\n"
+      "DCL OUT[0], POSITION\n"
+      "DCL OUT[1], GENERIC[0]\n"
+      "  0: MOV OUT[1], IN[1]\n"
+      "  1: MOV OUT[0], IN[0]\n"
+      "  2: END\n";
+
+   handle = graw_parse_vertex_shader(info.ctx, text);
+   info.ctx->bind_vs_state(info.ctx, handle);
+}
+
+
+static void create_fragment_shaders( void )
+{
+   /* Fade the previous color towards the previous depth. */
+   const char *pass_text =
+      "FRAG\n"
+      "DCL IN[0], GENERIC[0], LINEAR\n"
+      "DCL OUT[0], COLOR\n"
+      "DCL SAMP[0]\n"
+      "DCL SAMP[1]\n"
+      "DCL TEMP[0..1]\n"
+      "IMM FLT32 {     0.9,     0.1,     0.0,     0.0 }\n"
+      "  0: TEX TEMP[0], IN[0], SAMP[0], 2D\n"
+      "  1: TEX TEMP[1], IN[0], SAMP[1], 2D\n"
+      "  2: MUL TEMP[0], TEMP[0], IMM[0].xxxx\n"
+      "  3: MAD OUT[0], TEMP[1].xxxx, IMM[0].yyyy, TEMP[0]\n"
+      "  4: END\n";
+   const char *blit_text =
+      "FRAG\n"
+      "DCL IN[0], GENERIC[0], LINEAR\n"
+      "DCL OUT[0], COLOR\n"
+      "DCL SAMP[0]\n"
+      "  0: TEX OUT[0], IN[0], SAMP[0], 2D\n"
+      "  1: END\n";
+
+   pass_fs = graw_parse_fragment_shader(info.ctx, pass_text);
+   blit_fs = graw_parse_fragment_shader(info.ctx, blit_text);
+}
+
+
+static struct pipe_resource *
+create_target(enum pipe_format format, unsigned bind)
+{
+   struct pipe_resource temp, *tex;
+
+   memset(&temp, 0, sizeof temp);
+   temp.target = PIPE_TEXTURE_2D;
+   temp.format = format;
+   temp.width0 = TexSize;
+   temp.height0 = TexSize;
+   temp.depth0 = 1;
+   temp.array_size = 1;
+   temp.last_level = 0;
+   temp.nr_samples = 1;
+   temp.bind = bind | PIPE_BIND_SAMPLER_VIEW;
+
+   tex = info.screen->resource_create(info.screen, &temp);
+   if (!tex) {
+      printf("failed to create %s render target\n",
+             util_format_name(format));
+      exit(1);
+   }
+
+   return tex;
+}
+
+
+static struct pipe_surface *
+create_surface(struct pipe_resource *tex)
+{
+   struct pipe_surface surf_temp;
+
+   memset(&surf_temp, 0, sizeof surf_temp);
+   surf_temp.format = tex->format;
+   surf_temp.u.tex.level = 0;
+   surf_temp.u.tex.first_layer = 0;
+   surf_temp.u.tex.last_layer = 0;
+
+   return info.ctx->create_surface(info.ctx, tex, &surf_temp);
+}
+
+
+static void create_targets( void )
+{
+   unsigned i;
+
+   for (i = 0; i < 2; i++) {
+      color_tex[i] = create_target(PIPE_FORMAT_B8G8R8A8_UNORM,
+                                   PIPE_BIND_RENDER_TARGET);
+      depth_tex[i] = create_target(PIPE_FORMAT_Z32_FLOAT,
+                                   PIPE_BIND_DEPTH_STENCIL);
+
+      color_surf[i] = create_surface(color_tex[i]);
+      depth_surf[i] = create_surface(depth_tex[i]);
+
+      color_view[i] = graw_util_create_simple_sampler_view(&info,
+                                                           color_tex[i]);
+      depth_view[i] = graw_util_create_simple_sampler_view(&info,
+                                                           depth_tex[i]);
+   }
+}
+
+
+static void set_samplers( void )
+{
+   void *samplers[2];
+
+   samplers[0] = graw_util_create_simple_sampler(&info,
+                                                 PIPE_TEX_WRAP_CLAMP_TO_EDGE,
+                                                 PIPE_TEX_FILTER_LINEAR);
+   samplers[1] = graw_util_create_simple_sampler(&info,
+                                                 PIPE_TEX_WRAP_CLAMP_TO_EDGE,
+                                                 PIPE_TEX_FILTER_NEAREST);
+   info.ctx->bind_fragment_sampler_states(info.ctx, 2, samplers);
+}
+
+
+static void set_framebuffer(struct pipe_surface *cbuf,
+                            struct pipe_surface *zsbuf,
+                            unsigned width, unsigned height)
+{
+   struct pipe_framebuffer_state fb;
+
+   memset(&fb, 0, sizeof fb);
+   fb.nr_cbufs = 1;
+   fb.cbufs[0] = cbuf;
+   fb.zsbuf = zsbuf;
+   fb.width = width;
+   fb.height = height;
+   info.ctx->set_framebuffer_state(info.ctx, &fb);
+
+   graw_util_viewport(&info, 0, 0, width, height, 0, 1);
+}
+
+
+/**
+ * Render pass 'i': read the targets of pass i - 1, write the other pair.
+ */
+static void draw_pass( unsigned i )
+{
+   const unsigned dst = i & 1, src = dst ^ 1;
+   struct pipe_sampler_view *views[2];
+
+   set_framebuffer(color_surf[dst], depth_surf[dst], TexSize, TexSize);
+
+   views[0] = color_view[src];
+   views[1] = depth_view[src];
+   info.ctx->set_fragment_sampler_views(info.ctx, 2, views);
+
+   info.ctx->clear(info.ctx, PIPE_CLEAR_DEPTHSTENCIL, NULL, 1.0, 0);
+   util_draw_arrays(info.ctx, PIPE_PRIM_QUADS, 0, 4);
+}
+
+
+static void draw_frame( void )
+{
+   unsigned i;
+
+   info.ctx->bind_fs_state(info.ctx, pass_fs);
+   for (i = 0; i < NumPasses; i++) {
+      draw_pass(i);
+   }
+
+   /* show the result */
+   set_framebuffer(info.color_surf[0], info.zs_surf, WIDTH, HEIGHT);
+   info.ctx->bind_fs_state(info.ctx, blit_fs);
+   info.ctx->set_fragment_sampler_views(info.ctx, 1,
+                                        &color_view[(NumPasses - 1) & 1]);
+   info.ctx->clear(info.ctx, PIPE_CLEAR_DEPTHSTENCIL, NULL, 1.0, 0);
+   util_draw_arrays(info.ctx, PIPE_PRIM_QUADS, 0, 4);
+}
+
+
+static void finish( void )
+{
+   struct pipe_fence_handle *fence = NULL;
+
+   info.ctx->flush(info.ctx, &fence);
+   if (fence) {
+      info.screen->fence_finish(info.screen, fence, PIPE_TIMEOUT_INFINITE);
+      info.screen->fence_reference(info.screen, &fence, NULL);
+   }
+}
+
+
+static void init( void )
+{
+   if (!graw_util_create_window(&info, WIDTH, HEIGHT, 1, TRUE))
+      exit(1);
+
+   graw_util_default_state(&info, TRUE);
+
+   set_vertices();
+   set_vertex_shader();
+   create_fragment_shaders();
+   create_targets();
+   set_samplers();
+}
+
+
+static void args(int argc, char *argv[])
+{
+   int i;
+
+   for (i = 1; i < argc; ) {
+      if (graw_parse_args(&i, argc, argv)) {
+         /* ok */
+      }
+      else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+         TexSize = MAX2(1, atoi(argv[i + 1]));
+         i += 2;
+      }
+      else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+         NumPasses = MAX2(1, atoi(argv[i + 1]));
+         i += 2;
+      }
+      else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+         NumFrames = MAX2(1, atoi(argv[i + 1]));
+         i += 2;
+      }
+      else {
+         printf("Invalid arg %s\n", argv[i]);
+         exit(1);
+      }
+   }
+}
+
+
+int main( int argc, char *argv[] )
+{
+   int64_t start, end;
+   double secs;
+   unsigned i;
+
+   args(argc, argv);
+
+   init();
+
+   /* warm up: compile shader variants, allocate the textures */
+   draw_frame();
+   finish();
+
+   start = os_time_get();
+   for (i = 0; i < NumFrames; i++) {
+      draw_frame();
+   }
+   finish();
+   end = os_time_get();
+
+   secs = (end - start) / 1.0e6;
+   printf("%u x %u, %u passes/frame, %u frames\n",
+          TexSize, TexSize, NumPasses, NumFrames);
+   printf("%8.2f ms/frame, %8.3f ms/pass, %8.2f Mpix/s\n",
+          secs * 1000.0 / NumFrames,
+          secs * 1000.0 / (NumFrames * NumPasses),
+          (double)TexSize * TexSize * NumPasses * NumFrames / secs / 1.0e6);
+
+   graw_util_flush_front(&info);
+
+   info.ctx->destroy(info.ctx);
+   info.screen->destroy(info.screen);
+
+   return 0;
+}
@@ -0,0 +1,276 @@
+/* Rasterization throughput benchmark.
+ *
+ * Draws a dense grid of small triangles covering the window and reports
+ * the triangle and pixel rate.  The frames are rendered once for each
+ * rasterizer thread count given with -t (default: 0, 1, 2, 4, ... up to
+ * the number of CPUs, where 0 rasterizes on the calling thread), so the
+ * scaling of the llvmpipe rasterizer with the number of cores can be
+ * measured in a single run.
+ *
+ * Usage: tri-bench [-t n,n,...] [-g gridsize] [-n frames]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "graw_util.h"
+#include "os/os_time.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_string.h"
+
+static struct graw_info info;
+
+static const int WIDTH = 1024;
+static const int HEIGHT = 1024;
+
+#define MAX_RUNS 32
+
+static unsigned NumThreads[MAX_RUNS];
+static unsigned NumRuns = 0;
+static unsigned GridSize = 256;
+static unsigned NumFrames = 50;
+
+
+struct vertex {
+   float position[4];
+   float color[4];
+};
+
+
+static unsigned num_vertices(void)
+{
+   return GridSize * GridSize * 6;
+}
+
+
+static void set_vertices( void )
+{
+   struct pipe_vertex_element ve[2];
+   struct pipe_vertex_buffer vbuf;
+   struct vertex *vertices, *v;
+   void *handle;
+   unsigned x, y, i;
+
+   memset(ve, 0, sizeof ve);
+
+   ve[0].src_offset = Offset(struct vertex, position);
+   ve[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   ve[1].src_offset = Offset(struct vertex, color);
+   ve[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+
+   handle = info.ctx->create_vertex_elements_state(info.ctx, 2, ve);
+   info.ctx->bind_vertex_elements_state(info.ctx, handle);
+
+   vertices = MALLOC(num_vertices() * sizeof *vertices);
+   if (!vertices)
+      exit(1);
+
+   /* Two triangles per grid cell, in clip coordinates [-1, 1].
+    */
+   v = vertices;
+   for (y = 0; y < GridSize; y++) {
+      for (x = 0; x < GridSize; x++) {
+         static const unsigned corner[6][2] = {
+            {0, 0}, {1, 0}, {0, 1},
+            {1, 0}, {1, 1}, {0, 1}
+         };
+         for (i = 0; i < 6; i++) {
+            float fx = (float)(x + corner[i][0]) / GridSize;
+            float fy = (float)(y + corner[i][1]) / GridSize;
+            v->position[0] = fx * 2.0f - 1.0f;
+            v->position[1] = fy * 2.0f - 1.0f;
+            v->position[2] = 0.0f;
+            v->position[3] = 1.0f;
+            v->color[0] = fx;
+            v->color[1] = fy;
+            v->color[2] = 1.0f - fx;
+            v->color[3] = 1.0f;
+            v++;
+         }
+      }
+   }
+
+   memset(&vbuf, 0, sizeof vbuf);
+
+   vbuf.stride = sizeof( struct vertex );
+   vbuf.buffer_offset = 0;
+   vbuf.buffer = pipe_buffer_create_with_data(info.ctx,
+                                              PIPE_BIND_VERTEX_BUFFER,
+                                              PIPE_USAGE_STATIC,
+                                              num_vertices() * sizeof *vertices,
+                                              vertices);
+
+   info.ctx->set_vertex_buffers(info.ctx, 0, 1, &vbuf);
+
+   pipe_resource_reference(&vbuf.buffer, NULL);
+   FREE(vertices);
+}
+
+
+static void set_vertex_shader( void )
+{
+   void *handle;
+   const char *text =
+      "VERT\n"
+      "DCL IN[0]\n"
+      "DCL IN[1]\n"
+      "DCL OUT[0], POSITION\n"
+      "DCL OUT[1], COLOR\n"
+      "  0: MOV OUT[1], IN[1]\n"
+      "  1: MOV OUT[0], IN[0]\n"
+      "  2: END\n";
+
+   handle = graw_parse_vertex_shader(info.ctx, text);
+   info.ctx->bind_vs_state(info.ctx, handle);
+}
+
+
+static void set_fragment_shader( void )
+{
+   void *handle;
+   const char *text =
+      "FRAG\n"
+      "DCL IN[0], COLOR, LINEAR\n"
+      "DCL OUT[0], COLOR\n"
+      "  0: MOV OUT[0], IN[0]\n"
+      "  1: END\n";
+
+   handle = graw_parse_fragment_shader(info.ctx, text);
+   info.ctx->bind_fs_state(info.ctx, handle);
+}
+
+
+static void draw_frame( void )
+{
+   union pipe_color_union clear_color = { {0,0,0,1} };
+
+   info.ctx->clear(info.ctx, PIPE_CLEAR_COLOR, &clear_color, 0, 0);
+   util_draw_arrays(info.ctx, PIPE_PRIM_TRIANGLES, 0, num_vertices());
+}
+
+
+static void finish( void )
+{
+   struct pipe_fence_handle *fence = NULL;
+
+   info.ctx->flush(info.ctx, &fence);
+   if (fence) {
+      info.screen->fence_finish(info.screen, fence, PIPE_TIMEOUT_INFINITE);
+      info.screen->fence_reference(info.screen, &fence, NULL);
+   }
+}
+
+
+static void run( unsigned num_threads )
+{
+   char value[32];
+   int64_t start, end;
+   double secs;
+   unsigned i;
+
+   /* The llvmpipe screen reads this when it is created.
+    */
+#ifdef PIPE_OS_WINDOWS
+   util_snprintf(value, sizeof value, "LP_NUM_THREADS=%u", num_threads);
+   _putenv(value);
+#else
+   util_snprintf(value, sizeof value, "%u", num_threads);
+   setenv("LP_NUM_THREADS", value, 1);
+#endif
+
+   if (!graw_util_create_window(&info, WIDTH, HEIGHT, 1, FALSE))
+      exit(1);
+
+   graw_util_default_state(&info, FALSE);
+   graw_util_viewport(&info, 0, 0, WIDTH, HEIGHT, 30, 1000);
+
+   set_vertices();
+   set_vertex_shader();
+   set_fragment_shader();
+
+   /* warm up: compile shader variants, fault in the framebuffer */
+   draw_frame();
+   finish();
+
+   start = os_time_get();
+   for (i = 0; i < NumFrames; i++) {
+      draw_frame();
+   }
+   finish();
+   end = os_time_get();
+
+   secs = (end - start) / 1.0e6;
+   printf("threads %2u: %8.2f ms/frame, %8.2f Mtri/s, %8.2f Mpix/s\n",
+          num_threads,
+          secs * 1000.0 / NumFrames,
+          (double)num_vertices() / 3 * NumFrames / secs / 1.0e6,
+          (double)WIDTH * HEIGHT * NumFrames / secs / 1.0e6);
+
+   graw_util_flush_front(&info);
+
+   info.ctx->destroy(info.ctx);
+   info.screen->destroy(info.screen);
+}
+
+
+static void args(int argc, char *argv[])
+{
+   int i;
+
+   for (i = 1; i < argc; ) {
+      if (graw_parse_args(&i, argc, argv)) {
+         /* ok */
+      }
+      else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+         char *s = argv[i + 1];
+         while (*s && NumRuns < MAX_RUNS) {
+            NumThreads[NumRuns++] = strtoul(s, &s, 10);
+            if (*s == ',')
+               s++;
+         }
+         i += 2;
+      }
+      else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+         GridSize = MAX2(1, atoi(argv[i + 1]));
+         i += 2;
+      }
+      else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+         NumFrames = MAX2(1, atoi(argv[i + 1]));
+         i += 2;
+      }
+      else {
+         printf("Invalid arg %s\n", argv[i]);
+         exit(1);
+      }
+   }
+
+   if (NumRuns == 0) {
+      unsigned n;
+      util_cpu_detect();
+      NumThreads[NumRuns++] = 0;
+      for (n = 1; n <= (unsigned)util_cpu_caps.nr_cpus && NumRuns < MAX_RUNS;
+           n *= 2) {
+         NumThreads[NumRuns++] = n;
+      }
+      if (NumThreads[NumRuns - 1] != (unsigned)util_cpu_caps.nr_cpus &&
+          NumRuns < MAX_RUNS) {
+         NumThreads[NumRuns++] = util_cpu_caps.nr_cpus;
+      }
+   }
+}
+
+
+int main( int argc, char *argv[] )
+{
+   unsigned i;
+
+   args(argc, argv);
+
+   printf("%u x %u, %u triangles/frame, %u frames\n",
+          WIDTH, HEIGHT, num_vertices() / 3, NumFrames);
+
+   for (i = 0; i < NumRuns; i++) {
+      run(NumThreads[i]);
+   }
+
+   return 0;
+}
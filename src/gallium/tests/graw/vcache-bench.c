@@ -0,0 +1,295 @@
+/* Post-transform vertex cache benchmark.
+ *
+ * Draws an indexed triangle list covering the window with a grid mesh in
+ * which every interior vertex is shared by six triangles, and reports the
+ * frame time, the triangle rate and how many times each vertex was shaded
+ * (vs_invocations / unique vertices, from a PIPE_QUERY_PIPELINE_STATISTICS
+ * query).  A perfect cache shades each vertex once; without one each
+ * vertex is shaded six times.
+ *
+ * Usage: vcache-bench [-g gridsize] [-n frames]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "graw_util.h"
+#include "os/os_time.h"
+
+static struct graw_info info;
+
+static const int WIDTH = 1024;
+static const int HEIGHT = 1024;
+
+static unsigned GridSize = 256;
+static unsigned NumFrames = 20;
+
+
+struct vertex {
+   float position[4];
+   float color[4];
+};
+
+
+static unsigned num_vertices(void)
+{
+   return (GridSize + 1) * (GridSize + 1);
+}
+
+
+static unsigned num_indices(void)
+{
+   return GridSize * GridSize * 6;
+}
+
+
+static void set_vertices( void )
+{
+   struct pipe_vertex_element ve[2];
+   struct pipe_vertex_buffer vbuf;
+   struct vertex *vertices, *v;
+   void *handle;
+   unsigned x, y;
+
+   memset(ve, 0, sizeof ve);
+
+   ve[0].src_offset = Offset(struct vertex, position);
+   ve[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   ve[1].src_offset = Offset(struct vertex, color);
+   ve[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+
+   handle = info.ctx->create_vertex_elements_state(info.ctx, 2, ve);
+   info.ctx->bind_vertex_elements_state(info.ctx, handle);
+
+   vertices = MALLOC(num_vertices() * sizeof *vertices);
+   if (!vertices)
+      exit(1);
+
+   v = vertices;
+   for (y = 0; y <= GridSize; y++) {
+      for (x = 0; x <= GridSize; x++) {
+         float fx = (float)x / GridSize;
+         float fy = (float)y / GridSize;
+         v->position[0] = fx * 2.0f - 1.0f;
+         v->position[1] = fy * 2.0f - 1.0f;
+         v->position[2] = 0.0f;
+         v->position[3] = 1.0f;
+         v->color[0] = fx;
+         v->color[1] = fy;
+         v->color[2] = 1.0f - fx;
+         v->color[3] = 1.0f;
+         v++;
+      }
+   }
+
+   memset(&vbuf, 0, sizeof vbuf);
+
+   vbuf.stride = sizeof( struct vertex );
+   vbuf.buffer_offset = 0;
+   vbuf.buffer = pipe_buffer_create_with_data(info.ctx,
+                                              PIPE_BIND_VERTEX_BUFFER,
+                                              PIPE_USAGE_STATIC,
+                                              num_vertices() * sizeof *vertices,
+                                              vertices);
+
+   info.ctx->set_vertex_buffers(info.ctx, 0, 1, &vbuf);
+
+   pipe_resource_reference(&vbuf.buffer, NULL);
+   FREE(vertices);
+}
+
+
+/**
+ * Two triangles per grid cell, the cells in row order, as an application
+ * would naively emit them.
+ */
+static void set_indices( void )
+{
+   struct pipe_index_buffer ibuf;
+   unsigned *indices, *i;
+   unsigned x, y;
+
+   indices = MALLOC(num_indices() * sizeof *indices);
+   if (!indices)
+      exit(1);
+
+   i = indices;
+   for (y = 0; y < GridSize; y++) {
+      for (x = 0; x < GridSize; x++) {
+         unsigned v0 = y * (GridSize + 1) + x;
+         unsigned v1 = v0 + 1;
+         unsigned v2 = v0 + GridSize + 1;
+         unsigned v3 = v2 + 1;
+         *i++ = v0;
+         *i++ = v1;
+         *i++ = v2;
+         *i++ = v2;
+         *i++ = v1;
+         *i++ = v3;
+      }
+   }
+
+   memset(&ibuf, 0, sizeof ibuf);
+
+   ibuf.index_size = 4;
+   ibuf.offset = 0;
+   ibuf.buffer = pipe_buffer_create_with_data(info.ctx,
+                                              PIPE_BIND_INDEX_BUFFER,
+                                              PIPE_USAGE_STATIC,
+                                              num_indices() * sizeof *indices,
+                                              indices);
+
+   info.ctx->set_index_buffer(info.ctx, &ibuf);
+
+   pipe_resource_reference(&ibuf.buffer, NULL);
+   FREE(indices);
+}
+
+
+static void set_vertex_shader( void )
+{
+   void *handle;
+   const char *text =
+      "VERT\n"
+      "DCL IN[0]\n"
+      "DCL IN[1]\n"
+      "DCL OUT[0], POSITION\n"
+      "DCL OUT[1], COLOR\n"
+      "  0: MOV OUT[1], IN[1]\n"
+      "  1: MOV OUT[0], IN[0]\n"
+      "  2: END\n";
+
+   handle = graw_parse_vertex_shader(info.ctx, text);
+   info.ctx->bind_vs_state(info.ctx, handle);
+}
+
+
+static void set_fragment_shader( void )
+{
+   void *handle;
+   const char *text =
+      "FRAG\n"
+      "DCL IN[0], COLOR, LINEAR\n"
+      "DCL OUT[0], COLOR\n"
+      "  0: MOV OUT[0], IN[0]\n"
+      "  1: END\n";
+
+   handle = graw_parse_fragment_shader(info.ctx, text);
+   info.ctx->bind_fs_state(info.ctx, handle);
+}
+
+
+static void draw_frame( void )
+{
+   union pipe_color_union clear_color = { {0,0,0,1} };
+
+   info.ctx->clear(info.ctx, PIPE_CLEAR_COLOR, &clear_color, 0, 0);
+   util_draw_range_elements(info.ctx, 0, 0, num_vertices() - 1,
+                            PIPE_PRIM_TRIANGLES, 0, num_indices());
+}
+
+
+static void finish( void )
+{
+   struct pipe_fence_handle *fence = NULL;
+
+   info.ctx->flush(info.ctx, &fence);
+   if (fence) {
+      info.screen->fence_finish(info.screen, fence, PIPE_TIMEOUT_INFINITE);
+      info.screen->fence_reference(info.screen, &fence, NULL);
+   }
+}
+
+
+static void run( void )
+{
+   union pipe_query_result result;
+   struct pipe_query *query;
+   int64_t start, end;
+   double secs;
+   unsigned i;
+
+   if (!graw_util_create_window(&info, WIDTH, HEIGHT, 1, FALSE))
+      exit(1);
+
+   graw_util_default_state(&info, FALSE);
+   graw_util_viewport(&info, 0, 0, WIDTH, HEIGHT, 30, 1000);
+
+   set_vertices();
+   set_indices();
+   set_vertex_shader();
+   set_fragment_shader();
+
+   /* warm up: compile shader variants, fault in the framebuffer */
+   draw_frame();
+   finish();
+
+   query = info.ctx->create_query(info.ctx, PIPE_QUERY_PIPELINE_STATISTICS);
+
+   start = os_time_get();
+   info.ctx->begin_query(info.ctx, query);
+   for (i = 0; i < NumFrames; i++) {
+      draw_frame();
+   }
+   info.ctx->end_query(info.ctx, query);
+   finish();
+   end = os_time_get();
+
+   memset(&result, 0, sizeof result);
+   info.ctx->get_query_result(info.ctx, query, TRUE, &result);
+   info.ctx->destroy_query(info.ctx, query);
+
+   secs = (end - start) / 1.0e6;
+   printf("%8.2f ms/frame, %8.2f Mtri/s\n",
+          secs * 1000.0 / NumFrames,
+          (double)num_indices() / 3 * NumFrames / secs / 1.0e6);
+   printf("%llu vertices fetched, %llu shaded, %.2f shades/vertex, "
+          "%.2f shades/triangle\n",
+          (unsigned long long)result.pipeline_statistics.ia_vertices,
+          (unsigned long long)result.pipeline_statistics.vs_invocations,
+          (double)result.pipeline_statistics.vs_invocations /
+          ((double)num_vertices() * NumFrames),
+          (double)result.pipeline_statistics.vs_invocations /
+          ((double)num_indices() / 3 * NumFrames));
+
+   graw_util_flush_front(&info);
+
+   info.ctx->destroy(info.ctx);
+   info.screen->destroy(info.screen);
+}
+
+
+static void args(int argc, char *argv[])
+{
+   int i;
+
+   for (i = 1; i < argc; ) {
+      if (graw_parse_args(&i, argc, argv)) {
+         /* ok */
+      }
+      else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+         GridSize = MAX2(1, atoi(argv[i + 1]));
+         i += 2;
+      }
+      else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+         NumFrames = MAX2(1, atoi(argv[i + 1]));
+         i += 2;
+      }
+      else {
+         printf("Invalid arg %s\n", argv[i]);
+         exit(1);
+      }
+   }
+}
+
+
+int main( int argc, char *argv[] )
+{
+   args(argc, argv);
+
+   printf("%u x %u, %u vertices, %u triangles/frame, %u frames\n",
+          WIDTH, HEIGHT, num_vertices(), num_indices() / 3, NumFrames);
+
+   run();
+
+   return 0;
+}